@@ -198,6 +198,19 @@ typedef BOOL (^GCDAsyncUdpSocketSendFilterBlock)(NSData *data, NSData *address,
 - (uint32_t)maxReceiveIPv6BufferSize;
 - (void)setMaxReceiveIPv6BufferSize:(uint32_t)max;
 
+/**
+ * Gets/Sets the number of datagrams delivered to the delegate per dispatch onto the delegateQueue.
+ * The default is 1, i.e. one dispatch per datagram.
+ * 
+ * With a larger value, datagrams which are already waiting in the socket during continuous receive
+ * (beginReceiving:) are read in one go on the socketQueue, and the delegate is called for each of them
+ * within a single block on the delegateQueue. A batch is delivered once it is full or the socket has
+ * no more data, so no datagram waits for later ones. Datagrams passed through a receive filter are
+ * not batched.
+**/
+- (uint16_t)receiveBatchSize;
+- (void)setReceiveBatchSize:(uint16_t)size;
+
 /**
  * User data allows you to associate arbitrary information with the socket.
  * This data is not used internally in any way.
@@ -435,6 +448,16 @@ typedef BOOL (^GCDAsyncUdpSocketSendFilterBlock)(NSData *data, NSData *address,
 **/
 - (BOOL)enableBroadcast:(BOOL)flag error:(NSError **)errPtr;
 
+#pragma mark Reuse Port
+
+/**
+ * By default, only one socket can be bound to a given IP address + port at a time.
+ * To enable multiple processes or sockets to simultaneously bind to the same address+port,
+ * you need to enable this functionality in the socket. All sockets bound to the port
+ * must enable this option before binding.
+**/
+- (BOOL)enableReusePort:(BOOL)flag error:(NSError **)errPtr;
+
 #pragma mark Sending
 
 /**
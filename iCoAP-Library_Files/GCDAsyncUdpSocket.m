@@ -189,6 +189,10 @@ enum GCDAsyncUdpSocketConfig
 	uint16_t max4ReceiveSize;
 	uint32_t max6ReceiveSize;
 	
+	uint16_t receiveBatchSize;
+	NSMutableArray *receiveBatchData;
+	NSMutableArray *receiveBatchAddresses;
+	
 	int socket4FD;
 	int socket6FD;
 	
@@ -398,6 +402,8 @@ enum GCDAsyncUdpSocketConfig
 		max4ReceiveSize = 9216;
 		max6ReceiveSize = 9216;
 		
+		receiveBatchSize = 1;
+		
 		socket4FD = SOCKET_NULL;
 		socket6FD = SOCKET_NULL;
 		
@@ -886,6 +892,38 @@ enum GCDAsyncUdpSocketConfig
 		dispatch_async(socketQueue, block);
 }
 
+- (uint16_t)receiveBatchSize
+{
+	__block uint16_t result = 0;
+	
+	dispatch_block_t block = ^{
+		
+		result = receiveBatchSize;
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	return result;
+}
+
+- (void)setReceiveBatchSize:(uint16_t)size
+{
+	dispatch_block_t block = ^{
+		
+		LogVerbose(@"%@ %u", THIS_METHOD, (unsigned)size);
+		
+		receiveBatchSize = MAX(size, 1);
+	};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_async(socketQueue, block);
+}
+
 
 - (id)userData
 {
@@ -1002,6 +1040,38 @@ enum GCDAsyncUdpSocketConfig
 	}
 }
 
+- (void)notifyDidReceiveBatch
+{
+	LogTrace();
+	
+	if ([receiveBatchData count] == 0)
+		return;
+	
+	NSArray *batchData = [receiveBatchData copy];
+	NSArray *batchAddresses = [receiveBatchAddresses copy];
+	
+	[receiveBatchData removeAllObjects];
+	[receiveBatchAddresses removeAllObjects];
+	
+	SEL selector = @selector(udpSocket:didReceiveData:fromAddress:withFilterContext:);
+	
+	if (delegateQueue && [delegate respondsToSelector:selector])
+	{
+		id theDelegate = delegate;
+		
+		dispatch_async(delegateQueue, ^{ @autoreleasepool {
+			
+			NSUInteger count = [batchData count];
+			for (NSUInteger i = 0; i < count; i++)
+			{
+				[theDelegate udpSocket:self didReceiveData:[batchData objectAtIndex:i]
+				                                fromAddress:[batchAddresses objectAtIndex:i]
+				                          withFilterContext:nil];
+			}
+		}});
+	}
+}
+
 - (void)notifyDidCloseWithError:(NSError *)error
 {
 	LogTrace();
@@ -3529,6 +3599,71 @@ enum GCDAsyncUdpSocketConfig
 	return result;
 }
 
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+#pragma mark Reuse Port
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+- (BOOL)enableReusePort:(BOOL)flag error:(NSError **)errPtr
+{
+	__block BOOL result = NO;
+	__block NSError *err = nil;
+	
+	dispatch_block_t block = ^{ @autoreleasepool {
+		
+		if (![self preOp:&err])
+		{
+			return_from_block;
+		}
+		
+		if ((flags & kDidCreateSockets) == 0)
+		{
+			if (![self createSockets:&err])
+			{
+				return_from_block;
+			}
+		}
+		
+		int value = flag ? 1 : 0;
+		
+		if (socket4FD != SOCKET_NULL)
+		{
+			int error = setsockopt(socket4FD, SOL_SOCKET, SO_REUSEPORT, (const void *)&value, sizeof(value));
+			
+			if (error)
+			{
+				err = [self errnoErrorWithReason:@"Error in setsockopt() function"];
+				
+				return_from_block;
+			}
+			result = YES;
+		}
+		
+		if (socket6FD != SOCKET_NULL)
+		{
+			int error = setsockopt(socket6FD, SOL_SOCKET, SO_REUSEPORT, (const void *)&value, sizeof(value));
+			
+			if (error)
+			{
+				err = [self errnoErrorWithReason:@"Error in setsockopt() function"];
+				
+				return_from_block;
+			}
+			result = YES;
+		}
+		
+	}};
+	
+	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+		block();
+	else
+		dispatch_sync(socketQueue, block);
+	
+	if (errPtr)
+		*errPtr = err;
+	
+	return result;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 #pragma mark Sending
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -4226,6 +4361,8 @@ enum GCDAsyncUdpSocketConfig
 	{
 		LogVerbose(@"Receiving is paused...");
 		
+		[self notifyDidReceiveBatch];
+		
 		if (socket4FDBytesAvailable > 0) {
 			[self suspendReceive4Source];
 		}
@@ -4254,6 +4391,8 @@ enum GCDAsyncUdpSocketConfig
 	{
 		LogVerbose(@"No data available to receive...");
 		
+		[self notifyDidReceiveBatch];
+		
 		if (socket4FDBytesAvailable == 0) {
 			[self resumeReceive4Source];
 		}
@@ -4476,6 +4615,24 @@ enum GCDAsyncUdpSocketConfig
 					}
 				}
 			}
+			else if (receiveBatchSize > 1 && (flags & kReceiveContinuous))
+			{
+				// Delivered to the delegate with the following datagrams in one dispatch
+				
+				if (receiveBatchData == nil)
+				{
+					receiveBatchData = [[NSMutableArray alloc] initWithCapacity:receiveBatchSize];
+					receiveBatchAddresses = [[NSMutableArray alloc] initWithCapacity:receiveBatchSize];
+				}
+				
+				[receiveBatchData addObject:data];
+				[receiveBatchAddresses addObject:addr];
+				
+				if ([receiveBatchData count] >= receiveBatchSize)
+					[self notifyDidReceiveBatch];
+				
+				notifiedDelegate = YES;
+			}
 			else // if (!receiveFilterBlock || !receiveFilterQueue)
 			{
 				[self notifyDidReceiveData:data fromAddress:addr withFilterContext:nil];
@@ -4488,6 +4645,8 @@ enum GCDAsyncUdpSocketConfig
 	{
 		// Wait for a notification of available data.
 		
+		[self notifyDidReceiveBatch];
+		
 		if (socket4FDBytesAvailable == 0) {
 			[self resumeReceive4Source];
 		}
@@ -4497,6 +4656,7 @@ enum GCDAsyncUdpSocketConfig
 	}
 	else if (socketError)
 	{
+		[self notifyDidReceiveBatch];
 		[self closeWithError:socketError];
 	}
 	else
@@ -4547,6 +4707,8 @@ enum GCDAsyncUdpSocketConfig
 	if (currentSend) [self endCurrentSend];
 	
 	[sendQueue removeAllObjects];
+	[receiveBatchData removeAllObjects];
+	[receiveBatchAddresses removeAllObjects];
 	
 	// If a socket has been created, we should notify the delegate.
 	BOOL shouldCallDelegate = (flags & kDidCreateSockets) ? YES : NO;
@@ -5116,7 +5278,7 @@ Failed:
 
 - (int)socketFD
 {
-	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+	if (!dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
 	{
 		LogWarn(@"%@: %@ - Method only available from within the context of a performBlock: invocation",
 				THIS_FILE, THIS_METHOD);
@@ -5131,7 +5293,7 @@ Failed:
 
 - (int)socket4FD
 {
-	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+	if (!dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
 	{
 		LogWarn(@"%@: %@ - Method only available from within the context of a performBlock: invocation",
 				THIS_FILE, THIS_METHOD);
@@ -5143,7 +5305,7 @@ Failed:
 
 - (int)socket6FD
 {
-	if (dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
+	if (!dispatch_get_specific(IsOnSocketQueueOrTargetQueueKey))
 	{
 		LogWarn(@"%@: %@ - Method only available from within the context of a performBlock: invocation",
 				THIS_FILE, THIS_METHOD);
@@ -0,0 +1,112 @@
+//
+//  ICoAPBlock1Source.h
+//  iCoAP
+//
+
+
+/*
+ *  This class provides the payload of a block-wise request (BLOCK 1)
+ *  to an ICoAPExchange object.
+
+ *  The payload is read lazily, one block at a time, from an NSData
+ *  object, a memory-mapped file or an NSInputStream. For streams only
+ *  the blocks which are not yet acknowledged by the server are kept
+ *  in memory, so the memory use is bounded by the Block1 window.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+@interface ICoAPBlock1Source : NSObject {
+    NSData *sourceData;
+    NSInputStream *inputStream;
+    NSMutableData *streamBuffer;
+    NSUInteger streamBufferOffset;
+    BOOL isStreamAtEnd;
+    BOOL hasStreamError;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'length':
+ *  Total number of bytes of the payload, or 0 if unknown (streams).
+ */
+@property (readonly, nonatomic) NSUInteger length;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'sourceWithData:':
+ *  Returns a source providing the bytes of 'data'.
+ */
++ (ICoAPBlock1Source *)sourceWithData:(NSData *)data;
+
+/*
+ *  'sourceWithContentsOfFile:error:':
+ *  Returns a source providing the contents of the file at 'path'.
+ *  The file is memory-mapped, so only the pages of the blocks which
+ *  are sent are read from disk.
+ */
++ (ICoAPBlock1Source *)sourceWithContentsOfFile:(NSString *)path error:(NSError **)error;
+
+/*
+ *  'sourceWithInputStream:':
+ *  Returns a source reading from 'stream'. The stream is opened on the first
+ *  read and read synchronously, use file or memory based streams.
+ */
++ (ICoAPBlock1Source *)sourceWithInputStream:(NSInputStream *)stream;
+
+/*
+ *  'dataAtOffset:length:':
+ *  Returns up to 'length' bytes beginning at 'offset'. Fewer bytes are returned
+ *  at the end of the payload. Returns nil, if the bytes can not be read
+ *  (anymore).
+ */
+- (NSData *)dataAtOffset:(NSUInteger)offset length:(NSUInteger)length;
+
+/*
+ *  'hasDataAfterOffset:':
+ *  Indicates whether the payload continues after 'offset'.
+ */
+- (BOOL)hasDataAfterOffset:(NSUInteger)offset;
+
+/*
+ *  'discardDataBeforeOffset:':
+ *  Informs the source that the bytes before 'offset' are not required anymore.
+ */
+- (void)discardDataBeforeOffset:(NSUInteger)offset;
+
+/*
+ *  'close':
+ *  Closes the underlying stream (if any).
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,115 @@
+//
+//  ICoAPBlock1Source.m
+//  iCoAP
+//
+
+
+#import "ICoAPBlock1Source.h"
+
+
+@interface ICoAPBlock1Source ()
+- (void)readStreamToOffset:(NSUInteger)offset;
+@end
+
+@implementation ICoAPBlock1Source
+
+#pragma mark - Init
+
++ (ICoAPBlock1Source *)sourceWithData:(NSData *)data {
+    ICoAPBlock1Source *source = [[ICoAPBlock1Source alloc] init];
+    source->sourceData = data;
+    return source;
+}
+
++ (ICoAPBlock1Source *)sourceWithContentsOfFile:(NSString *)path error:(NSError **)error {
+    NSData *mappedData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:error];
+    if (!mappedData) {
+        return nil;
+    }
+    return [self sourceWithData:mappedData];
+}
+
++ (ICoAPBlock1Source *)sourceWithInputStream:(NSInputStream *)stream {
+    ICoAPBlock1Source *source = [[ICoAPBlock1Source alloc] init];
+    source->inputStream = stream;
+    source->streamBuffer = [[NSMutableData alloc] init];
+    return source;
+}
+
+#pragma mark - Reading
+
+- (NSUInteger)length {
+    return [sourceData length];
+}
+
+- (NSData *)dataAtOffset:(NSUInteger)offset length:(NSUInteger)length {
+    if (sourceData) {
+        if (offset > [sourceData length]) {
+            return nil;
+        }
+        return [sourceData subdataWithRange:NSMakeRange(offset, MIN(length, [sourceData length] - offset))];
+    }
+
+    if (offset < streamBufferOffset) {
+        return nil;
+    }
+
+    [self readStreamToOffset:offset + length];
+    if (hasStreamError) {
+        return nil;
+    }
+
+    NSUInteger bufferEnd = streamBufferOffset + [streamBuffer length];
+    if (offset > bufferEnd) {
+        return nil;
+    }
+    return [streamBuffer subdataWithRange:NSMakeRange(offset - streamBufferOffset, MIN(length, bufferEnd - offset))];
+}
+
+- (BOOL)hasDataAfterOffset:(NSUInteger)offset {
+    if (sourceData) {
+        return offset < [sourceData length];
+    }
+
+    [self readStreamToOffset:offset + 1];
+    return offset < streamBufferOffset + [streamBuffer length];
+}
+
+- (void)readStreamToOffset:(NSUInteger)offset {
+    if ([inputStream streamStatus] == NSStreamStatusNotOpen) {
+        [inputStream open];
+    }
+
+    while (!isStreamAtEnd && streamBufferOffset + [streamBuffer length] < offset) {
+        NSUInteger bufferedLength = [streamBuffer length];
+        NSUInteger missingLength = offset - (streamBufferOffset + bufferedLength);
+
+        [streamBuffer setLength:bufferedLength + missingLength];
+        NSInteger readLength = [inputStream read:(uint8_t *)[streamBuffer mutableBytes] + bufferedLength maxLength:missingLength];
+
+        if (readLength <= 0) {
+            [streamBuffer setLength:bufferedLength];
+            isStreamAtEnd = YES;
+            hasStreamError = readLength < 0;
+        }
+        else {
+            [streamBuffer setLength:bufferedLength + readLength];
+        }
+    }
+}
+
+- (void)discardDataBeforeOffset:(NSUInteger)offset {
+    if (!inputStream || offset <= streamBufferOffset) {
+        return;
+    }
+
+    NSUInteger discardLength = MIN(offset - streamBufferOffset, [streamBuffer length]);
+    [streamBuffer replaceBytesInRange:NSMakeRange(0, discardLength) withBytes:NULL length:0];
+    streamBufferOffset += discardLength;
+}
+
+- (void)close {
+    [inputStream close];
+}
+
+@end
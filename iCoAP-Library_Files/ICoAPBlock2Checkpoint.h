@@ -0,0 +1,98 @@
+//
+//  ICoAPBlock2Checkpoint.h
+//  iCoAP
+//
+
+
+/*
+ *  This class records the progress of a block-wise response (BLOCK 2),
+ *  so an interrupted download can be resumed with a new ICoAPExchange
+ *  object instead of being restarted from block 0.
+
+ *  The checkpoint stores the ETag of the representation: Blocks of a
+ *  resumed transfer with a different ETag are rejected, as they belong
+ *  to a changed resource. Checkpoints conform to NSCoding and can be
+ *  persisted between launches of the application.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+@interface ICoAPBlock2Checkpoint : NSObject<NSCoding, NSCopying>
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'etag':
+ *  ETag (hex string) of the representation, nil if the server did not send one.
+ */
+@property (copy, nonatomic) NSString *etag;
+
+/*
+ *  'szx':
+ *  Block size exponent of the received blocks, the block size is
+ *  2^(szx + 4) Bytes.
+ */
+@property (readwrite, nonatomic) uint szx;
+
+/*
+ *  'nextBlockNumber':
+ *  Number of the first block which was not received yet. All previous
+ *  blocks were delivered in order.
+ */
+@property (readwrite, nonatomic) uint nextBlockNumber;
+
+/*
+ *  'endOffset':
+ *  Byte offset at which the requested range ends, 0 if the transfer
+ *  continues until the end of the representation.
+ */
+@property (readwrite, nonatomic) NSUInteger endOffset;
+
+/*
+ *  'isComplete':
+ *  Indicates whether the last block of the requested range was received.
+ */
+@property (readwrite, nonatomic) BOOL isComplete;
+
+/*
+ *  'offset':
+ *  Byte offset of 'nextBlockNumber'.
+ */
+@property (readonly, nonatomic) NSUInteger offset;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'checkpointWithBlockNumber:szx:':
+ *  Returns a checkpoint starting at block 'blockNumber' of the size given by 'szx'.
+ */
++ (ICoAPBlock2Checkpoint *)checkpointWithBlockNumber:(uint)blockNumber szx:(uint)szx;
+
+@end
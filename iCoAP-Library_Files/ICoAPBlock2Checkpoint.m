@@ -0,0 +1,58 @@
+//
+//  ICoAPBlock2Checkpoint.m
+//  iCoAP
+//
+
+
+#import "ICoAPBlock2Checkpoint.h"
+
+
+@implementation ICoAPBlock2Checkpoint
+
+#pragma mark - Init
+
++ (ICoAPBlock2Checkpoint *)checkpointWithBlockNumber:(uint)blockNumber szx:(uint)szx {
+    ICoAPBlock2Checkpoint *checkpoint = [[ICoAPBlock2Checkpoint alloc] init];
+    checkpoint.nextBlockNumber = blockNumber;
+    checkpoint.szx = MIN(szx, 6);
+    return checkpoint;
+}
+
+- (NSUInteger)offset {
+    return (NSUInteger)self.nextBlockNumber * (16 << self.szx);
+}
+
+#pragma mark - NSCoding
+
+- (id)initWithCoder:(NSCoder *)aDecoder {
+    if (self = [super init]) {
+        self.etag = [aDecoder decodeObjectForKey:@"etag"];
+        self.szx = (uint)[aDecoder decodeIntegerForKey:@"szx"];
+        self.nextBlockNumber = (uint)[aDecoder decodeIntegerForKey:@"nextBlockNumber"];
+        self.endOffset = (NSUInteger)[aDecoder decodeIntegerForKey:@"endOffset"];
+        self.isComplete = [aDecoder decodeBoolForKey:@"isComplete"];
+    }
+    return self;
+}
+
+- (void)encodeWithCoder:(NSCoder *)aCoder {
+    [aCoder encodeObject:self.etag forKey:@"etag"];
+    [aCoder encodeInteger:self.szx forKey:@"szx"];
+    [aCoder encodeInteger:self.nextBlockNumber forKey:@"nextBlockNumber"];
+    [aCoder encodeInteger:self.endOffset forKey:@"endOffset"];
+    [aCoder encodeBool:self.isComplete forKey:@"isComplete"];
+}
+
+#pragma mark - NSCopying
+
+- (id)copyWithZone:(NSZone *)zone {
+    ICoAPBlock2Checkpoint *checkpoint = [[ICoAPBlock2Checkpoint allocWithZone:zone] init];
+    checkpoint.etag = self.etag;
+    checkpoint.szx = self.szx;
+    checkpoint.nextBlockNumber = self.nextBlockNumber;
+    checkpoint.endOffset = self.endOffset;
+    checkpoint.isComplete = self.isComplete;
+    return checkpoint;
+}
+
+@end
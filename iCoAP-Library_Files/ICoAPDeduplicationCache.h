@@ -0,0 +1,115 @@
+//
+//  ICoAPDeduplicationCache.h
+//  iCoAP
+//
+
+
+/*
+ *  This class remembers the Message IDs of received confirmable
+ *  messages together with the type of the response (ACK or RST) that
+ *  was sent for them, per peer, for EXCHANGE_LIFETIME.
+
+ *  A retransmitted message can then be answered with the same response
+ *  again, without being decoded and delivered a second time
+ *  (RFC 7252 Section 4.5).
+
+ *  Entries are kept in a fixed size ring in order of arrival. A small
+ *  counting bloom filter in front of the ring lets the common case of
+ *  a new Message ID be rejected without scanning the ring.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "ICoAPMessage.h"
+
+
+#define kDeduplicationCacheCapacity         256
+#define kDeduplicationFilterSize            1024
+
+
+typedef struct {
+    CFAbsoluteTime expiry;
+    uint32_t peerHash;
+    uint16_t messageID;
+    uint8_t responseType;
+} ICoAPDeduplicationEntry;
+
+
+@interface ICoAPDeduplicationCache : NSObject {
+    ICoAPDeduplicationEntry *entries;
+    NSUInteger capacity;
+    NSUInteger head;
+    NSUInteger count;
+    uint8_t filter[kDeduplicationFilterSize];
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'lifetime':
+ *  Time in seconds an entry is remembered. Default is kEXCHANGE_LIFETIME.
+ */
+@property (readwrite, nonatomic) NSTimeInterval lifetime;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization with kDeduplicationCacheCapacity entries.
+ */
+- (id)init;
+
+/*
+ *  'initWithCapacity:':
+ *  Initialization with the given maximum number of entries. If the
+ *  cache is full, the oldest entry is dropped before its lifetime expires.
+ */
+- (id)initWithCapacity:(NSUInteger)maxEntries;
+
+/*
+ *  'lookupMessageID:fromAddress:responseType:':
+ *  Returns YES if 'messageID' was recorded for the peer 'address'
+ *  within the lifetime. The type of the recorded response is
+ *  returned in 'type'.
+ */
+- (BOOL)lookupMessageID:(uint)messageID fromAddress:(NSData *)address responseType:(ICoAPType *)type;
+
+/*
+ *  'recordMessageID:fromAddress:responseType:':
+ *  Remembers 'messageID' of the peer 'address' together with the
+ *  'type' of the response which was sent for it.
+ */
+- (void)recordMessageID:(uint)messageID fromAddress:(NSData *)address responseType:(ICoAPType)type;
+
+/*
+ *  'removeAllEntries':
+ *  Forgets all recorded Message IDs.
+ */
+- (void)removeAllEntries;
+
+@end
@@ -0,0 +1,133 @@
+//
+//  ICoAPDeduplicationCache.m
+//  iCoAP
+//
+
+
+#import "ICoAPDeduplicationCache.h"
+#import "ICoAPExchange.h"
+
+
+static inline uint32_t ICoAPPeerHashFromAddress(NSData *address) {
+    //FNV-1a
+    const uint8_t *bytes = [address bytes];
+    uint32_t hash = 2166136261u;
+    for (NSUInteger i = 0; i < [address length]; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static inline uint32_t ICoAPFilterIndex(uint32_t peerHash, uint16_t messageID, uint32_t seed) {
+    uint32_t h = (peerHash ^ (messageID * 2654435761u)) + seed * 0x9E3779B9u;
+    h ^= h >> 15;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h % kDeduplicationFilterSize;
+}
+
+
+@interface ICoAPDeduplicationCache ()
+- (void)removeExpiredEntriesAtTime:(CFAbsoluteTime)now;
+- (void)removeOldestEntry;
+@end
+
+@implementation ICoAPDeduplicationCache
+
+#pragma mark - Init
+
+- (id)init {
+    return [self initWithCapacity:kDeduplicationCacheCapacity];
+}
+
+- (id)initWithCapacity:(NSUInteger)maxEntries {
+    if (self = [super init]) {
+        capacity = MAX(maxEntries, 1);
+        entries = calloc(capacity, sizeof(ICoAPDeduplicationEntry));
+        self.lifetime = kEXCHANGE_LIFETIME;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(entries);
+}
+
+#pragma mark - Lookup
+
+- (BOOL)lookupMessageID:(uint)messageID fromAddress:(NSData *)address responseType:(ICoAPType *)type {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    [self removeExpiredEntriesAtTime:now];
+
+    uint32_t peerHash = ICoAPPeerHashFromAddress(address);
+    uint16_t mid = messageID & 0xFFFF;
+
+    //All filter counters must be set for a possible match
+    if (filter[ICoAPFilterIndex(peerHash, mid, 0)] == 0 || filter[ICoAPFilterIndex(peerHash, mid, 1)] == 0) {
+        return NO;
+    }
+
+    //Scan from newest to oldest, retransmissions typically arrive shortly after the original
+    for (NSUInteger i = 0; i < count; i++) {
+        ICoAPDeduplicationEntry *entry = &entries[(head + capacity - 1 - i) % capacity];
+        if (entry->messageID == mid && entry->peerHash == peerHash) {
+            if (type) {
+                *type = entry->responseType;
+            }
+            return YES;
+        }
+    }
+    return NO;
+}
+
+- (void)recordMessageID:(uint)messageID fromAddress:(NSData *)address responseType:(ICoAPType)type {
+    if (count == capacity) {
+        [self removeOldestEntry];
+    }
+
+    ICoAPDeduplicationEntry *entry = &entries[head];
+    entry->expiry = CFAbsoluteTimeGetCurrent() + self.lifetime;
+    entry->peerHash = ICoAPPeerHashFromAddress(address);
+    entry->messageID = messageID & 0xFFFF;
+    entry->responseType = type;
+
+    for (uint32_t seed = 0; seed < 2; seed++) {
+        uint8_t *counter = &filter[ICoAPFilterIndex(entry->peerHash, entry->messageID, seed)];
+        if (*counter < UINT8_MAX) {
+            (*counter)++;
+        }
+    }
+
+    head = (head + 1) % capacity;
+    count++;
+}
+
+- (void)removeAllEntries {
+    head = 0;
+    count = 0;
+    memset(filter, 0, sizeof(filter));
+}
+
+#pragma mark - Expiry
+
+- (void)removeExpiredEntriesAtTime:(CFAbsoluteTime)now {
+    //Entries are stored in order of arrival and share one lifetime, so expired entries are always the oldest
+    while (count > 0 && entries[(head + capacity - count) % capacity].expiry <= now) {
+        [self removeOldestEntry];
+    }
+}
+
+- (void)removeOldestEntry {
+    ICoAPDeduplicationEntry *entry = &entries[(head + capacity - count) % capacity];
+
+    for (uint32_t seed = 0; seed < 2; seed++) {
+        uint8_t *counter = &filter[ICoAPFilterIndex(entry->peerHash, entry->messageID, seed)];
+        //Saturated counters are never decremented to keep the filter free of false negatives
+        if (*counter > 0 && *counter < UINT8_MAX) {
+            (*counter)--;
+        }
+    }
+    count--;
+}
+
+@end
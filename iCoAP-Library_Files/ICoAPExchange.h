@@ -29,8 +29,17 @@
 
 
 #import <Foundation/Foundation.h>
+#import <sys/socket.h>
+#import <mach/mach_time.h>
 #import "GCDAsyncUdpSocket.h"
 #import "ICoAPMessage.h"
+#import "ICoAPPeerScheduler.h"
+#import "ICoAPDeduplicationCache.h"
+#import "ICoAPBlock1Source.h"
+#import "ICoAPBlock2Checkpoint.h"
+#import "ICoAPResponseCache.h"
+#import "ICoAPRequestCoalescer.h"
+#import "ICoAPProxyTransport.h"
 
 
 
@@ -43,11 +52,30 @@
 #define kACK_TIMEOUT                        2.0
 #define kACK_RANDOM_FACTOR                  1.5
 #define kMAX_TRANSMIT_WAIT                  93.0
+#define kEXCHANGE_LIFETIME                  247.0
+#define kNSTART                             1
+#define kPROBING_RATE                       1.0     //bytes per second
+
+#define kMaxCongestionWindow                8
 
 #define kMaxObserveOptionValue              8388608
 #define kMaxNotificationDelayTime           128.0
 
+#define kMaxCoalescedEmptyMessages          16
+#define kDefaultBlock1Szx                   6       //1024 Bytes
+#define kBlock2ReorderWindowFactor          4       //Max. blocks requested ahead of delivery, as multiple of the window
+#define kMaxBlockSzx                        6       //1024 Bytes
+#define kMinBlockSzx                        2       //64 Bytes
+#define kBlockSzxGrowthThreshold            16      //Clean blocks in a row before the block size is doubled
+#define kPathMTUProbeOverhead               40      //Bytes of header, token and options of a block message
+
+#define kQBlockMaxPayloads                  10      //MAX_PAYLOADS (RFC 9177)
+#define kNON_TIMEOUT                        2.0
+#define kNON_RECEIVE_TIMEOUT                4.0
+#define kNON_MAX_RETRANSMIT                 4
+
 #define kProxyCoAPTypeIndicator             @"COAP_TYPE"    //Type of Response is sent in HTTP Header
+#define kCoAPDefaultPort                    5683
 
 #define kiCoAPErrorDomain                   @"iCoAPErrorDomain"
 
@@ -55,7 +83,9 @@
 typedef enum {
     IC_RESPONSE_TIMEOUT,            //  MAX_WAIT time expired and no response is expected
     IC_UDP_SOCKET_ERROR,            //  UDP Socket setup/bind failed
-    IC_PROXYING_ERROR               //  Error during Proxying
+    IC_PROXYING_ERROR,              //  Error during Proxying
+    IC_BLOCK_TRANSFER_ERROR,        //  Block-wise transfer could not be continued
+    IC_OBSERVE_ERROR                //  Observe registration was rejected
 } ICoAPExchangeErrorCode;
 
 
@@ -66,11 +96,50 @@ typedef enum {
     IC_OCTET_STREAM = 42,
     IC_EXI = 47,
     IC_JSON = 50,
-    IC_CBOR = 60
+    IC_CBOR = 60,
+    IC_MISSING_BLOCKS_CBOR_SEQ = 272
 } ICoAPKnownContentFormats;
 
 
-@interface ICoAPExchange : NSObject<GCDAsyncUdpSocketDelegate, NSURLConnectionDataDelegate, NSURLConnectionDelegate> {
+typedef struct {
+    uint8_t bytes[4];
+    socklen_t addressLength;
+    struct sockaddr_storage address;
+} ICoAPEmptyMessage;
+
+
+/*
+ *  'ICoAPMonotonicNanoseconds':
+ *  Returns the time of a monotonic clock in nanoseconds, which is not
+ *  affected by changes of the wall clock.
+ */
+static inline uint64_t ICoAPMonotonicNanoseconds(void) {
+    static mach_timebase_info_data_t timebase;
+    if (timebase.denom == 0) {
+        mach_timebase_info(&timebase);
+    }
+    return mach_absolute_time() * timebase.numer / timebase.denom;
+}
+
+/*
+ *  'ICoAPIsNotificationFresh':
+ *  Reordering check of RFC 7641 Section 3.4: A notification with the Observe
+ *  value 'value' received at 'now' is newer than the previous one (received at
+ *  'previousTime'), if its 24 bit sequence number is larger in serial number
+ *  arithmetic, or if more than kMaxNotificationDelayTime seconds have passed.
+ *  Times are given by ICoAPMonotonicNanoseconds().
+ */
+static inline BOOL ICoAPIsNotificationFresh(uint32_t previousValue, uint64_t previousTime, uint32_t value, uint64_t now) {
+    return (previousValue < value && value - previousValue < kMaxObserveOptionValue) ||
+           (previousValue > value && previousValue - value > kMaxObserveOptionValue) ||
+           now > previousTime + (uint64_t)(kMaxNotificationDelayTime * NSEC_PER_SEC);
+}
+
+
+typedef void (^ICoAPBlock2SinkHandler)(NSData *blockData, NSUInteger offset);
+
+
+@interface ICoAPExchange : NSObject<GCDAsyncUdpSocketDelegate, ICoAPPeerSchedulerClient, ICoAPRequestCoalescerClient> {
     uint randomMessageId;
     uint randomToken;
     
@@ -80,20 +149,95 @@ typedef enum {
     NSTimer *maxWaitTimer;
     int retransmissionCounter;
     
-    int observeOptionValue;
-    NSDate *recentNotificationDate;
+    /*
+     Peer Scheduling
+    */
+    BOOL isWaitingForTransmissionGrant;
+    BOOL isHoldingTransmissionGrant;
+    BOOL isWaitingForBlockTransmissionGrant;
+    BOOL isHoldingBlockTransmissionGrant;
+    CFAbsoluteTime transmissionStartTime;
+    
+    ICoAPDeduplicationCache *deduplicationCache;
+    ICoAPEmptyMessage pendingEmptyMessages[kMaxCoalescedEmptyMessages];
+    uint pendingEmptyMessageCount;
+    
+    /*
+     Block2 Pipelining
+    */
+    BOOL isBlock2PipelineActive;
+    uint block2Szx;
+    uint nextBlock2NumberToRequest;
+    uint nextBlock2NumberToDeliver;
+    uint lastBlock2Number;
+    NSMutableDictionary *pendingBlock2Requests;
+    NSMutableDictionary *receivedBlock2Messages;
+    
+    /*
+     Block2 Reassembly
+    */
+    NSMutableData *block2Buffer;
+    NSUInteger block2ExpectedLength;
+    NSUInteger block2ReceivedLength;
+    NSUInteger block2TotalLength;
+    
+    /*
+     Block2 Streaming
+    */
+    BOOL isBlock2StreamActive;
+    
+    /*
+     Block2 Ranges
+    */
+    NSUInteger block2RangeStartOffset;
+    NSUInteger block2RangeEndOffset;
+    uint block2ServerSzx;
+    
+    /*
+     Q-Block Transfer
+    */
+    BOOL isQBlock2TransferActive;
+    uint qBlock2Szx;
+    uint qBlock2LastNumber;
+    uint qBlock2HighestNumber;
+    uint qBlock2ReceivedCount;
+    uint qBlock2RetryCounter;
+    NSMutableData *qBlock2ReceivedBitmap;
+    NSString *qBlock2ETag;
+    NSTimer *qBlock2Timer;
+    BOOL isQBlock1TransferActive;
+    uint qBlock1NextNumber;
+    uint qBlock1LastNumber;
+    uint qBlock1RetryCounter;
+    NSTimer *qBlock1Timer;
+    
+    /*
+     Block1 Transfer
+    */
+    ICoAPBlock1Source *block1Source;
+    BOOL isBlock1TransferActive;
+    BOOL isBlock1SizeNegotiated;
+    BOOL isBlock1FinalBlockSent;
+    uint block1SzxInUse;
+    NSUInteger block1NextOffset;
+    NSMutableDictionary *pendingBlock1Requests;
+    
+    uint observeOptionValue;
+    uint64_t recentNotificationTime;
+    BOOL hasReceivedNotification;
     BOOL isObserveCancelled;
     
+    /*
+     Revalidation: copy of the request which carries the stored ETag added by the exchange
+    */
+    ICoAPMessage *revalidationRequest;
+    
     /*
      HTTP Proxying
     */
-    NSMutableURLRequest *urlRequest;
-    NSURLConnection *urlConnection;
-    NSMutableData *urlData;
+    NSURLSessionDataTask *proxyTask;
     
     ICoAPMessage *proxyCoAPMessage;
-    
-    NSArray *supportedOptions;
 }
 
 
@@ -135,6 +279,161 @@ typedef enum {
  */
 @property (readonly, nonatomic) BOOL isMessageInTransmission;
 
+/*
+ *  'peerScheduler':
+ *  If set, requests of this exchange are only sent when the scheduler
+ *  grants a transmission to the destination, which limits the number of
+ *  concurrent requests of all exchanges sharing the scheduler to the same 
+ *  CoAP-Server (NSTART). Use [ICoAPPeerScheduler sharedScheduler]
+ *  to coordinate all exchanges of the application. (Optional)
+ */
+@property (strong, nonatomic) ICoAPPeerScheduler *peerScheduler;
+
+/*
+ *  'responseCache':
+ *  If set, fresh responses to GET requests are taken from the cache and
+ *  passed to the delegate synchronously, without sending the request.
+ *  2.05 Content responses received by this exchange are stored in the cache.
+ *  For stale responses the stored ETag is added to a copy of the request, a
+ *  2.03 Valid response is then passed to the delegate as the refreshed stored
+ *  response. If the stored response can not be refreshed (it was replaced or
+ *  evicted meanwhile), it is removed and the request is sent again without
+ *  the ETag.
+ *  Use [ICoAPResponseCache sharedCache] to share the responses of all
+ *  exchanges of the application. (Optional)
+ */
+@property (strong, nonatomic) ICoAPResponseCache *responseCache;
+
+/*
+ *  'requestCoalescer':
+ *  If set, a GET request identical to one in transmission by another exchange
+ *  sharing the coalescer is not sent. This exchange receives the responses
+ *  of the other exchange instead, including all blocks of a Block2 transfer.
+ *  Requests of an exchange with a coalescer do not use Q-Block2.
+ *  Use [ICoAPRequestCoalescer sharedCoalescer] to coalesce the requests of
+ *  all exchanges of the application. (Optional)
+ */
+@property (strong, nonatomic) ICoAPRequestCoalescer *requestCoalescer;
+
+/*
+ *  'proxyTransport':
+ *  The transport carrying the HTTP requests of HTTP-Proxying. If not set,
+ *  [ICoAPProxyTransport sharedTransport] is used, so the connections to
+ *  the proxy are shared by all exchanges of the application. (Optional)
+ */
+@property (strong, nonatomic) ICoAPProxyTransport *proxyTransport;
+
+/*
+ *  'priority':
+ *  Priority of the requests of this exchange when queued by the
+ *  'peerScheduler' with IC_SCHEDULING_PRIORITY order. Higher values are
+ *  sent first. Default is 0.
+ */
+@property (readwrite, nonatomic) int priority;
+
+/*
+ *  'block2WindowSize':
+ *  Number of Block2 requests which are kept in flight at the same time,
+ *  once the first response revealed the block size. Blocks arriving out of
+ *  order are buffered and delivered to the delegate in order.
+ *  Default is 1 (stop-and-wait). If a 'peerScheduler' is set, every block
+ *  in flight takes a slot of the scheduler's window of the destination.
+ */
+@property (readwrite, nonatomic) uint block2WindowSize;
+
+/*
+ *  'adaptsBlock2Size':
+ *  If set to YES, successive Block2 requests ask for the block size the
+ *  'peerScheduler' prefers for the destination, based on its loss
+ *  statistics and path MTU probes (see ICoAPPing). Blocks are never larger
+ *  than the size chosen by the server. Default is NO.
+ */
+@property (readwrite, nonatomic) BOOL adaptsBlock2Size;
+
+/*
+ *  'reassemblesBlock2Payload':
+ *  If set to YES, the payloads of all Block2 messages of a response are
+ *  written into one buffer (preallocated from the Size2 option if present)
+ *  instead of being delivered message by message. The delegate is informed
+ *  about the progress and receives the complete payload with
+ *  'iCoAPExchange:didReceiveBlock2Payload:coapMessage:'. Default is NO.
+ */
+@property (readwrite, nonatomic) BOOL reassemblesBlock2Payload;
+
+/*
+ *  'block2SinkFileDescriptor':
+ *  If set to an open file descriptor, the payload of every Block2 message of a
+ *  response is written to it with pwrite() at the offset of the block, as
+ *  soon as the block arrives. The messages are delivered without payload,
+ *  the delegate is informed about the progress and receives
+ *  'iCoAPExchange:didCompleteBlock2TransferWithLength:coapMessage:' after the
+ *  last block. Takes precedence over 'reassemblesBlock2Payload'.
+ *  The descriptor is not closed by the exchange. Default is -1 (disabled).
+ */
+@property (readwrite, nonatomic) int block2SinkFileDescriptor;
+
+/*
+ *  'block2SinkHandler':
+ *  Like 'block2SinkFileDescriptor', but every block is passed to the handler
+ *  with its offset instead. Blocks of a pipelined transfer
+ *  ('block2WindowSize' > 1) may arrive out of order. (Optional)
+ */
+@property (copy, nonatomic) ICoAPBlock2SinkHandler block2SinkHandler;
+
+/*
+ *  'block2Checkpoint':
+ *  Progress of the current (or most recent) Block2 transfer, updated whenever
+ *  a block is delivered in order. It is kept after 'closeExchange' and can be
+ *  passed to 'resumeRequestWithCoAPMessage:fromBlock2Checkpoint:toHost:port:',
+ *  e.g. after a timeout. nil until the first Block2 message was received.
+ */
+@property (readonly, strong, nonatomic) ICoAPBlock2Checkpoint *block2Checkpoint;
+
+/*
+ *  'usesQBlock2':
+ *  If set to YES, requests ask for the response body as a burst of
+ *  non-confirmable Q-Block2 messages (RFC 9177). Missing blocks are requested
+ *  after NON_RECEIVE_TIMEOUT, at most 'qBlockMaxPayloads' per request. The body is
+ *  delivered as a whole like a reassembled Block2 transfer (or written to the
+ *  sink). Servers rejecting the option with 4.02 are asked again without it.
+ *  Not used for HTTP-Proxying and Observe. Default is NO.
+ */
+@property (readwrite, nonatomic) BOOL usesQBlock2;
+
+/*
+ *  'usesQBlock1':
+ *  If set to YES, block-wise requests send their payload as non-confirmable
+ *  Q-Block1 messages (RFC 9177) in sets of 'qBlockMaxPayloads' blocks, and only
+ *  repeat the blocks the server reports missing with 4.08. Servers rejecting
+ *  the option with 4.02 are served with Block1 instead. Default is NO.
+ */
+@property (readwrite, nonatomic) BOOL usesQBlock1;
+
+/*
+ *  'qBlockMaxPayloads':
+ *  Number of Q-Block messages sent (or requested) in one burst, MAX_PAYLOADS.
+ *  Default is kQBlockMaxPayloads.
+ */
+@property (readwrite, nonatomic) uint qBlockMaxPayloads;
+
+/*
+ *  'block1Szx':
+ *  Block size exponent of block-wise requests (BLOCK 1), the block size is
+ *  2^(block1Szx + 4) Bytes. The server may request a smaller size.
+ *  Default is kDefaultBlock1Szx.
+ */
+@property (readwrite, nonatomic) uint block1Szx;
+
+/*
+ *  'block1WindowSize':
+ *  Number of Block1 requests which are kept in flight at the same time,
+ *  once the server accepted the block size with 2.31 Continue.
+ *  The final block is only sent after all previous blocks were acknowledged.
+ *  If a 'peerScheduler' is set, every block in flight takes a slot of the
+ *  scheduler's window of the destination. Default is 1.
+ */
+@property (readwrite, nonatomic) uint block1WindowSize;
+
 
 
 
@@ -166,6 +465,34 @@ typedef enum {
  */
 - (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port;
 
+/*
+ *  'sendRequestWithCoAPMessage:block1Source:toHost:port':
+ *  Starts a block-wise request (BLOCK 1) with the given ICoAPMessage, whose payload
+ *  is read block by block from 'source' instead of the message's 'payload'.
+ *  The final response is delivered to the delegate as usual.
+ *  HTTP-Proxying is not supported for block-wise requests.
+ */
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block1Source:(ICoAPBlock1Source *)source toHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'sendRequestWithCoAPMessage:block2Number:count:szx:toHost:port':
+ *  Requests 'count' blocks of the size given by 'szx' (2^(szx + 4) Bytes),
+ *  beginning with block 'blockNumber', instead of the whole representation.
+ *  A 'count' of 0 requests all blocks until the end of the representation.
+ *  Reassembled payloads contain the requested range only, sinks receive
+ *  the blocks at their offset within the whole representation.
+ */
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block2Number:(uint)blockNumber count:(uint)count szx:(uint)szx toHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'resumeRequestWithCoAPMessage:fromBlock2Checkpoint:toHost:port':
+ *  Continues an interrupted Block2 transfer with the first block which was not
+ *  delivered yet. If the ETag of the representation differs from the one of
+ *  the 'checkpoint', the resource has changed and the transfer fails with
+ *  IC_BLOCK_TRANSFER_ERROR.
+ */
+- (void)resumeRequestWithCoAPMessage:(ICoAPMessage *)cO fromBlock2Checkpoint:(ICoAPBlock2Checkpoint *)checkpoint toHost:(NSString *)host port:(uint)port;
+
 /*
  *  'cancelObserve':
  *  Cancels an Observe subscription (if available).
@@ -231,4 +558,35 @@ typedef enum {
  */
 - (void)iCoAPExchange:(ICoAPExchange *)exchange didRetransmitCoAPMessage:(ICoAPMessage *)coapMessage number:(uint)number finalRetransmission:(BOOL)final;
 
+/*
+ *  'iCoAPExchange:didSendBlock1Bytes:totalBytes:':
+ *  Informs the delegate about the progress of a block-wise request. 'acknowledgedBytes'
+ *  were accepted by the server so far, 'totalBytes' is 0 for streamed payloads.
+ */
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didSendBlock1Bytes:(NSUInteger)acknowledgedBytes totalBytes:(NSUInteger)totalBytes;
+
+/*
+ *  'iCoAPExchange:didReceiveBlock2Bytes:expectedBytes:':
+ *  Informs the delegate about the progress of a reassembled or streamed Block2 transfer.
+ *  'expectedBytes' is 0, if the server did not indicate the size (Size2).
+ */
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveBlock2Bytes:(NSUInteger)receivedBytes expectedBytes:(NSUInteger)expectedBytes;
+
+/*
+ *  'iCoAPExchange:didReceiveBlock2Payload:coapMessage:':
+ *  Informs the delegate that a reassembled Block2 transfer is complete.
+ *  'payload' contains the whole representation, 'coapMessage' is
+ *  the message of the last block.
+ */
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveBlock2Payload:(NSData *)payload coapMessage:(ICoAPMessage *)coapMessage;
+
+/*
+ *  'iCoAPExchange:didCompleteBlock2TransferWithLength:coapMessage:':
+ *  Informs the delegate that all blocks of a streamed Block2 transfer were
+ *  written to the sink. 'length' is the end offset of the last block, i.e. the
+ *  size of the whole representation unless a block range was requested.
+ *  'coapMessage' is the message of the last block (without payload).
+ */
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didCompleteBlock2TransferWithLength:(NSUInteger)length coapMessage:(ICoAPMessage *)coapMessage;
+
 @end
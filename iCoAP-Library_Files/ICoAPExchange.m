@@ -5,9 +5,113 @@
 //  Created by Wojtek Kordylewski on 25.06.13.
 
 
+#import <unistd.h>
 #import "ICoAPExchange.h"
 #import "NSString+hex.h"
 
+
+static inline BOOL ICoAPBitmapContainsIndex(NSData *bitmap, uint index) {
+    return index / 8 < [bitmap length] && (((const uint8_t *)[bitmap bytes])[index / 8] & (1 << (index % 8)));
+}
+
+static inline void ICoAPBitmapAddIndex(NSMutableData *bitmap, uint index) {
+    if (index / 8 >= [bitmap length]) {
+        [bitmap setLength:MAX(index / 8 + 1, [bitmap length] * 2)];
+    }
+    ((uint8_t *)[bitmap mutableBytes])[index / 8] |= 1 << (index % 8);
+}
+
+static NSUInteger ICoAPDecodeMissingBlockNumbers(const uint8_t *bytes, NSUInteger length, uint *numbers, NSUInteger maxNumbers) {
+    //CBOR sequence of unsigned integers (major type 0), see RFC 9177 Section 5
+    NSUInteger index = 0;
+    NSUInteger count = 0;
+    
+    while (index < length && count < maxNumbers) {
+        uint8_t initialByte = bytes[index++];
+        uint8_t additionalInfo = initialByte & 0x1F;
+        uint value = 0;
+        
+        if (initialByte >> 5 != 0) {
+            break;
+        }
+        
+        if (additionalInfo < 24) {
+            value = additionalInfo;
+        }
+        else if (additionalInfo <= 26) {
+            NSUInteger valueLength = 1 << (additionalInfo - 24);
+            if (index + valueLength > length) {
+                break;
+            }
+            for (NSUInteger i = 0; i < valueLength; i++) {
+                value = (value << 8) | bytes[index++];
+            }
+        }
+        else {
+            break;
+        }
+        numbers[count++] = value;
+    }
+    return count;
+}
+
+//HTTP header fields of the options carried over HTTP-Proxying, indexed by option number
+static NSString * const ICoAPProxyHeaderFields[IC_SIZE1 + 1] = {
+    [IC_IF_MATCH] = @"IF_MATCH",
+    [IC_URI_HOST] = @"URI_HOST",
+    [IC_ETAG] = @"ETAG",
+    [IC_IF_NONE_MATCH] = @"IF_NONE_MATCH",
+    [IC_OBSERVE] = @"OBSERVE",
+    [IC_URI_PORT] = @"URI_PORT",
+    [IC_LOCATION_PATH] = @"LOCATION_PATH",
+    [IC_URI_PATH] = @"URI_PATH",
+    [IC_CONTENT_FORMAT] = @"CONTENT_FORMAT",
+    [IC_MAX_AGE] = @"MAX_AGE",
+    [IC_URI_QUERY] = @"URI_QUERY",
+    [IC_ACCEPT] = @"ACCEPT",
+    [IC_LOCATION_QUERY] = @"LOCATION_QUERY",
+    [IC_BLOCK2] = @"BLOCK2",
+    [IC_BLOCK1] = @"BLOCK1",
+    [IC_SIZE2] = @"SIZE2",
+    [IC_PROXY_URI] = @"PROXY_URI",
+    [IC_PROXY_SCHEME] = @"PROXY_SCHEME",
+    [IC_SIZE1] = @"SIZE1"
+};
+
+static inline NSString *ICoAPProxyHeaderFieldForOption(uint option) {
+    return option <= IC_SIZE1 ? ICoAPProxyHeaderFields[option] : nil;
+}
+
+//Option keys of the optionDict by response header field ("HTTP_" prefixed, upper case), built once
+static NSDictionary *ICoAPProxyOptionKeysByResponseHeaderField(void) {
+    static NSDictionary *optionKeys;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        NSMutableDictionary *keys = [[NSMutableDictionary alloc] init];
+        for (uint option = 0; option <= IC_SIZE1; option++) {
+            if (ICoAPProxyHeaderFields[option]) {
+                [keys setObject:[NSString stringWithFormat:@"%i", option] forKey:[@"HTTP_" stringByAppendingString:ICoAPProxyHeaderFields[option]]];
+            }
+        }
+        optionKeys = keys;
+    });
+    return optionKeys;
+}
+
+
+@interface ICoAPBlockRequest : NSObject
+@property (strong, nonatomic) ICoAPMessage *message;
+@property (readwrite, nonatomic) uint blockNumber;
+@property (readwrite, nonatomic) NSUInteger offset;
+@property (readwrite, nonatomic) int retransmissionCounter;
+@property (strong, nonatomic) NSTimer *retransmissionTimer;
+@property (readwrite, nonatomic) BOOL isHoldingTransmissionGrant;
+@end
+
+@implementation ICoAPBlockRequest
+@end
+
+
 @interface ICoAPExchange ()
 - (BOOL)setupUdpSocket;
 - (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext;
@@ -15,23 +119,69 @@
 - (void)udpSocketDidClose:(GCDAsyncUdpSocket *)sock withError:(NSError *)error;
 - (void)noResponseExpected;
 - (void)sendDidReceiveMessageToDelegateWithCoAPMessage:(ICoAPMessage *)coapMessage;
+- (void)reassembleBlock2CoAPMessage:(ICoAPMessage *)coapMessage;
+- (BOOL)usesBlock2Sink;
+- (BOOL)writeBlock2PayloadOfCoAPMessageToSink:(ICoAPMessage *)cO;
+- (void)streamBlock2CoAPMessage:(ICoAPMessage *)coapMessage;
+- (void)failBlock2StreamWithError:(int)errorNumber;
+- (NSUInteger)expectedBlock2LengthOfCoAPMessage:(ICoAPMessage *)cO;
+- (BOOL)isFinalBlock2Value:(uint)blockValue;
+- (void)updateBlock2CheckpointWithCoAPMessage:(ICoAPMessage *)cO;
+- (BOOL)validateBlock2ETagOfCoAPMessage:(ICoAPMessage *)cO;
+- (uint)adaptedBlock2SzxForOffset:(NSUInteger)offset szx:(uint)szx;
 - (void)sendDidRetransmitMessageToDelegateWithCoAPMessage:(ICoAPMessage *)coapMessage;
 - (void)sendFailWithErrorToDelegateWithError:(NSError *)error;
 - (void)handleBlock2OptionForCoapMessage:(ICoAPMessage *)cO;
+- (ICoAPMessage *)block2RequestWithBlockNumber:(uint)blockNumber szx:(uint)szx;
+- (void)startBlock2PipelineWithCoAPMessage:(ICoAPMessage *)cO blockNumber:(uint)blockNumber szx:(uint)szx;
+- (void)fillBlock2Pipeline;
+- (void)sendBlockRequest:(ICoAPBlockRequest *)request;
+- (BOOL)acquireBlockTransmissionGrantWithPendingRequests:(NSDictionary *)pendingRequests;
+- (void)releaseTransmissionGrantOfBlockRequest:(ICoAPBlockRequest *)request outcome:(ICoAPTransmissionOutcome)outcome;
+- (void)stopWaitingForBlockTransmissionGrant;
+- (void)onBlockRetransmissionTimer:(NSTimer *)timer;
+- (void)handlePipelinedBlock2Message:(ICoAPMessage *)cO;
+- (void)cancelBlock2RequestsAfterBlockNumber:(uint)blockNumber;
+- (void)stopBlock2Pipeline;
+- (void)prepareRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port;
+- (void)resendRevalidationRequestWithoutETag;
+- (void)addCoAPProxyOptionsToCoAPMessage:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block2Checkpoint:(ICoAPBlock2Checkpoint *)checkpoint toHost:(NSString *)host port:(uint)port;
+- (uint)block2ValueOfCoAPMessage:(ICoAPMessage *)cO;
+- (void)writeBlock2PayloadOfCoAPMessageToBuffer:(ICoAPMessage *)coapMessage;
+- (void)sendQBlockCoAPMessage:(ICoAPMessage *)cO;
+- (ICoAPMessage *)qBlock2RequestWithBlockValues:(NSArray *)blockValues;
+- (void)handleQBlock2CoAPMessage:(ICoAPMessage *)cO;
+- (void)onQBlock2Timer;
+- (void)finishQBlock2TransferWithCoAPMessage:(ICoAPMessage *)cO;
+- (void)stopQBlock2Transfer;
+- (BOOL)sendQBlock1BlockNumber:(uint)blockNumber;
+- (void)sendQBlock1Set;
+- (void)onQBlock1Timer;
+- (BOOL)handleQBlock1CoAPMessage:(ICoAPMessage *)cO;
+- (void)stopQBlock1Transfer;
+- (ICoAPMessage *)block1RequestWithBlockNumber:(uint)blockNumber szx:(uint)szx more:(BOOL)more payloadData:(NSData *)payloadData;
+- (void)fillBlock1Window;
+- (BOOL)handleBlock1CoAPMessage:(ICoAPMessage *)cO;
+- (void)cancelBlockRequests:(NSMutableDictionary *)requests;
+- (void)failBlock1TransferWithDescription:(NSString *)description;
+- (void)stopBlock1Transfer;
 - (NSMutableData *)getHexDataFromString:(NSString *)string;
 - (void)sendCircumstantialResponseWithMessageID:(uint)messageID type:(ICoAPType)type toAddress:(NSData *)address;
+- (void)flushEmptyMessages;
+- (void)scheduleSending;
 - (void)startSending;
+- (void)releaseTransmissionGrantWithOutcome:(ICoAPTransmissionOutcome)outcome;
 - (void)performTransmissionCycle;
 - (void)sendCoAPMessage;
 - (void)resetState;
 - (void)sendHttpMessageFromCoAPMessage:(ICoAPMessage *)coapMessage;
-- (NSString *)getHttpHeaderFieldForCoAPOptionDelta:(uint)delta;
 - (NSString *)getHttpMethodForCoAPMessageCode:(uint)code;
 - (ICoAPType)getCoapTypeForString:(NSString *)typeString;
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error;
-- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response;
-- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data;
-- (void)connectionDidFinishLoading:(NSURLConnection *)connection;
+- (void)proxyTaskWithIdentifier:(NSUInteger)taskIdentifier didCompleteWithData:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error;
+- (void)proxyFailWithError:(NSError *)error;
+- (void)proxyDidReceiveResponse:(NSHTTPURLResponse *)httpresponse;
+- (void)proxyDidFinishLoadingData:(NSData *)data;
 @end
 
 @implementation ICoAPExchange
@@ -42,32 +192,23 @@
     if (self = [super init]) {
         randomMessageId = 1 + arc4random() % 65536;
         randomToken = 1 + arc4random() % INT_MAX;
-        
-        supportedOptions =  [NSArray arrayWithObjects:
-                            [NSNumber numberWithInt: IC_IF_MATCH],
-                            [NSNumber numberWithInt: IC_URI_HOST],
-                            [NSNumber numberWithInt: IC_ETAG],
-                            [NSNumber numberWithInt: IC_IF_NONE_MATCH],
-                            [NSNumber numberWithInt: IC_OBSERVE],
-                            [NSNumber numberWithInt: IC_URI_PORT],
-                            [NSNumber numberWithInt: IC_LOCATION_PATH],
-                            [NSNumber numberWithInt: IC_URI_PATH],
-                            [NSNumber numberWithInt: IC_CONTENT_FORMAT],
-                            [NSNumber numberWithInt: IC_MAX_AGE],
-                            [NSNumber numberWithInt: IC_URI_QUERY],
-                            [NSNumber numberWithInt: IC_ACCEPT],
-                            [NSNumber numberWithInt: IC_LOCATION_QUERY],
-                            [NSNumber numberWithInt: IC_BLOCK2],
-                            [NSNumber numberWithInt: IC_BLOCK1],
-                            [NSNumber numberWithInt: IC_SIZE2],
-                            [NSNumber numberWithInt: IC_PROXY_URI],
-                            [NSNumber numberWithInt: IC_PROXY_SCHEME],
-                            [NSNumber numberWithInt: IC_SIZE1],
-                            nil];
+        deduplicationCache = [[ICoAPDeduplicationCache alloc] init];
+        pendingBlock2Requests = [[NSMutableDictionary alloc] init];
+        receivedBlock2Messages = [[NSMutableDictionary alloc] init];
+        pendingBlock1Requests = [[NSMutableDictionary alloc] init];
+        self.block2WindowSize = 1;
+        self.block1WindowSize = 1;
+        self.block1Szx = kDefaultBlock1Szx;
+        self.block2SinkFileDescriptor = -1;
+        self.qBlockMaxPayloads = kQBlockMaxPayloads;
     }
     return self;
 }
 
+- (void)dealloc {
+    [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_CANCELLED];
+}
+
 - (id)initAndSendRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString* )host port:(uint)port delegate:(id)delegate {
     if (self = [self init]) {
         self.delegate = delegate;
@@ -187,7 +328,7 @@
             if (newOptionNumber == IC_ETAG || newOptionNumber == IC_IF_MATCH) {
                 optVal = [hexString substringWithRange:NSMakeRange(optionIndex + optionIndexOffset, optionLength * 2)];
             }
-            else if (newOptionNumber == IC_BLOCK2 || newOptionNumber == IC_URI_PORT || newOptionNumber == IC_CONTENT_FORMAT || newOptionNumber == IC_MAX_AGE || newOptionNumber == IC_ACCEPT || newOptionNumber == IC_SIZE1 || newOptionNumber == IC_SIZE2 || newOptionNumber == IC_OBSERVE) {
+            else if (newOptionNumber == IC_BLOCK2 || newOptionNumber == IC_BLOCK1 || newOptionNumber == IC_Q_BLOCK2 || newOptionNumber == IC_Q_BLOCK1 || newOptionNumber == IC_URI_PORT || newOptionNumber == IC_CONTENT_FORMAT || newOptionNumber == IC_MAX_AGE || newOptionNumber == IC_ACCEPT || newOptionNumber == IC_SIZE1 || newOptionNumber == IC_SIZE2 || newOptionNumber == IC_OBSERVE) {
                 optVal = [NSString stringWithFormat:@"%i", (int)strtol([[hexString substringWithRange:NSMakeRange(optionIndex + optionIndexOffset, optionLength * 2)] UTF8String], NULL, 16)];
             }
             else {
@@ -207,6 +348,9 @@
     
     //Payload, first check if payloadmarker exists
     if (payloadStartIndex + 2 < [hexString length]) {
+        NSUInteger payloadByteIndex = (payloadStartIndex + 2) / 2;
+        cO.payloadData = [data subdataWithRange:NSMakeRange(payloadByteIndex, [data length] - payloadByteIndex)];
+        
         if ([self requiresPayloadStringDecodeForCoAPMessage:cO]){
             NSString* stringWithoutPercentEncoding = [NSString stringFromHexString:[hexString substringFromIndex:payloadStartIndex + 2]];
             NSString* stringWithPercentEncoding = [stringWithoutPercentEncoding stringByRemovingPercentEncoding];
@@ -234,7 +378,7 @@
     
     NSArray *sortedArray;
     sortedArray = [[cO.optionDict allKeys] sortedArrayUsingComparator:^NSComparisonResult(id a, id b) {
-        return [a integerValue] > [b integerValue];
+        return [[NSNumber numberWithInteger:[a integerValue]] compare:[NSNumber numberWithInteger:[b integerValue]]];
     }];
     
     uint previousDelta = 0;
@@ -249,7 +393,7 @@
             if ([key intValue] == IC_ETAG || [key intValue] == IC_IF_MATCH) {
                 valueForKey = [valueArray objectAtIndex:i];
             }
-            else if ([key intValue] == IC_BLOCK2 || [key intValue] == IC_URI_PORT || [key intValue] == IC_CONTENT_FORMAT || [key intValue] == IC_MAX_AGE || [key intValue] == IC_ACCEPT || [key intValue] == IC_SIZE1 || [key intValue] == IC_SIZE2) {
+            else if ([key intValue] == IC_BLOCK2 || [key intValue] == IC_BLOCK1 || [key intValue] == IC_Q_BLOCK2 || [key intValue] == IC_Q_BLOCK1 || [key intValue] == IC_URI_PORT || [key intValue] == IC_CONTENT_FORMAT || [key intValue] == IC_MAX_AGE || [key intValue] == IC_ACCEPT || [key intValue] == IC_SIZE1 || [key intValue] == IC_SIZE2 || [key intValue] == IC_OBSERVE) {
                 valueForKey = [NSString get0To4ByteHexStringFromInt:[[valueArray objectAtIndex:i] intValue]];
             }
             else {
@@ -303,6 +447,9 @@
             [final appendString:[NSString stringWithFormat:@"%02X%@", 255, cO.payload]];
         }
     }
+    else if ([cO.payloadData length] > 0) {
+        [final appendString:[NSString stringWithFormat:@"%02X%@", 255, [NSString stringFromDataWithHex:cO.payloadData]]];
+    }
 
     return [self getHexDataFromString:final];
 }
@@ -311,6 +458,17 @@
 
 - (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
     
+    //Duplicate confirmable message: repeat the previous response without decoding
+    if ([data length] >= 4) {
+        const uint8_t *header = [data bytes];
+        ICoAPType responseType;
+        
+        if (header[0] >> 4 == IC_CONFIRMABLE && [deduplicationCache lookupMessageID:(header[2] << 8 | header[3]) fromAddress:address responseType:&responseType]) {
+            [self sendCircumstantialResponseWithMessageID:(header[2] << 8 | header[3]) type:responseType toAddress:address];
+            return;
+        }
+    }
+    
     ICoAPMessage *cO = [self decodeCoAPMessageFromData:data];
     
     //Check if received data is a valid CoAP Message
@@ -325,23 +483,67 @@
     if ((cO.messageID != pendingCoAPMessageInTransmission.messageID && cO.token != pendingCoAPMessageInTransmission.token) || ([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] && isObserveCancelled && cO.type != IC_ACKNOWLEDGMENT)) {
         if (cO.type <= IC_NON_CONFIRMABLE) {
             [self sendCircumstantialResponseWithMessageID:cO.messageID type:IC_RESET toAddress:address];
+            if (cO.type == IC_CONFIRMABLE) {
+                [deduplicationCache recordMessageID:cO.messageID fromAddress:address responseType:IC_RESET];
+            }
         }
         return;
     }
     
+    //Any matching message completes the interaction with a scheduled peer
+    if (isHoldingTransmissionGrant) {
+        if (retransmissionCounter <= 1) {
+            [self.peerScheduler recordRoundTripTime:CFAbsoluteTimeGetCurrent() - transmissionStartTime forHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+            [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_CLEAN];
+        }
+        else {
+            [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_RETRANSMITTED];
+        }
+    }
+    
     //Invalidate Timers: Resend- and Max-Wait Timer
     if (cO.type == IC_ACKNOWLEDGMENT || cO.type == IC_RESET || cO.type == IC_NON_CONFIRMABLE) {
         [sendTimer invalidate];
         [maxWaitTimer invalidate];
     }
 
-    if (!(cO.type == IC_ACKNOWLEDGMENT && cO.code == IC_EMPTY) && !([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]])) {
+    if (!isBlock1TransferActive && !isQBlock1TransferActive && !isQBlock2TransferActive && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]] && !(cO.type == IC_ACKNOWLEDGMENT && cO.code == IC_EMPTY) && !([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]])) {
         _isMessageInTransmission = NO;
     }
     
     //Separate Response / Observe: Send ACK
     if (cO.type == IC_CONFIRMABLE) {        
         [self sendCircumstantialResponseWithMessageID:cO.messageID type:IC_ACKNOWLEDGMENT toAddress:address];
+        [deduplicationCache recordMessageID:cO.messageID fromAddress:address responseType:IC_ACKNOWLEDGMENT];
+    }
+    
+    if (isBlock1TransferActive && [self handleBlock1CoAPMessage:cO]) {
+        return;
+    }
+    
+    if (isQBlock1TransferActive && [self handleQBlock1CoAPMessage:cO]) {
+        return;
+    }
+    
+    //Servers without Q-Block2 support reject the option, the request is repeated without it
+    if (cO.code == IC_BAD_OPTION && !isQBlock2TransferActive && [pendingCoAPMessageInTransmission.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]]) {
+        [pendingCoAPMessageInTransmission.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]];
+        [self sendRequestWithCoAPMessage:pendingCoAPMessageInTransmission block2Checkpoint:nil toHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+        return;
+    }
+    
+    if (isQBlock2TransferActive || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]]) {
+        [self handleQBlock2CoAPMessage:cO];
+        return;
+    }
+    
+    if (![self validateBlock2ETagOfCoAPMessage:cO]) {
+        return;
+    }
+    
+    if (isBlock2PipelineActive) {
+        [self handlePipelinedBlock2Message:cO];
+        return;
     }
     
     [self handleBlock2OptionForCoapMessage:cO];
@@ -349,18 +551,11 @@
     //Check for Observe Option: If Observe Option is present, the message is only sent to the delegate if the order is correct.
     if ([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] && cO.type != IC_ACKNOWLEDGMENT) {
         uint currentObserveValue = [[[cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] objectAtIndex:0] intValue];
-       
-        if (!recentNotificationDate) {
-            recentNotificationDate = [[NSDate alloc] init];
-        }
-        
-        recentNotificationDate = [recentNotificationDate dateByAddingTimeInterval:kMaxNotificationDelayTime];
+        uint64_t now = ICoAPMonotonicNanoseconds();
         
-        if ((observeOptionValue < currentObserveValue && currentObserveValue - observeOptionValue < kMaxObserveOptionValue) ||
-            (observeOptionValue > currentObserveValue && observeOptionValue - currentObserveValue > kMaxObserveOptionValue) ||
-            [recentNotificationDate compare:[cO.timestamp dateByAddingTimeInterval:128.0]] == NSOrderedAscending) {
-            
-            recentNotificationDate = cO.timestamp;
+        if (!hasReceivedNotification || ICoAPIsNotificationFresh(observeOptionValue, recentNotificationTime, currentObserveValue, now)) {
+            hasReceivedNotification = YES;
+            recentNotificationTime = now;
             observeOptionValue = currentObserveValue;
         }
         else {
@@ -368,6 +563,21 @@
         }
     }
     
+    if (self.responseCache && cO.code == IC_VALID) {
+        ICoAPMessage *validatedResponse = [self.responseCache refreshResponseWithValidResponse:cO forRequest:pendingCoAPMessageInTransmission host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+        if (validatedResponse) {
+            cO = validatedResponse;
+        }
+        else if (revalidationRequest && revalidationRequest == pendingCoAPMessageInTransmission) {
+            //The ETag was added by the exchange, a bare 2.03 would leave the delegate without a body
+            [self resendRevalidationRequestWithoutETag];
+            return;
+        }
+    }
+    else if (self.responseCache && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]]) {
+        [self.responseCache storeResponse:cO forRequest:pendingCoAPMessageInTransmission host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+    }
+    
     [self sendDidReceiveMessageToDelegateWithCoAPMessage:cO];
 }
 
@@ -388,16 +598,222 @@
 - (void)noResponseExpected {
     NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"No Response expected for recently sent CoAP Message" forKey:NSLocalizedDescriptionKey];
 
+    [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_TIMED_OUT];
     [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_RESPONSE_TIMEOUT userInfo:userInfo]];
     [self closeExchange];
 }
 
 - (void)sendDidReceiveMessageToDelegateWithCoAPMessage:(ICoAPMessage *)coapMessage {
+    //Exchanges waiting for an identical request get the message before the payload is consumed
+    [self.requestCoalescer forwardCoAPMessage:coapMessage fromClient:self];
+    
+    BOOL isBlock2Transfer = [coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+    
+    if ([self usesBlock2Sink]) {
+        if (isBlock2Transfer) {
+            [self streamBlock2CoAPMessage:coapMessage];
+            return;
+        }
+        isBlock2StreamActive = NO;
+    }
+    else if (self.reassemblesBlock2Payload) {
+        if (isBlock2Transfer) {
+            [self updateBlock2CheckpointWithCoAPMessage:coapMessage];
+            [self reassembleBlock2CoAPMessage:coapMessage];
+            return;
+        }
+        //Any other message ends a reassembled transfer
+        block2Buffer = nil;
+    }
+    else if (isBlock2Transfer) {
+        [self updateBlock2CheckpointWithCoAPMessage:coapMessage];
+    }
+    
     if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveCoAPMessage:)]) {
         [self.delegate iCoAPExchange:self didReceiveCoAPMessage:coapMessage];
     }
 }
 
+- (void)reassembleBlock2CoAPMessage:(ICoAPMessage *)coapMessage {
+    uint blockValue = [self block2ValueOfCoAPMessage:coapMessage];
+    [self writeBlock2PayloadOfCoAPMessageToBuffer:coapMessage];
+    
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveBlock2Bytes:expectedBytes:)]) {
+        [self.delegate iCoAPExchange:self didReceiveBlock2Bytes:block2ReceivedLength expectedBytes:block2ExpectedLength];
+    }
+    
+    //More Flag not set or end of the requested range: transfer complete
+    if ([self isFinalBlock2Value:blockValue]) {
+        NSMutableData *payload = block2Buffer;
+        block2Buffer = nil;
+        [payload setLength:block2TotalLength];
+        
+        if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveBlock2Payload:coapMessage:)]) {
+            [self.delegate iCoAPExchange:self didReceiveBlock2Payload:payload coapMessage:coapMessage];
+        }
+    }
+}
+
+- (uint)block2ValueOfCoAPMessage:(ICoAPMessage *)cO {
+    NSArray *blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    if (!blockValues) {
+        blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]];
+    }
+    return [[blockValues objectAtIndex:0] intValue];
+}
+
+- (void)writeBlock2PayloadOfCoAPMessageToBuffer:(ICoAPMessage *)coapMessage {
+    uint blockValue = [self block2ValueOfCoAPMessage:coapMessage];
+    NSUInteger offset = (blockValue >> 4) * (16 << (blockValue & 7));
+    NSUInteger length = [coapMessage.payloadData length];
+    
+    //The buffer holds the requested range only
+    offset -= MIN(offset, block2RangeStartOffset);
+    
+    if (!block2Buffer) {
+        block2ExpectedLength = [self expectedBlock2LengthOfCoAPMessage:coapMessage];
+        block2ReceivedLength = 0;
+        block2TotalLength = 0;
+        block2Buffer = [[NSMutableData alloc] initWithLength:MAX(block2ExpectedLength, offset + length)];
+    }
+    
+    //Grow geometrically if the size is unknown or was underestimated
+    if (offset + length > [block2Buffer length]) {
+        [block2Buffer setLength:MAX(offset + length, [block2Buffer length] * 2)];
+    }
+    [block2Buffer replaceBytesInRange:NSMakeRange(offset, length) withBytes:[coapMessage.payloadData bytes]];
+    
+    block2ReceivedLength += length;
+    block2TotalLength = MAX(block2TotalLength, offset + length);
+}
+
+- (BOOL)usesBlock2Sink {
+    return self.block2SinkFileDescriptor >= 0 || self.block2SinkHandler;
+}
+
+- (BOOL)writeBlock2PayloadOfCoAPMessageToSink:(ICoAPMessage *)cO {
+    uint blockValue = [self block2ValueOfCoAPMessage:cO];
+    NSUInteger offset = (blockValue >> 4) * (16 << (blockValue & 7));
+    NSData *blockData = cO.payloadData;
+    
+    if (!isBlock2StreamActive) {
+        block2ExpectedLength = [self expectedBlock2LengthOfCoAPMessage:cO];
+        block2ReceivedLength = 0;
+        block2TotalLength = 0;
+        isBlock2StreamActive = YES;
+    }
+    
+    if (self.block2SinkHandler) {
+        if ([blockData length] > 0) {
+            self.block2SinkHandler(blockData, offset);
+        }
+    }
+    else {
+        const uint8_t *bytes = [blockData bytes];
+        NSUInteger written = 0;
+        while (written < [blockData length]) {
+            ssize_t result = pwrite(self.block2SinkFileDescriptor, bytes + written, [blockData length] - written, offset + written);
+            if (result < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                [self failBlock2StreamWithError:errno];
+                return NO;
+            }
+            written += result;
+        }
+    }
+    
+    block2ReceivedLength += [blockData length];
+    block2TotalLength = MAX(block2TotalLength, offset + [blockData length]);
+    
+    //The payload is on its way to the sink, the message is kept only for its options
+    cO.payloadData = nil;
+    cO.payload = nil;
+    return YES;
+}
+
+- (void)streamBlock2CoAPMessage:(ICoAPMessage *)coapMessage {
+    //Blocks of a pipelined transfer were already written on arrival
+    if ((coapMessage.payloadData || !isBlock2StreamActive) && ![self writeBlock2PayloadOfCoAPMessageToSink:coapMessage]) {
+        return;
+    }
+    [self updateBlock2CheckpointWithCoAPMessage:coapMessage];
+    
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveBlock2Bytes:expectedBytes:)]) {
+        [self.delegate iCoAPExchange:self didReceiveBlock2Bytes:block2ReceivedLength expectedBytes:block2ExpectedLength];
+    }
+    
+    //More Flag not set or end of the requested range: transfer complete
+    uint blockValue = [[[coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] objectAtIndex:0] intValue];
+    if ([self isFinalBlock2Value:blockValue]) {
+        isBlock2StreamActive = NO;
+        
+        if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didCompleteBlock2TransferWithLength:coapMessage:)]) {
+            [self.delegate iCoAPExchange:self didCompleteBlock2TransferWithLength:block2TotalLength coapMessage:coapMessage];
+        }
+    }
+}
+
+- (void)failBlock2StreamWithError:(int)errorNumber {
+    NSString *description = [NSString stringWithFormat:@"Writing Block2 payload failed: %s", strerror(errorNumber)];
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:description forKey:NSLocalizedDescriptionKey];
+    
+    [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_BLOCK_TRANSFER_ERROR userInfo:userInfo]];
+    [self closeExchange];
+}
+
+- (NSUInteger)expectedBlock2LengthOfCoAPMessage:(ICoAPMessage *)cO {
+    NSArray *size2Values = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]];
+    if (!size2Values) {
+        return 0;
+    }
+    
+    NSUInteger size2 = [[size2Values objectAtIndex:0] intValue];
+    return MIN(size2, block2RangeEndOffset) - MIN(size2, block2RangeStartOffset);
+}
+
+- (BOOL)isFinalBlock2Value:(uint)blockValue {
+    return !(blockValue & 8) || (NSUInteger)((blockValue >> 4) + 1) * (16 << (blockValue & 7)) >= block2RangeEndOffset;
+}
+
+- (void)updateBlock2CheckpointWithCoAPMessage:(ICoAPMessage *)cO {
+    if (cO.code >= 128) {
+        return;
+    }
+    
+    if (!_block2Checkpoint) {
+        _block2Checkpoint = [[ICoAPBlock2Checkpoint alloc] init];
+    }
+    
+    uint blockValue = [[[cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] objectAtIndex:0] intValue];
+    NSArray *etagValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    if (etagValues) {
+        _block2Checkpoint.etag = [etagValues objectAtIndex:0];
+    }
+    _block2Checkpoint.szx = blockValue & 7;
+    _block2Checkpoint.nextBlockNumber = (blockValue >> 4) + 1;
+    _block2Checkpoint.isComplete = [self isFinalBlock2Value:blockValue];
+}
+
+- (BOOL)validateBlock2ETagOfCoAPMessage:(ICoAPMessage *)cO {
+    NSArray *etagValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    
+    if (!_block2Checkpoint.etag || !etagValues || cO.code >= 128 || ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]]) {
+        return YES;
+    }
+    
+    if ([[etagValues objectAtIndex:0] isEqualToString:_block2Checkpoint.etag]) {
+        return YES;
+    }
+    
+    //Blocks of different representations must not be combined
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Resource changed during Block2 transfer (ETag mismatch)" forKey:NSLocalizedDescriptionKey];
+    [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_BLOCK_TRANSFER_ERROR userInfo:userInfo]];
+    [self closeExchange];
+    return NO;
+}
+
 - (void)sendDidRetransmitMessageToDelegateWithCoAPMessage:(ICoAPMessage *)coapMessage {
     if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didRetransmitCoAPMessage:number:finalRetransmission:)]) {
         retransmissionCounter == kMAX_RETRANSMIT ?
@@ -407,6 +823,8 @@
 }
 
 - (void)sendFailWithErrorToDelegateWithError:(NSError *)error {
+    [self.requestCoalescer forwardError:error fromClient:self];
+    
     if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didFailWithError:)]) {
         [self.delegate iCoAPExchange:self didFailWithError:error];
     }
@@ -420,35 +838,21 @@
     uint blockNum = strtol([[blockValue substringToIndex:[blockValue length] - 1] UTF8String], NULL, 16);
     uint blockTail = strtol([[blockValue substringFromIndex:[blockValue length] - 1] UTF8String], NULL, 16);
     
-    if (blockTail > 7) {
-        //More Flag is set
-        ICoAPMessage *blockObject = [[ICoAPMessage alloc] init];
-        blockObject.isRequest = YES;
-        blockObject.type = IC_CONFIRMABLE;
-        blockObject.code = pendingCoAPMessageInTransmission.code;
-        blockObject.messageID = pendingCoAPMessageInTransmission.messageID + 1 % 65536;
-        randomMessageId++;
-        blockObject.token = pendingCoAPMessageInTransmission.token;
-        blockObject.host = pendingCoAPMessageInTransmission.host;
-        blockObject.port = pendingCoAPMessageInTransmission.port;
-        blockObject.httpProxyHost = pendingCoAPMessageInTransmission.httpProxyHost;
-        blockObject.httpProxyPort = pendingCoAPMessageInTransmission.httpProxyPort;
-        blockObject.optionDict =  [[NSMutableDictionary alloc] init];
-        for (id key in pendingCoAPMessageInTransmission.optionDict) {
-            if (![key isEqualToString:[NSString stringWithFormat:@"%i", IC_BLOCK2]]) {
-                [blockObject.optionDict setValue:[[NSMutableArray alloc] initWithArray:[pendingCoAPMessageInTransmission.optionDict valueForKey:key]] forKey:key];
-            }
-        }
-        
-        NSString *newBlockValue = [NSString stringWithFormat:@"%i", (blockNum + 1) * 16 + blockTail - 8];
-        [blockObject addOption:IC_BLOCK2 withValue:newBlockValue];
+    if (blockTail > 7 && (NSUInteger)(blockNum + 1) * (16 << (blockTail - 8)) < block2RangeEndOffset) {
+        //More Flag is set and the requested range continues
+        if (self.block2WindowSize > 1 && !cO.usesHttpProxying && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]]) {
+            [self startBlock2PipelineWithCoAPMessage:cO blockNumber:blockNum szx:blockTail - 8];
+            return;
+        }
         
-        pendingCoAPMessageInTransmission = blockObject;
+        NSUInteger nextOffset = (NSUInteger)(blockNum + 1) * (16 << (blockTail - 8));
+        uint nextSzx = [self adaptedBlock2SzxForOffset:nextOffset szx:blockTail - 8];
+        pendingCoAPMessageInTransmission = [self block2RequestWithBlockNumber:(uint)(nextOffset / (16 << nextSzx)) szx:nextSzx];
         if (cO.usesHttpProxying) {
             [self sendHttpMessageFromCoAPMessage:pendingCoAPMessageInTransmission];
         }
         else {
-            [self startSending];
+            [self scheduleSending];
         }
     }
     else {
@@ -456,6 +860,46 @@
     }
 }
 
+- (ICoAPMessage *)block2RequestWithBlockNumber:(uint)blockNumber szx:(uint)szx {
+    ICoAPMessage *blockObject = [[ICoAPMessage alloc] init];
+    blockObject.isRequest = YES;
+    blockObject.type = IC_CONFIRMABLE;
+    blockObject.code = pendingCoAPMessageInTransmission.code;
+    randomMessageId++;
+    blockObject.messageID = randomMessageId % 65536;
+    blockObject.token = pendingCoAPMessageInTransmission.token;
+    blockObject.host = pendingCoAPMessageInTransmission.host;
+    blockObject.port = pendingCoAPMessageInTransmission.port;
+    blockObject.httpProxyHost = pendingCoAPMessageInTransmission.httpProxyHost;
+    blockObject.httpProxyPort = pendingCoAPMessageInTransmission.httpProxyPort;
+    blockObject.optionDict =  [[NSMutableDictionary alloc] init];
+    for (id key in pendingCoAPMessageInTransmission.optionDict) {
+        if (![key isEqualToString:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![key isEqualToString:[NSString stringWithFormat:@"%i", IC_BLOCK1]] && ![key isEqualToString:[NSString stringWithFormat:@"%i", IC_SIZE1]] && ![key isEqualToString:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]] && ![key isEqualToString:[NSString stringWithFormat:@"%i", IC_Q_BLOCK1]]) {
+            [blockObject.optionDict setValue:[[NSMutableArray alloc] initWithArray:[pendingCoAPMessageInTransmission.optionDict valueForKey:key]] forKey:key];
+        }
+    }
+    
+    [blockObject addOption:IC_BLOCK2 withValue:[NSString stringWithFormat:@"%i", blockNumber * 16 + szx]];
+    return blockObject;
+}
+
+- (uint)adaptedBlock2SzxForOffset:(NSUInteger)offset szx:(uint)szx {
+    //The largest size offered by the server is the upper bound
+    block2ServerSzx = MAX(block2ServerSzx, szx);
+    
+    if (!self.adaptsBlock2Size || !self.peerScheduler) {
+        return szx;
+    }
+    
+    uint adaptedSzx = MIN(block2ServerSzx, [self.peerScheduler blockSzxForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port]);
+    
+    //A larger block has to start at a multiple of its size, smaller ones always fit
+    while (adaptedSzx > szx && offset % (16 << adaptedSzx) != 0) {
+        adaptedSzx--;
+    }
+    return adaptedSzx;
+}
+
 - (NSMutableData *)getHexDataFromString:(NSString *)string {
     NSMutableData *commandData= [[NSMutableData alloc] init];
     unsigned char byteRepresentation;
@@ -475,109 +919,1057 @@
     isObserveCancelled = YES;
 }
 
-#pragma mark - Send Methods
-
-- (void)sendCircumstantialResponseWithMessageID:(uint)messageID type:(ICoAPType)type toAddress:(NSData *)address {
-    ICoAPMessage *ackObject = [[ICoAPMessage alloc] init];
-    ackObject.isRequest = NO;
-    ackObject.type = type;
-    ackObject.messageID = messageID;
-    
-    NSData *send = [self encodeDataFromCoAPMessage:ackObject];
-    [self.udpSocket sendData:send toAddress:address withTimeout:-1 tag:udpSocketTag];
-    udpSocketTag++;
-}
+#pragma mark - Block2 Pipelining
 
-- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port {
-    randomMessageId++;
-    randomToken++;
+- (void)startBlock2PipelineWithCoAPMessage:(ICoAPMessage *)cO blockNumber:(uint)blockNumber szx:(uint)szx {
+    //The block size is chosen once for the whole pipeline, requests in flight can not be renumbered
+    NSUInteger nextOffset = (NSUInteger)(blockNumber + 1) * (16 << szx);
+    szx = [self adaptedBlock2SzxForOffset:nextOffset szx:szx];
     
-    cO.messageID = randomMessageId % 65536;
+    isBlock2PipelineActive = YES;
+    block2Szx = szx;
+    nextBlock2NumberToRequest = (uint)(nextOffset / (16 << szx));
+    nextBlock2NumberToDeliver = nextBlock2NumberToRequest;
+    lastBlock2Number = UINT_MAX;
     
-    if ([cO isTokenRequested]) {
-        cO.token = randomToken % INT_MAX;
+    //Size2 reveals the number of blocks, otherwise the end is found by the first block without More Flag
+    NSArray *size2Values = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]];
+    uint blockSize = 16 << szx;
+    if (size2Values && [[size2Values objectAtIndex:0] intValue] > 0) {
+        lastBlock2Number = ([[size2Values objectAtIndex:0] intValue] + blockSize - 1) / blockSize - 1;
+    }
+    if (block2RangeEndOffset != NSUIntegerMax) {
+        lastBlock2Number = MIN(lastBlock2Number, (block2RangeEndOffset - 1) / blockSize);
     }
     
-    cO.isRequest = YES;
-    cO.host = host;
-    cO.port = port;
-    pendingCoAPMessageInTransmission = cO;
-    pendingCoAPMessageInTransmission.timestamp = [[NSDate alloc] init];
+    [self fillBlock2Pipeline];
+}
 
-    if (cO.usesHttpProxying) {
-        [self sendHttpMessageFromCoAPMessage:pendingCoAPMessageInTransmission];
+- (void)fillBlock2Pipeline {
+    uint window = self.block2WindowSize;
+    if (self.peerScheduler) {
+        window = MIN(window, [self.peerScheduler windowForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port]);
     }
-    else {
-        if (!self.udpSocket && ![self setupUdpSocket]) {
-            NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
-            
-            [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
-            return;
-        }
+    
+    //Blocks requested too far ahead of the delivery would have to be buffered for a long time
+    uint maxBlockNumber = MIN(lastBlock2Number, nextBlock2NumberToDeliver + window * kBlock2ReorderWindowFactor);
+    
+    while ([pendingBlock2Requests count] < window && nextBlock2NumberToRequest <= maxBlockNumber && [self acquireBlockTransmissionGrantWithPendingRequests:pendingBlock2Requests]) {
+        ICoAPBlockRequest *request = [[ICoAPBlockRequest alloc] init];
+        request.isHoldingTransmissionGrant = self.peerScheduler != nil;
+        request.blockNumber = nextBlock2NumberToRequest++;
+        request.message = [self block2RequestWithBlockNumber:request.blockNumber szx:block2Szx];
+        request.message.timestamp = [[NSDate alloc] init];
         
-        [self startSending];
+        [pendingBlock2Requests setObject:request forKey:[NSNumber numberWithUnsignedInt:request.message.messageID]];
+        [self sendBlockRequest:request];
     }
 }
 
-- (void)startSending {
-    [self resetState];
+- (void)sendBlockRequest:(ICoAPBlockRequest *)request {
+    NSData *send = [self encodeDataFromCoAPMessage:request.message];
+    [self.udpSocket sendData:send toHost:request.message.host port:request.message.port withTimeout:-1 tag:udpSocketTag];
+    udpSocketTag++;
     
-    if (pendingCoAPMessageInTransmission.type == IC_CONFIRMABLE) {
-        retransmissionCounter = 0;
-        maxWaitTimer = [NSTimer scheduledTimerWithTimeInterval:kMAX_TRANSMIT_WAIT target:self selector:@selector(noResponseExpected) userInfo:nil repeats:NO];
-        
-        [self performTransmissionCycle];
-    }
-    else {
-        [self sendCoAPMessage];
-    }
+    double timeout = kACK_TIMEOUT * pow(2.0, request.retransmissionCounter) * (kACK_RANDOM_FACTOR - fmodf((float)random()/RAND_MAX, 0.5));
+    request.retransmissionTimer = [NSTimer scheduledTimerWithTimeInterval:timeout target:self selector:@selector(onBlockRetransmissionTimer:) userInfo:request repeats:NO];
 }
 
-- (void)performTransmissionCycle {
-    [self sendCoAPMessage];
-    if (retransmissionCounter != 0) {
-        [self sendDidRetransmitMessageToDelegateWithCoAPMessage:pendingCoAPMessageInTransmission];
+- (BOOL)acquireBlockTransmissionGrantWithPendingRequests:(NSDictionary *)pendingRequests {
+    if (!self.peerScheduler) {
+        return YES;
     }
     
-    if (retransmissionCounter != kMAX_RETRANSMIT) {
-        double timeout = kACK_TIMEOUT * pow(2.0, retransmissionCounter) * (kACK_RANDOM_FACTOR - fmodf((float)random()/RAND_MAX, 0.5));
-        sendTimer = [NSTimer scheduledTimerWithTimeInterval:timeout target:self selector:@selector(performTransmissionCycle) userInfo:nil repeats:NO];
-        retransmissionCounter++;
+    if (isHoldingBlockTransmissionGrant) {
+        isHoldingBlockTransmissionGrant = NO;
+        return YES;
+    }
+    
+    if ([self.peerScheduler acquireTransmissionForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port]) {
+        return YES;
+    }
+    
+    //Without a block in flight no response would resume the transfer, so the exchange queues for the next slot
+    if ([pendingRequests count] == 0 && !isWaitingForBlockTransmissionGrant) {
+        isWaitingForBlockTransmissionGrant = YES;
+        [self.peerScheduler enqueueTransmissionForClient:self priority:self.priority size:8 + (16 << kMaxBlockSzx) host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
     }
+    return NO;
 }
 
-- (void)sendCoAPMessage {
-    NSData *send = [self encodeDataFromCoAPMessage:pendingCoAPMessageInTransmission];
-    [self.udpSocket sendData:send toHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port withTimeout:-1 tag:udpSocketTag];
-    udpSocketTag++;
+- (void)releaseTransmissionGrantOfBlockRequest:(ICoAPBlockRequest *)request outcome:(ICoAPTransmissionOutcome)outcome {
+    if (request.isHoldingTransmissionGrant) {
+        request.isHoldingTransmissionGrant = NO;
+        [self.peerScheduler releaseTransmissionForHost:request.message.host port:request.message.port outcome:outcome];
+    }
 }
 
-- (void)closeExchange {
-    if (pendingCoAPMessageInTransmission.usesHttpProxying) {
-        [urlConnection cancel];
-        urlConnection = nil;
-        urlData = nil;
-        urlRequest = nil;
-    }
-    else {
-        self.udpSocket.delegate = nil;
-        [self.udpSocket close];
-        self.udpSocket = nil;
-        [sendTimer invalidate];
-        [maxWaitTimer invalidate];
+- (void)stopWaitingForBlockTransmissionGrant {
+    if (isWaitingForBlockTransmissionGrant) {
+        isWaitingForBlockTransmissionGrant = NO;
+        [self.peerScheduler cancelQueuedTransmissionForClient:self host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
     }
-    
-    recentNotificationDate = nil;
-    pendingCoAPMessageInTransmission = nil;
-    _isMessageInTransmission = NO;
 }
 
-- (void)resetState {
-    [sendTimer invalidate];
-    [maxWaitTimer invalidate];
+- (void)onBlockRetransmissionTimer:(NSTimer *)timer {
+    ICoAPBlockRequest *request = [timer userInfo];
+    
+    if (request.retransmissionCounter == kMAX_RETRANSMIT) {
+        [self.peerScheduler recordBlockTransferOutcome:IC_TRANSMISSION_TIMED_OUT forHost:request.message.host port:request.message.port];
+        [self releaseTransmissionGrantOfBlockRequest:request outcome:IC_TRANSMISSION_TIMED_OUT];
+        [self noResponseExpected];
+        return;
+    }
+    
+    request.retransmissionCounter++;
+    [self sendBlockRequest:request];
+    
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didRetransmitCoAPMessage:number:finalRetransmission:)]) {
+        [self.delegate iCoAPExchange:self didRetransmitCoAPMessage:request.message number:request.retransmissionCounter finalRetransmission:request.retransmissionCounter == kMAX_RETRANSMIT];
+    }
+}
+
+- (void)handlePipelinedBlock2Message:(ICoAPMessage *)cO {
+    NSArray *blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    uint blockValue = [[blockValues objectAtIndex:0] intValue];
+    
+    //Separate responses carry a new Message ID, so they are assigned by their block number
+    ICoAPBlockRequest *request = [pendingBlock2Requests objectForKey:[NSNumber numberWithUnsignedInt:cO.messageID]];
+    if (!request && blockValues && (blockValue & 7) == block2Szx) {
+        for (ICoAPBlockRequest *candidate in [pendingBlock2Requests allValues]) {
+            if (candidate.blockNumber == blockValue >> 4) {
+                request = candidate;
+                break;
+            }
+        }
+    }
+    
+    if (!request) {
+        //Duplicate, or response to a cancelled request beyond the last block
+        return;
+    }
+    
+    [request.retransmissionTimer invalidate];
+    request.retransmissionTimer = nil;
+    
+    if (cO.type == IC_ACKNOWLEDGMENT && cO.code == IC_EMPTY) {
+        //Separate response follows
+        return;
+    }
+    [pendingBlock2Requests removeObjectForKey:[NSNumber numberWithUnsignedInt:request.message.messageID]];
+    [self.peerScheduler recordBlockTransferOutcome:request.retransmissionCounter == 0 ? IC_TRANSMISSION_CLEAN : IC_TRANSMISSION_RETRANSMITTED forHost:request.message.host port:request.message.port];
+    [self releaseTransmissionGrantOfBlockRequest:request outcome:request.retransmissionCounter == 0 ? IC_TRANSMISSION_CLEAN : IC_TRANSMISSION_RETRANSMITTED];
+    
+    if (cO.code == IC_CONTENT && blockValues && !(blockValue & 8)) {
+        lastBlock2Number = MIN(lastBlock2Number, request.blockNumber);
+        [self cancelBlock2RequestsAfterBlockNumber:lastBlock2Number];
+    }
+    
+    if (request.blockNumber > lastBlock2Number) {
+        return;
+    }
+    
+    //Streamed blocks are written on arrival, only their payload-free messages wait for in order delivery.
+    //Waiting exchanges need the payload, the block is written on delivery then.
+    if ([self usesBlock2Sink] && ![self.requestCoalescer hasWaitingClientsForClient:self] && cO.code == IC_CONTENT && blockValues && ![self writeBlock2PayloadOfCoAPMessageToSink:cO]) {
+        return;
+    }
+    [receivedBlock2Messages setObject:cO forKey:[NSNumber numberWithUnsignedInt:request.blockNumber]];
+    
+    //Deliver all blocks which are complete in order
+    ICoAPMessage *nextMessage;
+    while ((nextMessage = [receivedBlock2Messages objectForKey:[NSNumber numberWithUnsignedInt:nextBlock2NumberToDeliver]])) {
+        [receivedBlock2Messages removeObjectForKey:[NSNumber numberWithUnsignedInt:nextBlock2NumberToDeliver]];
+        
+        //An error response ends the transfer just like the last block does
+        BOOL isFinal = nextBlock2NumberToDeliver == lastBlock2Number || nextMessage.code != IC_CONTENT;
+        nextBlock2NumberToDeliver++;
+        
+        if (isFinal) {
+            [self stopBlock2Pipeline];
+            _isMessageInTransmission = NO;
+        }
+        
+        [self sendDidReceiveMessageToDelegateWithCoAPMessage:nextMessage];
+        
+        //The delegate might have closed the exchange
+        if (!isBlock2PipelineActive) {
+            return;
+        }
+    }
+    
+    [self fillBlock2Pipeline];
+}
+
+- (void)cancelBlock2RequestsAfterBlockNumber:(uint)blockNumber {
+    for (NSNumber *key in [pendingBlock2Requests allKeys]) {
+        ICoAPBlockRequest *request = [pendingBlock2Requests objectForKey:key];
+        if (request.blockNumber > blockNumber) {
+            [request.retransmissionTimer invalidate];
+            [self releaseTransmissionGrantOfBlockRequest:request outcome:IC_TRANSMISSION_CANCELLED];
+            [pendingBlock2Requests removeObjectForKey:key];
+        }
+    }
+}
+
+- (void)stopBlock2Pipeline {
+    [self stopWaitingForBlockTransmissionGrant];
+    [self cancelBlockRequests:pendingBlock2Requests];
+    [receivedBlock2Messages removeAllObjects];
+    isBlock2PipelineActive = NO;
+}
+
+#pragma mark - Request Coalescing
+
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didReceiveCoAPMessage:(ICoAPMessage *)coapMessage isFinal:(BOOL)isFinal {
+    //Every waiting exchange handles its own copy, carrying the token of its own request
+    ICoAPMessage *cO = [coapMessage copy];
+    cO.token = pendingCoAPMessageInTransmission.token;
+    
+    if (isFinal) {
+        _isMessageInTransmission = NO;
+    }
+    [self sendDidReceiveMessageToDelegateWithCoAPMessage:cO];
+}
+
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didFailWithError:(NSError *)error {
+    _isMessageInTransmission = NO;
+    [self sendFailWithErrorToDelegateWithError:error];
+}
+
+- (void)requestCoalescerDidAbandonRequest:(ICoAPRequestCoalescer *)coalescer {
+    //The leading exchange was closed: send the request again. A started Block2 transfer is continued,
+    //unless the body is reassembled, which needs all blocks in the buffer.
+    ICoAPMessage *cO = pendingCoAPMessageInTransmission;
+    _isMessageInTransmission = NO;
+    
+    if (self.block2Checkpoint && ([self usesBlock2Sink] || !self.reassemblesBlock2Payload)) {
+        [self resumeRequestWithCoAPMessage:cO fromBlock2Checkpoint:self.block2Checkpoint toHost:cO.host port:cO.port];
+    }
+    else {
+        [self sendRequestWithCoAPMessage:cO toHost:cO.host port:cO.port];
+    }
+}
+
+#pragma mark - Block1 Transfer
+
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block1Source:(ICoAPBlock1Source *)source toHost:(NSString *)host port:(uint)port {
+    [self addCoAPProxyOptionsToCoAPMessage:cO host:host port:port];
+    [self prepareRequestWithCoAPMessage:cO toHost:host port:port];
+    
+    if (cO.usesHttpProxying) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Block-wise requests can not be proxied." forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_PROXYING_ERROR userInfo:userInfo]];
+        return;
+    }
+    
+    if (!self.udpSocket && ![self setupUdpSocket]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+        return;
+    }
+    
+    [self resetState];
+    block1Source = source;
+    isBlock1TransferActive = YES;
+    isBlock1SizeNegotiated = NO;
+    isBlock1FinalBlockSent = NO;
+    block1SzxInUse = MIN(self.block1Szx, 6);
+    block1NextOffset = 0;
+    
+    if (self.usesQBlock1) {
+        isBlock1TransferActive = NO;
+        isQBlock1TransferActive = YES;
+        qBlock1NextNumber = 0;
+        qBlock1LastNumber = UINT_MAX;
+        qBlock1RetryCounter = 0;
+        [self sendQBlock1Set];
+        return;
+    }
+    
+    [self fillBlock1Window];
+}
+
+- (ICoAPMessage *)block1RequestWithBlockNumber:(uint)blockNumber szx:(uint)szx more:(BOOL)more payloadData:(NSData *)payloadData {
+    ICoAPMessage *blockObject = [[ICoAPMessage alloc] init];
+    blockObject.isRequest = YES;
+    blockObject.type = IC_CONFIRMABLE;
+    blockObject.code = pendingCoAPMessageInTransmission.code;
+    randomMessageId++;
+    blockObject.messageID = randomMessageId % 65536;
+    blockObject.token = pendingCoAPMessageInTransmission.token;
+    blockObject.host = pendingCoAPMessageInTransmission.host;
+    blockObject.port = pendingCoAPMessageInTransmission.port;
+    blockObject.optionDict =  [[NSMutableDictionary alloc] init];
+    for (id key in pendingCoAPMessageInTransmission.optionDict) {
+        [blockObject.optionDict setValue:[[NSMutableArray alloc] initWithArray:[pendingCoAPMessageInTransmission.optionDict valueForKey:key]] forKey:key];
+    }
+    
+    [blockObject addOption:IC_BLOCK1 withValue:[NSString stringWithFormat:@"%i", blockNumber * 16 + (more ? 8 : 0) + szx]];
+    
+    //Announce the total size with the first block, if known
+    if (blockNumber == 0 && [block1Source length] > 0) {
+        [blockObject addOption:IC_SIZE1 withValue:[NSString stringWithFormat:@"%lu", (unsigned long)[block1Source length]]];
+    }
+    
+    blockObject.payloadData = payloadData;
+    blockObject.timestamp = [[NSDate alloc] init];
+    return blockObject;
+}
+
+- (void)fillBlock1Window {
+    //The first block is sent alone, as the server may still choose a smaller block size
+    uint window = isBlock1SizeNegotiated ? self.block1WindowSize : 1;
+    if (self.peerScheduler) {
+        window = MIN(window, [self.peerScheduler windowForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port]);
+    }
+    
+    while (!isBlock1FinalBlockSent && [pendingBlock1Requests count] < MAX(window, 1)) {
+        NSUInteger blockSize = 16 << block1SzxInUse;
+        NSData *blockData = [block1Source dataAtOffset:block1NextOffset length:blockSize];
+        if (!blockData) {
+            [self failBlock1TransferWithDescription:@"Failed to read the payload of the block-wise request."];
+            return;
+        }
+        
+        //The final block must not overtake earlier blocks, the server answers it with the final response
+        BOOL more = [block1Source hasDataAfterOffset:block1NextOffset + [blockData length]];
+        if (!more && [pendingBlock1Requests count] > 0) {
+            return;
+        }
+        
+        if (![self acquireBlockTransmissionGrantWithPendingRequests:pendingBlock1Requests]) {
+            return;
+        }
+        
+        ICoAPBlockRequest *request = [[ICoAPBlockRequest alloc] init];
+        request.isHoldingTransmissionGrant = self.peerScheduler != nil;
+        request.offset = block1NextOffset;
+        request.blockNumber = (uint)(block1NextOffset / blockSize);
+        request.message = [self block1RequestWithBlockNumber:request.blockNumber szx:block1SzxInUse more:more payloadData:blockData];
+        
+        block1NextOffset += [blockData length];
+        isBlock1FinalBlockSent = !more;
+        
+        [pendingBlock1Requests setObject:request forKey:[NSNumber numberWithUnsignedInt:request.message.messageID]];
+        [self sendBlockRequest:request];
+    }
+}
+
+- (BOOL)handleBlock1CoAPMessage:(ICoAPMessage *)cO {
+    NSArray *blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK1]];
+    uint blockValue = [[blockValues objectAtIndex:0] intValue];
+    
+    //Separate responses carry a new Message ID, so they are assigned by their block number
+    ICoAPBlockRequest *request = [pendingBlock1Requests objectForKey:[NSNumber numberWithUnsignedInt:cO.messageID]];
+    if (!request && blockValues) {
+        for (ICoAPBlockRequest *candidate in [pendingBlock1Requests allValues]) {
+            if (candidate.blockNumber == blockValue >> 4) {
+                request = candidate;
+                break;
+            }
+        }
+    }
+    
+    if (!request) {
+        return YES;
+    }
+    
+    [request.retransmissionTimer invalidate];
+    request.retransmissionTimer = nil;
+    
+    if (cO.type == IC_ACKNOWLEDGMENT && cO.code == IC_EMPTY) {
+        //Separate response follows
+        return YES;
+    }
+    [pendingBlock1Requests removeObjectForKey:[NSNumber numberWithUnsignedInt:request.message.messageID]];
+    [self releaseTransmissionGrantOfBlockRequest:request outcome:request.retransmissionCounter == 0 ? IC_TRANSMISSION_CLEAN : IC_TRANSMISSION_RETRANSMITTED];
+    
+    uint responseSzx = blockValues ? blockValue & 7 : block1SzxInUse;
+    BOOL isFinalBlock = !([[[request.message.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK1]] objectAtIndex:0] intValue] & 8);
+    
+    if (cO.code == IC_REQUEST_ENTITY_TOO_LARGE && responseSzx < block1SzxInUse && request.offset == 0) {
+        //Restart the transfer with the block size preferred by the server
+        [self cancelBlockRequests:pendingBlock1Requests];
+        block1SzxInUse = responseSzx;
+        block1NextOffset = 0;
+        isBlock1FinalBlockSent = NO;
+        [self fillBlock1Window];
+        return YES;
+    }
+    
+    if (!isFinalBlock && cO.code < IC_BAD_REQUEST) {
+        //Block accepted (2.31 Continue, or a success code for non-atomic requests)
+        isBlock1SizeNegotiated = YES;
+        
+        if (responseSzx < block1SzxInUse) {
+            //Continue right after the acknowledged block with the smaller block size
+            [self cancelBlockRequests:pendingBlock1Requests];
+            block1SzxInUse = responseSzx;
+            block1NextOffset = request.offset + [request.message.payloadData length];
+            isBlock1FinalBlockSent = NO;
+        }
+        
+        NSUInteger acknowledgedOffset = block1NextOffset;
+        for (ICoAPBlockRequest *pendingRequest in [pendingBlock1Requests allValues]) {
+            acknowledgedOffset = MIN(acknowledgedOffset, pendingRequest.offset);
+        }
+        [block1Source discardDataBeforeOffset:acknowledgedOffset];
+        
+        if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didSendBlock1Bytes:totalBytes:)]) {
+            [self.delegate iCoAPExchange:self didSendBlock1Bytes:acknowledgedOffset totalBytes:[block1Source length]];
+        }
+        
+        if (isBlock1TransferActive) {
+            [self fillBlock1Window];
+        }
+        return YES;
+    }
+    
+    //Final response or error: the transfer ends and the response is handled as usual (e.g. Block2)
+    [self stopBlock1Transfer];
+    pendingCoAPMessageInTransmission = request.message;
+    return NO;
+}
+
+- (void)cancelBlockRequests:(NSMutableDictionary *)requests {
+    for (ICoAPBlockRequest *request in [requests allValues]) {
+        [request.retransmissionTimer invalidate];
+        [self releaseTransmissionGrantOfBlockRequest:request outcome:IC_TRANSMISSION_CANCELLED];
+    }
+    [requests removeAllObjects];
+}
+
+- (void)failBlock1TransferWithDescription:(NSString *)description {
+    [self closeExchange];
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:description forKey:NSLocalizedDescriptionKey];
+    [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_BLOCK_TRANSFER_ERROR userInfo:userInfo]];
+}
+
+- (void)stopBlock1Transfer {
+    [self stopWaitingForBlockTransmissionGrant];
+    [self cancelBlockRequests:pendingBlock1Requests];
+    [block1Source close];
+    block1Source = nil;
+    isBlock1TransferActive = NO;
+}
+
+#pragma mark - Q-Block Transfer
+
+- (void)sendQBlockCoAPMessage:(ICoAPMessage *)cO {
+    NSData *send = [self encodeDataFromCoAPMessage:cO];
+    [self.udpSocket sendData:send toHost:cO.host port:cO.port withTimeout:-1 tag:udpSocketTag];
+    udpSocketTag++;
+}
+
+- (ICoAPMessage *)qBlock2RequestWithBlockValues:(NSArray *)blockValues {
+    ICoAPMessage *blockObject = [self block2RequestWithBlockNumber:0 szx:qBlock2Szx];
+    blockObject.type = IC_NON_CONFIRMABLE;
+    [blockObject.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    
+    for (NSNumber *blockValue in blockValues) {
+        [blockObject addOption:IC_Q_BLOCK2 withValue:[NSString stringWithFormat:@"%u", [blockValue unsignedIntValue]]];
+    }
+    blockObject.timestamp = [[NSDate alloc] init];
+    return blockObject;
+}
+
+- (void)handleQBlock2CoAPMessage:(ICoAPMessage *)cO {
+    NSArray *blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]];
+    
+    if (!blockValues || cO.code >= IC_BAD_REQUEST) {
+        //Error response: the transfer ends and the response is delivered as usual
+        [self stopQBlock2Transfer];
+        _isMessageInTransmission = NO;
+        [self sendDidReceiveMessageToDelegateWithCoAPMessage:cO];
+        return;
+    }
+    
+    uint blockValue = [[blockValues objectAtIndex:0] intValue];
+    uint blockNumber = blockValue >> 4;
+    NSArray *etagValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    
+    if (!isQBlock2TransferActive) {
+        isQBlock2TransferActive = YES;
+        qBlock2Szx = blockValue & 7;
+        qBlock2LastNumber = UINT_MAX;
+        qBlock2ReceivedCount = 0;
+        qBlock2HighestNumber = 0;
+        qBlock2RetryCounter = 0;
+        qBlock2ReceivedBitmap = [[NSMutableData alloc] init];
+        qBlock2ETag = etagValues ? [etagValues objectAtIndex:0] : nil;
+        block2Buffer = nil;
+        isBlock2StreamActive = NO;
+    }
+    
+    //All blocks of a body share the ETag and the block size
+    if (etagValues && qBlock2ETag && ![[etagValues objectAtIndex:0] isEqualToString:qBlock2ETag]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Resource changed during Q-Block2 transfer (ETag mismatch)" forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_BLOCK_TRANSFER_ERROR userInfo:userInfo]];
+        [self closeExchange];
+        return;
+    }
+    if ((blockValue & 7) != qBlock2Szx) {
+        return;
+    }
+    
+    if (!(blockValue & 8)) {
+        qBlock2LastNumber = blockNumber;
+    }
+    else if (qBlock2LastNumber == UINT_MAX && [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]]) {
+        NSUInteger size2 = [[[cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]] objectAtIndex:0] intValue];
+        NSUInteger blockSize = 16 << qBlock2Szx;
+        if (size2 > 0) {
+            qBlock2LastNumber = (uint)((size2 + blockSize - 1) / blockSize - 1);
+        }
+    }
+    
+    if (ICoAPBitmapContainsIndex(qBlock2ReceivedBitmap, blockNumber)) {
+        //Duplicate
+        return;
+    }
+    ICoAPBitmapAddIndex(qBlock2ReceivedBitmap, blockNumber);
+    qBlock2ReceivedCount++;
+    qBlock2HighestNumber = MAX(qBlock2HighestNumber, blockNumber);
+    qBlock2RetryCounter = 0;
+    
+    if ([self usesBlock2Sink]) {
+        if (![self writeBlock2PayloadOfCoAPMessageToSink:cO]) {
+            return;
+        }
+    }
+    else {
+        [self writeBlock2PayloadOfCoAPMessageToBuffer:cO];
+    }
+    
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveBlock2Bytes:expectedBytes:)]) {
+        [self.delegate iCoAPExchange:self didReceiveBlock2Bytes:block2ReceivedLength expectedBytes:block2ExpectedLength];
+    }
+    if (!isQBlock2TransferActive) {
+        //The delegate closed the exchange
+        return;
+    }
+    
+    if (qBlock2LastNumber != UINT_MAX && qBlock2ReceivedCount == qBlock2LastNumber + 1) {
+        [self finishQBlock2TransferWithCoAPMessage:cO];
+        return;
+    }
+    
+    //A complete set of MAX_PAYLOADS blocks lets the server continue without waiting
+    uint maxPayloads = MAX(self.qBlockMaxPayloads, 1);
+    if ((blockNumber + 1) % maxPayloads == 0 && blockNumber < qBlock2LastNumber) {
+        BOOL isSetComplete = YES;
+        for (uint i = blockNumber + 1 - maxPayloads; i < blockNumber && isSetComplete; i++) {
+            isSetComplete = ICoAPBitmapContainsIndex(qBlock2ReceivedBitmap, i);
+        }
+        if (isSetComplete) {
+            [self sendQBlockCoAPMessage:[self qBlock2RequestWithBlockValues:[NSArray arrayWithObject:[NSNumber numberWithUnsignedInt:(blockNumber + 1) * 16 + 8 + qBlock2Szx]]]];
+        }
+    }
+    
+    [qBlock2Timer invalidate];
+    qBlock2Timer = [NSTimer scheduledTimerWithTimeInterval:kNON_RECEIVE_TIMEOUT target:self selector:@selector(onQBlock2Timer) userInfo:nil repeats:NO];
+}
+
+- (void)onQBlock2Timer {
+    if (++qBlock2RetryCounter > kNON_MAX_RETRANSMIT) {
+        [self noResponseExpected];
+        return;
+    }
+    
+    //Request up to MAX_PAYLOADS missing blocks, and the remaining ones if the end is not known yet
+    uint maxPayloads = MAX(self.qBlockMaxPayloads, 1);
+    uint lastKnownNumber = qBlock2LastNumber != UINT_MAX ? qBlock2LastNumber : qBlock2HighestNumber;
+    NSMutableArray *requestedValues = [[NSMutableArray alloc] init];
+    
+    for (uint i = 0; i <= lastKnownNumber && [requestedValues count] < maxPayloads; i++) {
+        if (!ICoAPBitmapContainsIndex(qBlock2ReceivedBitmap, i)) {
+            [requestedValues addObject:[NSNumber numberWithUnsignedInt:i * 16 + qBlock2Szx]];
+        }
+    }
+    if (qBlock2LastNumber == UINT_MAX && [requestedValues count] < maxPayloads) {
+        [requestedValues addObject:[NSNumber numberWithUnsignedInt:(qBlock2HighestNumber + 1) * 16 + 8 + qBlock2Szx]];
+    }
+    
+    [self sendQBlockCoAPMessage:[self qBlock2RequestWithBlockValues:requestedValues]];
+    qBlock2Timer = [NSTimer scheduledTimerWithTimeInterval:kNON_RECEIVE_TIMEOUT target:self selector:@selector(onQBlock2Timer) userInfo:nil repeats:NO];
+}
+
+- (void)finishQBlock2TransferWithCoAPMessage:(ICoAPMessage *)cO {
+    [self stopQBlock2Transfer];
+    _isMessageInTransmission = NO;
+    
+    if ([self usesBlock2Sink]) {
+        isBlock2StreamActive = NO;
+        if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didCompleteBlock2TransferWithLength:coapMessage:)]) {
+            [self.delegate iCoAPExchange:self didCompleteBlock2TransferWithLength:block2TotalLength coapMessage:cO];
+        }
+        return;
+    }
+    
+    NSMutableData *payload = block2Buffer;
+    block2Buffer = nil;
+    [payload setLength:block2TotalLength];
+    
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveBlock2Payload:coapMessage:)]) {
+        [self.delegate iCoAPExchange:self didReceiveBlock2Payload:payload coapMessage:cO];
+        return;
+    }
+    
+    //Without the reassembly delegate method, the body is delivered as one message
+    cO.payloadData = payload;
+    cO.payload = [self requiresPayloadStringDecodeForCoAPMessage:cO] ? [NSString stringFromHexString:[NSString stringFromDataWithHex:payload]] : [NSString stringFromDataWithHex:payload];
+    if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didReceiveCoAPMessage:)]) {
+        [self.delegate iCoAPExchange:self didReceiveCoAPMessage:cO];
+    }
+}
+
+- (void)stopQBlock2Transfer {
+    [qBlock2Timer invalidate];
+    qBlock2Timer = nil;
+    qBlock2ReceivedBitmap = nil;
+    qBlock2ETag = nil;
+    isQBlock2TransferActive = NO;
+}
+
+- (BOOL)sendQBlock1BlockNumber:(uint)blockNumber {
+    NSUInteger blockSize = 16 << block1SzxInUse;
+    NSData *blockData = [block1Source dataAtOffset:(NSUInteger)blockNumber * blockSize length:blockSize];
+    if (!blockData) {
+        [self failBlock1TransferWithDescription:@"Failed to read the payload of the block-wise request."];
+        return NO;
+    }
+    
+    BOOL more = [block1Source hasDataAfterOffset:(NSUInteger)blockNumber * blockSize + [blockData length]];
+    if (!more) {
+        qBlock1LastNumber = blockNumber;
+    }
+    
+    ICoAPMessage *blockObject = [self block1RequestWithBlockNumber:blockNumber szx:block1SzxInUse more:more payloadData:blockData];
+    blockObject.type = IC_NON_CONFIRMABLE;
+    [blockObject.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_BLOCK1]];
+    [blockObject addOption:IC_Q_BLOCK1 withValue:[NSString stringWithFormat:@"%i", blockNumber * 16 + (more ? 8 : 0) + block1SzxInUse]];
+    
+    //The final response refers to the last block
+    if (!more) {
+        pendingCoAPMessageInTransmission = blockObject;
+    }
+    [self sendQBlockCoAPMessage:blockObject];
+    return YES;
+}
+
+- (void)sendQBlock1Set {
+    uint sentBlocks = 0;
+    
+    while (sentBlocks < MAX(self.qBlockMaxPayloads, 1) && qBlock1NextNumber <= qBlock1LastNumber) {
+        if (![self sendQBlock1BlockNumber:qBlock1NextNumber]) {
+            return;
+        }
+        qBlock1NextNumber++;
+        sentBlocks++;
+    }
+    
+    //Wait for 2.31 Continue or 4.08 Request Entity Incomplete before the next set
+    double timeout = kNON_TIMEOUT * (kACK_RANDOM_FACTOR - fmodf((float)random()/RAND_MAX, 0.5));
+    [qBlock1Timer invalidate];
+    qBlock1Timer = [NSTimer scheduledTimerWithTimeInterval:timeout target:self selector:@selector(onQBlock1Timer) userInfo:nil repeats:NO];
+}
+
+- (void)onQBlock1Timer {
+    if (qBlock1NextNumber <= qBlock1LastNumber) {
+        [self sendQBlock1Set];
+        return;
+    }
+    
+    //All blocks were sent, but no final response arrived: repeat the last block
+    if (++qBlock1RetryCounter > kNON_MAX_RETRANSMIT) {
+        [self noResponseExpected];
+        return;
+    }
+    
+    if ([self sendQBlock1BlockNumber:qBlock1LastNumber]) {
+        qBlock1Timer = [NSTimer scheduledTimerWithTimeInterval:kNON_TIMEOUT * pow(2.0, qBlock1RetryCounter) target:self selector:@selector(onQBlock1Timer) userInfo:nil repeats:NO];
+    }
+}
+
+- (BOOL)handleQBlock1CoAPMessage:(ICoAPMessage *)cO {
+    NSArray *blockValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK1]];
+    
+    if (cO.type == IC_ACKNOWLEDGMENT && cO.code == IC_EMPTY) {
+        return YES;
+    }
+    
+    if (cO.code == IC_BAD_OPTION && qBlock1NextNumber > 0 && block1Source) {
+        //Q-Block1 is not supported by the server, fall back to Block1
+        [qBlock1Timer invalidate];
+        qBlock1Timer = nil;
+        isQBlock1TransferActive = NO;
+        isBlock1TransferActive = YES;
+        isBlock1SizeNegotiated = NO;
+        isBlock1FinalBlockSent = NO;
+        block1NextOffset = 0;
+        [self fillBlock1Window];
+        return YES;
+    }
+    
+    if (cO.code == IC_CONTINUE && blockValues) {
+        //The server received all blocks of the set up to the indicated block
+        uint acknowledgedNumber = [[blockValues objectAtIndex:0] intValue] >> 4;
+        NSUInteger acknowledgedOffset = MIN((NSUInteger)(acknowledgedNumber + 1) * (16 << block1SzxInUse), (NSUInteger)qBlock1NextNumber * (16 << block1SzxInUse));
+        [block1Source discardDataBeforeOffset:acknowledgedOffset];
+        qBlock1RetryCounter = 0;
+        
+        if ([self.delegate respondsToSelector:@selector(iCoAPExchange:didSendBlock1Bytes:totalBytes:)]) {
+            [self.delegate iCoAPExchange:self didSendBlock1Bytes:acknowledgedOffset totalBytes:[block1Source length]];
+        }
+        if (isQBlock1TransferActive && qBlock1NextNumber <= qBlock1LastNumber) {
+            [self sendQBlock1Set];
+        }
+        return YES;
+    }
+    
+    if (cO.code == IC_REQUEST_ENTITY_INCOMPLETE) {
+        //Payload: CBOR sequence of the missing block numbers
+        if (++qBlock1RetryCounter > kNON_MAX_RETRANSMIT) {
+            [self noResponseExpected];
+            return YES;
+        }
+        
+        uint missingNumbers[kQBlockMaxPayloads];
+        NSUInteger missingCount = ICoAPDecodeMissingBlockNumbers([cO.payloadData bytes], [cO.payloadData length], missingNumbers, kQBlockMaxPayloads);
+        for (NSUInteger i = 0; i < missingCount; i++) {
+            if (missingNumbers[i] < qBlock1NextNumber && ![self sendQBlock1BlockNumber:missingNumbers[i]]) {
+                return YES;
+            }
+        }
+        
+        [qBlock1Timer invalidate];
+        qBlock1Timer = [NSTimer scheduledTimerWithTimeInterval:kNON_TIMEOUT target:self selector:@selector(onQBlock1Timer) userInfo:nil repeats:NO];
+        return YES;
+    }
+    
+    //Final response or error: the transfer ends and the response is handled as usual (e.g. Q-Block2)
+    [self stopQBlock1Transfer];
+    return NO;
+}
+
+- (void)stopQBlock1Transfer {
+    [qBlock1Timer invalidate];
+    qBlock1Timer = nil;
+    if (isQBlock1TransferActive) {
+        [block1Source close];
+        block1Source = nil;
+        isQBlock1TransferActive = NO;
+    }
+}
+
+#pragma mark - Send Methods
+
+- (void)sendCircumstantialResponseWithMessageID:(uint)messageID type:(ICoAPType)type toAddress:(NSData *)address {
+    if (pendingEmptyMessageCount == kMaxCoalescedEmptyMessages) {
+        [self flushEmptyMessages];
+    }
+    
+    ICoAPEmptyMessage *message = &pendingEmptyMessages[pendingEmptyMessageCount];
+    ICoAPWriteEmptyMessage(message->bytes, type, messageID);
+    message->addressLength = (socklen_t)MIN([address length], sizeof(struct sockaddr_storage));
+    [address getBytes:&message->address length:message->addressLength];
+    
+    //All empty messages which are due in this run loop cycle are sent together
+    if (pendingEmptyMessageCount++ == 0) {
+        [self performSelector:@selector(flushEmptyMessages) withObject:nil afterDelay:0];
+    }
+}
+
+- (void)flushEmptyMessages {
+    if (pendingEmptyMessageCount == 0) {
+        return;
+    }
+    
+    GCDAsyncUdpSocket *socket = self.udpSocket;
+    ICoAPEmptyMessage *messages = pendingEmptyMessages;
+    uint messageCount = pendingEmptyMessageCount;
+    
+    [socket performBlock:^{
+        int socket4FD = [socket socket4FD];
+        int socket6FD = [socket socket6FD];
+        
+        for (uint i = 0; i < messageCount; i++) {
+            int fd = messages[i].address.ss_family == AF_INET6 ? socket6FD : socket4FD;
+            if (fd != -1) {
+                sendto(fd, messages[i].bytes, sizeof(messages[i].bytes), 0, (const struct sockaddr *)&messages[i].address, messages[i].addressLength);
+            }
+        }
+    }];
+    pendingEmptyMessageCount = 0;
+}
+
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port {
+    //Forward-Proxying: cached responses and coalesced requests are kept per proxy, the destination is part of the options
+    [self addCoAPProxyOptionsToCoAPMessage:cO host:host port:port];
+    NSString *destinationHost = host;
+    uint destinationPort = port;
+    if (cO.usesCoAPProxying && !cO.usesHttpProxying) {
+        destinationHost = cO.coapProxyHost;
+        destinationPort = cO.coapProxyPort;
+    }
+    
+    ICoAPMessage *cachedResponse = [self.responseCache freshResponseForRequest:cO host:destinationHost port:destinationPort];
+    if (cachedResponse) {
+        [self sendDidReceiveMessageToDelegateWithCoAPMessage:cachedResponse];
+        return;
+    }
+    
+    //Stale response: ask the server to validate it instead of transferring the body again.
+    //The ETag is added to a copy, the message of the caller stays as it was.
+    revalidationRequest = nil;
+    NSString *storedETag = [self.responseCache storedETagForRequest:cO host:destinationHost port:destinationPort];
+    if (storedETag && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]]) {
+        cO = [cO copy];
+        [cO addOption:IC_ETAG withValue:storedETag];
+        revalidationRequest = cO;
+    }
+    
+    //An identical request in transmission answers this one as well
+    if ([self.requestCoalescer joinRequest:cO host:destinationHost port:destinationPort client:self]) {
+        [self prepareRequestWithCoAPMessage:cO toHost:host port:port];
+        _isMessageInTransmission = YES;
+        return;
+    }
+    
+    //Q-Block2 (NUM 0) announces that the whole body may be sent at once, it must not be mixed with Block2
+    if (self.usesQBlock2 && !self.requestCoalescer && !cO.usesHttpProxying && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]]) {
+        uint szx = self.adaptsBlock2Size && self.peerScheduler ? [self.peerScheduler blockSzxForHost:destinationHost port:destinationPort] : kMaxBlockSzx;
+        [cO addOption:IC_Q_BLOCK2 withValue:[NSString stringWithFormat:@"%u", szx]];
+    }
+    [self sendRequestWithCoAPMessage:cO block2Checkpoint:nil toHost:host port:port];
+}
+
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block2Number:(uint)blockNumber count:(uint)count szx:(uint)szx toHost:(NSString *)host port:(uint)port {
+    ICoAPBlock2Checkpoint *checkpoint = [ICoAPBlock2Checkpoint checkpointWithBlockNumber:blockNumber szx:szx];
+    if (count > 0) {
+        checkpoint.endOffset = checkpoint.offset + (NSUInteger)count * (16 << checkpoint.szx);
+    }
+    [self sendRequestWithCoAPMessage:cO block2Checkpoint:checkpoint toHost:host port:port];
+}
+
+- (void)resumeRequestWithCoAPMessage:(ICoAPMessage *)cO fromBlock2Checkpoint:(ICoAPBlock2Checkpoint *)checkpoint toHost:(NSString *)host port:(uint)port {
+    [self sendRequestWithCoAPMessage:cO block2Checkpoint:[checkpoint copy] toHost:host port:port];
+}
+
+- (void)sendRequestWithCoAPMessage:(ICoAPMessage *)cO block2Checkpoint:(ICoAPBlock2Checkpoint *)checkpoint toHost:(NSString *)host port:(uint)port {
+    if (checkpoint) {
+        [cO.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+        [cO addOption:IC_BLOCK2 withValue:[NSString stringWithFormat:@"%i", checkpoint.nextBlockNumber * 16 + checkpoint.szx]];
+    }
+    
+    [self addCoAPProxyOptionsToCoAPMessage:cO host:host port:port];
+    [self prepareRequestWithCoAPMessage:cO toHost:host port:port];
+    
+    if (checkpoint) {
+        _block2Checkpoint = checkpoint;
+        block2RangeStartOffset = checkpoint.offset;
+        block2RangeEndOffset = checkpoint.endOffset > 0 ? checkpoint.endOffset : NSUIntegerMax;
+    }
+
+    if (cO.usesHttpProxying) {
+        [self sendHttpMessageFromCoAPMessage:pendingCoAPMessageInTransmission];
+    }
+    else {
+        if (!self.udpSocket && ![self setupUdpSocket]) {
+            NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
+            
+            [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+            return;
+        }
+        
+        [self scheduleSending];
+    }
+}
+
+- (void)prepareRequestWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port {
+    randomMessageId++;
+    randomToken++;
+    
+    cO.messageID = randomMessageId % 65536;
+    
+    if ([cO isTokenRequested]) {
+        cO.token = randomToken % INT_MAX;
+    }
+    
+    cO.isRequest = YES;
+    cO.host = host;
+    cO.port = port;
+    if (cO.usesCoAPProxying && !cO.usesHttpProxying) {
+        cO.host = cO.coapProxyHost;
+        cO.port = cO.coapProxyPort;
+    }
+    block2Buffer = nil;
+    isBlock2StreamActive = NO;
+    block2RangeStartOffset = 0;
+    block2RangeEndOffset = NSUIntegerMax;
+    block2ServerSzx = 0;
+    _block2Checkpoint = nil;
+    [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_CANCELLED];
+    pendingCoAPMessageInTransmission = cO;
+    pendingCoAPMessageInTransmission.timestamp = [[NSDate alloc] init];
+}
+
+- (void)resendRevalidationRequestWithoutETag {
+    ICoAPMessage *cO = revalidationRequest;
+    revalidationRequest = nil;
+    
+    //Without the stale response the request is not revalidated again
+    [self.responseCache removeResponseForRequest:cO host:cO.host port:cO.port];
+    [cO.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    [self sendRequestWithCoAPMessage:cO block2Checkpoint:nil toHost:cO.host port:cO.port];
+}
+
+//The options name the destination. A message carrying Proxy-Scheme or Proxy-Uri already names it,
+//e.g. when it is sent again to its 'host', which is the proxy by then.
+- (void)addCoAPProxyOptionsToCoAPMessage:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    if (!cO.usesCoAPProxying || cO.usesHttpProxying || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_PROXY_URI]] || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_PROXY_SCHEME]]) {
+        return;
+    }
+    
+    [cO addOption:IC_PROXY_SCHEME withValue:@"coap"];
+    if (![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_HOST]]) {
+        [cO addOption:IC_URI_HOST withValue:host];
+    }
+    if (port != kCoAPDefaultPort && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_PORT]]) {
+        [cO addOption:IC_URI_PORT withValue:[NSString stringWithFormat:@"%u", port]];
+    }
+}
+
+- (void)scheduleSending {
+    if (!self.peerScheduler) {
+        [self startSending];
+        return;
+    }
+    
+    _isMessageInTransmission = YES;
+    isWaitingForTransmissionGrant = YES;
+    
+    //Approximate size: header, token and payload
+    NSUInteger size = 8 + [pendingCoAPMessageInTransmission.payload length];
+    [self.peerScheduler enqueueTransmissionForClient:self priority:self.priority size:size host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+}
+
+- (void)peerSchedulerDidGrantTransmission:(ICoAPPeerScheduler *)scheduler {
+    if (!isWaitingForTransmissionGrant && isWaitingForBlockTransmissionGrant) {
+        //The slot is taken by the next block of the running transfer
+        isWaitingForBlockTransmissionGrant = NO;
+        isHoldingBlockTransmissionGrant = YES;
+        if (isBlock2PipelineActive) {
+            [self fillBlock2Pipeline];
+        }
+        else if (isBlock1TransferActive) {
+            [self fillBlock1Window];
+        }
+        
+        if (isHoldingBlockTransmissionGrant) {
+            isHoldingBlockTransmissionGrant = NO;
+            [scheduler releaseTransmissionForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port outcome:IC_TRANSMISSION_CANCELLED];
+        }
+        return;
+    }
+    
+    isWaitingForTransmissionGrant = NO;
+    isHoldingTransmissionGrant = YES;
+    [self startSending];
+}
+
+- (void)releaseTransmissionGrantWithOutcome:(ICoAPTransmissionOutcome)outcome {
+    if (isWaitingForTransmissionGrant) {
+        isWaitingForTransmissionGrant = NO;
+        [self.peerScheduler cancelQueuedTransmissionForClient:self host:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+    }
+    
+    if (isHoldingTransmissionGrant) {
+        isHoldingTransmissionGrant = NO;
+        [self.peerScheduler releaseTransmissionForHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port outcome:outcome];
+        
+        if ([pendingCoAPMessageInTransmission.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]]) {
+            [self.peerScheduler recordBlockTransferOutcome:outcome forHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port];
+        }
+    }
+}
+
+- (void)startSending {
+    [self resetState];
+    transmissionStartTime = CFAbsoluteTimeGetCurrent();
+    
+    if (pendingCoAPMessageInTransmission.type == IC_CONFIRMABLE) {
+        retransmissionCounter = 0;
+        maxWaitTimer = [NSTimer scheduledTimerWithTimeInterval:kMAX_TRANSMIT_WAIT target:self selector:@selector(noResponseExpected) userInfo:nil repeats:NO];
+        
+        [self performTransmissionCycle];
+    }
+    else {
+        [self sendCoAPMessage];
+        [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_UNCONFIRMED];
+    }
+}
+
+- (void)performTransmissionCycle {
+    [self sendCoAPMessage];
+    if (retransmissionCounter != 0) {
+        [self sendDidRetransmitMessageToDelegateWithCoAPMessage:pendingCoAPMessageInTransmission];
+    }
+    
+    if (retransmissionCounter != kMAX_RETRANSMIT) {
+        double timeout = kACK_TIMEOUT * pow(2.0, retransmissionCounter) * (kACK_RANDOM_FACTOR - fmodf((float)random()/RAND_MAX, 0.5));
+        sendTimer = [NSTimer scheduledTimerWithTimeInterval:timeout target:self selector:@selector(performTransmissionCycle) userInfo:nil repeats:NO];
+        retransmissionCounter++;
+    }
+}
+
+- (void)sendCoAPMessage {
+    NSData *send = [self encodeDataFromCoAPMessage:pendingCoAPMessageInTransmission];
+    [self.udpSocket sendData:send toHost:pendingCoAPMessageInTransmission.host port:pendingCoAPMessageInTransmission.port withTimeout:-1 tag:udpSocketTag];
+    udpSocketTag++;
+}
+
+- (void)closeExchange {
+    [self releaseTransmissionGrantWithOutcome:IC_TRANSMISSION_CANCELLED];
+    [self.requestCoalescer leaveRequestWithClient:self];
+    
+    if (pendingCoAPMessageInTransmission.usesHttpProxying) {
+        [proxyTask cancel];
+        proxyTask = nil;
+    }
+    else {
+        [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(flushEmptyMessages) object:nil];
+        [self flushEmptyMessages];
+        self.udpSocket.delegate = nil;
+        [self.udpSocket close];
+        self.udpSocket = nil;
+        [sendTimer invalidate];
+        [maxWaitTimer invalidate];
+    }
+    
+    [self stopBlock2Pipeline];
+    [self stopBlock1Transfer];
+    [self stopQBlock2Transfer];
+    [self stopQBlock1Transfer];
+    block2Buffer = nil;
+    isBlock2StreamActive = NO;
+    [deduplicationCache removeAllEntries];
+    hasReceivedNotification = NO;
+    pendingCoAPMessageInTransmission = nil;
+    _isMessageInTransmission = NO;
+}
+
+- (void)resetState {
+    [self stopBlock2Pipeline];
+    [self stopBlock1Transfer];
+    [self stopQBlock2Transfer];
+    [self stopQBlock1Transfer];
+    [sendTimer invalidate];
+    [maxWaitTimer invalidate];
     isObserveCancelled = NO;
     observeOptionValue = 0;
-    recentNotificationDate = nil;
+    hasReceivedNotification = NO;
     _isMessageInTransmission = YES;
 }
 
@@ -586,22 +1978,37 @@
 - (void)sendHttpMessageFromCoAPMessage:(ICoAPMessage *)coapMessage {
     [self resetState];
     NSString *urlString = [NSString stringWithFormat:@"http://%@:%i/%@:%i",coapMessage.httpProxyHost, coapMessage.httpProxyPort, coapMessage.host, coapMessage.port];
-    urlRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:urlString] cachePolicy:NSURLRequestUseProtocolCachePolicy timeoutInterval:kMAX_TRANSMIT_WAIT];
+    NSMutableURLRequest *urlRequest = [NSMutableURLRequest requestWithURL:[NSURL URLWithString:urlString]];
     
     if (coapMessage.code != IC_GET) {
         [urlRequest setHTTPMethod:[self getHttpMethodForCoAPMessageCode:coapMessage.code]];
     }
     
     for (id key in coapMessage.optionDict) {
+        NSString *headerField = ICoAPProxyHeaderFieldForOption([key intValue]);
+        if (!headerField) {
+            continue;
+        }
+        
         NSMutableArray *values = [coapMessage.optionDict valueForKey:key];
         for (NSString *value in values) {
-            [urlRequest addValue:value forHTTPHeaderField:[self getHttpHeaderFieldForCoAPOptionDelta:[key intValue]]];
+            [urlRequest addValue:value forHTTPHeaderField:headerField];
         }
     }
     
     [urlRequest setHTTPBody:[coapMessage.payload dataUsingEncoding:NSUTF8StringEncoding]];
-    urlConnection = [[NSURLConnection alloc] initWithRequest:urlRequest delegate:self];
-    if (!urlConnection) {
+    
+    //The identifier tells responses of cancelled tasks apart, the task itself is not retained by its handler
+    __weak ICoAPExchange *weakSelf = self;
+    __block NSUInteger taskIdentifier = NSNotFound;
+    ICoAPProxyTransport *transport = self.proxyTransport ? self.proxyTransport : [ICoAPProxyTransport sharedTransport];
+    
+    proxyTask = [transport dataTaskWithRequest:urlRequest completionHandler:^(NSData *data, NSURLResponse *response, NSError *error) {
+        [weakSelf proxyTaskWithIdentifier:taskIdentifier didCompleteWithData:data response:response error:error];
+    }];
+    taskIdentifier = proxyTask.taskIdentifier;
+    
+    if (!proxyTask) {
         NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to send HTTP-Request." forKey:NSLocalizedDescriptionKey];
         [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_PROXYING_ERROR userInfo:userInfo]];
     }
@@ -609,51 +2016,6 @@
 
 #pragma mark - Mapping Methods for Proxying
 
-- (NSString *)getHttpHeaderFieldForCoAPOptionDelta:(uint)delta {
-    switch (delta) {
-        case IC_IF_MATCH:
-            return @"IF_MATCH";
-        case IC_URI_HOST:
-            return @"URI_HOST";
-        case IC_ETAG:
-            return @"ETAG";
-        case IC_IF_NONE_MATCH:
-            return @"IF_NONE_MATCH";
-        case IC_URI_PORT:
-            return @"URI_PORT";
-        case IC_LOCATION_PATH:
-            return @"LOCATION_PATH";
-        case IC_URI_PATH:
-            return @"URI_PATH";
-        case IC_CONTENT_FORMAT:
-            return @"CONTENT_FORMAT";
-        case IC_MAX_AGE:
-            return @"MAX_AGE";
-        case IC_URI_QUERY:
-            return @"URI_QUERY";
-        case IC_ACCEPT:
-            return @"ACCEPT";
-        case IC_LOCATION_QUERY:
-            return @"LOCATION_QUERY";
-        case IC_PROXY_URI:
-            return  @"PROXY_URI";
-        case IC_PROXY_SCHEME:
-            return @"PROXY_SCHEME";
-        case IC_BLOCK2:
-            return @"BLOCK2";
-        case IC_BLOCK1:
-            return @"BLOCK1";
-        case IC_OBSERVE:
-            return @"OBSERVE";
-        case IC_SIZE1:
-            return @"SIZE1";
-        case IC_SIZE2:
-            return @"SIZE2";
-        default:
-            return nil;
-    }
-}
-
 - (NSString *)getHttpMethodForCoAPMessageCode:(uint)code {
     switch (code) {
         case IC_POST:
@@ -682,45 +2044,66 @@
     }
 }
 
-#pragma mark - NSURL Connection Delegate
+#pragma mark - Proxy Transport
+
+- (void)proxyTaskWithIdentifier:(NSUInteger)taskIdentifier didCompleteWithData:(NSData *)data response:(NSURLResponse *)response error:(NSError *)error {
+    //Cancelled or replaced by a later request of this exchange
+    if (!proxyTask || proxyTask.taskIdentifier != taskIdentifier) {
+        return;
+    }
+    proxyTask = nil;
+    
+    if (error || ![response isKindOfClass:[NSHTTPURLResponse class]]) {
+        [self proxyFailWithError:error];
+        return;
+    }
+    
+    [self proxyDidReceiveResponse:(NSHTTPURLResponse *)response];
+    [self proxyDidFinishLoadingData:data];
+}
 
-- (void)connection:(NSURLConnection *)connection didFailWithError:(NSError *)error {
+- (void)proxyFailWithError:(NSError *)error {
     [self closeExchange];
     NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Proxying Failure." forKey:NSLocalizedDescriptionKey];
     [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_PROXYING_ERROR userInfo:userInfo]];
 }
 
-#pragma mark - NSURL Connection Data Delegate
-
-- (void)connection:(NSURLConnection *)connection didReceiveResponse:(NSURLResponse *)response {
-    urlData = [[NSMutableData alloc] init];
+- (void)proxyDidReceiveResponse:(NSHTTPURLResponse *)httpresponse {
     proxyCoAPMessage = [[ICoAPMessage alloc] init];
     proxyCoAPMessage.isRequest = NO;
+    proxyCoAPMessage.type = IC_ACKNOWLEDGMENT;
     
-    NSHTTPURLResponse *httpresponse = (NSHTTPURLResponse *)response;
-    
-    for (NSNumber *optNumber in supportedOptions) {
-        NSString *optString = [self getHttpHeaderFieldForCoAPOptionDelta:[optNumber intValue]];
-        
-        if ([httpresponse.allHeaderFields objectForKey:[NSString stringWithFormat:@"HTTP_%@", optString]]) {
-            NSString *valueString = [httpresponse.allHeaderFields objectForKey:[NSString stringWithFormat:@"HTTP_%@", optString]];
-            NSArray *valueArray = [valueString componentsSeparatedByString:@","];
-            
-            [proxyCoAPMessage.optionDict setValue:[NSMutableArray arrayWithArray:valueArray] forKey:[optNumber stringValue]];
+    //One pass over the received header fields, instead of probing for every supported option
+    NSDictionary *optionKeys = ICoAPProxyOptionKeysByResponseHeaderField();
+    [httpresponse.allHeaderFields enumerateKeysAndObjectsUsingBlock:^(NSString *field, NSString *value, BOOL *stop) {
+        if ([field length] > 5 && [field compare:@"HTTP_" options:NSCaseInsensitiveSearch range:NSMakeRange(0, 5)] == NSOrderedSame) {
+            NSString *optionKey = [optionKeys objectForKey:field];
+            if (!optionKey) {
+                optionKey = [optionKeys objectForKey:[field uppercaseString]];
+            }
+            if (optionKey) {
+                [proxyCoAPMessage.optionDict setObject:[[value componentsSeparatedByString:@","] mutableCopy] forKey:optionKey];
+            }
         }
-    }
+        else if ([field caseInsensitiveCompare:kProxyCoAPTypeIndicator] == NSOrderedSame) {
+            proxyCoAPMessage.type = [self getCoapTypeForString:value];
+        }
+    }];
     
-    proxyCoAPMessage.type = [self getCoapTypeForString:[httpresponse.allHeaderFields objectForKey:kProxyCoAPTypeIndicator]];
     proxyCoAPMessage.code = httpresponse.statusCode;
     proxyCoAPMessage.usesHttpProxying = YES;
 }
 
-- (void)connection:(NSURLConnection *)connection didReceiveData:(NSData *)data {
-    [urlData appendData:data];
-}
-
-- (void)connectionDidFinishLoading:(NSURLConnection *)connection {
-    proxyCoAPMessage.payload = [self requiresPayloadStringDecodeForCoAPMessage:proxyCoAPMessage] ? [NSString stringFromHexString:[NSString stringFromDataWithHex:urlData]] : [NSString stringFromDataWithHex:urlData];
+- (void)proxyDidFinishLoadingData:(NSData *)data {
+    //The body is passed on as received, text is decoded directly from the bytes
+    proxyCoAPMessage.payloadData = data;
+    if ([self requiresPayloadStringDecodeForCoAPMessage:proxyCoAPMessage]) {
+        NSString *payload = [[NSString alloc] initWithData:data encoding:NSUTF8StringEncoding];
+        proxyCoAPMessage.payload = payload ? payload : [[NSString alloc] initWithData:data encoding:NSISOLatin1StringEncoding];
+    }
+    else {
+        proxyCoAPMessage.payload = [NSString stringFromDataWithHex:data];
+    }
     proxyCoAPMessage.timestamp = [[NSDate alloc] init];
     
     if ([proxyCoAPMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]] && ![proxyCoAPMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]]) {
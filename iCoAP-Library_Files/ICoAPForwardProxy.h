@@ -0,0 +1,139 @@
+//
+//  ICoAPForwardProxy.h
+//  iCoAP
+//
+
+
+/*
+ *  This class is a CoAP-to-CoAP Forward-Proxy. It receives requests
+ *  on its own UDP socket and forwards them to the CoAP-Server named
+ *  by the Proxy-Uri option, or by the Proxy-Scheme, Uri-Host and
+ *  Uri-Port options (RFC 7252 Section 5.7.2).
+
+ *  Every forwarded request is sent by an ICoAPExchange, which shares
+ *  the 'responseCache' and the 'requestCoalescer' of the proxy. Fresh
+ *  responses are therefore answered from the cache without contacting
+ *  the server, with their remaining lifetime as Max-Age, identical
+ *  requests of several clients are sent to the server once, and stale
+ *  responses are revalidated with their ETag. A client whose request
+ *  names the ETag of the fresh response or of the kept representation
+ *  (see below) is answered with 2.03 (Valid) and the remaining Max-Age,
+ *  without the payload.
+ *  Block2 transfers of the server are reassembled by the proxy, the
+ *  whole representation is cached and passed to the clients in blocks
+ *  of their requested size. Apart from the cache, the representation
+ *  is kept for kProxyBlock2BodyLifetime after each block, so the
+ *  follow-up requests of a client are answered from it even if it
+ *  can not be cached (Max-Age 0, too large) or was evicted.
+
+ *  Responses are piggybacked on the ACK of a confirmable request, or
+ *  sent as non-confirmable message. Schemes other than "coap" are
+ *  answered with 5.05 (Proxying Not Supported), unreachable servers
+ *  with 5.04 (Gateway Timeout) or 5.02 (Bad Gateway). Observe is not
+ *  relayed, Block1 and Q-Block requests are answered with 4.02 (Bad Option).
+
+ *  The proxy must be used from the main queue, which is the queue all
+ *  ICoAPExchange objects operate on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+#import "ICoAPExchange.h"
+
+
+#define kProxyBlock2BodyLifetime            kMAX_TRANSMIT_WAIT  //Seconds a representation is kept for the next block
+
+
+@interface ICoAPForwardProxy : NSObject<GCDAsyncUdpSocketDelegate, ICoAPExchangeDelegate> {
+    ICoAPExchange *codec;
+    uint randomMessageId;
+    long udpSocketTag;
+    NSMutableDictionary *clientRequests;
+    NSMutableDictionary *upstreamRequests;
+    NSMutableDictionary *block2Bodies;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'udpSocket':
+ *  The socket on which the proxy receives requests and sends responses.
+ */
+@property (strong, nonatomic) GCDAsyncUdpSocket *udpSocket;
+
+/*
+ *  'responseCache':
+ *  The cache shared by all forwarded requests. Default is a new
+ *  ICoAPResponseCache, set [ICoAPResponseCache sharedCache] to share
+ *  the responses with the exchanges of the application.
+ */
+@property (strong, nonatomic) ICoAPResponseCache *responseCache;
+
+/*
+ *  'requestCoalescer':
+ *  The coalescer shared by all forwarded requests. Default is a new
+ *  ICoAPRequestCoalescer.
+ */
+@property (strong, nonatomic) ICoAPRequestCoalescer *requestCoalescer;
+
+/*
+ *  'peerScheduler':
+ *  If set, forwarded requests are scheduled per server. (Optional)
+ */
+@property (strong, nonatomic) ICoAPPeerScheduler *peerScheduler;
+
+/*
+ *  'forwardedRequestCount':
+ *  Number of requests which were passed to an ICoAPExchange, i.e. which
+ *  were not answered from the cache by the proxy itself.
+ */
+@property (readonly, nonatomic) NSUInteger forwardedRequestCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'startOnPort:error:':
+ *  Binds the socket of the proxy to 'port' and starts receiving requests.
+ *  Returns NO and sets 'error' if the socket could not be set up.
+ */
+- (BOOL)startOnPort:(uint)port error:(NSError **)error;
+
+/*
+ *  'stop':
+ *  Closes the socket and all pending exchanges. Pending requests are not answered.
+ */
+- (void)stop;
+
+@end
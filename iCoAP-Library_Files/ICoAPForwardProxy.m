@@ -0,0 +1,430 @@
+//
+//  ICoAPForwardProxy.m
+//  iCoAP
+//
+
+
+#import "ICoAPForwardProxy.h"
+
+
+
+
+@interface ICoAPProxyClientRequest : NSObject
+@property (strong, nonatomic) NSData *key;
+@property (strong, nonatomic) NSData *address;
+@property (readwrite, nonatomic) uint messageID;
+@property (readwrite, nonatomic) uint token;
+@property (readwrite, nonatomic) uint type;
+@property (readwrite, nonatomic) BOOL hasBlock2;
+@property (readwrite, nonatomic) uint block2Value;
+@property (strong, nonatomic) NSArray *etagValues;
+@property (strong, nonatomic) ICoAPMessage *upstreamRequest;
+@property (strong, nonatomic) ICoAPExchange *exchange;
+@property (strong, nonatomic) NSData *responseData;
+@end
+
+@implementation ICoAPProxyClientRequest
+@end
+
+
+
+
+@interface ICoAPProxyBlock2Body : NSObject
+@property (strong, nonatomic) ICoAPMessage *response;
+@property (readwrite, nonatomic) CFAbsoluteTime expiry;
+@end
+
+@implementation ICoAPProxyBlock2Body
+@end
+
+
+
+
+@interface ICoAPForwardProxy ()
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext;
+- (void)handleRequestWithCoAPMessage:(ICoAPMessage *)cO fromAddress:(NSData *)address;
+- (ICoAPMessage *)upstreamRequestForCoAPMessage:(ICoAPMessage *)cO;
+- (void)finishUpstreamExchange:(ICoAPExchange *)exchange withCoAPMessage:(ICoAPMessage *)response;
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withCoAPMessage:(ICoAPMessage *)response;
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withCode:(uint)code;
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withLocalResponse:(ICoAPMessage *)response;
+- (void)removeClientRequestForKey:(NSData *)key;
+- (ICoAPMessage *)block2BodyResponseForClientRequest:(ICoAPProxyClientRequest *)clientRequest;
+- (void)keepBlock2BodyOfResponse:(ICoAPMessage *)response forClientRequest:(ICoAPProxyClientRequest *)clientRequest;
+- (void)removeBlock2BodyForKey:(NSData *)key;
+@end
+
+@implementation ICoAPForwardProxy
+
+#pragma mark - Init
+
+- (id)init {
+    if (self = [super init]) {
+        codec = [[ICoAPExchange alloc] init];
+        randomMessageId = 1 + arc4random() % 65536;
+        clientRequests = [[NSMutableDictionary alloc] init];
+        upstreamRequests = [[NSMutableDictionary alloc] init];
+        block2Bodies = [[NSMutableDictionary alloc] init];
+        self.responseCache = [[ICoAPResponseCache alloc] init];
+        self.requestCoalescer = [[ICoAPRequestCoalescer alloc] init];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+#pragma mark - Socket
+
+- (BOOL)startOnPort:(uint)port error:(NSError **)error {
+    [self stop];
+    self.udpSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:dispatch_get_main_queue()];
+
+    if (![self.udpSocket bindToPort:port error:error] || ![self.udpSocket beginReceiving:error]) {
+        [self.udpSocket close];
+        self.udpSocket = nil;
+        return NO;
+    }
+    return YES;
+}
+
+- (void)stop {
+    [NSObject cancelPreviousPerformRequestsWithTarget:self];
+
+    for (ICoAPProxyClientRequest *clientRequest in [upstreamRequests objectEnumerator]) {
+        clientRequest.exchange.delegate = nil;
+        [clientRequest.exchange closeExchange];
+        clientRequest.exchange = nil;
+    }
+    [upstreamRequests removeAllObjects];
+    [clientRequests removeAllObjects];
+    [block2Bodies removeAllObjects];
+
+    self.udpSocket.delegate = nil;
+    [self.udpSocket close];
+    self.udpSocket = nil;
+}
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+    ICoAPMessage *cO = [codec decodeCoAPMessageFromData:data];
+    if (!cO) {
+        return;
+    }
+
+    //CoAP Ping: answered with a Reset message
+    if (cO.code == IC_EMPTY) {
+        if (cO.type == IC_CONFIRMABLE) {
+            ICoAPMessage *reset = [[ICoAPMessage alloc] init];
+            reset.type = IC_RESET;
+            reset.messageID = cO.messageID;
+            [self.udpSocket sendData:[codec encodeDataFromCoAPMessage:reset] toAddress:address withTimeout:-1 tag:udpSocketTag++];
+        }
+        return;
+    }
+
+    //Responses and messages of other types are not expected by the proxy
+    if (cO.code >= 32 || (cO.type != IC_CONFIRMABLE && cO.type != IC_NON_CONFIRMABLE)) {
+        return;
+    }
+
+    [self handleRequestWithCoAPMessage:cO fromAddress:address];
+}
+
+#pragma mark - Forwarding
+
+- (void)handleRequestWithCoAPMessage:(ICoAPMessage *)cO fromAddress:(NSData *)address {
+    NSMutableData *key = [NSMutableData dataWithData:address];
+    uint8_t messageID[2] = {(cO.messageID >> 8) & 0xFF, cO.messageID & 0xFF};
+    [key appendBytes:messageID length:2];
+
+    //Duplicate: the response is repeated once it is known, until then the duplicate is ignored
+    ICoAPProxyClientRequest *clientRequest = [clientRequests objectForKey:key];
+    if (clientRequest) {
+        if (clientRequest.responseData) {
+            [self.udpSocket sendData:clientRequest.responseData toAddress:address withTimeout:-1 tag:udpSocketTag++];
+        }
+        return;
+    }
+
+    clientRequest = [[ICoAPProxyClientRequest alloc] init];
+    clientRequest.key = key;
+    clientRequest.address = address;
+    clientRequest.messageID = cO.messageID;
+    clientRequest.token = cO.token;
+    clientRequest.type = cO.type;
+
+    NSArray *block2Values = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    if (block2Values) {
+        clientRequest.hasBlock2 = YES;
+        clientRequest.block2Value = [[block2Values objectAtIndex:0] intValue];
+    }
+    clientRequest.etagValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    [clientRequests setObject:clientRequest forKey:key];
+    [self performSelector:@selector(removeClientRequestForKey:) withObject:key afterDelay:kEXCHANGE_LIFETIME];
+
+    if ([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK1]] || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK1]] || [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]]) {
+        [self respondToClientRequest:clientRequest withCode:IC_BAD_OPTION];
+        return;
+    }
+
+    ICoAPMessage *upstreamRequest = [self upstreamRequestForCoAPMessage:cO];
+    if (!upstreamRequest) {
+        [self respondToClientRequest:clientRequest withCode:IC_PROXYING_NOT_SUPPORTED];
+        return;
+    }
+    clientRequest.upstreamRequest = [upstreamRequest copy];
+
+    //Follow-up blocks come from the representation the first blocks were taken from
+    ICoAPMessage *block2BodyResponse = [self block2BodyResponseForClientRequest:clientRequest];
+    if (block2BodyResponse) {
+        [self respondToClientRequest:clientRequest withLocalResponse:block2BodyResponse];
+        return;
+    }
+
+    ICoAPMessage *cachedResponse = [self.responseCache freshResponseForRequest:upstreamRequest host:upstreamRequest.host port:upstreamRequest.port];
+    if (cachedResponse) {
+        [self respondToClientRequest:clientRequest withLocalResponse:cachedResponse];
+        return;
+    }
+
+    ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    exchange.responseCache = self.responseCache;
+    exchange.requestCoalescer = self.requestCoalescer;
+    exchange.peerScheduler = self.peerScheduler;
+    exchange.reassemblesBlock2Payload = YES;
+    clientRequest.exchange = exchange;
+
+    //Registered before sending, the exchange may answer synchronously
+    [upstreamRequests setObject:clientRequest forKey:[NSValue valueWithNonretainedObject:exchange]];
+    _forwardedRequestCount++;
+    [exchange sendRequestWithCoAPMessage:upstreamRequest toHost:upstreamRequest.host port:upstreamRequest.port];
+}
+
+- (ICoAPMessage *)upstreamRequestForCoAPMessage:(ICoAPMessage *)cO {
+    ICoAPMessage *upstreamRequest = [cO copy];
+    upstreamRequest.isRequest = YES;
+    upstreamRequest.isTokenRequested = YES;
+    upstreamRequest.type = IC_CONFIRMABLE;
+    upstreamRequest.payload = nil;
+
+    NSArray *proxyUriValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_PROXY_URI]];
+    if (proxyUriValues) {
+        NSURL *url = [NSURL URLWithString:[proxyUriValues objectAtIndex:0]];
+        if (![url host] || [[url scheme] caseInsensitiveCompare:@"coap"] != NSOrderedSame) {
+            return nil;
+        }
+        upstreamRequest.host = [url host];
+        upstreamRequest.port = [url port] ? [[url port] unsignedIntValue] : kCoAPDefaultPort;
+
+        //The Proxy-Uri replaces the Uri-Path and Uri-Query options of the request
+        [upstreamRequest.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_URI_PATH]];
+        [upstreamRequest.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_URI_QUERY]];
+
+        for (NSString *pathComponent in [url pathComponents]) {
+            if (![pathComponent isEqualToString:@"/"]) {
+                [upstreamRequest addOption:IC_URI_PATH withValue:pathComponent];
+            }
+        }
+        for (NSString *query in [[url query] componentsSeparatedByString:@"&"]) {
+            [upstreamRequest addOption:IC_URI_QUERY withValue:[query stringByRemovingPercentEncoding] ?: query];
+        }
+    }
+    else {
+        NSArray *schemeValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_PROXY_SCHEME]];
+        NSArray *hostValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_HOST]];
+        NSArray *portValues = [cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_PORT]];
+
+        if (!schemeValues || !hostValues || [[schemeValues objectAtIndex:0] caseInsensitiveCompare:@"coap"] != NSOrderedSame) {
+            return nil;
+        }
+        upstreamRequest.host = [hostValues objectAtIndex:0];
+        upstreamRequest.port = portValues ? [[portValues objectAtIndex:0] intValue] : kCoAPDefaultPort;
+    }
+
+    //Options addressing the proxy, the whole representation is requested from the server
+    uint proxyOptions[] = {IC_PROXY_URI, IC_PROXY_SCHEME, IC_URI_HOST, IC_URI_PORT, IC_OBSERVE, IC_BLOCK2, IC_SIZE2};
+    for (uint i = 0; i < sizeof(proxyOptions) / sizeof(proxyOptions[0]); i++) {
+        [upstreamRequest.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", proxyOptions[i]]];
+    }
+    return upstreamRequest;
+}
+
+- (void)finishUpstreamExchange:(ICoAPExchange *)exchange withCoAPMessage:(ICoAPMessage *)response {
+    NSValue *exchangeKey = [NSValue valueWithNonretainedObject:exchange];
+    ICoAPProxyClientRequest *clientRequest = [upstreamRequests objectForKey:exchangeKey];
+    if (!clientRequest) {
+        return;
+    }
+    [upstreamRequests removeObjectForKey:exchangeKey];
+
+    //The exchange is still calling its delegate, it is closed and released afterwards
+    exchange.delegate = nil;
+    [exchange performSelector:@selector(closeExchange) withObject:nil afterDelay:0];
+    clientRequest.exchange = nil;
+
+    [self respondToClientRequest:clientRequest withCoAPMessage:response];
+}
+
+- (void)removeClientRequestForKey:(NSData *)key {
+    ICoAPProxyClientRequest *clientRequest = [clientRequests objectForKey:key];
+    if (clientRequest.exchange) {
+        [upstreamRequests removeObjectForKey:[NSValue valueWithNonretainedObject:clientRequest.exchange]];
+        clientRequest.exchange.delegate = nil;
+        [clientRequest.exchange closeExchange];
+    }
+    [clientRequests removeObjectForKey:key];
+}
+
+#pragma mark - Block2 Bodies
+
+- (ICoAPMessage *)block2BodyResponseForClientRequest:(ICoAPProxyClientRequest *)clientRequest {
+    if (!clientRequest.hasBlock2 || clientRequest.block2Value >> 4 == 0) {
+        return nil;
+    }
+
+    ICoAPMessage *upstreamRequest = clientRequest.upstreamRequest;
+    ICoAPProxyBlock2Body *block2Body = [block2Bodies objectForKey:[ICoAPResponseCache cacheKeyForRequest:upstreamRequest host:upstreamRequest.host port:upstreamRequest.port]];
+    if (!block2Body) {
+        return nil;
+    }
+
+    //Like a cache hit, the Max-Age passed on is the remaining lifetime
+    ICoAPMessage *response = [block2Body.response copy];
+    CFAbsoluteTime remainingLifetime = block2Body.expiry - CFAbsoluteTimeGetCurrent();
+    NSMutableArray *maxAgeValues = [NSMutableArray arrayWithObject:[NSString stringWithFormat:@"%u", remainingLifetime > 0 ? (uint)ceil(remainingLifetime) : 0]];
+    [response.optionDict setObject:maxAgeValues forKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    return response;
+}
+
+- (void)keepBlock2BodyOfResponse:(ICoAPMessage *)response forClientRequest:(ICoAPProxyClientRequest *)clientRequest {
+    ICoAPMessage *upstreamRequest = clientRequest.upstreamRequest;
+    NSData *key = [ICoAPResponseCache cacheKeyForRequest:upstreamRequest host:upstreamRequest.host port:upstreamRequest.port];
+    NSArray *maxAgeValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+
+    //A newer representation replaces the kept one, later blocks are taken from it
+    ICoAPProxyBlock2Body *block2Body = [[ICoAPProxyBlock2Body alloc] init];
+    block2Body.response = response;
+    block2Body.expiry = CFAbsoluteTimeGetCurrent() + (maxAgeValues ? [[maxAgeValues objectAtIndex:0] intValue] : kDefaultResponseMaxAge);
+    [block2Bodies setObject:block2Body forKey:key];
+
+    [NSObject cancelPreviousPerformRequestsWithTarget:self selector:@selector(removeBlock2BodyForKey:) object:key];
+    [self performSelector:@selector(removeBlock2BodyForKey:) withObject:key afterDelay:kProxyBlock2BodyLifetime];
+}
+
+- (void)removeBlock2BodyForKey:(NSData *)key {
+    [block2Bodies removeObjectForKey:key];
+}
+
+#pragma mark - Responses
+
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withCoAPMessage:(ICoAPMessage *)response {
+    ICoAPMessage *cO = [response copy];
+    NSData *body = [response.payloadData length] > 0 || !response.payload ? response.payloadData : [response.payload dataUsingEncoding:NSUTF8StringEncoding];
+
+    cO.isRequest = NO;
+    cO.token = clientRequest.token;
+    cO.payload = nil;
+    cO.payloadData = body;
+    [cO.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+    [cO.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+
+    if (clientRequest.type == IC_CONFIRMABLE) {
+        cO.type = IC_ACKNOWLEDGMENT;
+        cO.messageID = clientRequest.messageID;
+    }
+    else {
+        cO.type = IC_NON_CONFIRMABLE;
+        cO.messageID = ++randomMessageId % 65536;
+    }
+
+    //Representations larger than a block, or requested in blocks, are passed in blocks of the requested size
+    uint szx = clientRequest.hasBlock2 ? MIN(clientRequest.block2Value & 7, kMaxBlockSzx) : kMaxBlockSzx;
+    uint blockNumber = clientRequest.hasBlock2 ? clientRequest.block2Value >> 4 : 0;
+    NSUInteger blockSize = 16 << szx;
+
+    if ([body length] > 0 && (clientRequest.hasBlock2 || [body length] > blockSize)) {
+        NSUInteger offset = (NSUInteger)blockNumber * blockSize;
+        if (offset >= [body length]) {
+            [self respondToClientRequest:clientRequest withCode:IC_BAD_OPTION];
+            return;
+        }
+
+        NSUInteger length = MIN(blockSize, [body length] - offset);
+        BOOL more = offset + length < [body length];
+        cO.payloadData = [body subdataWithRange:NSMakeRange(offset, length)];
+        [cO addOption:IC_BLOCK2 withValue:[NSString stringWithFormat:@"%u", blockNumber * 16 + (more ? 8 : 0) + szx]];
+
+        if (more && response.code == IC_CONTENT && clientRequest.upstreamRequest) {
+            [self keepBlock2BodyOfResponse:response forClientRequest:clientRequest];
+        }
+
+        if (blockNumber == 0 && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]]) {
+            [cO addOption:IC_SIZE2 withValue:[NSString stringWithFormat:@"%lu", (unsigned long)[body length]]];
+        }
+    }
+
+    NSData *data = [codec encodeDataFromCoAPMessage:cO];
+    if (clientRequest.type == IC_CONFIRMABLE) {
+        clientRequest.responseData = data;
+    }
+    [self.udpSocket sendData:data toAddress:clientRequest.address withTimeout:-1 tag:udpSocketTag++];
+}
+
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withCode:(uint)code {
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = code;
+    [self respondToClientRequest:clientRequest withCoAPMessage:response];
+}
+
+//Answers from the cache or a kept representation, which the client may already hold
+- (void)respondToClientRequest:(ICoAPProxyClientRequest *)clientRequest withLocalResponse:(ICoAPMessage *)response {
+    NSArray *etagValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    if (!etagValues || ![clientRequest.etagValues containsObject:[etagValues objectAtIndex:0]]) {
+        [self respondToClientRequest:clientRequest withCoAPMessage:response];
+        return;
+    }
+
+    ICoAPMessage *validResponse = [[ICoAPMessage alloc] init];
+    validResponse.code = IC_VALID;
+    [validResponse.optionDict setObject:[etagValues mutableCopy] forKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    NSArray *maxAgeValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    if (maxAgeValues) {
+        [validResponse.optionDict setObject:[maxAgeValues mutableCopy] forKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    }
+    [self respondToClientRequest:clientRequest withCoAPMessage:validResponse];
+}
+
+#pragma mark - ICoAP Exchange Delegate
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveCoAPMessage:(ICoAPMessage *)coapMessage {
+    //Empty ACK: the separate response follows
+    if (coapMessage.code == IC_EMPTY) {
+        return;
+    }
+    [self finishUpstreamExchange:exchange withCoAPMessage:coapMessage];
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveBlock2Payload:(NSData *)payload coapMessage:(ICoAPMessage *)coapMessage {
+    ICoAPMessage *response = [coapMessage copy];
+    [response.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    [response.optionDict removeObjectForKey:[NSString stringWithFormat:@"%i", IC_SIZE2]];
+    response.payload = nil;
+    response.payloadData = payload;
+
+    //The exchange caches single responses only, the reassembled representation is stored here
+    ICoAPProxyClientRequest *clientRequest = [upstreamRequests objectForKey:[NSValue valueWithNonretainedObject:exchange]];
+    if (clientRequest) {
+        [self.responseCache storeResponse:response forRequest:clientRequest.upstreamRequest host:clientRequest.upstreamRequest.host port:clientRequest.upstreamRequest.port];
+    }
+    [self finishUpstreamExchange:exchange withCoAPMessage:response];
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didFailWithError:(NSError *)error {
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = error.code == IC_RESPONSE_TIMEOUT ? IC_GATEWAY_TIMEOUT : IC_BAD_GATEWAY;
+    [self finishUpstreamExchange:exchange withCoAPMessage:response];
+}
+
+@end
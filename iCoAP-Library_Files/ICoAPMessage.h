@@ -41,6 +41,7 @@ typedef enum {
     IC_VALID = 67,
     IC_CHANGED = 68,
     IC_CONTENT = 69,
+    IC_CONTINUE = 95,
     IC_BAD_REQUEST = 128,
     IC_UNAUTHORIZED = 129,
     IC_BAD_OPTION = 130,
@@ -48,6 +49,7 @@ typedef enum {
     IC_NOT_FOUND = 132,
     IC_METHOD_NOT_ALLOWED = 133,
     IC_NOT_ACCEPTABLE = 134,
+    IC_REQUEST_ENTITY_INCOMPLETE = 136,
     IC_PRECONDITION_FAILED = 140,
     IC_REQUEST_ENTITY_TOO_LARGE = 141,
     IC_UNSUPPORTED_CONTENT_FORMAT = 143,
@@ -72,17 +74,32 @@ typedef enum {
     IC_MAX_AGE = 14,
     IC_URI_QUERY = 15,
     IC_ACCEPT = 17,
+    IC_Q_BLOCK1 = 19,
     IC_LOCATION_QUERY = 20,
     IC_BLOCK2 = 23,
     IC_BLOCK1 = 27,
     IC_SIZE2 = 28,
+    IC_Q_BLOCK2 = 31,
     IC_PROXY_URI = 35,
     IC_PROXY_SCHEME = 39,
     IC_SIZE1 = 60
 } ICoAPOption;
 
 
-@interface ICoAPMessage : NSObject
+/*
+ *  'ICoAPWriteEmptyMessage':
+ *  Writes the 4 byte header of an empty message (e.g. ACK, RST or CoAP ping)
+ *  with the given 'type' and 'messageID' to 'bytes'.
+ */
+static inline void ICoAPWriteEmptyMessage(uint8_t *bytes, ICoAPType type, uint messageID) {
+    bytes[0] = type << 4;   //type includes the version
+    bytes[1] = IC_EMPTY;
+    bytes[2] = (messageID >> 8) & 0xFF;
+    bytes[3] = messageID & 0xFF;
+}
+
+
+@interface ICoAPMessage : NSObject<NSCopying>
 
 
 
@@ -134,6 +151,27 @@ typedef enum {
  */
 @property (readwrite, nonatomic) uint httpProxyPort;
 
+/*
+ *  'usesCoAPProxying':
+ *  Tells whether this message is supposed to be sent to a CoAP
+ *  Forward-Proxy (YES), which forwards it to the destination host.
+ *  The destination is then named by the Proxy-Scheme, Uri-Host and
+ *  Uri-Port options, unless a Proxy-Uri option is set.
+ */
+@property (readwrite, nonatomic) BOOL usesCoAPProxying;
+
+/*
+ *  'coapProxyHost':
+ *  The CoAP-Proxy Host (optional).
+ */
+@property (copy) NSString *coapProxyHost;
+
+/*
+ *  'coapProxyPort':
+ *  The CoAP-Proxy Port (optional).
+ */
+@property (readwrite, nonatomic) uint coapProxyPort;
+
 
 /*
  *  'type':
@@ -174,6 +212,13 @@ typedef enum {
  */
 @property (copy) NSString *payload;
 
+/*
+ *  'payloadData':
+ *  The raw bytes of the payload of a received CoAP Message. For requests
+ *  it is sent as payload, if 'payload' is empty.
+ */
+@property (strong, nonatomic) NSData *payloadData;
+
 /*
  *  'host':
  *  CoAP-Host of the CoAP-Message destination/origin.
@@ -232,5 +277,12 @@ typedef enum {
  */
 - (void)addOption:(uint)option withValue:(NSString *)value;
 
+/*
+ *  'copyWithZone:'
+ *  Returns a copy of the message. The option value arrays are copied
+ *  as well, so options of the copy can be changed independently.
+ */
+- (id)copyWithZone:(NSZone *)zone;
+
 @end
 
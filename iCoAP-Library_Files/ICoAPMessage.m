@@ -52,4 +52,30 @@
     [valueArray addObject:value];
 }
 
+- (id)copyWithZone:(NSZone *)zone {
+    ICoAPMessage *copy = [[ICoAPMessage allocWithZone:zone] init];
+    copy.isRequest = self.isRequest;
+    copy.isTokenRequested = self.isTokenRequested;
+    copy.usesHttpProxying = self.usesHttpProxying;
+    copy.httpProxyHost = self.httpProxyHost;
+    copy.httpProxyPort = self.httpProxyPort;
+    copy.usesCoAPProxying = self.usesCoAPProxying;
+    copy.coapProxyHost = self.coapProxyHost;
+    copy.coapProxyPort = self.coapProxyPort;
+    copy.type = self.type;
+    copy.code = self.code;
+    copy.messageID = self.messageID;
+    copy.token = self.token;
+    copy.payload = self.payload;
+    copy.payloadData = self.payloadData;
+    copy.host = self.host;
+    copy.port = self.port;
+    copy.timestamp = self.timestamp;
+    
+    for (NSString *optionKey in self.optionDict) {
+        [copy.optionDict setObject:[[self.optionDict objectForKey:optionKey] mutableCopy] forKey:optionKey];
+    }
+    return copy;
+}
+
 @end
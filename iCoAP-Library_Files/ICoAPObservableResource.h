@@ -0,0 +1,200 @@
+//
+//  ICoAPObservableResource.h
+//  iCoAP
+//
+
+
+/*
+ *  This class is a resource of an ICoAPServer which clients can
+ *  observe (RFC 7641).
+
+ *  GET requests are answered with the current 'representation'. A GET
+ *  with Observe 0 registers the client as observer, Observe 1 or a RST
+ *  in reply to a notification removes it. Observers are compact records
+ *  (sizeof(ICoAPObserverRecord) bytes) in one array.
+
+ *  When the representation is updated, it is encoded once into a
+ *  template with the new Observe sequence number. The notification of
+ *  an observer consists of a header with its type, Message ID and token,
+ *  followed by the shared template, and is sent with sendmsg() without
+ *  copying the template. Notifications are sent in batches of
+ *  kObserveFanoutBatchSize within one call into the socket queue.
+
+ *  Every 'confirmableInterval'-th notification of an observer is
+ *  confirmable, the others are non-confirmable. While a confirmable
+ *  notification is unacknowledged, later notifications to that observer
+ *  are dropped, and only the latest state is sent once it acknowledged
+ *  (RFC 7641 Section 4.5.2). An observer which does not acknowledge a
+ *  confirmable notification within MAX_RETRANSMIT retransmissions is removed.
+
+ *  Observe sequence numbers are 24 bit values which increase with every
+ *  update, in the serial number arithmetic clients check with
+ *  ICoAPIsNotificationFresh().
+
+ *  The resource must only be used from the queue of its server.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import <sys/socket.h>
+#import "ICoAPExchange.h"
+#import "ICoAPResourceDirectory.h"
+
+
+#define kObserveFanoutBatchSize             64      //Notifications per call into the socket queue
+#define kObserveFanoutTimerInterval         0.1
+#define kObserverConfirmableInterval        10      //Every 10th notification of an observer is confirmable
+#define kObserverInitialCapacity            64
+#define kObserveTemplateValue               8388608 //Placeholder which is encoded with 3 bytes
+
+
+typedef enum {
+    IC_OBSERVER_FREE,               //  Slot not in use
+    IC_OBSERVER_IDLE,               //  No confirmable notification outstanding
+    IC_OBSERVER_AWAITING_ACK        //  Confirmable notification outstanding, later ones are dropped
+} ICoAPObserverState;
+
+
+typedef struct {
+    struct sockaddr_storage address;
+    CFAbsoluteTime retransmissionTime;
+    float retransmissionTimeout;
+    socklen_t addressLength;
+    uint32_t token;
+    uint32_t pendingSequenceNumber;
+    uint16_t messageID;
+    uint16_t confirmableInterval;
+    uint16_t notificationsSinceConfirmable;
+    uint8_t retransmissionCounter;
+    uint8_t state;
+    uint8_t hasDroppedNotification;
+} ICoAPObserverRecord;
+
+
+typedef struct {
+    uint8_t header[8];
+    uint8_t headerLength;
+    socklen_t addressLength;
+    struct sockaddr_storage address;
+} ICoAPNotificationHeader;
+
+
+@class ICoAPServer;
+
+
+@interface ICoAPObservableResource : NSObject {
+    ICoAPExchange *codec;
+    ICoAPObserverRecord *observers;
+    NSUInteger capacity;
+    NSUInteger usedSlots;
+    NSMutableIndexSet *freeSlots;
+    NSMutableDictionary *observerSlots;
+    NSMutableDictionary *confirmationSlots;
+    NSData *notificationTemplate;
+    uint8_t notificationCode;
+    uint32_t sequenceNumber;
+    ICoAPNotificationHeader pendingNotifications[kObserveFanoutBatchSize];
+    uint pendingNotificationCount;
+    dispatch_source_t retransmissionTimer;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'server':
+ *  The server of the resource.
+ */
+@property (weak, nonatomic) ICoAPServer *server;
+
+/*
+ *  'representation':
+ *  The current representation, e.g. a 2.05 Content message with payload
+ *  and Content-Format. Type, Message ID and token are set per client.
+ */
+@property (readonly, nonatomic) ICoAPMessage *representation;
+
+/*
+ *  'observerCount':
+ *  Number of registered observers.
+ */
+@property (readonly, nonatomic) NSUInteger observerCount;
+
+/*
+ *  'confirmableInterval':
+ *  Every 'confirmableInterval'-th notification of a new observer is
+ *  confirmable, 1 makes all notifications confirmable.
+ *  Default is kObserverConfirmableInterval.
+ */
+@property (readwrite, nonatomic) uint confirmableInterval;
+
+/*
+ *  'handler':
+ *  Handles requests other than GET. If not set, they are answered with
+ *  4.05 (Method Not Allowed). (Optional)
+ */
+@property (copy, nonatomic) ICoAPResourceHandler handler;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'initWithServer:representation:':
+ *  Initialization for the 'server' with the initial 'representation'.
+ */
+- (id)initWithServer:(ICoAPServer *)server representation:(ICoAPMessage *)representation;
+
+/*
+ *  'updateRepresentation:':
+ *  Replaces the representation and notifies all observers.
+ */
+- (void)updateRepresentation:(ICoAPMessage *)representation;
+
+/*
+ *  'setConfirmableInterval:forObserverWithToken:address:':
+ *  Changes the share of confirmable notifications of a single observer.
+ */
+- (void)setConfirmableInterval:(uint)interval forObserverWithToken:(uint)token address:(NSData *)address;
+
+/*
+ *  'removeAllObservers':
+ *  Forgets all observers without notifying them.
+ */
+- (void)removeAllObservers;
+
+/*
+ *  'handleTransaction:':
+ *  Answers a request to the resource, registering or removing observers.
+ */
+- (void)handleTransaction:(ICoAPServerTransaction *)transaction;
+
+/*
+ *  'handleEmptyMessageWithType:messageID:fromAddress:':
+ *  Handles an ACK or RST. Returns NO if it does not belong to a notification.
+ */
+- (BOOL)handleEmptyMessageWithType:(ICoAPType)type messageID:(uint)messageID fromAddress:(NSData *)address;
+
+@end
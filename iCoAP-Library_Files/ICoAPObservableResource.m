@@ -0,0 +1,419 @@
+//
+//  ICoAPObservableResource.m
+//  iCoAP
+//
+
+
+#import "ICoAPObservableResource.h"
+#import "ICoAPServer.h"
+#import <sys/uio.h>
+
+
+static inline NSData *ICoAPObserverKey(NSData *address, uint value) {
+    NSMutableData *key = [NSMutableData dataWithData:address];
+    uint8_t valueBytes[4] = {(value >> 24) & 0xFF, (value >> 16) & 0xFF, (value >> 8) & 0xFF, value & 0xFF};
+    [key appendBytes:valueBytes length:4];
+    return key;
+}
+
+static inline uint8_t ICoAPTokenLength(uint32_t token) {
+    return token == 0 ? 0 : token <= 0xFF ? 1 : token <= 0xFFFF ? 2 : token <= 0xFFFFFF ? 3 : 4;
+}
+
+//Returns the offset of the value of the Observe option in an encoded message without token
+static NSUInteger ICoAPObserveValueOffset(const uint8_t *bytes, NSUInteger length) {
+    NSUInteger i = 4;
+    uint option = 0;
+
+    while (i < length && bytes[i] != 0xFF) {
+        uint delta = bytes[i] >> 4;
+        uint optionLength = bytes[i] & 0x0F;
+        i++;
+
+        if (delta == k8bitIntForOption && i < length) {
+            delta = bytes[i++] + 13;
+        }
+        else if (delta == k16bitIntForOption && i + 1 < length) {
+            delta = (bytes[i] << 8 | bytes[i + 1]) + 269;
+            i += 2;
+        }
+        if (optionLength == k8bitIntForOption && i < length) {
+            optionLength = bytes[i++] + 13;
+        }
+        else if (optionLength == k16bitIntForOption && i + 1 < length) {
+            optionLength = (bytes[i] << 8 | bytes[i + 1]) + 269;
+            i += 2;
+        }
+
+        option += delta;
+        if (option == IC_OBSERVE) {
+            return optionLength == 3 && i + 3 <= length ? i : NSNotFound;
+        }
+        i += optionLength;
+    }
+    return NSNotFound;
+}
+
+
+
+
+@interface ICoAPObservableResource ()
+- (NSUInteger)addObserverWithToken:(uint)token address:(NSData *)address;
+- (void)removeObserverAtSlot:(NSUInteger)slot;
+- (void)compileNotificationTemplate;
+- (void)queueNotificationForObserverAtSlot:(NSUInteger)slot;
+- (void)queueNotificationWithType:(ICoAPType)type messageID:(uint)messageID observer:(ICoAPObserverRecord *)observer;
+- (void)flushNotifications;
+- (void)onRetransmissionTimer;
+@end
+
+@implementation ICoAPObservableResource
+
+#pragma mark - Init
+
+- (id)initWithServer:(ICoAPServer *)server representation:(ICoAPMessage *)representation {
+    if (self = [super init]) {
+        self.server = server;
+        self.confirmableInterval = kObserverConfirmableInterval;
+        codec = [[ICoAPExchange alloc] init];
+        capacity = kObserverInitialCapacity;
+        observers = calloc(capacity, sizeof(ICoAPObserverRecord));
+        freeSlots = [[NSMutableIndexSet alloc] init];
+        observerSlots = [[NSMutableDictionary alloc] init];
+        confirmationSlots = [[NSMutableDictionary alloc] init];
+        sequenceNumber = arc4random() % kMaxObserveOptionValue;
+
+        __weak ICoAPObservableResource *weakSelf = self;
+        retransmissionTimer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, server.serverQueue);
+        dispatch_source_set_timer(retransmissionTimer, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(kObserveFanoutTimerInterval * NSEC_PER_SEC)), (uint64_t)(kObserveFanoutTimerInterval * NSEC_PER_SEC), (uint64_t)(kObserveFanoutTimerInterval * NSEC_PER_SEC / 10));
+        dispatch_source_set_event_handler(retransmissionTimer, ^{
+            [weakSelf onRetransmissionTimer];
+        });
+        dispatch_resume(retransmissionTimer);
+
+        _representation = [representation copy];
+        [self compileNotificationTemplate];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    dispatch_source_cancel(retransmissionTimer);
+    free(observers);
+}
+
+#pragma mark - Observers
+
+- (NSUInteger)addObserverWithToken:(uint)token address:(NSData *)address {
+    NSData *key = ICoAPObserverKey(address, token);
+    NSNumber *existingSlot = [observerSlots objectForKey:key];
+    if (existingSlot) {
+        return [existingSlot unsignedIntegerValue];
+    }
+
+    NSUInteger slot = [freeSlots firstIndex];
+    if (slot != NSNotFound) {
+        [freeSlots removeIndex:slot];
+    }
+    else {
+        if (usedSlots == capacity) {
+            observers = realloc(observers, capacity * 2 * sizeof(ICoAPObserverRecord));
+            memset(observers + capacity, 0, capacity * sizeof(ICoAPObserverRecord));
+            capacity *= 2;
+        }
+        slot = usedSlots++;
+    }
+
+    ICoAPObserverRecord *observer = &observers[slot];
+    memset(observer, 0, sizeof(ICoAPObserverRecord));
+    observer->addressLength = (socklen_t)MIN([address length], sizeof(struct sockaddr_storage));
+    [address getBytes:&observer->address length:observer->addressLength];
+    observer->token = token;
+    observer->confirmableInterval = MAX(self.confirmableInterval, 1);
+    observer->state = IC_OBSERVER_IDLE;
+
+    [observerSlots setObject:[NSNumber numberWithUnsignedInteger:slot] forKey:key];
+    _observerCount++;
+    return slot;
+}
+
+- (void)removeObserverAtSlot:(NSUInteger)slot {
+    ICoAPObserverRecord *observer = &observers[slot];
+    if (observer->state == IC_OBSERVER_FREE) {
+        return;
+    }
+
+    NSData *address = [NSData dataWithBytes:&observer->address length:observer->addressLength];
+    if (observer->state == IC_OBSERVER_AWAITING_ACK) {
+        [confirmationSlots removeObjectForKey:ICoAPObserverKey(address, observer->messageID)];
+    }
+    [observerSlots removeObjectForKey:ICoAPObserverKey(address, observer->token)];
+
+    observer->state = IC_OBSERVER_FREE;
+    [freeSlots addIndex:slot];
+    _observerCount--;
+}
+
+- (void)removeAllObservers {
+    [observerSlots removeAllObjects];
+    [confirmationSlots removeAllObjects];
+    [freeSlots removeAllIndexes];
+    memset(observers, 0, capacity * sizeof(ICoAPObserverRecord));
+    usedSlots = 0;
+    _observerCount = 0;
+}
+
+- (void)setConfirmableInterval:(uint)interval forObserverWithToken:(uint)token address:(NSData *)address {
+    NSNumber *slot = [observerSlots objectForKey:ICoAPObserverKey(address, token)];
+    if (slot) {
+        observers[[slot unsignedIntegerValue]].confirmableInterval = MAX(interval, 1);
+    }
+}
+
+#pragma mark - Requests
+
+- (void)handleTransaction:(ICoAPServerTransaction *)transaction {
+    ICoAPMessage *request = transaction.request;
+
+    if (request.code != IC_GET) {
+        if (self.handler) {
+            self.handler(transaction);
+        }
+        else {
+            ICoAPMessage *response = [[ICoAPMessage alloc] init];
+            response.code = IC_METHOD_NOT_ALLOWED;
+            [transaction respondWithCoAPMessage:response];
+        }
+        return;
+    }
+
+    ICoAPMessage *response = [self.representation copy];
+    if (!response) {
+        response = [[ICoAPMessage alloc] init];
+        response.code = IC_NOT_FOUND;
+        [transaction respondWithCoAPMessage:response];
+        return;
+    }
+
+    NSArray *observeValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+    if (observeValues && [[observeValues objectAtIndex:0] intValue] == 0) {
+        [self addObserverWithToken:request.token address:transaction.address];
+        [response.optionDict setObject:[NSMutableArray arrayWithObject:[NSString stringWithFormat:@"%u", sequenceNumber]] forKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+    }
+    else if (observeValues) {
+        NSNumber *slot = [observerSlots objectForKey:ICoAPObserverKey(transaction.address, request.token)];
+        if (slot) {
+            [self removeObserverAtSlot:[slot unsignedIntegerValue]];
+        }
+    }
+    [transaction respondWithCoAPMessage:response];
+}
+
+- (BOOL)handleEmptyMessageWithType:(ICoAPType)type messageID:(uint)messageID fromAddress:(NSData *)address {
+    NSData *key = ICoAPObserverKey(address, messageID);
+    NSNumber *slotNumber = [confirmationSlots objectForKey:key];
+
+    if (!slotNumber) {
+        //RST to a non-confirmable notification: the observer is found by its most recent Message ID
+        if (type != IC_RESET) {
+            return NO;
+        }
+        for (NSUInteger slot = 0; slot < usedSlots; slot++) {
+            ICoAPObserverRecord *observer = &observers[slot];
+            if (observer->state != IC_OBSERVER_FREE && observer->messageID == messageID && observer->addressLength == [address length] && memcmp(&observer->address, [address bytes], observer->addressLength) == 0) {
+                [self removeObserverAtSlot:slot];
+                return YES;
+            }
+        }
+        return NO;
+    }
+
+    NSUInteger slot = [slotNumber unsignedIntegerValue];
+    if (type == IC_RESET) {
+        [self removeObserverAtSlot:slot];
+        return YES;
+    }
+
+    [confirmationSlots removeObjectForKey:key];
+    ICoAPObserverRecord *observer = &observers[slot];
+    observer->state = IC_OBSERVER_IDLE;
+
+    //Notifications were dropped meanwhile: the observer catches up with the latest state
+    if (observer->hasDroppedNotification) {
+        observer->hasDroppedNotification = NO;
+        [self queueNotificationForObserverAtSlot:slot];
+        [self flushNotifications];
+    }
+    return YES;
+}
+
+#pragma mark - Notifications
+
+- (void)updateRepresentation:(ICoAPMessage *)representation {
+    _representation = [representation copy];
+    sequenceNumber = (sequenceNumber + 1) % (2 * kMaxObserveOptionValue);
+    [self compileNotificationTemplate];
+
+    for (NSUInteger slot = 0; slot < usedSlots; slot++) {
+        ICoAPObserverRecord *observer = &observers[slot];
+        if (observer->state == IC_OBSERVER_AWAITING_ACK) {
+            observer->hasDroppedNotification = YES;
+        }
+        else if (observer->state == IC_OBSERVER_IDLE) {
+            [self queueNotificationForObserverAtSlot:slot];
+        }
+    }
+    [self flushNotifications];
+}
+
+//Encodes the representation once, without header and token, with the current sequence number
+- (void)compileNotificationTemplate {
+    notificationTemplate = nil;
+    if (!self.representation) {
+        return;
+    }
+
+    ICoAPMessage *cO = [self.representation copy];
+    cO.type = IC_NON_CONFIRMABLE;
+    cO.messageID = 0;
+    cO.token = 0;
+    cO.isRequest = NO;
+    [cO.optionDict setObject:[NSMutableArray arrayWithObject:[NSString stringWithFormat:@"%i", kObserveTemplateValue]] forKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+
+    NSMutableData *data = [[codec encodeDataFromCoAPMessage:cO] mutableCopy];
+    NSUInteger offset = ICoAPObserveValueOffset([data bytes], [data length]);
+    if (offset == NSNotFound) {
+        return;
+    }
+
+    uint8_t *bytes = [data mutableBytes];
+    bytes[offset] = (sequenceNumber >> 16) & 0xFF;
+    bytes[offset + 1] = (sequenceNumber >> 8) & 0xFF;
+    bytes[offset + 2] = sequenceNumber & 0xFF;
+
+    notificationCode = bytes[1];
+    notificationTemplate = [data subdataWithRange:NSMakeRange(4, [data length] - 4)];
+}
+
+- (void)queueNotificationForObserverAtSlot:(NSUInteger)slot {
+    ICoAPObserverRecord *observer = &observers[slot];
+    uint messageID = [self.server nextMessageID];
+    observer->notificationsSinceConfirmable++;
+
+    if (observer->notificationsSinceConfirmable < observer->confirmableInterval) {
+        observer->messageID = messageID;
+        [self queueNotificationWithType:IC_NON_CONFIRMABLE messageID:messageID observer:observer];
+        return;
+    }
+
+    NSData *address = [NSData dataWithBytes:&observer->address length:observer->addressLength];
+    observer->notificationsSinceConfirmable = 0;
+    observer->state = IC_OBSERVER_AWAITING_ACK;
+    observer->messageID = messageID;
+    observer->pendingSequenceNumber = sequenceNumber;
+    observer->retransmissionCounter = 0;
+    observer->retransmissionTimeout = kACK_TIMEOUT + kACK_TIMEOUT * (kACK_RANDOM_FACTOR - 1) * arc4random_uniform(1001) / 1000.0;
+    observer->retransmissionTime = CFAbsoluteTimeGetCurrent() + observer->retransmissionTimeout;
+    [confirmationSlots setObject:[NSNumber numberWithUnsignedInteger:slot] forKey:ICoAPObserverKey(address, messageID)];
+
+    [self queueNotificationWithType:IC_CONFIRMABLE messageID:messageID observer:observer];
+}
+
+- (void)queueNotificationWithType:(ICoAPType)type messageID:(uint)messageID observer:(ICoAPObserverRecord *)observer {
+    if (!notificationTemplate) {
+        return;
+    }
+    if (pendingNotificationCount == kObserveFanoutBatchSize) {
+        [self flushNotifications];
+    }
+
+    //Only the header and the token differ between observers
+    ICoAPNotificationHeader *notification = &pendingNotifications[pendingNotificationCount++];
+    uint8_t tokenLength = ICoAPTokenLength(observer->token);
+    notification->header[0] = type << 4 | tokenLength;
+    notification->header[1] = notificationCode;
+    notification->header[2] = (messageID >> 8) & 0xFF;
+    notification->header[3] = messageID & 0xFF;
+    for (uint8_t i = 0; i < tokenLength; i++) {
+        notification->header[4 + i] = (observer->token >> (8 * (tokenLength - 1 - i))) & 0xFF;
+    }
+    notification->headerLength = 4 + tokenLength;
+    notification->addressLength = observer->addressLength;
+    memcpy(&notification->address, &observer->address, observer->addressLength);
+}
+
+- (void)flushNotifications {
+    GCDAsyncUdpSocket *socket = self.server.udpSocket;
+    if (pendingNotificationCount == 0 || !socket) {
+        pendingNotificationCount = 0;
+        return;
+    }
+
+    ICoAPNotificationHeader *notifications = pendingNotifications;
+    uint notificationCount = pendingNotificationCount;
+    NSData *body = notificationTemplate;
+
+    [socket performBlock:^{
+        int socket4FD = [socket socket4FD];
+        int socket6FD = [socket socket6FD];
+        struct iovec iov[2];
+        struct msghdr message;
+        memset(&message, 0, sizeof(message));
+        iov[1].iov_base = (void *)[body bytes];
+        iov[1].iov_len = [body length];
+
+        for (uint i = 0; i < notificationCount; i++) {
+            int fd = notifications[i].address.ss_family == AF_INET6 ? socket6FD : socket4FD;
+            if (fd == -1) {
+                continue;
+            }
+            iov[0].iov_base = notifications[i].header;
+            iov[0].iov_len = notifications[i].headerLength;
+            message.msg_name = &notifications[i].address;
+            message.msg_namelen = notifications[i].addressLength;
+            message.msg_iov = iov;
+            message.msg_iovlen = 2;
+            sendmsg(fd, &message, 0);
+        }
+    }];
+    pendingNotificationCount = 0;
+}
+
+- (void)onRetransmissionTimer {
+    if ([confirmationSlots count] == 0) {
+        return;
+    }
+
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    for (NSNumber *slotNumber in [confirmationSlots allValues]) {
+        NSUInteger slot = [slotNumber unsignedIntegerValue];
+        ICoAPObserverRecord *observer = &observers[slot];
+        if (observer->retransmissionTime > now) {
+            continue;
+        }
+
+        //Not acknowledged: the client is assumed to be gone (RFC 7641 Section 4.5)
+        if (observer->retransmissionCounter >= kMAX_RETRANSMIT) {
+            [self removeObserverAtSlot:slot];
+            continue;
+        }
+
+        observer->retransmissionCounter++;
+        observer->retransmissionTimeout *= 2;
+        observer->retransmissionTime = now + observer->retransmissionTimeout;
+
+        //A newer state replaces the retransmitted one, it needs a new Message ID (RFC 7641 Section 4.5.2)
+        if (observer->pendingSequenceNumber != sequenceNumber) {
+            NSData *address = [NSData dataWithBytes:&observer->address length:observer->addressLength];
+            [confirmationSlots removeObjectForKey:ICoAPObserverKey(address, observer->messageID)];
+            observer->messageID = [self.server nextMessageID];
+            observer->pendingSequenceNumber = sequenceNumber;
+            observer->hasDroppedNotification = NO;
+            [confirmationSlots setObject:slotNumber forKey:ICoAPObserverKey(address, observer->messageID)];
+        }
+        [self queueNotificationWithType:IC_CONFIRMABLE messageID:observer->messageID observer:observer];
+    }
+    [self flushNotifications];
+}
+
+@end
@@ -0,0 +1,269 @@
+//
+//  ICoAPObserveRegistry.h
+//  iCoAP
+//
+
+
+/*
+ *  This class keeps a large number of Observe subscriptions
+ *  (RFC 7641) to many CoAP-Servers on one shared UDP socket.
+
+ *  Instead of one ICoAPExchange object with its own socket and
+ *  timers per subscription, every subscription is a compact record
+ *  (sizeof(ICoAPObservationRecord) bytes) in an open-addressing hash
+ *  table keyed by the peer and the token. Incoming notifications are
+ *  routed to their record with a single table lookup, ordered with
+ *  the Observe option value and passed to the delegate.
+ *  The record holds the registration state as well. The request is
+ *  kept once per peer and request (e.g. the same path on every
+ *  device) without token and Message ID, and only encoded into a
+ *  message while its registration is sent.
+
+ *  Cancelled subscriptions are forgotten immediately, later
+ *  notifications are answered with a RST (RFC 7641 Section 3.6).
+
+ *  The Max-Age of every notification is tracked. Before it expires,
+ *  the subscription is registered again at a random point in the
+ *  second half of the Max-Age, in batches of at most
+ *  'reregistrationBatchSize' requests per second, so that the
+ *  re-registrations of many subscriptions do not arrive at once.
+ *  If the socket fails, all subscriptions are registered again on
+ *  a new socket in the same way.
+
+ *  A delivery policy per subscription lets notification storms be
+ *  thinned out: only the latest notification of a time window, or at
+ *  most N notifications per second, are decoded and delivered.
+
+ *  Notifications are matched against their source address, so the
+ *  hosts have to be given as numeric IP addresses.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+#import "ICoAPMessage.h"
+#import "ICoAPDeduplicationCache.h"
+
+
+#define kObserveRegistryCapacity            1024    //Initial number of table slots, power of two
+#define kObserveRegistryTimerInterval       0.1
+#define kDefaultMaxAge                      60      //Seconds, if a notification has no Max-Age option
+#define kReregistrationTimerInterval        1.0
+#define kReregistrationBatchSize            16
+#define kReregistrationEarliest             0.5     //Re-register between these fractions of the Max-Age
+#define kReregistrationLatest               0.9
+#define kSocketRecoverySpread               10.0    //Seconds over which subscriptions are re-registered after a socket error
+
+
+typedef enum {
+    IC_DELIVER_ALL,                 //  Every notification is delivered
+    IC_DELIVER_LATEST,              //  Only the latest notification within the interval is delivered at its end
+    IC_DELIVER_RATE_LIMITED         //  At most one notification per interval, held back ones are replaced by newer ones
+} ICoAPNotificationDelivery;
+
+
+typedef struct {
+    uint64_t recentNotificationTime;
+    CFAbsoluteTime nextDeliveryTime;
+    CFAbsoluteTime reregistrationTime;
+    CFAbsoluteTime registrationDeadline;
+    uint32_t peerHash;
+    uint32_t token;
+    uint32_t observeValue;
+    uint32_t peerIndex;
+    uint32_t templateIndex;
+    float deliveryInterval;
+    float registrationTimeout;
+    uint16_t messageID;
+    uint8_t retransmissions;
+    uint8_t deliveryPolicy;
+    uint8_t state;
+    uint8_t flags;
+} ICoAPObservationRecord;
+
+
+@class ICoAPExchange;
+@class ICoAPObserveSharedValues;
+
+
+@interface ICoAPObserveRegistry : NSObject<GCDAsyncUdpSocketDelegate> {
+    ICoAPObservationRecord *records;
+    NSUInteger capacity;
+    NSUInteger usedSlots;
+    NSUInteger count;
+    uint randomMessageId;
+    ICoAPObserveSharedValues *peers;
+    ICoAPObserveSharedValues *templates;
+    NSMutableDictionary *pendingRegistrations;
+    NSTimer *retransmissionTimer;
+    NSTimer *reregistrationTimer;
+    NSMutableDictionary *pendingNotifications;
+    NSTimer *deliveryTimer;
+    ICoAPDeduplicationCache *deduplicationCache;
+    ICoAPExchange *codec;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+@property (weak, nonatomic) id delegate;
+
+/*
+ *  'udpSocket':
+ *  The shared GCDAsyncUdpSocket of all subscriptions.
+ */
+@property (strong, nonatomic) GCDAsyncUdpSocket *udpSocket;
+
+/*
+ *  'udpPort':
+ *  The udpPort for listening. (Optional)
+ */
+@property (readwrite, nonatomic) uint udpPort;
+
+/*
+ *  'observationCount':
+ *  Number of active subscriptions, including the ones waiting for
+ *  the response to their registration.
+ */
+@property (readonly, nonatomic) NSUInteger observationCount;
+
+/*
+ *  'reregistrationBatchSize':
+ *  Maximum number of re-registrations sent per kReregistrationTimerInterval.
+ *  Default is kReregistrationBatchSize.
+ */
+@property (readwrite, nonatomic) uint reregistrationBatchSize;
+
+/*
+ *  'defaultDeliveryPolicy':
+ *  Delivery policy of new subscriptions. Default is IC_DELIVER_ALL.
+ */
+@property (readwrite, nonatomic) ICoAPNotificationDelivery defaultDeliveryPolicy;
+
+/*
+ *  'defaultDeliveryInterval':
+ *  Interval in seconds of the delivery policy of new subscriptions.
+ */
+@property (readwrite, nonatomic) NSTimeInterval defaultDeliveryInterval;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'initWithDelegate:':
+ *  Initialization with a delegate.
+ */
+- (id)initWithDelegate:(id)delegate;
+
+/*
+ *  'observeWithCoAPMessage:toHost:port:':
+ *  Registers the GET request 'cO' as Observe subscription at the CoAP-Server.
+ *  An Observe option is added if missing, the token and Message ID are chosen
+ *  by the registry. Returns the token which identifies the subscription
+ *  together with 'host' and 'port', or 0 if the socket could not be set up.
+ */
+- (uint)observeWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'setDeliveryPolicy:interval:forObservationWithToken:host:port:':
+ *  Changes how notifications of the subscription are passed to the delegate.
+ *  With IC_DELIVER_LATEST a notification is held back for 'interval' seconds and
+ *  replaced by newer ones arriving meanwhile. IC_DELIVER_RATE_LIMITED delivers at
+ *  most one notification per 'interval' (1/N for N notifications per second).
+ *  Replaced notifications are dropped without being decoded, confirmable ones
+ *  are acknowledged on arrival nevertheless. Switching to IC_DELIVER_ALL passes
+ *  a held back notification to the delegate before this method returns.
+ */
+- (void)setDeliveryPolicy:(ICoAPNotificationDelivery)policy interval:(NSTimeInterval)interval forObservationWithToken:(uint)token host:(NSString *)host port:(uint)port;
+
+/*
+ *  'cancelObservationWithToken:host:port:':
+ *  Forgets the subscription. The next notification of the server is
+ *  answered with a RST, which ends the subscription on the server.
+ */
+- (void)cancelObservationWithToken:(uint)token host:(NSString *)host port:(uint)port;
+
+/*
+ *  'cancelAllObservations':
+ *  Forgets all subscriptions.
+ */
+- (void)cancelAllObservations;
+
+/*
+ *  'close':
+ *  Cancels all subscriptions and closes the UDP socket.
+ */
+- (void)close;
+
+@end
+
+
+
+
+
+
+
+#pragma mark - Delegate Protocol Definition
+
+
+
+
+
+
+
+@protocol ICoAPObserveRegistryDelegate <NSObject>
+@optional
+
+/*
+ *  'observeRegistry:didReceiveNotification:token:':
+ *  Informs the delegate about a new notification (or the final response) of the
+ *  subscription identified by 'token' and the 'host' and 'port' of 'coapMessage'.
+ *  Responses without Observe option end the subscription.
+ */
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didReceiveNotification:(ICoAPMessage *)coapMessage token:(uint)token;
+
+/*
+ *  'observeRegistry:didFailObservationWithToken:host:port:error:':
+ *  Informs the delegate that the registration of a subscription was not answered
+ *  or rejected. The error code matches the defined 'ICoAPExchangeErrorCode'.
+ */
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didFailObservationWithToken:(uint)token host:(NSString *)host port:(uint)port error:(NSError *)error;
+
+/*
+ *  'observeRegistry:didFailWithError:':
+ *  Informs the delegate that the UDP socket failed and could not be set up again.
+ *  All subscriptions are forgotten. The error code matches the defined
+ *  'ICoAPExchangeErrorCode'.
+ */
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didFailWithError:(NSError *)error;
+
+@end
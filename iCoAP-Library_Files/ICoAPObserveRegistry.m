@@ -0,0 +1,771 @@
+//
+//  ICoAPObserveRegistry.m
+//  iCoAP
+//
+
+
+#import "ICoAPObserveRegistry.h"
+#import "ICoAPExchange.h"
+
+
+enum {
+    IC_SLOT_EMPTY,
+    IC_SLOT_USED,
+    IC_SLOT_DELETED
+};
+
+#define kObservationHasNotification         0x01
+#define kObservationHasPendingNotification  0x02
+#define kObservationIsRegistering           0x04
+
+
+static inline uint32_t ICoAPPeerHashFromHost(NSString *host, uint port) {
+    //FNV-1a
+    const char *bytes = [host UTF8String];
+    uint32_t hash = 2166136261u;
+    for (NSUInteger i = 0; bytes[i] != '\0'; i++) {
+        hash = (hash ^ (uint8_t)bytes[i]) * 16777619u;
+    }
+    hash = (hash ^ (port >> 8)) * 16777619u;
+    return (hash ^ (port & 0xFF)) * 16777619u;
+}
+
+static inline NSNumber *ICoAPObservationKey(uint32_t peerHash, uint32_t token) {
+    return [NSNumber numberWithUnsignedLongLong:(uint64_t)peerHash << 32 | token];
+}
+
+static BOOL ICoAPReadUintOption(const uint8_t *bytes, NSUInteger length, uint option, uint *value) {
+    //Options start after the header and token, only the deltas up to 'option' are read
+    NSUInteger index = 4 + (bytes[0] & 0x0F);
+    uint optionNumber = 0;
+
+    while (index < length && bytes[index] != 0xFF) {
+        uint delta = bytes[index] >> 4;
+        uint optionLength = bytes[index] & 0x0F;
+        index++;
+
+        //Extended delta and length take up to four more bytes
+        if (index + 4 > length && (delta >= k8bitIntForOption || optionLength >= k8bitIntForOption)) {
+            return NO;
+        }
+
+        if (delta == k8bitIntForOption) {
+            delta = 13 + bytes[index++];
+        }
+        else if (delta == k16bitIntForOption) {
+            delta = 269 + (bytes[index] << 8 | bytes[index + 1]);
+            index += 2;
+        }
+        if (optionLength == k8bitIntForOption) {
+            optionLength = 13 + bytes[index++];
+        }
+        else if (optionLength == k16bitIntForOption) {
+            optionLength = 269 + (bytes[index] << 8 | bytes[index + 1]);
+            index += 2;
+        }
+        if (delta == kOptionDeltaPayloadIndicator || optionLength == kOptionDeltaPayloadIndicator || index + optionLength > length) {
+            return NO;
+        }
+
+        optionNumber += delta;
+        if (optionNumber == option && optionLength <= 4) {
+            *value = 0;
+            for (uint i = 0; i < optionLength; i++) {
+                *value = *value << 8 | bytes[index + i];
+            }
+            return YES;
+        }
+        if (optionNumber > option) {
+            return NO;
+        }
+        index += optionLength;
+    }
+    return NO;
+}
+
+static inline NSUInteger ICoAPObservationSlot(uint32_t peerHash, uint32_t token) {
+    uint32_t h = peerHash ^ (token * 2654435761u);
+    h ^= h >> 16;
+    h *= 0x85EBCA6Bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static NSData *ICoAPRegistrationDataFromTemplate(NSData *template, uint32_t token, uint messageID) {
+    //Same token length as the codec of ICoAPExchange uses
+    uint tokenLength = token == 0 ? 0 : token < 255 ? 1 : token <= 65535 ? 2 : token <= 16777215 ? 3 : 4;
+    const uint8_t *templateBytes = [template bytes];
+
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:[template length] + tokenLength];
+    uint8_t *bytes = [data mutableBytes];
+    bytes[0] = (templateBytes[0] & 0xF0) | tokenLength;
+    bytes[1] = templateBytes[1];
+    bytes[2] = (messageID >> 8) & 0xFF;
+    bytes[3] = messageID & 0xFF;
+    for (uint i = 0; i < tokenLength; i++) {
+        bytes[4 + i] = (token >> (8 * (tokenLength - 1 - i))) & 0xFF;
+    }
+    memcpy(bytes + 4 + tokenLength, templateBytes + 4, [template length] - 4);
+    return data;
+}
+
+
+
+
+//Values shared by many records, which refer to them by index
+@interface ICoAPObserveSharedValues : NSObject {
+    NSMutableArray *values;
+    NSMutableArray *useCounts;
+    NSMutableDictionary *indexes;
+    NSMutableIndexSet *freeIndexes;
+}
+- (uint32_t)retainIndexOfValue:(id<NSCopying>)value;
+- (id)valueAtIndex:(uint32_t)index;
+- (void)releaseIndex:(uint32_t)index;
+- (void)removeAllValues;
+@end
+
+@implementation ICoAPObserveSharedValues
+
+- (id)init {
+    if (self = [super init]) {
+        values = [[NSMutableArray alloc] init];
+        useCounts = [[NSMutableArray alloc] init];
+        indexes = [[NSMutableDictionary alloc] init];
+        freeIndexes = [[NSMutableIndexSet alloc] init];
+    }
+    return self;
+}
+
+- (uint32_t)retainIndexOfValue:(id<NSCopying>)value {
+    NSNumber *existingIndex = [indexes objectForKey:value];
+    if (existingIndex) {
+        uint32_t index = [existingIndex unsignedIntValue];
+        [useCounts replaceObjectAtIndex:index withObject:[NSNumber numberWithUnsignedInteger:[[useCounts objectAtIndex:index] unsignedIntegerValue] + 1]];
+        return index;
+    }
+
+    uint32_t index;
+    if ([freeIndexes count] > 0) {
+        index = (uint32_t)[freeIndexes firstIndex];
+        [freeIndexes removeIndex:index];
+        [values replaceObjectAtIndex:index withObject:value];
+        [useCounts replaceObjectAtIndex:index withObject:[NSNumber numberWithUnsignedInteger:1]];
+    }
+    else {
+        index = (uint32_t)[values count];
+        [values addObject:value];
+        [useCounts addObject:[NSNumber numberWithUnsignedInteger:1]];
+    }
+    [indexes setObject:[NSNumber numberWithUnsignedInt:index] forKey:value];
+    return index;
+}
+
+- (id)valueAtIndex:(uint32_t)index {
+    return [values objectAtIndex:index];
+}
+
+- (void)releaseIndex:(uint32_t)index {
+    NSUInteger useCount = [[useCounts objectAtIndex:index] unsignedIntegerValue] - 1;
+    if (useCount > 0) {
+        [useCounts replaceObjectAtIndex:index withObject:[NSNumber numberWithUnsignedInteger:useCount]];
+        return;
+    }
+
+    [indexes removeObjectForKey:[values objectAtIndex:index]];
+    [values replaceObjectAtIndex:index withObject:[NSNull null]];
+    [useCounts replaceObjectAtIndex:index withObject:[NSNumber numberWithUnsignedInteger:0]];
+    [freeIndexes addIndex:index];
+}
+
+- (void)removeAllValues {
+    [values removeAllObjects];
+    [useCounts removeAllObjects];
+    [indexes removeAllObjects];
+    [freeIndexes removeAllIndexes];
+}
+
+@end
+
+
+
+
+@interface ICoAPPendingNotification : NSObject
+@property (strong, nonatomic) NSData *data;
+@property (strong, nonatomic) NSData *address;
+@property (strong, nonatomic) NSDate *timestamp;
+@end
+
+@implementation ICoAPPendingNotification
+@end
+
+
+
+
+@interface ICoAPObserveRegistry ()
+- (BOOL)setupUdpSocket;
+- (ICoAPObservationRecord *)recordForPeerHash:(uint32_t)peerHash token:(uint32_t)token;
+- (ICoAPObservationRecord *)recordForKey:(NSNumber *)key;
+- (ICoAPObservationRecord *)insertRecordWithPeerHash:(uint32_t)peerHash token:(uint32_t)token;
+- (void)removeRecord:(ICoAPObservationRecord *)record;
+- (void)resizeTableToCapacity:(NSUInteger)newCapacity;
+- (void)sendRegistrationOfRecord:(ICoAPObservationRecord *)record;
+- (void)transmitRegistrationOfRecord:(ICoAPObservationRecord *)record;
+- (void)endRegistrationOfRecord:(ICoAPObservationRecord *)record;
+- (void)onReregistrationTimer;
+- (void)onRetransmissionTimer;
+- (void)failRegistrationOfRecord:(ICoAPObservationRecord *)record withErrorCode:(ICoAPExchangeErrorCode)code description:(NSString *)description;
+- (void)holdNotificationData:(NSData *)data fromAddress:(NSData *)address forRecord:(ICoAPObservationRecord *)record;
+- (ICoAPPendingNotification *)takePendingNotificationOfRecord:(ICoAPObservationRecord *)record;
+- (void)onDeliveryTimer;
+- (void)sendEmptyMessageWithMessageID:(uint)messageID type:(ICoAPType)type toAddress:(NSData *)address;
+- (void)sendNotificationToDelegateWithData:(NSData *)data fromAddress:(NSData *)address timestamp:(NSDate *)timestamp token:(uint)token;
+- (void)sendFailWithErrorToDelegateWithError:(NSError *)error;
+@end
+
+@implementation ICoAPObserveRegistry
+
+#pragma mark - Init
+
+- (id)init {
+    if (self = [super init]) {
+        capacity = kObserveRegistryCapacity;
+        records = calloc(capacity, sizeof(ICoAPObservationRecord));
+        randomMessageId = 1 + arc4random() % 65536;
+        peers = [[ICoAPObserveSharedValues alloc] init];
+        templates = [[ICoAPObserveSharedValues alloc] init];
+        pendingRegistrations = [[NSMutableDictionary alloc] init];
+        pendingNotifications = [[NSMutableDictionary alloc] init];
+        self.defaultDeliveryPolicy = IC_DELIVER_ALL;
+        self.reregistrationBatchSize = kReregistrationBatchSize;
+        deduplicationCache = [[ICoAPDeduplicationCache alloc] init];
+        codec = [[ICoAPExchange alloc] init];
+    }
+    return self;
+}
+
+- (id)initWithDelegate:(id)delegate {
+    if (self = [self init]) {
+        self.delegate = delegate;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    free(records);
+}
+
+- (BOOL)setupUdpSocket {
+    self.udpSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:dispatch_get_main_queue()];
+
+    NSError *error;
+    if (![self.udpSocket bindToPort:self.udpPort error:&error]) {
+        self.udpSocket = nil;
+        return NO;
+    }
+
+    if (![self.udpSocket beginReceiving:&error]) {
+        [self.udpSocket close];
+        self.udpSocket = nil;
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark - Observation Table
+
+- (NSUInteger)observationCount {
+    return count;
+}
+
+- (ICoAPObservationRecord *)recordForPeerHash:(uint32_t)peerHash token:(uint32_t)token {
+    NSUInteger mask = capacity - 1;
+
+    //Linear probing, the load factor keeps at least one empty slot
+    for (NSUInteger i = ICoAPObservationSlot(peerHash, token) & mask; ; i = (i + 1) & mask) {
+        ICoAPObservationRecord *record = &records[i];
+
+        if (record->state == IC_SLOT_EMPTY) {
+            return NULL;
+        }
+        if (record->state == IC_SLOT_USED && record->token == token && record->peerHash == peerHash) {
+            return record;
+        }
+    }
+}
+
+- (ICoAPObservationRecord *)recordForKey:(NSNumber *)key {
+    return [self recordForPeerHash:[key unsignedLongLongValue] >> 32 token:[key unsignedLongLongValue] & 0xFFFFFFFF];
+}
+
+- (ICoAPObservationRecord *)insertRecordWithPeerHash:(uint32_t)peerHash token:(uint32_t)token {
+    //Deleted slots count towards the load, as they lengthen the probe sequences as well
+    if ((usedSlots + 1) * 4 > capacity * 3) {
+        NSUInteger newCapacity = capacity;
+        while ((count + 1) * 2 > newCapacity) {
+            newCapacity *= 2;
+        }
+        [self resizeTableToCapacity:newCapacity];
+    }
+
+    NSUInteger mask = capacity - 1;
+    NSUInteger i = ICoAPObservationSlot(peerHash, token) & mask;
+    while (records[i].state == IC_SLOT_USED) {
+        i = (i + 1) & mask;
+    }
+
+    ICoAPObservationRecord *record = &records[i];
+    if (record->state == IC_SLOT_EMPTY) {
+        usedSlots++;
+    }
+    memset(record, 0, sizeof(ICoAPObservationRecord));
+    record->state = IC_SLOT_USED;
+    record->peerHash = peerHash;
+    record->token = token;
+    record->deliveryPolicy = self.defaultDeliveryPolicy;
+    record->deliveryInterval = self.defaultDeliveryInterval;
+    record->reregistrationTime = DBL_MAX;
+    count++;
+    return record;
+}
+
+- (void)removeRecord:(ICoAPObservationRecord *)record {
+    [self endRegistrationOfRecord:record];
+    [peers releaseIndex:record->peerIndex];
+    [templates releaseIndex:record->templateIndex];
+
+    if (record->flags & kObservationHasPendingNotification) {
+        [pendingNotifications removeObjectForKey:ICoAPObservationKey(record->peerHash, record->token)];
+    }
+    record->state = IC_SLOT_DELETED;
+    count--;
+
+    //Without any record left all deleted slots can be reused at once
+    if (count == 0) {
+        memset(records, 0, capacity * sizeof(ICoAPObservationRecord));
+        usedSlots = 0;
+        [reregistrationTimer invalidate];
+        reregistrationTimer = nil;
+    }
+}
+
+- (void)resizeTableToCapacity:(NSUInteger)newCapacity {
+    ICoAPObservationRecord *oldRecords = records;
+    NSUInteger oldCapacity = capacity;
+
+    records = calloc(newCapacity, sizeof(ICoAPObservationRecord));
+    capacity = newCapacity;
+    usedSlots = count;
+
+    NSUInteger mask = capacity - 1;
+    for (NSUInteger j = 0; j < oldCapacity; j++) {
+        if (oldRecords[j].state != IC_SLOT_USED) {
+            continue;
+        }
+        NSUInteger i = ICoAPObservationSlot(oldRecords[j].peerHash, oldRecords[j].token) & mask;
+        while (records[i].state != IC_SLOT_EMPTY) {
+            i = (i + 1) & mask;
+        }
+        records[i] = oldRecords[j];
+    }
+    free(oldRecords);
+}
+
+#pragma mark - Observing
+
+- (uint)observeWithCoAPMessage:(ICoAPMessage *)cO toHost:(NSString *)host port:(uint)port {
+    if (!self.udpSocket && ![self setupUdpSocket]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+        return 0;
+    }
+
+    uint32_t peerHash = ICoAPPeerHashFromHost(host, port);
+    uint token;
+    do {
+        token = 1 + arc4random() % INT_MAX;
+    } while ([self recordForPeerHash:peerHash token:token]);
+
+    cO.isRequest = YES;
+    cO.type = IC_CONFIRMABLE;
+    cO.host = host;
+    cO.port = port;
+    if (![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]]) {
+        [cO addOption:IC_OBSERVE withValue:@""];
+    }
+
+    //The request is encoded without token and Message ID, so that equal requests share one template
+    cO.token = 0;
+    cO.messageID = 0;
+    NSData *template = [codec encodeDataFromCoAPMessage:cO];
+    cO.token = token;
+
+    ICoAPObservationRecord *record = [self insertRecordWithPeerHash:peerHash token:token];
+    record->peerIndex = [peers retainIndexOfValue:[NSArray arrayWithObjects:host, [NSNumber numberWithUnsignedInt:port], nil]];
+    record->templateIndex = [templates retainIndexOfValue:template];
+    [self sendRegistrationOfRecord:record];
+
+    if (![reregistrationTimer isValid]) {
+        reregistrationTimer = [NSTimer scheduledTimerWithTimeInterval:kReregistrationTimerInterval target:self selector:@selector(onReregistrationTimer) userInfo:nil repeats:YES];
+    }
+    return token;
+}
+
+- (void)setDeliveryPolicy:(ICoAPNotificationDelivery)policy interval:(NSTimeInterval)interval forObservationWithToken:(uint)token host:(NSString *)host port:(uint)port {
+    ICoAPObservationRecord *record = [self recordForPeerHash:ICoAPPeerHashFromHost(host, port) token:token];
+    if (!record) {
+        return;
+    }
+    record->deliveryPolicy = policy;
+    record->deliveryInterval = interval;
+
+    //A held back notification is released at once, before any newer one can be delivered
+    if (policy == IC_DELIVER_ALL) {
+        record->nextDeliveryTime = 0;
+        ICoAPPendingNotification *notification = [self takePendingNotificationOfRecord:record];
+        if (notification) {
+            [self sendNotificationToDelegateWithData:notification.data fromAddress:notification.address timestamp:notification.timestamp token:token];
+        }
+    }
+}
+
+- (void)cancelObservationWithToken:(uint)token host:(NSString *)host port:(uint)port {
+    ICoAPObservationRecord *record = [self recordForPeerHash:ICoAPPeerHashFromHost(host, port) token:token];
+    if (record) {
+        [self removeRecord:record];
+    }
+}
+
+- (void)cancelAllObservations {
+    [retransmissionTimer invalidate];
+    retransmissionTimer = nil;
+    [reregistrationTimer invalidate];
+    reregistrationTimer = nil;
+    [pendingRegistrations removeAllObjects];
+    [peers removeAllValues];
+    [templates removeAllValues];
+    [deliveryTimer invalidate];
+    deliveryTimer = nil;
+    [pendingNotifications removeAllObjects];
+    memset(records, 0, capacity * sizeof(ICoAPObservationRecord));
+    usedSlots = 0;
+    count = 0;
+}
+
+- (void)close {
+    [self cancelAllObservations];
+    self.udpSocket.delegate = nil;
+    [self.udpSocket close];
+    self.udpSocket = nil;
+}
+
+#pragma mark - Registration
+
+- (void)sendRegistrationOfRecord:(ICoAPObservationRecord *)record {
+    [self endRegistrationOfRecord:record];
+
+    do {
+        randomMessageId = (randomMessageId + 1) % 65536;
+    } while ([pendingRegistrations objectForKey:[NSNumber numberWithUnsignedInt:randomMessageId]]);
+
+    //Only registrations in flight have an entry, the record alone is enough while waiting for the next one
+    record->flags |= kObservationIsRegistering;
+    record->messageID = randomMessageId;
+    record->retransmissions = 0;
+    record->registrationTimeout = kACK_TIMEOUT * (1.0 + (kACK_RANDOM_FACTOR - 1.0) * arc4random_uniform(1001) / 1000.0);
+    [pendingRegistrations setObject:ICoAPObservationKey(record->peerHash, record->token) forKey:[NSNumber numberWithUnsignedInt:record->messageID]];
+    [self transmitRegistrationOfRecord:record];
+
+    if (![retransmissionTimer isValid]) {
+        retransmissionTimer = [NSTimer scheduledTimerWithTimeInterval:kObserveRegistryTimerInterval target:self selector:@selector(onRetransmissionTimer) userInfo:nil repeats:YES];
+    }
+}
+
+- (void)endRegistrationOfRecord:(ICoAPObservationRecord *)record {
+    if (!(record->flags & kObservationIsRegistering)) {
+        return;
+    }
+    record->flags &= ~kObservationIsRegistering;
+    [pendingRegistrations removeObjectForKey:[NSNumber numberWithUnsignedInt:record->messageID]];
+}
+
+- (void)onReregistrationTimer {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    uint sentCount = 0;
+
+    //Due subscriptions exceeding the batch stay due and are sent with the next ticks
+    for (NSUInteger i = 0; i < capacity && sentCount < self.reregistrationBatchSize; i++) {
+        ICoAPObservationRecord *record = &records[i];
+
+        if (record->state != IC_SLOT_USED || record->reregistrationTime > now) {
+            continue;
+        }
+        record->reregistrationTime = DBL_MAX;
+        [self sendRegistrationOfRecord:record];
+        sentCount++;
+    }
+}
+
+- (void)transmitRegistrationOfRecord:(ICoAPObservationRecord *)record {
+    NSArray *peer = [peers valueAtIndex:record->peerIndex];
+    NSData *data = ICoAPRegistrationDataFromTemplate([templates valueAtIndex:record->templateIndex], record->token, record->messageID);
+
+    record->registrationDeadline = CFAbsoluteTimeGetCurrent() + record->registrationTimeout * pow(2.0, record->retransmissions);
+    [self.udpSocket sendData:data toHost:[peer objectAtIndex:0] port:[[peer objectAtIndex:1] unsignedIntValue] withTimeout:-1 tag:0];
+}
+
+- (void)onRetransmissionTimer {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    for (NSNumber *messageID in [pendingRegistrations allKeys]) {
+        NSNumber *key = [pendingRegistrations objectForKey:messageID];
+        ICoAPObservationRecord *record = key ? [self recordForKey:key] : NULL;
+        if (!record) {
+            //Cancelled by the delegate while an earlier registration failed
+            continue;
+        }
+        if (record->registrationDeadline > now) {
+            continue;
+        }
+
+        if (record->retransmissions < kMAX_RETRANSMIT) {
+            record->retransmissions++;
+            [self transmitRegistrationOfRecord:record];
+        }
+        else {
+            [self failRegistrationOfRecord:record withErrorCode:IC_RESPONSE_TIMEOUT description:@"No Response expected for recently sent CoAP Message"];
+        }
+    }
+
+    if ([pendingRegistrations count] == 0) {
+        [retransmissionTimer invalidate];
+        retransmissionTimer = nil;
+    }
+}
+
+- (void)failRegistrationOfRecord:(ICoAPObservationRecord *)record withErrorCode:(ICoAPExchangeErrorCode)code description:(NSString *)description {
+    NSArray *peer = [peers valueAtIndex:record->peerIndex];
+    uint token = record->token;
+    [self removeRecord:record];
+
+    if ([self.delegate respondsToSelector:@selector(observeRegistry:didFailObservationWithToken:host:port:error:)]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:description forKey:NSLocalizedDescriptionKey];
+        [self.delegate observeRegistry:self didFailObservationWithToken:token host:[peer objectAtIndex:0] port:[[peer objectAtIndex:1] unsignedIntValue] error:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:code userInfo:userInfo]];
+    }
+}
+
+#pragma mark - GCD Async UDP Socket Delegate
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+    if ([data length] < 4) {
+        return;
+    }
+
+    const uint8_t *header = [data bytes];
+    uint type = header[0] >> 4;
+    uint tokenLength = header[0] & 0x0F;
+    uint messageID = header[2] << 8 | header[3];
+    ICoAPType responseType;
+
+    //Duplicate confirmable message: repeat the previous response without decoding
+    if (type == IC_CONFIRMABLE && [deduplicationCache lookupMessageID:messageID fromAddress:address responseType:&responseType]) {
+        [self sendEmptyMessageWithMessageID:messageID type:responseType toAddress:address];
+        return;
+    }
+
+    NSString *host = [GCDAsyncUdpSocket hostFromAddress:address];
+    uint port = [GCDAsyncUdpSocket portFromAddress:address];
+
+    //Empty ACK (separate response follows) or RST (registration rejected)
+    if (header[1] == IC_EMPTY) {
+        NSNumber *key = [pendingRegistrations objectForKey:[NSNumber numberWithUnsignedInt:messageID]];
+        ICoAPObservationRecord *record = key ? [self recordForKey:key] : NULL;
+        if (!record || record->peerHash != ICoAPPeerHashFromHost(host, port)) {
+            return;
+        }
+
+        if (type == IC_RESET) {
+            [self failRegistrationOfRecord:record withErrorCode:IC_OBSERVE_ERROR description:@"Observe registration rejected"];
+        }
+        else if (type == IC_ACKNOWLEDGMENT) {
+            [self endRegistrationOfRecord:record];
+        }
+        return;
+    }
+
+    if (tokenLength > 4 || [data length] < 4 + tokenLength) {
+        return;
+    }
+
+    uint token = 0;
+    for (uint i = 0; i < tokenLength; i++) {
+        token = token << 8 | header[4 + i];
+    }
+
+    //Notifications of unknown (or cancelled) subscriptions are rejected
+    ICoAPObservationRecord *record = [self recordForPeerHash:ICoAPPeerHashFromHost(host, port) token:token];
+    if (!record) {
+        if (type <= IC_NON_CONFIRMABLE) {
+            [self sendEmptyMessageWithMessageID:messageID type:IC_RESET toAddress:address];
+            if (type == IC_CONFIRMABLE) {
+                [deduplicationCache recordMessageID:messageID fromAddress:address responseType:IC_RESET];
+            }
+        }
+        return;
+    }
+
+    if (type == IC_CONFIRMABLE) {
+        [self sendEmptyMessageWithMessageID:messageID type:IC_ACKNOWLEDGMENT toAddress:address];
+        [deduplicationCache recordMessageID:messageID fromAddress:address responseType:IC_ACKNOWLEDGMENT];
+    }
+    else if (type == IC_ACKNOWLEDGMENT && record->messageID == messageID) {
+        [self endRegistrationOfRecord:record];
+    }
+
+    uint currentObserveValue;
+    if (header[1] < 128 && ICoAPReadUintOption(header, [data length], IC_OBSERVE, &currentObserveValue)) {
+        //Reordering (RFC 7641 Section 3.4): only newer notifications are delivered
+        uint64_t receiveTime = ICoAPMonotonicNanoseconds();
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+        if ((record->flags & kObservationHasNotification) && !ICoAPIsNotificationFresh(record->observeValue, record->recentNotificationTime, currentObserveValue, receiveTime)) {
+            return;
+        }
+        record->flags |= kObservationHasNotification;
+        record->observeValue = currentObserveValue;
+        record->recentNotificationTime = receiveTime;
+
+        //Max-Age: the subscription is renewed at a random point before the notification expires
+        uint maxAge = kDefaultMaxAge;
+        ICoAPReadUintOption(header, [data length], IC_MAX_AGE, &maxAge);
+        record->reregistrationTime = now + maxAge * (kReregistrationEarliest + (kReregistrationLatest - kReregistrationEarliest) * arc4random_uniform(1001) / 1000.0);
+
+        if (record->deliveryPolicy == IC_DELIVER_LATEST || (record->deliveryPolicy == IC_DELIVER_RATE_LIMITED && now < record->nextDeliveryTime)) {
+            [self holdNotificationData:data fromAddress:address forRecord:record];
+            return;
+        }
+        if (record->deliveryPolicy == IC_DELIVER_RATE_LIMITED) {
+            record->nextDeliveryTime = now + record->deliveryInterval;
+        }
+
+        //Delivered before the timer released the held back notification, which is outdated now
+        [self takePendingNotificationOfRecord:record];
+    }
+    else {
+        //A response without Observe option ends the subscription and supersedes held back notifications
+        [self removeRecord:record];
+    }
+
+    [self sendNotificationToDelegateWithData:data fromAddress:address timestamp:[[NSDate alloc] init] token:token];
+}
+
+- (void)udpSocketDidClose:(GCDAsyncUdpSocket *)sock withError:(NSError *)error {
+    self.udpSocket.delegate = nil;
+    self.udpSocket = nil;
+    [pendingRegistrations removeAllObjects];
+
+    //Subscriptions survive on a new socket, their registrations are spread over kSocketRecoverySpread
+    if (count > 0 && [self setupUdpSocket]) {
+        CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+        for (NSUInteger i = 0; i < capacity; i++) {
+            if (records[i].state == IC_SLOT_USED) {
+                records[i].flags &= ~kObservationIsRegistering;
+                records[i].reregistrationTime = now + kSocketRecoverySpread * arc4random_uniform(1001) / 1000.0;
+            }
+        }
+        return;
+    }
+
+    [self close];
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"UDP Socket Closed" forKey:NSLocalizedDescriptionKey];
+    [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+}
+
+#pragma mark - Notification Delivery
+
+- (void)holdNotificationData:(NSData *)data fromAddress:(NSData *)address forRecord:(ICoAPObservationRecord *)record {
+    //The first held back notification starts the window of IC_DELIVER_LATEST
+    if (record->deliveryPolicy == IC_DELIVER_LATEST && !(record->flags & kObservationHasPendingNotification)) {
+        record->nextDeliveryTime = CFAbsoluteTimeGetCurrent() + record->deliveryInterval;
+    }
+    record->flags |= kObservationHasPendingNotification;
+
+    //Replaces (and drops) the previously held back notification
+    ICoAPPendingNotification *notification = [[ICoAPPendingNotification alloc] init];
+    notification.data = data;
+    notification.address = address;
+    notification.timestamp = [[NSDate alloc] init];
+    [pendingNotifications setObject:notification forKey:ICoAPObservationKey(record->peerHash, record->token)];
+
+    if (![deliveryTimer isValid]) {
+        deliveryTimer = [NSTimer scheduledTimerWithTimeInterval:kObserveRegistryTimerInterval target:self selector:@selector(onDeliveryTimer) userInfo:nil repeats:YES];
+    }
+}
+
+- (ICoAPPendingNotification *)takePendingNotificationOfRecord:(ICoAPObservationRecord *)record {
+    if (!(record->flags & kObservationHasPendingNotification)) {
+        return nil;
+    }
+    record->flags &= ~kObservationHasPendingNotification;
+
+    NSNumber *key = ICoAPObservationKey(record->peerHash, record->token);
+    ICoAPPendingNotification *notification = [pendingNotifications objectForKey:key];
+    [pendingNotifications removeObjectForKey:key];
+    return notification;
+}
+
+- (void)onDeliveryTimer {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+
+    for (NSNumber *key in [pendingNotifications allKeys]) {
+        uint32_t peerHash = [key unsignedLongLongValue] >> 32;
+        uint32_t token = [key unsignedLongLongValue] & 0xFFFFFFFF;
+        ICoAPObservationRecord *record = [self recordForPeerHash:peerHash token:token];
+
+        if (!record || record->nextDeliveryTime > now) {
+            continue;
+        }
+        if (record->deliveryPolicy == IC_DELIVER_RATE_LIMITED) {
+            record->nextDeliveryTime = now + record->deliveryInterval;
+        }
+
+        ICoAPPendingNotification *notification = [self takePendingNotificationOfRecord:record];
+        [self sendNotificationToDelegateWithData:notification.data fromAddress:notification.address timestamp:notification.timestamp token:token];
+    }
+
+    if ([pendingNotifications count] == 0) {
+        [deliveryTimer invalidate];
+        deliveryTimer = nil;
+    }
+}
+
+- (void)sendEmptyMessageWithMessageID:(uint)messageID type:(ICoAPType)type toAddress:(NSData *)address {
+    uint8_t bytes[4];
+    ICoAPWriteEmptyMessage(bytes, type, messageID);
+    [self.udpSocket sendData:[NSData dataWithBytes:bytes length:4] toAddress:address withTimeout:-1 tag:0];
+}
+
+#pragma mark - Delegate Method Calls
+
+- (void)sendNotificationToDelegateWithData:(NSData *)data fromAddress:(NSData *)address timestamp:(NSDate *)timestamp token:(uint)token {
+    //Decoded only now, held back notifications which were replaced never reach this point
+    ICoAPMessage *cO = [codec decodeCoAPMessageFromData:data];
+    if (!cO) {
+        return;
+    }
+    cO.host = [GCDAsyncUdpSocket hostFromAddress:address];
+    cO.port = [GCDAsyncUdpSocket portFromAddress:address];
+    cO.timestamp = timestamp;
+
+    if ([self.delegate respondsToSelector:@selector(observeRegistry:didReceiveNotification:token:)]) {
+        [self.delegate observeRegistry:self didReceiveNotification:cO token:token];
+    }
+}
+
+- (void)sendFailWithErrorToDelegateWithError:(NSError *)error {
+    if ([self.delegate respondsToSelector:@selector(observeRegistry:didFailWithError:)]) {
+        [self.delegate observeRegistry:self didFailWithError:error];
+    }
+}
+
+@end
@@ -0,0 +1,243 @@
+//
+//  ICoAPPeerScheduler.h
+//  iCoAP
+//
+
+
+/*
+ *  This class coordinates the transmissions of several ICoAPExchange
+ *  objects towards the same CoAP-Server (peer).
+
+ *  Each peer is identified by its host and port. The scheduler
+ *  limits the number of outstanding interactions per peer to a
+ *  congestion window, which starts at NSTART and grows as long as
+ *  the peer acknowledges requests without retransmissions. Requests
+ *  exceeding the window are queued in FIFO or priority order.
+
+ *  If a peer stops responding, the scheduler falls back to a single
+ *  outstanding interaction and paces further requests according
+ *  to PROBING_RATE (RFC 7252 Section 4.7).
+
+ *  Additionally a smoothed round trip time is estimated for
+ *  every peer (RFC 6298), and a block size for block-wise transfers
+ *  is chosen from the loss statistics of previous blocks and the
+ *  results of path MTU probes.
+
+ *  The scheduler is not thread-safe and must only be used from the
+ *  main queue, which is the queue all ICoAPExchange objects operate on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+@class ICoAPPeerScheduler;
+
+
+typedef enum {
+    IC_SCHEDULING_FIFO,             //  Queued requests are granted in order of arrival
+    IC_SCHEDULING_PRIORITY          //  Queued requests with a higher priority are granted first
+} ICoAPSchedulingOrder;
+
+
+typedef enum {
+    IC_TRANSMISSION_CLEAN,          //  Response received without any retransmission
+    IC_TRANSMISSION_RETRANSMITTED,  //  Response received after at least one retransmission
+    IC_TRANSMISSION_TIMED_OUT,      //  No response received at all
+    IC_TRANSMISSION_UNCONFIRMED,    //  Non-confirmable request sent, no acknowledgment expected
+    IC_TRANSMISSION_CANCELLED       //  Exchange was closed by the application
+} ICoAPTransmissionOutcome;
+
+
+
+
+
+
+
+#pragma mark - Client Protocol Definition
+
+
+
+
+
+
+
+@protocol ICoAPPeerSchedulerClient <NSObject>
+
+/*
+ *  'peerSchedulerDidGrantTransmission:':
+ *  Informs the client that it may start its transmission now.
+ *  The client has to report the end of its interaction with
+ *  'releaseTransmissionForHost:port:outcome:'.
+ */
+- (void)peerSchedulerDidGrantTransmission:(ICoAPPeerScheduler *)scheduler;
+
+@end
+
+
+
+
+
+
+
+@interface ICoAPPeerScheduler : NSObject {
+    NSMutableDictionary *peerStates;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'nstart':
+ *  The initial number of outstanding interactions per peer.
+ *  Default is kNSTART.
+ */
+@property (readwrite, nonatomic) uint nstart;
+
+/*
+ *  'maxWindow':
+ *  Upper bound the per-peer window may grow to after clean
+ *  acknowledgments. Default is kMaxCongestionWindow.
+ */
+@property (readwrite, nonatomic) uint maxWindow;
+
+/*
+ *  'probingRate':
+ *  Average data rate in bytes per second which is not exceeded
+ *  towards a peer that does not respond. Default is kPROBING_RATE.
+ */
+@property (readwrite, nonatomic) double probingRate;
+
+/*
+ *  'schedulingOrder':
+ *  Order in which queued requests are granted. Default is IC_SCHEDULING_FIFO.
+ */
+@property (readwrite, nonatomic) ICoAPSchedulingOrder schedulingOrder;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'sharedScheduler':
+ *  Returns the scheduler which is shared across the application.
+ */
++ (ICoAPPeerScheduler *)sharedScheduler;
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'enqueueTransmissionForClient:priority:size:host:port:':
+ *  Queues the 'client' for a transmission to the given peer. The client
+ *  is granted immediately if the peer's window allows it.
+ *  'size' is the approximate number of bytes, used for pacing
+ *  unresponsive peers. The client is not retained while queued.
+ */
+- (void)enqueueTransmissionForClient:(id<ICoAPPeerSchedulerClient>)client priority:(int)priority size:(NSUInteger)size host:(NSString *)host port:(uint)port;
+
+/*
+ *  'cancelQueuedTransmissionForClient:host:port:':
+ *  Removes a not yet granted 'client' from the queue of the given peer.
+ */
+- (void)cancelQueuedTransmissionForClient:(id<ICoAPPeerSchedulerClient>)client host:(NSString *)host port:(uint)port;
+
+/*
+ *  'acquireTransmissionForHost:port:':
+ *  Takes one slot of the window of the given peer without queueing,
+ *  e.g. for every block of a pipelined transfer. Returns NO if the
+ *  window is exhausted, the peer is probed or clients are queued.
+ *  An acquired slot is released like a granted one.
+ */
+- (BOOL)acquireTransmissionForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'releaseTransmissionForHost:port:outcome:':
+ *  Reports the end of a granted interaction with the given peer.
+ *  The window of the peer is adapted according to the 'outcome'
+ *  and waiting clients are granted.
+ */
+- (void)releaseTransmissionForHost:(NSString *)host port:(uint)port outcome:(ICoAPTransmissionOutcome)outcome;
+
+/*
+ *  'recordRoundTripTime:forHost:port:':
+ *  Adds a round trip time sample (in seconds) to the estimator of the given peer.
+ *  Samples must not be taken from retransmitted messages.
+ */
+- (void)recordRoundTripTime:(NSTimeInterval)rtt forHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'smoothedRoundTripTimeForHost:port:':
+ *  Returns the smoothed round trip time of the given peer, or 0
+ *  if no sample was recorded yet.
+ */
+- (NSTimeInterval)smoothedRoundTripTimeForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'windowForHost:port:':
+ *  Returns the current number of allowed outstanding interactions of the given peer.
+ */
+- (uint)windowForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'outstandingTransmissionsForHost:port:':
+ *  Returns the number of granted but not yet released interactions of the given peer.
+ */
+- (uint)outstandingTransmissionsForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'recordBlockTransferOutcome:forHost:port:':
+ *  Adds the outcome of a block request to the loss statistics of the given peer.
+ *  A loss shrinks the preferred block size by one step (at most once per window),
+ *  kBlockSzxGrowthThreshold clean blocks in a row grow it again.
+ */
+- (void)recordBlockTransferOutcome:(ICoAPTransmissionOutcome)outcome forHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'recordPathMTUProbeWithBlockSzx:delivered:forHost:port:':
+ *  Reports whether a datagram large enough for a block of the size given by 'szx'
+ *  reached the given peer. Undelivered sizes above the largest delivered one
+ *  limit the block size of the peer, regardless of the order of the reports.
+ */
+- (void)recordPathMTUProbeWithBlockSzx:(uint)szx delivered:(BOOL)delivered forHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'blockSzxForHost:port:':
+ *  Returns the preferred block size exponent for block-wise transfers with the
+ *  given peer, the block size is 2^(szx + 4) Bytes.
+ */
+- (uint)blockSzxForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'maxBlockSzxForHost:port:':
+ *  Returns the largest block size exponent the path to the given peer is
+ *  assumed to carry without fragmentation.
+ */
+- (uint)maxBlockSzxForHost:(NSString *)host port:(uint)port;
+
+@end
@@ -0,0 +1,318 @@
+//
+//  ICoAPPeerScheduler.m
+//  iCoAP
+//
+
+
+#import "ICoAPPeerScheduler.h"
+#import "ICoAPExchange.h"
+
+
+
+
+@interface ICoAPQueuedTransmission : NSObject
+@property (weak, nonatomic) id<ICoAPPeerSchedulerClient> client;
+@property (readwrite, nonatomic) int priority;
+@property (readwrite, nonatomic) NSUInteger size;
+@end
+
+@implementation ICoAPQueuedTransmission
+@end
+
+
+
+
+@interface ICoAPPeerState : NSObject
+@property (strong, nonatomic) NSMutableArray *queue;
+@property (readwrite, nonatomic) uint window;
+@property (readwrite, nonatomic) uint outstanding;
+@property (readwrite, nonatomic) uint cleanAcknowledgments;
+@property (readwrite, nonatomic) BOOL isProbing;
+@property (readwrite, nonatomic) CFAbsoluteTime nextProbeTime;
+@property (strong, nonatomic) NSTimer *probeTimer;
+@property (readwrite, nonatomic) NSTimeInterval smoothedRTT;
+@property (readwrite, nonatomic) NSTimeInterval rttVariation;
+@property (readwrite, nonatomic) uint blockSzx;
+@property (readwrite, nonatomic) uint maxBlockSzx;
+@property (readwrite, nonatomic) int deliveredProbeSzx;
+@property (readwrite, nonatomic) uint lostProbeSzxMask;
+@property (readwrite, nonatomic) uint cleanBlockTransfers;
+@property (readwrite, nonatomic) uint blockSzxHoldOff;
+@end
+
+@implementation ICoAPPeerState
+@end
+
+
+
+
+@interface ICoAPPeerScheduler ()
+- (NSString *)keyForHost:(NSString *)host port:(uint)port;
+- (ICoAPPeerState *)peerStateForHost:(NSString *)host port:(uint)port create:(BOOL)create;
+- (void)grantQueuedTransmissionsForPeerState:(ICoAPPeerState *)state;
+- (void)onProbeTimer:(NSTimer *)timer;
+@end
+
+@implementation ICoAPPeerScheduler
+
+#pragma mark - Init
+
++ (ICoAPPeerScheduler *)sharedScheduler {
+    static ICoAPPeerScheduler *sharedScheduler;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedScheduler = [[ICoAPPeerScheduler alloc] init];
+    });
+    return sharedScheduler;
+}
+
+- (id)init {
+    if (self = [super init]) {
+        peerStates = [[NSMutableDictionary alloc] init];
+        self.nstart = kNSTART;
+        self.maxWindow = kMaxCongestionWindow;
+        self.probingRate = kPROBING_RATE;
+        self.schedulingOrder = IC_SCHEDULING_FIFO;
+    }
+    return self;
+}
+
+#pragma mark - Queueing
+
+- (void)enqueueTransmissionForClient:(id<ICoAPPeerSchedulerClient>)client priority:(int)priority size:(NSUInteger)size host:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:YES];
+
+    ICoAPQueuedTransmission *transmission = [[ICoAPQueuedTransmission alloc] init];
+    transmission.client = client;
+    transmission.priority = priority;
+    transmission.size = size;
+
+    NSUInteger index = [state.queue count];
+    if (self.schedulingOrder == IC_SCHEDULING_PRIORITY) {
+        //Insert behind all transmissions with an equal or higher priority to keep FIFO order among equals
+        while (index > 0 && [[state.queue objectAtIndex:index - 1] priority] < priority) {
+            index--;
+        }
+    }
+    [state.queue insertObject:transmission atIndex:index];
+
+    [self grantQueuedTransmissionsForPeerState:state];
+}
+
+- (void)cancelQueuedTransmissionForClient:(id<ICoAPPeerSchedulerClient>)client host:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:NO];
+
+    for (NSUInteger i = 0; i < [state.queue count]; i++) {
+        if ([[state.queue objectAtIndex:i] client] == client) {
+            [state.queue removeObjectAtIndex:i];
+            return;
+        }
+    }
+}
+
+- (BOOL)acquireTransmissionForHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:YES];
+
+    //Queued clients were first, and an unresponsive peer is only probed through the paced queue
+    if (state.isProbing || [state.queue count] > 0 || state.outstanding >= state.window) {
+        return NO;
+    }
+
+    state.outstanding++;
+    return YES;
+}
+
+- (void)releaseTransmissionForHost:(NSString *)host port:(uint)port outcome:(ICoAPTransmissionOutcome)outcome {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:NO];
+    if (!state) {
+        return;
+    }
+
+    if (state.outstanding > 0) {
+        state.outstanding--;
+    }
+
+    switch (outcome) {
+        case IC_TRANSMISSION_CLEAN:
+            //Additive increase: one more slot after a full window of clean acknowledgments
+            state.isProbing = NO;
+            state.cleanAcknowledgments++;
+            if (state.cleanAcknowledgments >= state.window && state.window < self.maxWindow) {
+                state.window++;
+                state.cleanAcknowledgments = 0;
+            }
+            break;
+        case IC_TRANSMISSION_RETRANSMITTED:
+            //Multiplicative decrease, but never below NSTART
+            state.isProbing = NO;
+            state.cleanAcknowledgments = 0;
+            state.window = MAX(self.nstart, state.window / 2);
+            break;
+        case IC_TRANSMISSION_TIMED_OUT:
+            state.isProbing = YES;
+            state.cleanAcknowledgments = 0;
+            state.window = self.nstart;
+            break;
+        case IC_TRANSMISSION_UNCONFIRMED:
+        case IC_TRANSMISSION_CANCELLED:
+            break;
+    }
+
+    [self grantQueuedTransmissionsForPeerState:state];
+}
+
+- (void)grantQueuedTransmissionsForPeerState:(ICoAPPeerState *)state {
+    //A peer which does not respond is only probed with one interaction at a time
+    uint window = state.isProbing ? 1 : state.window;
+
+    while (state.outstanding < window && [state.queue count] > 0) {
+        if (state.isProbing) {
+            CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+            if (now < state.nextProbeTime) {
+                if (![state.probeTimer isValid]) {
+                    state.probeTimer = [NSTimer scheduledTimerWithTimeInterval:state.nextProbeTime - now target:self selector:@selector(onProbeTimer:) userInfo:state repeats:NO];
+                }
+                return;
+            }
+        }
+
+        ICoAPQueuedTransmission *transmission = [state.queue objectAtIndex:0];
+        [state.queue removeObjectAtIndex:0];
+
+        id<ICoAPPeerSchedulerClient> client = transmission.client;
+        if (!client) {
+            continue;
+        }
+
+        if (state.isProbing) {
+            state.nextProbeTime = CFAbsoluteTimeGetCurrent() + transmission.size / self.probingRate;
+        }
+
+        state.outstanding++;
+        [client peerSchedulerDidGrantTransmission:self];
+    }
+}
+
+- (void)onProbeTimer:(NSTimer *)timer {
+    [self grantQueuedTransmissionsForPeerState:[timer userInfo]];
+}
+
+#pragma mark - Round Trip Time Estimation
+
+- (void)recordRoundTripTime:(NSTimeInterval)rtt forHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:YES];
+
+    //RFC 6298 with alpha = 1/8 and beta = 1/4
+    if (state.smoothedRTT == 0) {
+        state.smoothedRTT = rtt;
+        state.rttVariation = rtt / 2.0;
+    }
+    else {
+        state.rttVariation = 0.75 * state.rttVariation + 0.25 * fabs(state.smoothedRTT - rtt);
+        state.smoothedRTT = 0.875 * state.smoothedRTT + 0.125 * rtt;
+    }
+}
+
+- (NSTimeInterval)smoothedRoundTripTimeForHost:(NSString *)host port:(uint)port {
+    return [self peerStateForHost:host port:port create:NO].smoothedRTT;
+}
+
+#pragma mark - Block Size Adaptation
+
+- (void)recordBlockTransferOutcome:(ICoAPTransmissionOutcome)outcome forHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:YES];
+
+    if (state.blockSzxHoldOff > 0) {
+        state.blockSzxHoldOff--;
+    }
+
+    switch (outcome) {
+        case IC_TRANSMISSION_CLEAN:
+            state.cleanBlockTransfers++;
+            if (state.cleanBlockTransfers >= kBlockSzxGrowthThreshold && state.blockSzx < state.maxBlockSzx) {
+                state.blockSzx++;
+                state.cleanBlockTransfers = 0;
+            }
+            break;
+        case IC_TRANSMISSION_RETRANSMITTED:
+        case IC_TRANSMISSION_TIMED_OUT:
+            //Losses within one window after a decrease belong to the same event
+            state.cleanBlockTransfers = 0;
+            if (state.blockSzxHoldOff == 0 && state.blockSzx > kMinBlockSzx) {
+                state.blockSzx--;
+                state.blockSzxHoldOff = state.window;
+            }
+            break;
+        case IC_TRANSMISSION_UNCONFIRMED:
+        case IC_TRANSMISSION_CANCELLED:
+            break;
+    }
+}
+
+- (void)recordPathMTUProbeWithBlockSzx:(uint)szx delivered:(BOOL)delivered forHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:YES];
+    szx = MIN(MAX(szx, kMinBlockSzx), kMaxBlockSzx);
+
+    if (delivered) {
+        state.deliveredProbeSzx = MAX(state.deliveredProbeSzx, (int)szx);
+        state.maxBlockSzx = MAX(state.maxBlockSzx, szx);
+        state.lostProbeSzxMask &= ~(1 << szx);
+    }
+    else {
+        state.lostProbeSzxMask |= 1 << szx;
+    }
+
+    //Losses are kept until a smaller size got through, as probes may complete in any order
+    if (state.deliveredProbeSzx >= 0) {
+        for (uint lostSzx = state.deliveredProbeSzx + 1; lostSzx <= kMaxBlockSzx; lostSzx++) {
+            if (state.lostProbeSzxMask & (1 << lostSzx)) {
+                state.maxBlockSzx = MIN(state.maxBlockSzx, lostSzx - 1);
+                break;
+            }
+        }
+    }
+    state.blockSzx = MIN(state.blockSzx, state.maxBlockSzx);
+}
+
+- (uint)blockSzxForHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:NO];
+    return state ? state.blockSzx : kMaxBlockSzx;
+}
+
+- (uint)maxBlockSzxForHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:NO];
+    return state ? state.maxBlockSzx : kMaxBlockSzx;
+}
+
+#pragma mark - Peer State
+
+- (uint)windowForHost:(NSString *)host port:(uint)port {
+    ICoAPPeerState *state = [self peerStateForHost:host port:port create:NO];
+    return state ? state.window : self.nstart;
+}
+
+- (uint)outstandingTransmissionsForHost:(NSString *)host port:(uint)port {
+    return [self peerStateForHost:host port:port create:NO].outstanding;
+}
+
+- (NSString *)keyForHost:(NSString *)host port:(uint)port {
+    return [NSString stringWithFormat:@"%@:%u", host, port];
+}
+
+- (ICoAPPeerState *)peerStateForHost:(NSString *)host port:(uint)port create:(BOOL)create {
+    NSString *key = [self keyForHost:host port:port];
+    ICoAPPeerState *state = [peerStates objectForKey:key];
+
+    if (!state && create) {
+        state = [[ICoAPPeerState alloc] init];
+        state.queue = [[NSMutableArray alloc] init];
+        state.window = self.nstart;
+        state.blockSzx = kMaxBlockSzx;
+        state.maxBlockSzx = kMaxBlockSzx;
+        state.deliveredProbeSzx = -1;
+        [peerStates setObject:state forKey:key];
+    }
+    return state;
+}
+
+@end
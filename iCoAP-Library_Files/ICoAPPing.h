@@ -0,0 +1,220 @@
+//
+//  ICoAPPing.h
+//  iCoAP
+//
+
+
+/*
+ *  This class checks the reachability of CoAP-Servers with
+ *  CoAP pings (RFC 7252 Section 4.3): An empty confirmable message
+ *  is sent and answered with a RST message by every CoAP endpoint.
+ *  A reply only counts if it comes from the host and port the ping was
+ *  sent to, and carries its Message ID.
+
+ *  All pings share one UDP socket. Large lists of servers can be
+ *  passed at once, they are probed in batches of at most
+ *  'maxConcurrentPings' outstanding pings.
+
+ *  Measured round trip times are reported to the delegate and
+ *  recorded in the round trip time estimator of the 'peerScheduler'.
+
+ *  Path MTU probes are pings padded to the size of a block message.
+ *  As an empty message must not carry any bytes after the Message ID,
+ *  the server rejects the probe with a RST if it arrives. The delivered
+ *  sizes limit the block size the 'peerScheduler' prefers for the server.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+#import "ICoAPPeerScheduler.h"
+
+
+#define kMaxConcurrentPings                 64
+#define kPingRetransmissions                2
+#define kPingTimerInterval                  0.05
+
+
+@interface ICoAPPing : NSObject<GCDAsyncUdpSocketDelegate> {
+    uint randomMessageId;
+    NSMutableArray *queuedProbes;
+    NSMutableDictionary *activeProbes;
+    NSTimer *timeoutTimer;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+@property (weak, nonatomic) id delegate;
+
+/*
+ *  'udpSocket':
+ *  The shared GCDAsyncUdpSocket of all pings.
+ */
+@property (strong, nonatomic) GCDAsyncUdpSocket *udpSocket;
+
+/*
+ *  'udpPort':
+ *  The udpPort for listening. (Optional)
+ */
+@property (readwrite, nonatomic) uint udpPort;
+
+/*
+ *  'maxConcurrentPings':
+ *  Maximum number of pings which are outstanding at the same time.
+ *  Default is kMaxConcurrentPings.
+ */
+@property (readwrite, nonatomic) uint maxConcurrentPings;
+
+/*
+ *  'timeout':
+ *  Initial time in seconds to wait for the RST before retransmitting.
+ *  The timeout is doubled for every retransmission. Default is kACK_TIMEOUT.
+ */
+@property (readwrite, nonatomic) NSTimeInterval timeout;
+
+/*
+ *  'maxRetransmissions':
+ *  Number of retransmissions before a server is considered unreachable.
+ *  Default is kPingRetransmissions.
+ */
+@property (readwrite, nonatomic) uint maxRetransmissions;
+
+/*
+ *  'peerScheduler':
+ *  Scheduler whose round trip time estimator is fed with the samples
+ *  of unambiguous (not retransmitted) pings.
+ *  Default is [ICoAPPeerScheduler sharedScheduler]. (Optional)
+ */
+@property (strong, nonatomic) ICoAPPeerScheduler *peerScheduler;
+
+/*
+ *  'pendingPingCount':
+ *  Number of queued and outstanding pings.
+ */
+@property (readonly, nonatomic) NSUInteger pendingPingCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'initWithDelegate:':
+ *  Initialization with a delegate.
+ */
+- (id)initWithDelegate:(id)delegate;
+
+/*
+ *  'pingHost:port:':
+ *  Queues a ping to the given CoAP-Server.
+ */
+- (void)pingHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'pingHosts:port:':
+ *  Queues a ping to every host (NSString) in 'hosts' at the given 'port'.
+ */
+- (void)pingHosts:(NSArray *)hosts port:(uint)port;
+
+/*
+ *  'probePathMTUToHost:port:':
+ *  Queues one probe for every block size from kMinBlockSzx up to kMaxBlockSzx
+ *  to the given CoAP-Server. The results are recorded in the 'peerScheduler'
+ *  and reported with 'iCoAPPing:didProbePathMTUToHost:port:blockSzx:delivered:'.
+ */
+- (void)probePathMTUToHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'cancelAllPings':
+ *  Drops all queued and outstanding pings without informing the delegate.
+ */
+- (void)cancelAllPings;
+
+/*
+ *  'close':
+ *  Cancels all pings and closes the UDP socket.
+ */
+- (void)close;
+
+@end
+
+
+
+
+
+
+
+#pragma mark - Delegate Protocol Definition
+
+
+
+
+
+
+
+@protocol ICoAPPingDelegate <NSObject>
+@optional
+
+/*
+ *  'iCoAPPing:didReceivePongFromHost:port:roundTripTime:':
+ *  Informs the delegate that the CoAP-Server at 'host' and 'port' is reachable.
+ *  'rtt' is measured from the most recent (re-)transmission of the ping.
+ */
+- (void)iCoAPPing:(ICoAPPing *)ping didReceivePongFromHost:(NSString *)host port:(uint)port roundTripTime:(NSTimeInterval)rtt;
+
+/*
+ *  'iCoAPPing:didTimeOutForHost:port:':
+ *  Informs the delegate that the CoAP-Server at 'host' and 'port' did not
+ *  answer any transmission of the ping.
+ */
+- (void)iCoAPPing:(ICoAPPing *)ping didTimeOutForHost:(NSString *)host port:(uint)port;
+
+/*
+ *  'iCoAPPing:didProbePathMTUToHost:port:blockSzx:delivered:':
+ *  Informs the delegate whether a path MTU probe large enough for a block of the
+ *  size given by 'szx' reached the CoAP-Server at 'host' and 'port'.
+ */
+- (void)iCoAPPing:(ICoAPPing *)ping didProbePathMTUToHost:(NSString *)host port:(uint)port blockSzx:(uint)szx delivered:(BOOL)delivered;
+
+/*
+ *  'iCoAPPingDidFinish:':
+ *  Informs the delegate that all queued pings are completed.
+ */
+- (void)iCoAPPingDidFinish:(ICoAPPing *)ping;
+
+/*
+ *  'iCoAPPing:didFailWithError:':
+ *  Informs the delegate that the UDP socket failed. The error code matches the defined
+ *  'ICoAPExchangeErrorCode'.
+ */
+- (void)iCoAPPing:(ICoAPPing *)ping didFailWithError:(NSError *)error;
+
+@end
@@ -0,0 +1,304 @@
+//
+//  ICoAPPing.m
+//  iCoAP
+//
+
+
+#import "ICoAPPing.h"
+#import "ICoAPExchange.h"
+
+
+
+
+@interface ICoAPPingProbe : NSObject
+@property (copy) NSString *host;
+@property (readwrite, nonatomic) uint port;
+@property (strong, nonatomic) NSData *address;
+@property (readwrite, nonatomic) uint messageID;
+@property (readwrite, nonatomic) uint retransmissions;
+@property (readwrite, nonatomic) CFAbsoluteTime sendTime;
+@property (readwrite, nonatomic) CFAbsoluteTime deadline;
+@property (readwrite, nonatomic) BOOL isPathMTUProbe;
+@property (readwrite, nonatomic) uint blockSzx;
+@end
+
+@implementation ICoAPPingProbe
+@end
+
+
+
+
+@interface ICoAPPing ()
+- (BOOL)setupUdpSocket;
+- (void)sendQueuedProbes;
+- (void)transmitProbe:(ICoAPPingProbe *)probe;
+- (void)recordAddress:(NSData *)address ofProbeWithMessageID:(uint)messageID;
+- (void)onTimeoutTimer;
+- (void)finishIfIdle;
+- (void)sendFailWithErrorToDelegateWithError:(NSError *)error;
+@end
+
+@implementation ICoAPPing
+
+#pragma mark - Init
+
+- (id)init {
+    if (self = [super init]) {
+        randomMessageId = 1 + arc4random() % 65536;
+        queuedProbes = [[NSMutableArray alloc] init];
+        activeProbes = [[NSMutableDictionary alloc] init];
+        self.maxConcurrentPings = kMaxConcurrentPings;
+        self.timeout = kACK_TIMEOUT;
+        self.maxRetransmissions = kPingRetransmissions;
+        self.peerScheduler = [ICoAPPeerScheduler sharedScheduler];
+    }
+    return self;
+}
+
+- (id)initWithDelegate:(id)delegate {
+    if (self = [self init]) {
+        self.delegate = delegate;
+    }
+    return self;
+}
+
+- (BOOL)setupUdpSocket {
+    self.udpSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:dispatch_get_main_queue()];
+
+    //The filter sees the resolved destination of each probe, before any reply can be delivered on the main queue
+    __weak ICoAPPing *weakSelf = self;
+    [self.udpSocket setSendFilter:^BOOL(NSData *data, NSData *address, long tag) {
+        [weakSelf recordAddress:address ofProbeWithMessageID:(uint)tag];
+        return YES;
+    } withQueue:dispatch_get_main_queue()];
+
+    NSError *error;
+    if (![self.udpSocket bindToPort:self.udpPort error:&error]) {
+        self.udpSocket = nil;
+        return NO;
+    }
+
+    if (![self.udpSocket beginReceiving:&error]) {
+        [self.udpSocket close];
+        self.udpSocket = nil;
+        return NO;
+    }
+    return YES;
+}
+
+#pragma mark - Pinging
+
+- (NSUInteger)pendingPingCount {
+    return [queuedProbes count] + [activeProbes count];
+}
+
+- (void)pingHost:(NSString *)host port:(uint)port {
+    [self pingHosts:[NSArray arrayWithObject:host] port:port];
+}
+
+- (void)pingHosts:(NSArray *)hosts port:(uint)port {
+    if (!self.udpSocket && ![self setupUdpSocket]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+        return;
+    }
+
+    for (NSString *host in hosts) {
+        ICoAPPingProbe *probe = [[ICoAPPingProbe alloc] init];
+        probe.host = host;
+        probe.port = port;
+        [queuedProbes addObject:probe];
+    }
+
+    [self sendQueuedProbes];
+}
+
+- (void)probePathMTUToHost:(NSString *)host port:(uint)port {
+    if (!self.udpSocket && ![self setupUdpSocket]) {
+        NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"Failed to setup UDP Socket" forKey:NSLocalizedDescriptionKey];
+        [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+        return;
+    }
+    
+    //Smallest first, so losses of larger probes can be attributed to their size
+    for (int szx = kMinBlockSzx; szx <= kMaxBlockSzx; szx++) {
+        ICoAPPingProbe *probe = [[ICoAPPingProbe alloc] init];
+        probe.host = host;
+        probe.port = port;
+        probe.isPathMTUProbe = YES;
+        probe.blockSzx = szx;
+        [queuedProbes addObject:probe];
+    }
+    
+    [self sendQueuedProbes];
+}
+
+- (void)sendQueuedProbes {
+    NSUInteger index = 0;
+
+    while ([activeProbes count] < self.maxConcurrentPings && index < [queuedProbes count]) {
+        ICoAPPingProbe *probe = [queuedProbes objectAtIndex:index++];
+
+        //Skip Message IDs which are still in use
+        do {
+            randomMessageId = (randomMessageId + 1) % 65536;
+        } while ([activeProbes objectForKey:[NSNumber numberWithUnsignedInt:randomMessageId]]);
+
+        probe.messageID = randomMessageId;
+        probe.retransmissions = 0;
+        [activeProbes setObject:probe forKey:[NSNumber numberWithUnsignedInt:probe.messageID]];
+        [self transmitProbe:probe];
+    }
+    [queuedProbes removeObjectsInRange:NSMakeRange(0, index)];
+
+    //One timer checks the deadlines of all outstanding pings
+    if ([activeProbes count] > 0 && ![timeoutTimer isValid]) {
+        timeoutTimer = [NSTimer scheduledTimerWithTimeInterval:kPingTimerInterval target:self selector:@selector(onTimeoutTimer) userInfo:nil repeats:YES];
+    }
+}
+
+- (void)transmitProbe:(ICoAPPingProbe *)probe {
+    //Path MTU probes are padded with zeros to the size of a block message
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:probe.isPathMTUProbe ? (16 << probe.blockSzx) + kPathMTUProbeOverhead : 4];
+    ICoAPWriteEmptyMessage([data mutableBytes], IC_CONFIRMABLE, probe.messageID);
+
+    probe.sendTime = CFAbsoluteTimeGetCurrent();
+    probe.deadline = probe.sendTime + self.timeout * pow(2.0, probe.retransmissions);
+    [self.udpSocket sendData:data toHost:probe.host port:probe.port withTimeout:-1 tag:probe.messageID];
+}
+
+- (void)recordAddress:(NSData *)address ofProbeWithMessageID:(uint)messageID {
+    ICoAPPingProbe *probe = [activeProbes objectForKey:[NSNumber numberWithUnsignedInt:messageID]];
+    probe.address = address;
+}
+
+- (void)onTimeoutTimer {
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    NSMutableArray *timedOutProbes = [[NSMutableArray alloc] init];
+
+    for (ICoAPPingProbe *probe in [activeProbes allValues]) {
+        if (probe.deadline > now) {
+            continue;
+        }
+
+        if (probe.retransmissions < self.maxRetransmissions) {
+            probe.retransmissions++;
+            [self transmitProbe:probe];
+        }
+        else {
+            [activeProbes removeObjectForKey:[NSNumber numberWithUnsignedInt:probe.messageID]];
+            [timedOutProbes addObject:probe];
+        }
+    }
+
+    if ([timedOutProbes count] == 0) {
+        return;
+    }
+
+    [self sendQueuedProbes];
+
+    for (ICoAPPingProbe *probe in timedOutProbes) {
+        if (probe.isPathMTUProbe) {
+            [self.peerScheduler recordPathMTUProbeWithBlockSzx:probe.blockSzx delivered:NO forHost:probe.host port:probe.port];
+            
+            if ([self.delegate respondsToSelector:@selector(iCoAPPing:didProbePathMTUToHost:port:blockSzx:delivered:)]) {
+                [self.delegate iCoAPPing:self didProbePathMTUToHost:probe.host port:probe.port blockSzx:probe.blockSzx delivered:NO];
+            }
+        }
+        else if ([self.delegate respondsToSelector:@selector(iCoAPPing:didTimeOutForHost:port:)]) {
+            [self.delegate iCoAPPing:self didTimeOutForHost:probe.host port:probe.port];
+        }
+    }
+    [self finishIfIdle];
+}
+
+- (void)finishIfIdle {
+    if ([activeProbes count] > 0 || [queuedProbes count] > 0) {
+        return;
+    }
+
+    [timeoutTimer invalidate];
+    timeoutTimer = nil;
+
+    if ([self.delegate respondsToSelector:@selector(iCoAPPingDidFinish:)]) {
+        [self.delegate iCoAPPingDidFinish:self];
+    }
+}
+
+- (void)cancelAllPings {
+    [timeoutTimer invalidate];
+    timeoutTimer = nil;
+    [queuedProbes removeAllObjects];
+    [activeProbes removeAllObjects];
+}
+
+- (void)close {
+    [self cancelAllPings];
+    self.udpSocket.delegate = nil;
+    [self.udpSocket close];
+    self.udpSocket = nil;
+}
+
+#pragma mark - GCD Async UDP Socket Delegate
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+    if ([data length] < 4) {
+        return;
+    }
+
+    //Only empty RST (or ACK of implementations answering pings that way) messages are expected
+    const uint8_t *header = [data bytes];
+    uint type = header[0] >> 4;
+    if ((type != IC_RESET && type != IC_ACKNOWLEDGMENT) || header[1] != IC_EMPTY) {
+        return;
+    }
+
+    NSNumber *key = [NSNumber numberWithUnsignedInt:(header[2] << 8 | header[3])];
+    ICoAPPingProbe *probe = [activeProbes objectForKey:key];
+    //Host and port must be the ones the probe was sent to, not only the Message ID
+    if (!probe || !probe.address || [GCDAsyncUdpSocket portFromAddress:address] != probe.port || ![[GCDAsyncUdpSocket hostFromAddress:address] isEqualToString:[GCDAsyncUdpSocket hostFromAddress:probe.address]]) {
+        return;
+    }
+    [activeProbes removeObjectForKey:key];
+
+    NSTimeInterval rtt = CFAbsoluteTimeGetCurrent() - probe.sendTime;
+
+    if (probe.isPathMTUProbe) {
+        [self.peerScheduler recordPathMTUProbeWithBlockSzx:probe.blockSzx delivered:YES forHost:probe.host port:probe.port];
+        [self sendQueuedProbes];
+        
+        if ([self.delegate respondsToSelector:@selector(iCoAPPing:didProbePathMTUToHost:port:blockSzx:delivered:)]) {
+            [self.delegate iCoAPPing:self didProbePathMTUToHost:probe.host port:probe.port blockSzx:probe.blockSzx delivered:YES];
+        }
+        [self finishIfIdle];
+        return;
+    }
+
+    //Karn's algorithm: the RST of a retransmitted ping can not be assigned to one transmission
+    if (probe.retransmissions == 0) {
+        [self.peerScheduler recordRoundTripTime:rtt forHost:probe.host port:probe.port];
+    }
+
+    [self sendQueuedProbes];
+
+    if ([self.delegate respondsToSelector:@selector(iCoAPPing:didReceivePongFromHost:port:roundTripTime:)]) {
+        [self.delegate iCoAPPing:self didReceivePongFromHost:probe.host port:probe.port roundTripTime:rtt];
+    }
+    [self finishIfIdle];
+}
+
+- (void)udpSocketDidClose:(GCDAsyncUdpSocket *)sock withError:(NSError *)error {
+    [self close];
+    NSDictionary *userInfo = [NSDictionary dictionaryWithObject:@"UDP Socket Closed" forKey:NSLocalizedDescriptionKey];
+    [self sendFailWithErrorToDelegateWithError:[[NSError alloc] initWithDomain:kiCoAPErrorDomain code:IC_UDP_SOCKET_ERROR userInfo:userInfo]];
+}
+
+#pragma mark - Delegate Method Calls
+
+- (void)sendFailWithErrorToDelegateWithError:(NSError *)error {
+    if ([self.delegate respondsToSelector:@selector(iCoAPPing:didFailWithError:)]) {
+        [self.delegate iCoAPPing:self didFailWithError:error];
+    }
+}
+
+@end
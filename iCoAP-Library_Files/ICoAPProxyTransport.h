@@ -0,0 +1,107 @@
+//
+//  ICoAPProxyTransport.h
+//  iCoAP
+//
+
+
+/*
+ *  This class carries the HTTP requests of ICoAPExchange objects
+ *  which use HTTP-Proxying.
+
+ *  All requests share one NSURLSession, so connections to a proxy
+ *  are kept alive and reused by later requests, including the
+ *  follow-up requests of Block2 transfers. Requests are pipelined on
+ *  HTTP/1.1 connections, or multiplexed if the proxy supports HTTP/2.
+ *  The number of concurrent connections per proxy is limited by
+ *  'maxConnectionsPerProxy', further requests are queued by the session.
+
+ *  Responses are passed on the main queue, which is the queue all
+ *  ICoAPExchange objects operate on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+#define kProxyMaxConnectionsPerProxy        4
+
+
+@interface ICoAPProxyTransport : NSObject {
+    NSURLSession *session;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'maxConnectionsPerProxy':
+ *  Maximum number of concurrent connections to one proxy.
+ *  Default is kProxyMaxConnectionsPerProxy.
+ */
+@property (readwrite, nonatomic) NSInteger maxConnectionsPerProxy;
+
+/*
+ *  'usesPipelining':
+ *  Indicates whether requests are pipelined on HTTP/1.1 connections. Default is YES.
+ */
+@property (readwrite, nonatomic) BOOL usesPipelining;
+
+/*
+ *  'requestTimeout':
+ *  Time in seconds after which a request without response fails.
+ *  Default is MAX_TRANSMIT_WAIT.
+ */
+@property (readwrite, nonatomic) NSTimeInterval requestTimeout;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'sharedTransport':
+ *  Returns the transport which is shared across the application.
+ */
++ (ICoAPProxyTransport *)sharedTransport;
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'dataTaskWithRequest:completionHandler:':
+ *  Starts the HTTP 'request' and returns its task. The 'completionHandler'
+ *  is called on the main queue with the complete response body, or an error.
+ */
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request completionHandler:(void (^)(NSData *data, NSURLResponse *response, NSError *error))completionHandler;
+
+/*
+ *  'invalidate':
+ *  Cancels all requests and closes the connections. Later requests open new ones.
+ */
+- (void)invalidate;
+
+@end
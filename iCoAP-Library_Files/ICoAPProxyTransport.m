@@ -0,0 +1,93 @@
+//
+//  ICoAPProxyTransport.m
+//  iCoAP
+//
+
+
+#import "ICoAPProxyTransport.h"
+#import "ICoAPExchange.h"
+
+
+
+
+@interface ICoAPProxyTransport ()
+- (NSURLSession *)session;
+@end
+
+@implementation ICoAPProxyTransport
+
+#pragma mark - Init
+
++ (ICoAPProxyTransport *)sharedTransport {
+    static ICoAPProxyTransport *sharedTransport;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedTransport = [[ICoAPProxyTransport alloc] init];
+    });
+    return sharedTransport;
+}
+
+- (id)init {
+    if (self = [super init]) {
+        _maxConnectionsPerProxy = kProxyMaxConnectionsPerProxy;
+        _usesPipelining = YES;
+        _requestTimeout = kMAX_TRANSMIT_WAIT;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [session finishTasksAndInvalidate];
+}
+
+#pragma mark - Session
+
+- (NSURLSession *)session {
+    if (!session) {
+        NSURLSessionConfiguration *configuration = [NSURLSessionConfiguration defaultSessionConfiguration];
+        configuration.HTTPMaximumConnectionsPerHost = self.maxConnectionsPerProxy;
+        configuration.HTTPShouldUsePipelining = self.usesPipelining;
+        configuration.timeoutIntervalForRequest = self.requestTimeout;
+
+        //Responses depend on the CoAP options in the headers, they must not be taken from the URL cache
+        configuration.requestCachePolicy = NSURLRequestReloadIgnoringLocalCacheData;
+        configuration.URLCache = nil;
+
+        session = [NSURLSession sessionWithConfiguration:configuration delegate:nil delegateQueue:[NSOperationQueue mainQueue]];
+    }
+    return session;
+}
+
+//Changed settings apply to a new session, running requests finish on the old one
+- (void)setMaxConnectionsPerProxy:(NSInteger)maxConnectionsPerProxy {
+    _maxConnectionsPerProxy = maxConnectionsPerProxy;
+    [session finishTasksAndInvalidate];
+    session = nil;
+}
+
+- (void)setUsesPipelining:(BOOL)usesPipelining {
+    _usesPipelining = usesPipelining;
+    [session finishTasksAndInvalidate];
+    session = nil;
+}
+
+- (void)setRequestTimeout:(NSTimeInterval)requestTimeout {
+    _requestTimeout = requestTimeout;
+    [session finishTasksAndInvalidate];
+    session = nil;
+}
+
+#pragma mark - Requests
+
+- (NSURLSessionDataTask *)dataTaskWithRequest:(NSURLRequest *)request completionHandler:(void (^)(NSData *data, NSURLResponse *response, NSError *error))completionHandler {
+    NSURLSessionDataTask *task = [[self session] dataTaskWithRequest:request completionHandler:completionHandler];
+    [task resume];
+    return task;
+}
+
+- (void)invalidate {
+    [session invalidateAndCancel];
+    session = nil;
+}
+
+@end
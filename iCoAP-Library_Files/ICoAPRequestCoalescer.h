@@ -0,0 +1,170 @@
+//
+//  ICoAPRequestCoalescer.h
+//  iCoAP
+//
+
+
+/*
+ *  This class lets several ICoAPExchange objects share one
+ *  transmission of identical GET requests.
+
+ *  Requests are identical if they have the same cache key (see
+ *  ICoAPResponseCache), i.e. the same destination and the same options
+ *  apart from ETag, Observe and the options of block-wise transfers,
+ *  and the same ETags. A 2.03 (Valid) response only answers requests
+ *  carrying the validated ETag, so requests with other ETags or none
+ *  are not coalesced with it.
+ *  The first exchange sending such a request leads the transmission.
+ *  Exchanges sending an identical request before the leading exchange
+ *  received its first response do not send anything, they wait for the
+ *  response of the leading exchange instead.
+
+ *  Every response message of the leading exchange, including all
+ *  blocks of a Block2 transfer, is passed to the waiting exchanges,
+ *  which handle it like a response to their own request (reassembly,
+ *  streaming and the delegate calls of each exchange apply).
+ *  Errors are passed as well. If the leading exchange is closed, the
+ *  waiting exchanges send their requests again themselves.
+
+ *  The coalescer is not thread-safe and must only be used from the
+ *  main queue, which is the queue all ICoAPExchange objects operate on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "ICoAPMessage.h"
+
+
+@class ICoAPRequestCoalescer;
+
+
+
+
+
+
+
+#pragma mark - Client Protocol Definition
+
+
+
+
+
+
+
+@protocol ICoAPRequestCoalescerClient <NSObject>
+
+/*
+ *  'requestCoalescer:didReceiveCoAPMessage:isFinal:':
+ *  Passes a response message of the leading exchange to a waiting client.
+ *  'isFinal' indicates that no further messages follow.
+ */
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didReceiveCoAPMessage:(ICoAPMessage *)coapMessage isFinal:(BOOL)isFinal;
+
+/*
+ *  'requestCoalescer:didFailWithError:':
+ *  Passes the error which ended the transmission of the leading exchange.
+ */
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didFailWithError:(NSError *)error;
+
+/*
+ *  'requestCoalescerDidAbandonRequest:':
+ *  Informs a waiting client that the leading exchange was closed before
+ *  the transmission was complete. The client has to send its request itself.
+ */
+- (void)requestCoalescerDidAbandonRequest:(ICoAPRequestCoalescer *)coalescer;
+
+@end
+
+
+
+
+@interface ICoAPRequestCoalescer : NSObject {
+    NSMutableDictionary *flights;
+    NSMapTable *flightsByClient;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'coalescedRequestCount':
+ *  Number of requests which were not sent, because they were answered
+ *  by the transmission of an identical request.
+ */
+@property (readonly, nonatomic) NSUInteger coalescedRequestCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'sharedCoalescer':
+ *  Returns the coalescer which is shared across the application.
+ */
++ (ICoAPRequestCoalescer *)sharedCoalescer;
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'joinRequest:host:port:client:':
+ *  Returns YES if an identical request is in transmission, the 'client' then
+ *  waits for its responses and must not send the request. Otherwise the client
+ *  leads the transmission of the request (if it can be coalesced) and NO is returned.
+ */
+- (BOOL)joinRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port client:(id<ICoAPRequestCoalescerClient>)client;
+
+/*
+ *  'hasWaitingClientsForClient:':
+ *  Indicates whether clients are waiting for the transmission led by 'client'.
+ */
+- (BOOL)hasWaitingClientsForClient:(id<ICoAPRequestCoalescerClient>)client;
+
+/*
+ *  'forwardCoAPMessage:fromClient:':
+ *  Passes a response message received by the leading 'client' to the waiting clients.
+ *  The transmission ends with the last block of a Block2 transfer, or with any other
+ *  response which is not empty.
+ */
+- (void)forwardCoAPMessage:(ICoAPMessage *)coapMessage fromClient:(id<ICoAPRequestCoalescerClient>)client;
+
+/*
+ *  'forwardError:fromClient:':
+ *  Passes the error of the leading 'client' to the waiting clients and ends the transmission.
+ */
+- (void)forwardError:(NSError *)error fromClient:(id<ICoAPRequestCoalescerClient>)client;
+
+/*
+ *  'leaveRequestWithClient:':
+ *  Removes the 'client' from the transmission it leads or waits for.
+ *  Clients waiting for a transmission led by 'client' are informed with
+ *  'requestCoalescerDidAbandonRequest:'.
+ */
+- (void)leaveRequestWithClient:(id<ICoAPRequestCoalescerClient>)client;
+
+@end
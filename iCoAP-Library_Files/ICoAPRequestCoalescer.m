@@ -0,0 +1,173 @@
+//
+//  ICoAPRequestCoalescer.m
+//  iCoAP
+//
+
+
+#import "ICoAPRequestCoalescer.h"
+#import "ICoAPResponseCache.h"
+
+
+
+
+@interface ICoAPRequestFlight : NSObject
+@property (strong, nonatomic) NSData *key;
+@property (strong, nonatomic) id<ICoAPRequestCoalescerClient> leader;
+@property (strong, nonatomic) NSMutableArray *waiters;
+@property (readwrite, nonatomic) BOOL hasDeliveredMessage;
+@end
+
+@implementation ICoAPRequestFlight
+@end
+
+
+
+
+@interface ICoAPRequestCoalescer ()
+- (NSData *)flightKeyForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+- (ICoAPRequestFlight *)flightLedByClient:(id<ICoAPRequestCoalescerClient>)client;
+- (void)removeFlight:(ICoAPRequestFlight *)flight;
+@end
+
+@implementation ICoAPRequestCoalescer
+
+#pragma mark - Init
+
++ (ICoAPRequestCoalescer *)sharedCoalescer {
+    static ICoAPRequestCoalescer *sharedCoalescer;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedCoalescer = [[ICoAPRequestCoalescer alloc] init];
+    });
+    return sharedCoalescer;
+}
+
+- (id)init {
+    if (self = [super init]) {
+        flights = [[NSMutableDictionary alloc] init];
+        //Clients are looked up by identity, the flights retain their leader and waiters
+        flightsByClient = [[NSMapTable alloc] initWithKeyOptions:NSPointerFunctionsOpaqueMemory | NSPointerFunctionsObjectPointerPersonality valueOptions:NSPointerFunctionsStrongMemory capacity:0];
+    }
+    return self;
+}
+
+#pragma mark - Flights
+
+- (BOOL)joinRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port client:(id<ICoAPRequestCoalescerClient>)client {
+    [self leaveRequestWithClient:client];
+
+    if (![ICoAPResponseCache isCacheableRequest:cO]) {
+        return NO;
+    }
+
+    NSData *key = [self flightKeyForRequest:cO host:host port:port];
+    ICoAPRequestFlight *flight = [flights objectForKey:key];
+
+    if (!flight) {
+        flight = [[ICoAPRequestFlight alloc] init];
+        flight.key = key;
+        flight.leader = client;
+        flight.waiters = [[NSMutableArray alloc] init];
+        [flights setObject:flight forKey:key];
+        [flightsByClient setObject:flight forKey:client];
+        return NO;
+    }
+
+    //Messages delivered before joining would be missing, the request is sent on its own then
+    if (flight.hasDeliveredMessage) {
+        return NO;
+    }
+
+    [flight.waiters addObject:client];
+    [flightsByClient setObject:flight forKey:client];
+    _coalescedRequestCount++;
+    return YES;
+}
+
+//The cache key leaves out ETags, but a 2.03 (Valid) only answers requests with the validated ETag
+- (NSData *)flightKeyForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    NSMutableData *key = [[ICoAPResponseCache cacheKeyForRequest:cO host:host port:port] mutableCopy];
+    NSArray *etagValues = [[cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]] sortedArrayUsingSelector:@selector(compare:)];
+
+    for (NSString *etag in etagValues) {
+        NSData *etagData = [etag dataUsingEncoding:NSUTF8StringEncoding];
+        uint8_t optionHeader[4] = {(IC_ETAG >> 8) & 0xFF, IC_ETAG & 0xFF, ([etagData length] >> 8) & 0xFF, [etagData length] & 0xFF};
+        [key appendBytes:optionHeader length:4];
+        [key appendData:etagData];
+    }
+    return key;
+}
+
+- (ICoAPRequestFlight *)flightLedByClient:(id<ICoAPRequestCoalescerClient>)client {
+    ICoAPRequestFlight *flight = [flightsByClient objectForKey:client];
+    return flight.leader == client ? flight : nil;
+}
+
+- (void)removeFlight:(ICoAPRequestFlight *)flight {
+    [flights removeObjectForKey:flight.key];
+    [flightsByClient removeObjectForKey:flight.leader];
+    for (id<ICoAPRequestCoalescerClient> waiter in flight.waiters) {
+        [flightsByClient removeObjectForKey:waiter];
+    }
+}
+
+- (BOOL)hasWaitingClientsForClient:(id<ICoAPRequestCoalescerClient>)client {
+    return [[self flightLedByClient:client].waiters count] > 0;
+}
+
+- (void)forwardCoAPMessage:(ICoAPMessage *)coapMessage fromClient:(id<ICoAPRequestCoalescerClient>)client {
+    //Empty ACKs announce a separate response and are not passed on
+    if (coapMessage.code == IC_EMPTY) {
+        return;
+    }
+
+    ICoAPRequestFlight *flight = [self flightLedByClient:client];
+    if (!flight) {
+        return;
+    }
+    flight.hasDeliveredMessage = YES;
+
+    NSArray *blockValues = [coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+    BOOL isFinal = coapMessage.code != IC_CONTENT || !blockValues || !([[blockValues objectAtIndex:0] intValue] & 8);
+
+    //The flight is gone before the clients are called, so they can send new requests right away
+    if (isFinal) {
+        [self removeFlight:flight];
+    }
+
+    for (id<ICoAPRequestCoalescerClient> waiter in [flight.waiters copy]) {
+        [waiter requestCoalescer:self didReceiveCoAPMessage:coapMessage isFinal:isFinal];
+    }
+}
+
+- (void)forwardError:(NSError *)error fromClient:(id<ICoAPRequestCoalescerClient>)client {
+    ICoAPRequestFlight *flight = [self flightLedByClient:client];
+    if (!flight) {
+        return;
+    }
+
+    [self removeFlight:flight];
+    for (id<ICoAPRequestCoalescerClient> waiter in flight.waiters) {
+        [waiter requestCoalescer:self didFailWithError:error];
+    }
+}
+
+- (void)leaveRequestWithClient:(id<ICoAPRequestCoalescerClient>)client {
+    ICoAPRequestFlight *flight = [flightsByClient objectForKey:client];
+    if (!flight) {
+        return;
+    }
+
+    if (flight.leader == client) {
+        [self removeFlight:flight];
+        for (id<ICoAPRequestCoalescerClient> waiter in flight.waiters) {
+            [waiter requestCoalescerDidAbandonRequest:self];
+        }
+        return;
+    }
+
+    [flight.waiters removeObjectIdenticalTo:client];
+    [flightsByClient removeObjectForKey:client];
+}
+
+@end
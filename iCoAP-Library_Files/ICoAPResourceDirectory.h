@@ -0,0 +1,137 @@
+//
+//  ICoAPResourceDirectory.h
+//  iCoAP
+//
+
+
+/*
+ *  This class holds the resources of an ICoAPServer and finds the
+ *  handler of a request by its Uri-Path options.
+
+ *  Registered resources are compiled into an immutable trie with one
+ *  node per path segment, so a request is dispatched with one
+ *  dictionary lookup per Uri-Path option. The link-format rendering
+ *  of all resources (RFC 6690), which is served as /.well-known/core,
+ *  is built at the same time.
+
+ *  Adding or removing a resource compiles a new trie, which replaces
+ *  the previous one. Every server registers a trie handler, to which
+ *  each compiled trie is passed on the queue of the server. A server
+ *  dispatches with its own reference to the immutable trie, so several
+ *  servers share one directory without a lock on the request path.
+ *  'handlerForUriPath:' locks the directory and is meant for callers
+ *  outside of a server.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+#define kWellKnownCorePath                  @".well-known/core"
+
+
+@class ICoAPServerTransaction;
+
+typedef void (^ICoAPResourceHandler)(ICoAPServerTransaction *transaction);
+typedef void (^ICoAPResourceTrieHandler)(id trie);
+
+
+@interface ICoAPResourceDirectory : NSObject {
+    NSMutableDictionary *resources;
+    NSMapTable *trieHandlers;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'linkFormat':
+ *  The link-format rendering of all resources, served as /.well-known/core.
+ */
+@property (readonly, atomic) NSData *linkFormat;
+
+/*
+ *  'resourceCount':
+ *  Number of registered resources.
+ */
+@property (readonly, atomic) NSUInteger resourceCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization. The directory serves /.well-known/core itself.
+ */
+- (id)init;
+
+/*
+ *  'addResourceWithPath:attributes:handler:':
+ *  Registers the 'handler' for the resource at 'path' (e.g. @"sensors/temp"),
+ *  replacing a handler registered before. 'attributes' are listed in
+ *  /.well-known/core, e.g. @{@"rt": @"temperature", @"ct": @"0", @"obs": @""}.
+ *  Numeric values are rendered as they are, empty ones as flag, all others quoted.
+ */
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler;
+
+/*
+ *  'removeResourceWithPath:':
+ *  Removes the resource at 'path'.
+ */
+- (void)removeResourceWithPath:(NSString *)path;
+
+/*
+ *  'handlerForUriPath:':
+ *  Returns the handler of the resource named by the values of the Uri-Path
+ *  options 'uriPath', or nil if there is no such resource.
+ */
+- (ICoAPResourceHandler)handlerForUriPath:(NSArray *)uriPath;
+
+/*
+ *  'addTrieHandler:queue:owner:':
+ *  Passes the compiled trie to 'handler' on 'queue', once right away and
+ *  again after every change of the resources, as long as 'owner' exists.
+ *  Tries are passed in the order they were compiled, so on a serial queue
+ *  the last one received is the current one. A handler added before for
+ *  'owner' is replaced.
+ */
+- (void)addTrieHandler:(ICoAPResourceTrieHandler)handler queue:(dispatch_queue_t)queue owner:(id)owner;
+
+/*
+ *  'removeTrieHandlerOfOwner:':
+ *  Stops passing tries to the handler added for 'owner'.
+ */
+- (void)removeTrieHandlerOfOwner:(id)owner;
+
+/*
+ *  'handlerForUriPath:inTrie:':
+ *  Returns the handler of the resource named by 'uriPath' in a 'trie'
+ *  passed to a trie handler, or nil if there is no such resource.
+ *  Does not lock, tries are never changed once compiled.
+ */
++ (ICoAPResourceHandler)handlerForUriPath:(NSArray *)uriPath inTrie:(id)trie;
+
+@end
@@ -0,0 +1,229 @@
+//
+//  ICoAPResourceDirectory.m
+//  iCoAP
+//
+
+
+#import "ICoAPResourceDirectory.h"
+#import "ICoAPServer.h"
+
+
+
+
+@interface ICoAPResource : NSObject
+@property (strong, nonatomic) NSArray *segments;
+@property (strong, nonatomic) NSDictionary *attributes;
+@property (copy, nonatomic) ICoAPResourceHandler handler;
+@property (readwrite, nonatomic) BOOL isListed;
+@end
+
+@implementation ICoAPResource
+@end
+
+
+
+
+@interface ICoAPResourceTrieNode : NSObject
+@property (strong, nonatomic) NSDictionary *children;
+@property (copy, nonatomic) ICoAPResourceHandler handler;
+@end
+
+@implementation ICoAPResourceTrieNode
+@end
+
+
+
+
+@interface ICoAPResourceTrieSubscription : NSObject
+@property (strong, nonatomic) dispatch_queue_t queue;
+@property (copy, nonatomic) ICoAPResourceTrieHandler handler;
+@end
+
+@implementation ICoAPResourceTrieSubscription
+@end
+
+
+
+
+@interface ICoAPResourceDirectory ()
+@property (strong, nonatomic) ICoAPResourceTrieNode *root;
+@property (readwrite, atomic) NSData *linkFormat;
+@property (readwrite, atomic) NSUInteger resourceCount;
+- (void)addResource:(ICoAPResource *)resource;
+- (void)compileResources;
+- (ICoAPResourceTrieNode *)compiledNodeForResources:(NSArray *)nodeResources depth:(NSUInteger)depth;
+- (NSString *)linkFormatOfResource:(ICoAPResource *)resource;
+@end
+
+@implementation ICoAPResourceDirectory
+
+#pragma mark - Init
+
+- (id)init {
+    if (self = [super init]) {
+        resources = [[NSMutableDictionary alloc] init];
+        trieHandlers = [NSMapTable weakToStrongObjectsMapTable];
+
+        __weak ICoAPResourceDirectory *weakSelf = self;
+        ICoAPResource *wellKnownCore = [[ICoAPResource alloc] init];
+        wellKnownCore.segments = [kWellKnownCorePath componentsSeparatedByString:@"/"];
+        wellKnownCore.handler = ^(ICoAPServerTransaction *transaction) {
+            ICoAPMessage *response = [[ICoAPMessage alloc] init];
+            if (transaction.request.code == IC_GET) {
+                response.code = IC_CONTENT;
+                response.payloadData = weakSelf.linkFormat;
+                [response addOption:IC_CONTENT_FORMAT withValue:[NSString stringWithFormat:@"%i", IC_LINK_FORMAT]];
+            }
+            else {
+                response.code = IC_METHOD_NOT_ALLOWED;
+            }
+            [transaction respondWithCoAPMessage:response];
+        };
+        [self addResource:wellKnownCore];
+    }
+    return self;
+}
+
+#pragma mark - Resources
+
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler {
+    NSString *trimmedPath = [path stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"/"]];
+    ICoAPResource *resource = [[ICoAPResource alloc] init];
+    resource.segments = [trimmedPath length] > 0 ? [trimmedPath componentsSeparatedByString:@"/"] : [NSArray array];
+    resource.attributes = [attributes copy];
+    resource.handler = handler;
+    resource.isListed = YES;
+    [self addResource:resource];
+}
+
+- (void)addResource:(ICoAPResource *)resource {
+    @synchronized(self) {
+        [resources setObject:resource forKey:[resource.segments componentsJoinedByString:@"/"]];
+        [self compileResources];
+    }
+}
+
+- (void)removeResourceWithPath:(NSString *)path {
+    @synchronized(self) {
+        [resources removeObjectForKey:[path stringByTrimmingCharactersInSet:[NSCharacterSet characterSetWithCharactersInString:@"/"]]];
+        [self compileResources];
+    }
+}
+
+#pragma mark - Compilation
+
+- (void)compileResources {
+    NSArray *sortedPaths = [[resources allKeys] sortedArrayUsingSelector:@selector(compare:)];
+    NSMutableArray *links = [[NSMutableArray alloc] init];
+
+    for (NSString *path in sortedPaths) {
+        ICoAPResource *resource = [resources objectForKey:path];
+        if (resource.isListed) {
+            [links addObject:[self linkFormatOfResource:resource]];
+        }
+    }
+
+    self.linkFormat = [[links componentsJoinedByString:@","] dataUsingEncoding:NSUTF8StringEncoding];
+    self.resourceCount = [links count];
+    self.root = [self compiledNodeForResources:[resources allValues] depth:0];
+
+    //Dispatched while locked, so every queue receives the tries in the order they were compiled
+    ICoAPResourceTrieNode *root = self.root;
+    for (ICoAPResourceTrieSubscription *subscription in [trieHandlers objectEnumerator]) {
+        ICoAPResourceTrieHandler handler = subscription.handler;
+        dispatch_async(subscription.queue, ^{
+            handler(root);
+        });
+    }
+}
+
+- (ICoAPResourceTrieNode *)compiledNodeForResources:(NSArray *)nodeResources depth:(NSUInteger)depth {
+    ICoAPResourceTrieNode *node = [[ICoAPResourceTrieNode alloc] init];
+    NSMutableDictionary *childResources = [[NSMutableDictionary alloc] init];
+
+    for (ICoAPResource *resource in nodeResources) {
+        if ([resource.segments count] == depth) {
+            node.handler = resource.handler;
+            continue;
+        }
+
+        NSString *segment = [resource.segments objectAtIndex:depth];
+        NSMutableArray *segmentResources = [childResources objectForKey:segment];
+        if (!segmentResources) {
+            segmentResources = [[NSMutableArray alloc] init];
+            [childResources setObject:segmentResources forKey:segment];
+        }
+        [segmentResources addObject:resource];
+    }
+
+    NSMutableDictionary *children = [[NSMutableDictionary alloc] initWithCapacity:[childResources count]];
+    for (NSString *segment in childResources) {
+        [children setObject:[self compiledNodeForResources:[childResources objectForKey:segment] depth:depth + 1] forKey:segment];
+    }
+    node.children = [children copy];
+    return node;
+}
+
+- (NSString *)linkFormatOfResource:(ICoAPResource *)resource {
+    NSMutableString *link = [NSMutableString stringWithFormat:@"</%@>", [resource.segments componentsJoinedByString:@"/"]];
+    NSCharacterSet *nonDigits = [[NSCharacterSet decimalDigitCharacterSet] invertedSet];
+
+    for (NSString *name in [[resource.attributes allKeys] sortedArrayUsingSelector:@selector(compare:)]) {
+        NSString *value = [[resource.attributes objectForKey:name] description];
+        if ([value length] == 0) {
+            [link appendFormat:@";%@", name];
+        }
+        else if ([value rangeOfCharacterFromSet:nonDigits].location == NSNotFound) {
+            [link appendFormat:@";%@=%@", name, value];
+        }
+        else {
+            [link appendFormat:@";%@=\"%@\"", name, value];
+        }
+    }
+    return link;
+}
+
+#pragma mark - Dispatch
+
+- (ICoAPResourceHandler)handlerForUriPath:(NSArray *)uriPath {
+    ICoAPResourceTrieNode *root;
+    @synchronized(self) {
+        root = self.root;
+    }
+    return [ICoAPResourceDirectory handlerForUriPath:uriPath inTrie:root];
+}
+
++ (ICoAPResourceHandler)handlerForUriPath:(NSArray *)uriPath inTrie:(id)trie {
+    ICoAPResourceTrieNode *node = trie;
+    for (NSString *segment in uriPath) {
+        node = [node.children objectForKey:segment];
+        if (!node) {
+            return nil;
+        }
+    }
+    return node.handler;
+}
+
+#pragma mark - Trie Handlers
+
+- (void)addTrieHandler:(ICoAPResourceTrieHandler)handler queue:(dispatch_queue_t)queue owner:(id)owner {
+    ICoAPResourceTrieSubscription *subscription = [[ICoAPResourceTrieSubscription alloc] init];
+    subscription.queue = queue;
+    subscription.handler = handler;
+
+    @synchronized(self) {
+        [trieHandlers setObject:subscription forKey:owner];
+        ICoAPResourceTrieNode *root = self.root;
+        dispatch_async(queue, ^{
+            handler(root);
+        });
+    }
+}
+
+- (void)removeTrieHandlerOfOwner:(id)owner {
+    @synchronized(self) {
+        [trieHandlers removeObjectForKey:owner];
+    }
+}
+
+@end
@@ -0,0 +1,205 @@
+//
+//  ICoAPResponseCache.h
+//  iCoAP
+//
+
+
+/*
+ *  This class caches responses to GET requests in memory
+ *  (RFC 7252 Section 5.6).
+
+ *  Responses are stored under a cache key made of the destination,
+ *  the request method and all request options, except the ones marked
+ *  NoCacheKey, ETag and the options of block-wise transfers and Observe.
+ *  A stored response is fresh for the time given in its Max-Age option
+ *  (60 seconds if absent).
+
+ *  The total size of the stored responses is bounded by 'byteLimit'.
+ *  If the limit is exceeded, entries are evicted with the CLOCK policy
+ *  (second chance), an approximation of LRU which marks an entry on
+ *  a hit instead of reordering a list.
+
+ *  Stale entries are kept until they are evicted, so their ETag can be
+ *  used for revalidation: A 2.03 Valid response to a request carrying the
+ *  ETag makes the stored response fresh again (RFC 7252 Section 5.10.6).
+
+ *  Optionally the cache is backed by a file, so it starts hot after
+ *  a restart. The file is an append-only log of stored and removed
+ *  responses. On opening, the file is memory-mapped and only the
+ *  record headers and keys are read to build the index, the responses
+ *  are decoded on their first use. Every record carries checksums: a
+ *  torn record at the end (crash during a write) is cut off, a damaged
+ *  response is dropped when it is read. Once less than half of the
+ *  file is live, the log is compacted into a new file, so the file
+ *  stays within about twice the size of the cached responses.
+
+ *  The cache is not thread-safe and must only be used from the
+ *  main queue, which is the queue all ICoAPExchange objects operate on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "ICoAPMessage.h"
+
+
+@class ICoAPExchange;
+
+
+#define kResponseCacheByteLimit             1048576     //1 MB
+#define kResponseCacheEntryOverhead         128         //Bytes accounted per entry in addition to payload and options
+#define kDefaultResponseMaxAge              60
+#define kPersistentCacheMagic               0x69434331  //"iCC1"
+#define kPersistentCacheMinCompactionSize   65536       //Smaller logs are never compacted
+
+
+typedef struct {
+    uint32_t headerChecksum;    //FNV-1a of the remaining header fields and the key
+    uint32_t bodyChecksum;      //FNV-1a of the encoded response
+    CFAbsoluteTime expiry;
+    uint32_t bodyLength;
+    uint16_t keyLength;
+    uint8_t kind;
+    uint8_t reserved;
+} ICoAPCacheRecordHeader;
+
+
+@interface ICoAPResponseCache : NSObject {
+    NSMutableDictionary *entries;
+    NSMutableArray *clockEntries;
+    NSUInteger clockHand;
+    ICoAPExchange *codec;
+    int persistentFileDescriptor;
+    NSData *persistentData;
+    NSUInteger persistentLength;
+    NSUInteger persistentLiveLength;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'byteLimit':
+ *  Maximum number of bytes of all stored responses. Default is kResponseCacheByteLimit.
+ */
+@property (readwrite, nonatomic) NSUInteger byteLimit;
+
+/*
+ *  'byteCount':
+ *  Number of bytes of all stored responses.
+ */
+@property (readonly, nonatomic) NSUInteger byteCount;
+
+/*
+ *  'persistentStorePath':
+ *  Path of the file backing the cache, or nil.
+ */
+@property (readonly, nonatomic) NSString *persistentStorePath;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'sharedCache':
+ *  Returns the cache which is shared across the application.
+ */
++ (ICoAPResponseCache *)sharedCache;
+
+/*
+ *  'init':
+ *  Initialization
+ */
+- (id)init;
+
+/*
+ *  'openPersistentStoreAtPath:error:':
+ *  Backs the cache with the file at 'path', which is created if missing.
+ *  The responses stored in the file are added to the cache. Returns NO, if
+ *  the file can not be opened.
+ */
+- (BOOL)openPersistentStoreAtPath:(NSString *)path error:(NSError **)error;
+
+/*
+ *  'closePersistentStore':
+ *  Closes the file backing the cache. The cached responses are kept in memory.
+ */
+- (void)closePersistentStore;
+
+/*
+ *  'isCacheableRequest:':
+ *  Indicates whether responses to the request 'cO' can be cached: GET requests
+ *  without Observe, Block2 and HTTP-Proxying.
+ */
++ (BOOL)isCacheableRequest:(ICoAPMessage *)cO;
+
+/*
+ *  'cacheKeyForRequest:host:port:':
+ *  Returns the cache key of the request 'cO' to the given destination.
+ *  Requests with equal keys are answered by the same response.
+ */
++ (NSData *)cacheKeyForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'freshResponseForRequest:host:port:':
+ *  Returns a copy of the fresh response stored for the request, or nil.
+ *  Its Max-Age is the remaining lifetime of the stored response, rounded up.
+ */
+- (ICoAPMessage *)freshResponseForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'storeResponse:forRequest:host:port:':
+ *  Stores a 2.05 Content 'response' to the request, replacing a previously
+ *  stored one. Other responses are ignored.
+ */
+- (void)storeResponse:(ICoAPMessage *)response forRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'storedETagForRequest:host:port:':
+ *  Returns the ETag (hex string) of the response stored for the request,
+ *  fresh or stale, or nil.
+ */
+- (NSString *)storedETagForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'refreshResponseWithValidResponse:forRequest:host:port:':
+ *  Updates the freshness of the stored response with the Max-Age of the
+ *  2.03 Valid 'validResponse', if both carry the same ETag. Returns a copy
+ *  of the refreshed response, or nil if the ETag does not match.
+ */
+- (ICoAPMessage *)refreshResponseWithValidResponse:(ICoAPMessage *)validResponse forRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'removeResponseForRequest:host:port:':
+ *  Removes the response stored for the request.
+ */
+- (void)removeResponseForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port;
+
+/*
+ *  'removeAllResponses':
+ *  Removes all stored responses.
+ */
+- (void)removeAllResponses;
+
+@end
@@ -0,0 +1,518 @@
+//
+//  ICoAPResponseCache.m
+//  iCoAP
+//
+
+
+#import "ICoAPResponseCache.h"
+#import "ICoAPExchange.h"
+#import <fcntl.h>
+#import <unistd.h>
+
+
+enum {
+    IC_CACHE_RECORD_STORE = 1,
+    IC_CACHE_RECORD_REMOVE = 2
+};
+
+
+static inline uint32_t ICoAPChecksum(uint32_t hash, const void *bytes, NSUInteger length) {
+    //FNV-1a
+    for (NSUInteger i = 0; i < length; i++) {
+        hash = (hash ^ ((const uint8_t *)bytes)[i]) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t ICoAPCacheRecordHeaderChecksum(const ICoAPCacheRecordHeader *header, const void *keyBytes) {
+    uint32_t hash = ICoAPChecksum(2166136261u, &header->bodyChecksum, sizeof(ICoAPCacheRecordHeader) - sizeof(uint32_t));
+    return ICoAPChecksum(hash, keyBytes, header->keyLength);
+}
+
+static NSData *ICoAPCacheRecord(NSData *key, NSData *body, CFAbsoluteTime expiry, uint8_t kind) {
+    ICoAPCacheRecordHeader header;
+    memset(&header, 0, sizeof(header));
+    header.bodyChecksum = ICoAPChecksum(2166136261u, [body bytes], [body length]);
+    header.expiry = expiry;
+    header.bodyLength = (uint32_t)[body length];
+    header.keyLength = (uint16_t)[key length];
+    header.kind = kind;
+    header.headerChecksum = ICoAPCacheRecordHeaderChecksum(&header, [key bytes]);
+
+    NSMutableData *record = [[NSMutableData alloc] initWithCapacity:sizeof(header) + [key length] + [body length]];
+    [record appendBytes:&header length:sizeof(header)];
+    [record appendData:key];
+    [record appendData:body];
+    return record;
+}
+
+
+static inline BOOL ICoAPIsCacheKeyOption(uint option) {
+    //NoCacheKey options have the bits 0x1C set in the low five bits (RFC 7252 Section 5.4.6)
+    return (option & 0x1E) != 0x1C && option != IC_ETAG && option != IC_OBSERVE && option != IC_BLOCK1 && option != IC_BLOCK2 && option != IC_Q_BLOCK1 && option != IC_Q_BLOCK2;
+}
+
+
+
+
+@interface ICoAPCacheEntry : NSObject
+@property (strong, nonatomic) NSData *key;
+@property (strong, nonatomic) ICoAPMessage *response;
+@property (readwrite, nonatomic) CFAbsoluteTime expiry;
+@property (readwrite, nonatomic) NSUInteger size;
+@property (readwrite, nonatomic) NSUInteger clockIndex;
+@property (readwrite, nonatomic) BOOL isReferenced;
+@property (readwrite, nonatomic) NSUInteger persistentOffset;
+@property (readwrite, nonatomic) NSUInteger persistentLength;
+@end
+
+@implementation ICoAPCacheEntry
+@end
+
+
+
+
+@interface ICoAPResponseCache ()
+- (uint)maxAgeOfResponse:(ICoAPMessage *)response;
+- (NSString *)etagOfResponse:(ICoAPMessage *)response;
+- (ICoAPMessage *)responseOfEntry:(ICoAPCacheEntry *)entry;
+- (void)insertEntry:(ICoAPCacheEntry *)entry;
+- (void)removeEntry:(ICoAPCacheEntry *)entry;
+- (void)evictEntries;
+- (void)loadPersistentRecords;
+- (void)appendPersistentRecordForEntry:(ICoAPCacheEntry *)entry kind:(uint8_t)kind;
+- (void)compactPersistentStore;
+@end
+
+@implementation ICoAPResponseCache
+
+#pragma mark - Init
+
++ (ICoAPResponseCache *)sharedCache {
+    static ICoAPResponseCache *sharedCache;
+    static dispatch_once_t onceToken;
+    dispatch_once(&onceToken, ^{
+        sharedCache = [[ICoAPResponseCache alloc] init];
+    });
+    return sharedCache;
+}
+
+- (id)init {
+    if (self = [super init]) {
+        entries = [[NSMutableDictionary alloc] init];
+        clockEntries = [[NSMutableArray alloc] init];
+        codec = [[ICoAPExchange alloc] init];
+        persistentFileDescriptor = -1;
+        self.byteLimit = kResponseCacheByteLimit;
+    }
+    return self;
+}
+
+#pragma mark - Cache Key
+
++ (BOOL)isCacheableRequest:(ICoAPMessage *)cO {
+    return cO.code == IC_GET && !cO.usesHttpProxying && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] && ![cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+}
+
++ (NSData *)cacheKeyForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    NSMutableData *key = [[NSMutableData alloc] init];
+    uint8_t header[3] = {(port >> 8) & 0xFF, port & 0xFF, cO.code};
+
+    [key appendData:[host dataUsingEncoding:NSUTF8StringEncoding]];
+    [key appendBytes:header length:3];
+
+    //Options in ascending order, values of repeatable options in the order they are sent
+    NSArray *sortedKeys = [[cO.optionDict allKeys] sortedArrayUsingComparator:^NSComparisonResult(id a, id b) {
+        return [[NSNumber numberWithInteger:[a integerValue]] compare:[NSNumber numberWithInteger:[b integerValue]]];
+    }];
+
+    for (NSString *optionKey in sortedKeys) {
+        uint option = [optionKey intValue];
+        if (!ICoAPIsCacheKeyOption(option)) {
+            continue;
+        }
+
+        for (NSString *value in [cO.optionDict valueForKey:optionKey]) {
+            NSData *valueData = [value dataUsingEncoding:NSUTF8StringEncoding];
+            uint8_t optionHeader[4] = {(option >> 8) & 0xFF, option & 0xFF, ([valueData length] >> 8) & 0xFF, [valueData length] & 0xFF};
+            [key appendBytes:optionHeader length:4];
+            [key appendData:valueData];
+        }
+    }
+    return key;
+}
+
+#pragma mark - Lookup
+
+- (ICoAPMessage *)freshResponseForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    if (![ICoAPResponseCache isCacheableRequest:cO]) {
+        return nil;
+    }
+
+    ICoAPCacheEntry *entry = [entries objectForKey:[ICoAPResponseCache cacheKeyForRequest:cO host:host port:port]];
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    if (!entry || entry.expiry <= now) {
+        return nil;
+    }
+
+    ICoAPMessage *storedResponse = [self responseOfEntry:entry];
+    if (!storedResponse) {
+        return nil;
+    }
+
+    entry.isReferenced = YES;
+    ICoAPMessage *response = [storedResponse copy];
+
+    //The Max-Age passed on is the remaining lifetime, not the one of the stored response (RFC 7252 Section 5.6.1)
+    NSMutableArray *maxAgeValues = [NSMutableArray arrayWithObject:[NSString stringWithFormat:@"%u", (uint)ceil(entry.expiry - now)]];
+    [response.optionDict setObject:maxAgeValues forKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    response.host = host;
+    response.port = port;
+    response.timestamp = [[NSDate alloc] init];
+    return response;
+}
+
+- (ICoAPMessage *)responseOfEntry:(ICoAPCacheEntry *)entry {
+    if (entry.response || entry.persistentOffset == NSNotFound) {
+        return entry.response;
+    }
+
+    //Responses loaded from the persistent store are decoded on their first use
+    const uint8_t *record = (const uint8_t *)[persistentData bytes] + entry.persistentOffset;
+    ICoAPCacheRecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const uint8_t *body = record + sizeof(header) + header.keyLength;
+
+    if (ICoAPChecksum(2166136261u, body, header.bodyLength) == header.bodyChecksum) {
+        entry.response = [codec decodeCoAPMessageFromData:[NSData dataWithBytes:body length:header.bodyLength]];
+    }
+    if (!entry.response) {
+        [self appendPersistentRecordForEntry:entry kind:IC_CACHE_RECORD_REMOVE];
+        [self removeEntry:entry];
+    }
+    return entry.response;
+}
+
+#pragma mark - Storing
+
+- (void)storeResponse:(ICoAPMessage *)response forRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    if (response.code != IC_CONTENT || ![ICoAPResponseCache isCacheableRequest:cO]) {
+        return;
+    }
+
+    NSData *key = [ICoAPResponseCache cacheKeyForRequest:cO host:host port:port];
+    ICoAPCacheEntry *entry = [entries objectForKey:key];
+    if (entry) {
+        [self removeEntry:entry];
+    }
+
+    entry = [[ICoAPCacheEntry alloc] init];
+    entry.key = key;
+    entry.response = [response copy];
+    entry.expiry = CFAbsoluteTimeGetCurrent() + [self maxAgeOfResponse:response];
+    entry.persistentOffset = NSNotFound;
+    entry.size = kResponseCacheEntryOverhead + [key length] + [response.payloadData length] + [response.payload lengthOfBytesUsingEncoding:NSUTF8StringEncoding];
+
+    for (NSString *optionKey in response.optionDict) {
+        for (NSString *value in [response.optionDict objectForKey:optionKey]) {
+            entry.size += [value length];
+        }
+    }
+
+    if (entry.size > self.byteLimit) {
+        return;
+    }
+
+    [self insertEntry:entry];
+    [self appendPersistentRecordForEntry:entry kind:IC_CACHE_RECORD_STORE];
+    [self evictEntries];
+}
+
+- (void)insertEntry:(ICoAPCacheEntry *)entry {
+    entry.clockIndex = [clockEntries count];
+    [clockEntries addObject:entry];
+    [entries setObject:entry forKey:entry.key];
+    _byteCount += entry.size;
+}
+
+- (uint)maxAgeOfResponse:(ICoAPMessage *)response {
+    NSArray *maxAgeValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    return maxAgeValues ? [[maxAgeValues objectAtIndex:0] intValue] : kDefaultResponseMaxAge;
+}
+
+#pragma mark - Revalidation
+
+- (NSString *)etagOfResponse:(ICoAPMessage *)response {
+    NSArray *etagValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+    return [etagValues count] > 0 ? [etagValues objectAtIndex:0] : nil;
+}
+
+- (NSString *)storedETagForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    if (![ICoAPResponseCache isCacheableRequest:cO]) {
+        return nil;
+    }
+    ICoAPCacheEntry *entry = [entries objectForKey:[ICoAPResponseCache cacheKeyForRequest:cO host:host port:port]];
+    return entry ? [self etagOfResponse:[self responseOfEntry:entry]] : nil;
+}
+
+- (ICoAPMessage *)refreshResponseWithValidResponse:(ICoAPMessage *)validResponse forRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    if (validResponse.code != IC_VALID || ![ICoAPResponseCache isCacheableRequest:cO]) {
+        return nil;
+    }
+
+    ICoAPCacheEntry *entry = [entries objectForKey:[ICoAPResponseCache cacheKeyForRequest:cO host:host port:port]];
+    NSString *etag = [self etagOfResponse:validResponse];
+    if (!entry || !etag || ![self responseOfEntry:entry] || ![etag isEqualToString:[self etagOfResponse:entry.response]]) {
+        return nil;
+    }
+
+    //The 2.03 Valid response updates the Max-Age of the stored response (RFC 7252 Section 5.9.1.3)
+    uint maxAge = [self maxAgeOfResponse:validResponse];
+    NSMutableArray *maxAgeValues = [NSMutableArray arrayWithObject:[NSString stringWithFormat:@"%u", maxAge]];
+    [entry.response.optionDict setObject:maxAgeValues forKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]];
+    entry.expiry = CFAbsoluteTimeGetCurrent() + maxAge;
+    entry.isReferenced = YES;
+    [self appendPersistentRecordForEntry:entry kind:IC_CACHE_RECORD_STORE];
+
+    ICoAPMessage *response = [entry.response copy];
+    response.messageID = validResponse.messageID;
+    response.token = validResponse.token;
+    response.type = validResponse.type;
+    response.host = host;
+    response.port = port;
+    response.timestamp = validResponse.timestamp;
+    return response;
+}
+
+#pragma mark - Eviction
+
+- (void)evictEntries {
+    while (_byteCount > self.byteLimit && [clockEntries count] > 0) {
+        if (clockHand >= [clockEntries count]) {
+            clockHand = 0;
+        }
+
+        //Second chance: referenced entries are unmarked and skipped once
+        ICoAPCacheEntry *entry = [clockEntries objectAtIndex:clockHand];
+        if (entry.isReferenced) {
+            entry.isReferenced = NO;
+            clockHand++;
+        }
+        else {
+            [self appendPersistentRecordForEntry:entry kind:IC_CACHE_RECORD_REMOVE];
+            [self removeEntry:entry];
+        }
+    }
+}
+
+- (void)removeEntry:(ICoAPCacheEntry *)entry {
+    //The last entry takes the place of the removed one, the clock order does not need to be preserved
+    ICoAPCacheEntry *lastEntry = [clockEntries lastObject];
+    lastEntry.clockIndex = entry.clockIndex;
+    [clockEntries replaceObjectAtIndex:entry.clockIndex withObject:lastEntry];
+    [clockEntries removeLastObject];
+
+    [entries removeObjectForKey:entry.key];
+    _byteCount -= entry.size;
+    persistentLiveLength -= entry.persistentLength;
+    entry.persistentLength = 0;
+}
+
+- (void)removeResponseForRequest:(ICoAPMessage *)cO host:(NSString *)host port:(uint)port {
+    ICoAPCacheEntry *entry = [entries objectForKey:[ICoAPResponseCache cacheKeyForRequest:cO host:host port:port]];
+    if (entry) {
+        [self appendPersistentRecordForEntry:entry kind:IC_CACHE_RECORD_REMOVE];
+        [self removeEntry:entry];
+    }
+}
+
+- (void)removeAllResponses {
+    [entries removeAllObjects];
+    [clockEntries removeAllObjects];
+    clockHand = 0;
+    _byteCount = 0;
+    persistentLiveLength = 0;
+
+    if (persistentFileDescriptor >= 0) {
+        [self compactPersistentStore];
+    }
+}
+
+#pragma mark - Persistent Store
+
+- (BOOL)openPersistentStoreAtPath:(NSString *)path error:(NSError **)error {
+    [self closePersistentStore];
+
+    persistentFileDescriptor = open([path fileSystemRepresentation], O_RDWR | O_CREAT, 0644);
+    if (persistentFileDescriptor < 0) {
+        if (error) {
+            *error = [NSError errorWithDomain:NSPOSIXErrorDomain code:errno userInfo:nil];
+        }
+        return NO;
+    }
+
+    persistentData = [NSData dataWithContentsOfFile:path options:NSDataReadingMappedAlways error:nil];
+    _persistentStorePath = [path copy];
+    [self loadPersistentRecords];
+    return YES;
+}
+
+- (void)closePersistentStore {
+    if (persistentFileDescriptor < 0) {
+        return;
+    }
+
+    //Responses still only mapped from the file are dropped with the mapping
+    for (ICoAPCacheEntry *entry in [clockEntries copy]) {
+        if (!entry.response) {
+            [self removeEntry:entry];
+        }
+        entry.persistentOffset = NSNotFound;
+        entry.persistentLength = 0;
+    }
+
+    close(persistentFileDescriptor);
+    persistentFileDescriptor = -1;
+    persistentData = nil;
+    persistentLength = 0;
+    persistentLiveLength = 0;
+    _persistentStorePath = nil;
+}
+
+- (void)loadPersistentRecords {
+    const uint8_t *bytes = [persistentData bytes];
+    NSUInteger length = [persistentData length];
+    NSUInteger offset = sizeof(uint32_t);
+
+    //An empty or foreign file is started over
+    if (length < sizeof(uint32_t) || *(const uint32_t *)bytes != kPersistentCacheMagic) {
+        [self compactPersistentStore];
+        return;
+    }
+
+    while (offset + sizeof(ICoAPCacheRecordHeader) <= length) {
+        //Records are not aligned, the header is copied out of the mapping
+        ICoAPCacheRecordHeader header;
+        memcpy(&header, bytes + offset, sizeof(header));
+        const uint8_t *keyBytes = bytes + offset + sizeof(header);
+        NSUInteger recordLength = sizeof(header) + header.keyLength + header.bodyLength;
+
+        //Torn or damaged record: the log ends here
+        if (offset + recordLength > length || ICoAPCacheRecordHeaderChecksum(&header, keyBytes) != header.headerChecksum) {
+            break;
+        }
+
+        NSData *key = [NSData dataWithBytes:keyBytes length:header.keyLength];
+        ICoAPCacheEntry *entry = [entries objectForKey:key];
+        if (entry) {
+            [self removeEntry:entry];
+        }
+
+        if (header.kind == IC_CACHE_RECORD_STORE) {
+            entry = [[ICoAPCacheEntry alloc] init];
+            entry.key = key;
+            entry.expiry = header.expiry;
+            entry.size = kResponseCacheEntryOverhead + header.keyLength + header.bodyLength;
+            entry.persistentOffset = offset;
+            entry.persistentLength = recordLength;
+            [self insertEntry:entry];
+            persistentLiveLength += recordLength;
+        }
+        offset += recordLength;
+    }
+
+    persistentLength = offset;
+    if (offset < length) {
+        ftruncate(persistentFileDescriptor, offset);
+    }
+    [self evictEntries];
+}
+
+- (void)appendPersistentRecordForEntry:(ICoAPCacheEntry *)entry kind:(uint8_t)kind {
+    if (persistentFileDescriptor < 0) {
+        return;
+    }
+
+    NSData *body = kind == IC_CACHE_RECORD_STORE ? [codec encodeDataFromCoAPMessage:entry.response] : nil;
+    NSData *record = ICoAPCacheRecord(entry.key, body, entry.expiry, kind);
+
+    if (pwrite(persistentFileDescriptor, [record bytes], [record length], persistentLength) != (ssize_t)[record length]) {
+        //A partially written record is cut off on the next start
+        [self closePersistentStore];
+        return;
+    }
+    persistentLength += [record length];
+
+    //The new record supersedes the previous one of the entry, which is not mapped anymore
+    persistentLiveLength -= entry.persistentLength;
+    entry.persistentOffset = NSNotFound;
+    entry.persistentLength = 0;
+    if (kind == IC_CACHE_RECORD_STORE) {
+        entry.persistentLength = [record length];
+        persistentLiveLength += entry.persistentLength;
+    }
+
+    if (persistentLength > kPersistentCacheMinCompactionSize && persistentLength > 2 * persistentLiveLength) {
+        [self compactPersistentStore];
+    }
+}
+
+- (void)compactPersistentStore {
+    NSString *temporaryPath = [_persistentStorePath stringByAppendingString:@".compact"];
+    int fd = open([temporaryPath fileSystemRepresentation], O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        [self closePersistentStore];
+        return;
+    }
+
+    NSMutableData *log = [[NSMutableData alloc] init];
+    uint32_t magic = kPersistentCacheMagic;
+    [log appendBytes:&magic length:sizeof(magic)];
+
+    //Entries not decoded yet are copied as they are and stay mapped from the new log
+    NSMutableArray *mappedEntries = [[NSMutableArray alloc] init];
+    NSMutableArray *mappedOffsets = [[NSMutableArray alloc] init];
+    for (ICoAPCacheEntry *entry in clockEntries) {
+        NSData *record;
+        if (entry.response) {
+            record = ICoAPCacheRecord(entry.key, [codec encodeDataFromCoAPMessage:entry.response], entry.expiry, IC_CACHE_RECORD_STORE);
+        }
+        else {
+            record = [persistentData subdataWithRange:NSMakeRange(entry.persistentOffset, entry.persistentLength)];
+            [mappedEntries addObject:entry];
+            [mappedOffsets addObject:[NSNumber numberWithUnsignedInteger:[log length]]];
+        }
+        entry.persistentLength = [record length];
+        [log appendData:record];
+    }
+
+    //The new log replaces the old one only once it is completely on disk
+    if (write(fd, [log bytes], [log length]) != (ssize_t)[log length] || fsync(fd) != 0 || rename([temporaryPath fileSystemRepresentation], [_persistentStorePath fileSystemRepresentation]) != 0) {
+        close(fd);
+        unlink([temporaryPath fileSystemRepresentation]);
+        for (ICoAPCacheEntry *entry in clockEntries) {
+            entry.persistentLength = 0;
+        }
+        [self closePersistentStore];
+        return;
+    }
+
+    close(persistentFileDescriptor);
+    persistentFileDescriptor = fd;
+    persistentData = [mappedEntries count] > 0 ? [NSData dataWithContentsOfFile:_persistentStorePath options:NSDataReadingMappedAlways error:nil] : nil;
+    persistentLength = [log length];
+    persistentLiveLength = [log length] - sizeof(magic);
+
+    for (ICoAPCacheEntry *entry in clockEntries) {
+        entry.persistentOffset = NSNotFound;
+    }
+    for (NSUInteger i = 0; i < [mappedEntries count]; i++) {
+        ICoAPCacheEntry *entry = [mappedEntries objectAtIndex:i];
+        entry.persistentOffset = persistentData ? [[mappedOffsets objectAtIndex:i] unsignedIntegerValue] : NSNotFound;
+        if (entry.persistentOffset == NSNotFound) {
+            [self removeEntry:entry];
+        }
+    }
+}
+
+@end
@@ -0,0 +1,248 @@
+//
+//  ICoAPServer.h
+//  iCoAP
+//
+
+
+/*
+ *  This class is a lightweight CoAP-Server, built on the codec of
+ *  ICoAPExchange and a GCDAsyncUdpSocket.
+
+ *  Requests are dispatched by their Uri-Path options to the handlers
+ *  of the 'resourceDirectory', unknown resources are answered with
+ *  4.04 (Not Found). A handler receives an ICoAPServerTransaction and
+ *  answers it with 'respondWithCoAPMessage:'.
+
+ *  A response given while the handler runs is piggybacked on the ACK
+ *  of a confirmable request. Otherwise the request is acknowledged with
+ *  an empty ACK after 'separateResponseDelay', and the response follows
+ *  as separate confirmable message, which is retransmitted until it is
+ *  acknowledged (RFC 7252 Section 5.2.2). Duplicates of confirmable
+ *  requests are answered with the previous response without calling
+ *  the handler again.
+
+ *  Duplicates are recognized by address and Message ID for
+ *  EXCHANGE_LIFETIME after the request arrived, however many requests
+ *  arrive meanwhile. The server therefore keeps one entry with the
+ *  encoded response for every confirmable request of the last
+ *  EXCHANGE_LIFETIME (247 s), e.g. about 250000 entries at 1000
+ *  requests per second.
+
+ *  Handlers are called on the 'serverQueue' and responses must be given
+ *  on it, which is the main queue unless another one is passed on init.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+#import "ICoAPExchange.h"
+#import "ICoAPResourceDirectory.h"
+#import "ICoAPObservableResource.h"
+
+
+#define kSeparateResponseDelay              0.5     //Seconds before a request without response is acknowledged
+#define kServerReceiveBatchSize             16      //Waiting datagrams passed to the server queue in one dispatch
+
+
+@class ICoAPServer;
+
+
+
+
+
+
+
+#pragma mark - Transaction
+
+
+
+
+
+
+
+@interface ICoAPServerTransaction : NSObject
+
+/*
+ *  'request':
+ *  The received request.
+ */
+@property (strong, nonatomic) ICoAPMessage *request;
+
+/*
+ *  'address':
+ *  The address of the client.
+ */
+@property (strong, nonatomic) NSData *address;
+
+/*
+ *  'server':
+ *  The server which received the request.
+ */
+@property (weak, nonatomic) ICoAPServer *server;
+
+/*
+ *  'isResponded':
+ *  Indicates whether a response was given.
+ */
+@property (readonly, nonatomic) BOOL isResponded;
+
+/*
+ *  'isAcknowledged':
+ *  Indicates whether the confirmable request was acknowledged with an
+ *  empty ACK, i.e. whether the response is sent separately.
+ */
+@property (readonly, nonatomic) BOOL isAcknowledged;
+
+/*
+ *  'respondWithCoAPMessage:':
+ *  Sends 'response' to the client. Type, Message ID and token are set
+ *  by the server, only the first response of a transaction is sent.
+ */
+- (void)respondWithCoAPMessage:(ICoAPMessage *)response;
+
+@end
+
+
+
+
+@interface ICoAPServer : NSObject<GCDAsyncUdpSocketDelegate> {
+    ICoAPExchange *codec;
+    uint randomMessageId;
+    long udpSocketTag;
+    NSMutableDictionary *recentRequests;
+    NSMutableArray *recentRequestQueue;
+    NSMutableDictionary *pendingSeparateResponses;
+    NSMutableArray *observableResources;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'udpSocket':
+ *  The socket on which the server receives requests.
+ */
+@property (strong, nonatomic) GCDAsyncUdpSocket *udpSocket;
+
+/*
+ *  'serverQueue':
+ *  The queue on which requests are handled.
+ */
+@property (readonly, nonatomic) dispatch_queue_t serverQueue;
+
+/*
+ *  'resourceDirectory':
+ *  The resources of the server. Requests are dispatched with the trie
+ *  the directory passes to the 'serverQueue' after every change.
+ */
+@property (strong, nonatomic) ICoAPResourceDirectory *resourceDirectory;
+
+/*
+ *  'separateResponseDelay':
+ *  Time in seconds a handler may take before the request is acknowledged
+ *  with an empty ACK and the response is sent separately.
+ *  Default is kSeparateResponseDelay.
+ */
+@property (readwrite, nonatomic) NSTimeInterval separateResponseDelay;
+
+/*
+ *  'reusesPort':
+ *  If set, the socket is bound with SO_REUSEPORT, so several servers
+ *  can receive on the same port (see ICoAPServerPool). Default is NO.
+ */
+@property (readwrite, nonatomic) BOOL reusesPort;
+
+/*
+ *  'receiveBatchSize':
+ *  Maximum number of datagrams waiting in the socket which are read in
+ *  one go and handled in one block on the 'serverQueue', instead of one
+ *  dispatch per datagram. Applies from the next 'startOnPort:error:'.
+ *  Default is kServerReceiveBatchSize.
+ */
+@property (readwrite, nonatomic) uint16_t receiveBatchSize;
+
+/*
+ *  'handledRequestCount':
+ *  Number of requests which were passed to a handler or answered with 4.04.
+ */
+@property (readonly, nonatomic) NSUInteger handledRequestCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization on the main queue with a new resource directory.
+ */
+- (id)init;
+
+/*
+ *  'initWithQueue:resourceDirectory:':
+ *  Initialization on the serial 'queue' with the given 'resourceDirectory'.
+ */
+- (id)initWithQueue:(dispatch_queue_t)queue resourceDirectory:(ICoAPResourceDirectory *)resourceDirectory;
+
+/*
+ *  'addResourceWithPath:attributes:handler:':
+ *  Registers a resource in the 'resourceDirectory' (see ICoAPResourceDirectory).
+ */
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler;
+
+/*
+ *  'addObservableResourceWithPath:attributes:representation:':
+ *  Registers a resource which clients can observe (see ICoAPObservableResource)
+ *  and returns it. Its representation is changed with 'updateRepresentation:'.
+ *  Observable resources belong to this server and are not shared with other
+ *  servers using the same resource directory.
+ */
+- (ICoAPObservableResource *)addObservableResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes representation:(ICoAPMessage *)representation;
+
+/*
+ *  'startOnPort:error:':
+ *  Binds the socket to 'port' and starts handling requests.
+ *  Returns NO and sets 'error' if the socket could not be set up.
+ */
+- (BOOL)startOnPort:(uint)port error:(NSError **)error;
+
+/*
+ *  'stop':
+ *  Closes the socket. Pending separate responses are not sent.
+ */
+- (void)stop;
+
+/*
+ *  'sendResponse:forTransaction:':
+ *  Sends the response of 'transaction', see 'respondWithCoAPMessage:'.
+ */
+- (void)sendResponse:(ICoAPMessage *)response forTransaction:(ICoAPServerTransaction *)transaction;
+
+/*
+ *  'nextMessageID':
+ *  Returns the Message ID for the next message sent by the server.
+ */
+- (uint)nextMessageID;
+
+@end
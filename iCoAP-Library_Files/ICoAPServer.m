@@ -0,0 +1,347 @@
+//
+//  ICoAPServer.m
+//  iCoAP
+//
+
+
+#import "ICoAPServer.h"
+
+
+static inline NSData *ICoAPServerMessageKey(NSData *address, uint messageID) {
+    NSMutableData *key = [NSMutableData dataWithData:address];
+    uint8_t messageIDBytes[2] = {(messageID >> 8) & 0xFF, messageID & 0xFF};
+    [key appendBytes:messageIDBytes length:2];
+    return key;
+}
+
+
+
+
+@interface ICoAPServerTransaction ()
+@property (readwrite, nonatomic) BOOL isResponded;
+@property (readwrite, nonatomic) BOOL isAcknowledged;
+@property (strong, nonatomic) NSData *responseData;
+@property (readwrite, nonatomic) uint retransmissionCounter;
+@property (readwrite, nonatomic) NSTimeInterval retransmissionTimeout;
+@end
+
+@implementation ICoAPServerTransaction
+
+- (void)respondWithCoAPMessage:(ICoAPMessage *)response {
+    [self.server sendResponse:response forTransaction:self];
+}
+
+@end
+
+
+
+
+@interface ICoAPServerRecentRequest : NSObject
+@property (strong, nonatomic) NSData *key;
+@property (readwrite, nonatomic) CFAbsoluteTime expiry;
+@property (strong, nonatomic) NSData *responseData;
+@end
+
+@implementation ICoAPServerRecentRequest
+@end
+
+
+
+
+@interface ICoAPServer ()
+@property (strong, nonatomic) id resourceTrie;
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext;
+- (void)handleRequestWithCoAPMessage:(ICoAPMessage *)cO fromAddress:(NSData *)address;
+- (void)acknowledgeTransaction:(ICoAPServerTransaction *)transaction;
+- (void)retransmitSeparateResponseWithKey:(NSData *)key;
+- (ICoAPServerRecentRequest *)recentRequestForKey:(NSData *)key;
+- (void)recordRequestWithKey:(NSData *)key;
+- (void)rememberResponseData:(NSData *)data forKey:(NSData *)key;
+- (void)sendData:(NSData *)data toAddress:(NSData *)address;
+@end
+
+@implementation ICoAPServer
+
+#pragma mark - Init
+
+- (id)init {
+    return [self initWithQueue:dispatch_get_main_queue() resourceDirectory:[[ICoAPResourceDirectory alloc] init]];
+}
+
+- (id)initWithQueue:(dispatch_queue_t)queue resourceDirectory:(ICoAPResourceDirectory *)resourceDirectory {
+    if (self = [super init]) {
+        _serverQueue = queue;
+        codec = [[ICoAPExchange alloc] init];
+        randomMessageId = 1 + arc4random() % 65536;
+        recentRequests = [[NSMutableDictionary alloc] init];
+        recentRequestQueue = [[NSMutableArray alloc] init];
+        pendingSeparateResponses = [[NSMutableDictionary alloc] init];
+        observableResources = [[NSMutableArray alloc] init];
+        self.resourceDirectory = resourceDirectory;
+        self.separateResponseDelay = kSeparateResponseDelay;
+        self.receiveBatchSize = kServerReceiveBatchSize;
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self stop];
+}
+
+//Requests are dispatched with the trie passed to the server queue, the directory is not locked for them
+- (void)setResourceDirectory:(ICoAPResourceDirectory *)resourceDirectory {
+    [_resourceDirectory removeTrieHandlerOfOwner:self];
+    _resourceDirectory = resourceDirectory;
+
+    __weak ICoAPServer *weakSelf = self;
+    [resourceDirectory addTrieHandler:^(id trie) {
+        weakSelf.resourceTrie = trie;
+    } queue:self.serverQueue owner:self];
+}
+
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler {
+    [self.resourceDirectory addResourceWithPath:path attributes:attributes handler:handler];
+}
+
+- (ICoAPObservableResource *)addObservableResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes representation:(ICoAPMessage *)representation {
+    ICoAPObservableResource *resource = [[ICoAPObservableResource alloc] initWithServer:self representation:representation];
+    [observableResources addObject:resource];
+
+    NSMutableDictionary *observableAttributes = [NSMutableDictionary dictionaryWithDictionary:attributes];
+    [observableAttributes setObject:@"" forKey:@"obs"];
+    [self.resourceDirectory addResourceWithPath:path attributes:observableAttributes handler:^(ICoAPServerTransaction *transaction) {
+        [resource handleTransaction:transaction];
+    }];
+    return resource;
+}
+
+#pragma mark - Socket
+
+- (BOOL)startOnPort:(uint)port error:(NSError **)error {
+    [self stop];
+    self.udpSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:self.serverQueue];
+    [self.udpSocket setReceiveBatchSize:self.receiveBatchSize];
+
+    if ((self.reusesPort && ![self.udpSocket enableReusePort:YES error:error]) || ![self.udpSocket bindToPort:port error:error] || ![self.udpSocket beginReceiving:error]) {
+        [self.udpSocket close];
+        self.udpSocket = nil;
+        return NO;
+    }
+    return YES;
+}
+
+- (void)stop {
+    [pendingSeparateResponses removeAllObjects];
+    self.udpSocket.delegate = nil;
+    [self.udpSocket close];
+    self.udpSocket = nil;
+}
+
+- (void)sendData:(NSData *)data toAddress:(NSData *)address {
+    [self.udpSocket sendData:data toAddress:address withTimeout:-1 tag:udpSocketTag++];
+}
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+
+    //Duplicate confirmable request: the previous response is repeated, if there is one yet
+    if ([data length] >= 4) {
+        const uint8_t *header = [data bytes];
+        uint messageID = header[2] << 8 | header[3];
+        ICoAPServerRecentRequest *recentRequest = header[0] >> 4 == IC_CONFIRMABLE ? [self recentRequestForKey:ICoAPServerMessageKey(address, messageID)] : nil;
+
+        if (recentRequest) {
+            if (recentRequest.responseData) {
+                [self sendData:recentRequest.responseData toAddress:address];
+            }
+            return;
+        }
+
+        //Empty ACK or RST: a separate response or a notification, handled without decoding
+        if ((header[0] >> 4 == IC_ACKNOWLEDGMENT || header[0] >> 4 == IC_RESET) && header[1] == IC_EMPTY) {
+            if ([pendingSeparateResponses objectForKey:ICoAPServerMessageKey(address, messageID)]) {
+                [pendingSeparateResponses removeObjectForKey:ICoAPServerMessageKey(address, messageID)];
+                return;
+            }
+            for (ICoAPObservableResource *resource in observableResources) {
+                if ([resource handleEmptyMessageWithType:(ICoAPType)(header[0] >> 4) messageID:messageID fromAddress:address]) {
+                    return;
+                }
+            }
+            return;
+        }
+    }
+
+    ICoAPMessage *cO = [codec decodeCoAPMessageFromData:data];
+    if (!cO) {
+        return;
+    }
+
+    //ACK or RST of a separate response
+    if (cO.type == IC_ACKNOWLEDGMENT || cO.type == IC_RESET) {
+        [pendingSeparateResponses removeObjectForKey:ICoAPServerMessageKey(address, cO.messageID)];
+        return;
+    }
+
+    //CoAP Ping: answered with a Reset message
+    if (cO.code == IC_EMPTY) {
+        if (cO.type == IC_CONFIRMABLE) {
+            ICoAPMessage *reset = [[ICoAPMessage alloc] init];
+            reset.type = IC_RESET;
+            reset.messageID = cO.messageID;
+            [self sendData:[codec encodeDataFromCoAPMessage:reset] toAddress:address];
+        }
+        return;
+    }
+
+    if (cO.code >= 32) {
+        return;
+    }
+
+    [self handleRequestWithCoAPMessage:cO fromAddress:address];
+}
+
+#pragma mark - Dispatch
+
+- (void)handleRequestWithCoAPMessage:(ICoAPMessage *)cO fromAddress:(NSData *)address {
+    cO.isRequest = YES;
+
+    ICoAPServerTransaction *transaction = [[ICoAPServerTransaction alloc] init];
+    transaction.request = cO;
+    transaction.address = address;
+    transaction.server = self;
+
+    //Recorded before the handler runs, so duplicates arriving meanwhile do not call it again
+    if (cO.type == IC_CONFIRMABLE) {
+        [self recordRequestWithKey:ICoAPServerMessageKey(address, cO.messageID)];
+    }
+
+    _handledRequestCount++;
+    ICoAPResourceHandler handler = [ICoAPResourceDirectory handlerForUriPath:[cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_PATH]] inTrie:self.resourceTrie];
+
+    if (handler) {
+        handler(transaction);
+    }
+    else {
+        ICoAPMessage *response = [[ICoAPMessage alloc] init];
+        response.code = IC_NOT_FOUND;
+        [transaction respondWithCoAPMessage:response];
+    }
+
+    if (!transaction.isResponded && cO.type == IC_CONFIRMABLE) {
+        __weak ICoAPServer *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(self.separateResponseDelay * NSEC_PER_SEC)), self.serverQueue, ^{
+            [weakSelf acknowledgeTransaction:transaction];
+        });
+    }
+}
+
+#pragma mark - Responses
+
+- (void)sendResponse:(ICoAPMessage *)response forTransaction:(ICoAPServerTransaction *)transaction {
+    if (transaction.isResponded) {
+        return;
+    }
+    transaction.isResponded = YES;
+
+    ICoAPMessage *cO = [response copy];
+    cO.isRequest = NO;
+    cO.token = transaction.request.token;
+
+    //Piggybacked response
+    if (transaction.request.type == IC_CONFIRMABLE && !transaction.isAcknowledged) {
+        cO.type = IC_ACKNOWLEDGMENT;
+        cO.messageID = transaction.request.messageID;
+
+        NSData *data = [codec encodeDataFromCoAPMessage:cO];
+        [self rememberResponseData:data forKey:ICoAPServerMessageKey(transaction.address, transaction.request.messageID)];
+        [self sendData:data toAddress:transaction.address];
+        return;
+    }
+
+    //Separate response, confirmable if the request was
+    cO.type = transaction.request.type == IC_CONFIRMABLE ? IC_CONFIRMABLE : IC_NON_CONFIRMABLE;
+    cO.messageID = [self nextMessageID];
+    transaction.responseData = [codec encodeDataFromCoAPMessage:cO];
+    [self sendData:transaction.responseData toAddress:transaction.address];
+
+    if (cO.type == IC_CONFIRMABLE) {
+        NSData *key = ICoAPServerMessageKey(transaction.address, cO.messageID);
+        transaction.retransmissionTimeout = kACK_TIMEOUT + kACK_TIMEOUT * (kACK_RANDOM_FACTOR - 1) * arc4random_uniform(1001) / 1000.0;
+        [pendingSeparateResponses setObject:transaction forKey:key];
+
+        __weak ICoAPServer *weakSelf = self;
+        dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(transaction.retransmissionTimeout * NSEC_PER_SEC)), self.serverQueue, ^{
+            [weakSelf retransmitSeparateResponseWithKey:key];
+        });
+    }
+}
+
+- (uint)nextMessageID {
+    return ++randomMessageId % 65536;
+}
+
+- (void)acknowledgeTransaction:(ICoAPServerTransaction *)transaction {
+    if (transaction.isResponded || !self.udpSocket) {
+        return;
+    }
+    transaction.isAcknowledged = YES;
+
+    ICoAPMessage *ack = [[ICoAPMessage alloc] init];
+    ack.type = IC_ACKNOWLEDGMENT;
+    ack.messageID = transaction.request.messageID;
+
+    NSData *data = [codec encodeDataFromCoAPMessage:ack];
+    [self rememberResponseData:data forKey:ICoAPServerMessageKey(transaction.address, transaction.request.messageID)];
+    [self sendData:data toAddress:transaction.address];
+}
+
+- (void)retransmitSeparateResponseWithKey:(NSData *)key {
+    ICoAPServerTransaction *transaction = [pendingSeparateResponses objectForKey:key];
+    if (!transaction) {
+        return;
+    }
+
+    if (transaction.retransmissionCounter >= kMAX_RETRANSMIT) {
+        [pendingSeparateResponses removeObjectForKey:key];
+        return;
+    }
+
+    transaction.retransmissionCounter++;
+    transaction.retransmissionTimeout *= 2;
+    [self sendData:transaction.responseData toAddress:transaction.address];
+
+    __weak ICoAPServer *weakSelf = self;
+    dispatch_after(dispatch_time(DISPATCH_TIME_NOW, (int64_t)(transaction.retransmissionTimeout * NSEC_PER_SEC)), self.serverQueue, ^{
+        [weakSelf retransmitSeparateResponseWithKey:key];
+    });
+}
+
+#pragma mark - Deduplication
+
+- (ICoAPServerRecentRequest *)recentRequestForKey:(NSData *)key {
+    //Requests are queued in order of arrival and share one lifetime, so expired requests are always the oldest
+    CFAbsoluteTime now = CFAbsoluteTimeGetCurrent();
+    while ([recentRequestQueue count] > 0 && ((ICoAPServerRecentRequest *)[recentRequestQueue objectAtIndex:0]).expiry <= now) {
+        ICoAPServerRecentRequest *expiredRequest = [recentRequestQueue objectAtIndex:0];
+        if ([recentRequests objectForKey:expiredRequest.key] == expiredRequest) {
+            [recentRequests removeObjectForKey:expiredRequest.key];
+        }
+        [recentRequestQueue removeObjectAtIndex:0];
+    }
+    return [recentRequests objectForKey:key];
+}
+
+- (void)recordRequestWithKey:(NSData *)key {
+    ICoAPServerRecentRequest *recentRequest = [[ICoAPServerRecentRequest alloc] init];
+    recentRequest.key = key;
+    recentRequest.expiry = CFAbsoluteTimeGetCurrent() + kEXCHANGE_LIFETIME;
+    [recentRequests setObject:recentRequest forKey:key];
+    [recentRequestQueue addObject:recentRequest];
+}
+
+//The response is kept with its request, until the request expires
+- (void)rememberResponseData:(NSData *)data forKey:(NSData *)key {
+    [[recentRequests objectForKey:key] setResponseData:data];
+}
+
+@end
@@ -0,0 +1,126 @@
+//
+//  ICoAPServerPool.h
+//  iCoAP
+//
+
+
+/*
+ *  This class runs a CoAP-Server on several cores.
+
+ *  Every worker is an ICoAPServer with its own serial queue, its own
+ *  UDP socket bound to the common port with SO_REUSEPORT, its own codec,
+ *  deduplication cache and pending responses. The kernel distributes
+ *  the requests among the sockets by the address of the client, so the
+ *  duplicates of a request reach the worker which handled it, and no
+ *  state is shared between workers on the request path.
+
+ *  All workers dispatch through the same ICoAPResourceDirectory. Each
+ *  compiled trie is passed to the queue of every worker, which then
+ *  dispatches with its own reference to it, so workers take no shared
+ *  lock to find a handler. Handlers run
+ *  concurrently on the worker queues and must be thread-safe; a response
+ *  must be given on the queue of the worker which called the handler
+ *  (transaction.server.serverQueue).
+
+ *  The pool scales on Linux only. Linux balances datagrams over all
+ *  SO_REUSEPORT sockets, Darwin delivers unicast datagrams to one of
+ *  them, so on macOS and iOS a single worker handles all requests and
+ *  the pool is no faster than one ICoAPServer.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "ICoAPServer.h"
+
+
+@interface ICoAPServerPool : NSObject {
+    NSMutableArray *workers;
+}
+
+
+
+
+
+
+
+#pragma mark - Properties
+
+
+
+
+
+
+
+/*
+ *  'resourceDirectory':
+ *  The resources shared by all workers.
+ */
+@property (readonly, nonatomic) ICoAPResourceDirectory *resourceDirectory;
+
+/*
+ *  'workers':
+ *  The ICoAPServer objects of the pool.
+ */
+@property (readonly, nonatomic) NSArray *workers;
+
+/*
+ *  'port':
+ *  The port the workers are bound to, 0 before 'startOnPort:error:'.
+ */
+@property (readonly, nonatomic) uint port;
+
+/*
+ *  'handledRequestCount':
+ *  Number of requests handled by all workers. Each count is read on the
+ *  queue of its worker, so this must not be called from a worker queue.
+ */
+@property (readonly, nonatomic) NSUInteger handledRequestCount;
+
+
+
+
+
+
+
+#pragma mark - Accessible Methods
+
+
+
+
+
+
+
+/*
+ *  'init':
+ *  Initialization with one worker per active processor core.
+ */
+- (id)init;
+
+/*
+ *  'initWithWorkerCount:':
+ *  Initialization with 'count' workers.
+ */
+- (id)initWithWorkerCount:(NSUInteger)count;
+
+/*
+ *  'addResourceWithPath:attributes:handler:':
+ *  Registers a resource for all workers (see ICoAPResourceDirectory).
+ */
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler;
+
+/*
+ *  'startOnPort:error:':
+ *  Binds the sockets of all workers to 'port'. With port 0 the workers are
+ *  bound to the port the system chooses for the first one. Returns NO and
+ *  sets 'error' if a socket could not be set up, no worker is running then.
+ */
+- (BOOL)startOnPort:(uint)port error:(NSError **)error;
+
+/*
+ *  'stop':
+ *  Closes the sockets of all workers.
+ */
+- (void)stop;
+
+@end
@@ -0,0 +1,93 @@
+//
+//  ICoAPServerPool.m
+//  iCoAP
+//
+
+
+#import "ICoAPServerPool.h"
+
+@implementation ICoAPServerPool
+
+#pragma mark - Init
+
+- (id)init {
+    return [self initWithWorkerCount:[[NSProcessInfo processInfo] activeProcessorCount]];
+}
+
+- (id)initWithWorkerCount:(NSUInteger)count {
+    if (self = [super init]) {
+        _resourceDirectory = [[ICoAPResourceDirectory alloc] init];
+        workers = [[NSMutableArray alloc] initWithCapacity:count];
+
+        for (NSUInteger i = 0; i < MAX(count, 1); i++) {
+            NSString *label = [NSString stringWithFormat:@"iCoAP.ServerPool.worker%lu", (unsigned long)i];
+            dispatch_queue_t queue = dispatch_queue_create([label UTF8String], DISPATCH_QUEUE_SERIAL);
+
+            ICoAPServer *worker = [[ICoAPServer alloc] initWithQueue:queue resourceDirectory:self.resourceDirectory];
+            worker.reusesPort = YES;
+            [workers addObject:worker];
+        }
+    }
+    return self;
+}
+
+- (NSArray *)workers {
+    return [workers copy];
+}
+
+- (NSUInteger)handledRequestCount {
+    __block NSUInteger count = 0;
+    for (ICoAPServer *worker in workers) {
+        dispatch_sync(worker.serverQueue, ^{
+            count += worker.handledRequestCount;
+        });
+    }
+    return count;
+}
+
+- (void)addResourceWithPath:(NSString *)path attributes:(NSDictionary *)attributes handler:(ICoAPResourceHandler)handler {
+    [self.resourceDirectory addResourceWithPath:path attributes:attributes handler:handler];
+}
+
+#pragma mark - Workers
+
+//The state of a worker is only touched on its own queue
+- (BOOL)startOnPort:(uint)port error:(NSError **)error {
+    __block uint boundPort = port;
+
+    for (ICoAPServer *worker in workers) {
+        __block BOOL isStarted;
+        __block NSError *workerError;
+        dispatch_sync(worker.serverQueue, ^{
+            NSError *startError;
+            isStarted = [worker startOnPort:boundPort error:&startError];
+            workerError = startError;
+
+            //The ephemeral port of the first worker is shared by the others
+            if (isStarted && boundPort == 0) {
+                boundPort = [worker.udpSocket localPort];
+            }
+        });
+
+        if (!isStarted) {
+            if (error) {
+                *error = workerError;
+            }
+            [self stop];
+            return NO;
+        }
+    }
+    _port = boundPort;
+    return YES;
+}
+
+- (void)stop {
+    _port = 0;
+    for (ICoAPServer *worker in workers) {
+        dispatch_sync(worker.serverQueue, ^{
+            [worker stop];
+        });
+    }
+}
+
+@end
@@ -24,20 +24,17 @@
 }
 
 + (NSString *)stringFromDataWithHex:(NSData *)data{
-	// We first need to get the length of our hexstring
-	// data.length returns the length in bytes, so we *2 to get as hexstring
-	NSUInteger capacity = data.length * 2;
-	// Create a new NSMutableString with the correct lenght
-	NSMutableString *mutableString = [NSMutableString stringWithCapacity:capacity];
-	// get the bytes of data to be able to loop through it
-	const unsigned char *buf = (const unsigned char*) [data bytes];
-	 
-	NSInteger t;
-	for (t=0; t<data.length; ++t) {
-		// "%02x" will append a 0 if the value is less than 2 digits (i.e. 4 becomes 04)
-		[mutableString appendFormat:@"%02lx", (unsigned long)buf[t]];
-	}
-	return [NSString stringWithString:mutableString];
+    // Two lowercase hex digits per byte, written into one buffer instead of formatting every byte
+    static const char digits[] = "0123456789abcdef";
+    const unsigned char *buf = (const unsigned char*) [data bytes];
+    NSUInteger length = data.length;
+    char *hex = malloc(length * 2 + 1);
+    
+    for (NSUInteger t = 0; t < length; ++t) {
+        hex[t * 2] = digits[buf[t] >> 4];
+        hex[t * 2 + 1] = digits[buf[t] & 0x0F];
+    }
+    return [[NSString alloc] initWithBytesNoCopy:hex length:length * 2 encoding:NSASCIIStringEncoding freeWhenDone:YES];
 }
 
 + (NSString *)get0To4ByteHexStringFromInt:(int32_t)value {
@@ -0,0 +1,256 @@
+//
+//  ICoAPForwardProxyTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Block2 transfers through ICoAPForwardProxy. A stand-in server sends
+ *  a representation which must not be cached (Max-Age 0) in blocks, a
+ *  stand-in client fetches it block by block through the proxy. The
+ *  follow-up requests of the client must be answered from the body the
+ *  proxy reassembled, without another transfer from the server.
+ *  Requests naming the ETag of a cached response or of the reassembled
+ *  body must be answered with 2.03 (Valid) by the proxy itself.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import <netinet/in.h>
+#import "ICoAPForwardProxy.h"
+#import "ICoAPTestServer.h"
+
+
+#define kForwardProxyTestBodyLength         3000    //Three blocks of 1024 Bytes
+#define kForwardProxyTestSzx                6
+#define kForwardProxyTestETag               @"a1b2"
+
+
+
+
+@interface ICoAPForwardProxyTests : XCTestCase {
+    NSData *body;
+}
+- (ICoAPMessage *)blockRequestWithNumber:(uint)blockNumber proxyUri:(NSString *)proxyUri client:(ICoAPTestServer *)client;
+- (NSData *)addressOfProxy:(ICoAPForwardProxy *)proxy;
+- (ICoAPTestServer *)blockServerWithMaxAge:(NSString *)maxAge transferCount:(NSUInteger *)transferCount;
+@end
+
+@implementation ICoAPForwardProxyTests
+
+- (void)setUp {
+    [super setUp];
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:kForwardProxyTestBodyLength];
+    uint8_t *bytes = [data mutableBytes];
+    for (NSUInteger i = 0; i < kForwardProxyTestBodyLength; i++) {
+        bytes[i] = i % 251;
+    }
+    body = data;
+}
+
+- (ICoAPMessage *)blockRequestWithNumber:(uint)blockNumber proxyUri:(NSString *)proxyUri client:(ICoAPTestServer *)client {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    cO.messageID = [client nextMessageID];
+    cO.token = 0x2A;
+    [cO addOption:IC_PROXY_URI withValue:proxyUri];
+    [cO addOption:IC_BLOCK2 withValue:[NSString stringWithFormat:@"%u", blockNumber << 4 | kForwardProxyTestSzx]];
+    return cO;
+}
+
+- (NSData *)addressOfProxy:(ICoAPForwardProxy *)proxy {
+    struct sockaddr_in proxyAddress;
+    memset(&proxyAddress, 0, sizeof(proxyAddress));
+    proxyAddress.sin_len = sizeof(proxyAddress);
+    proxyAddress.sin_family = AF_INET;
+    proxyAddress.sin_port = htons([proxy.udpSocket localPort]);
+    proxyAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return [NSData dataWithBytes:&proxyAddress length:sizeof(proxyAddress)];
+}
+
+//Sends 'body' in blocks, 'transferCount' counts the requests for the first block
+- (ICoAPTestServer *)blockServerWithMaxAge:(NSString *)maxAge transferCount:(NSUInteger *)transferCount {
+    return [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        NSArray *blockValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+        uint blockNumber = blockValues ? [[blockValues objectAtIndex:0] intValue] >> 4 : 0;
+        if (blockNumber == 0) {
+            (*transferCount)++;
+        }
+
+        NSUInteger blockSize = 16 << kForwardProxyTestSzx;
+        NSUInteger offset = MIN(blockNumber * blockSize, [body length]);
+        NSUInteger length = MIN(blockSize, [body length] - offset);
+        BOOL more = offset + length < [body length];
+
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_CONTENT];
+        response.payloadData = [body subdataWithRange:NSMakeRange(offset, length)];
+        [response addOption:IC_CONTENT_FORMAT withValue:[NSString stringWithFormat:@"%i", IC_OCTET_STREAM]];
+        [response addOption:IC_ETAG withValue:kForwardProxyTestETag];
+        [response addOption:IC_MAX_AGE withValue:maxAge];
+        [response addOption:IC_BLOCK2 withValue:[NSString stringWithFormat:@"%u", blockNumber << 4 | (more ? 8 : 0) | kForwardProxyTestSzx]];
+        [server sendCoAPMessage:response toAddress:address];
+    }];
+}
+
+- (void)testBlock2FollowUpsAreAnsweredFromReassembledBody {
+    NSUInteger transferCount = 0;
+    ICoAPTestServer *server = [self blockServerWithMaxAge:@"0" transferCount:&transferCount];
+    XCTAssertNotNil(server);
+
+    ICoAPForwardProxy *proxy = [[ICoAPForwardProxy alloc] init];
+    NSError *error;
+    XCTAssertTrue([proxy startOnPort:0 error:&error], @"%@", error);
+    NSData *address = [self addressOfProxy:proxy];
+
+    NSString *proxyUri = [NSString stringWithFormat:@"coap://127.0.0.1:%u/large", server.port];
+    NSMutableData *receivedBody = [[NSMutableData alloc] init];
+    XCTestExpectation *transferExpectation = [self expectationWithDescription:@"Body received through the proxy"];
+
+    ICoAPTestServer *client = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *client, ICoAPMessage *response, NSData *responseAddress) {
+        NSArray *blockValues = [response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+        XCTAssertEqual(response.code, (uint)IC_CONTENT);
+        XCTAssertNotNil(blockValues);
+        if (response.code != IC_CONTENT || !blockValues) {
+            [transferExpectation fulfill];
+            return;
+        }
+
+        uint blockValue = [[blockValues objectAtIndex:0] intValue];
+        XCTAssertEqual(blockValue >> 4, (uint)([receivedBody length] >> (4 + kForwardProxyTestSzx)));
+        [receivedBody appendData:response.payloadData];
+
+        if (blockValue & 8) {
+            [client sendCoAPMessage:[self blockRequestWithNumber:(blockValue >> 4) + 1 proxyUri:proxyUri client:client] toAddress:responseAddress];
+        }
+        else {
+            [transferExpectation fulfill];
+        }
+    }];
+    XCTAssertNotNil(client);
+
+    [client sendCoAPMessage:[self blockRequestWithNumber:0 proxyUri:proxyUri client:client] toAddress:address];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    XCTAssertEqualObjects(receivedBody, body);
+    XCTAssertEqual(transferCount, (NSUInteger)1);
+    XCTAssertEqual(proxy.forwardedRequestCount, (NSUInteger)1);
+
+    [proxy stop];
+    [client close];
+    [server close];
+}
+
+- (void)testMatchingETagOfKeptBodyIsAnsweredWithValid {
+    NSUInteger transferCount = 0;
+    ICoAPTestServer *server = [self blockServerWithMaxAge:@"0" transferCount:&transferCount];
+    XCTAssertNotNil(server);
+
+    ICoAPForwardProxy *proxy = [[ICoAPForwardProxy alloc] init];
+    NSError *error;
+    XCTAssertTrue([proxy startOnPort:0 error:&error], @"%@", error);
+    NSData *address = [self addressOfProxy:proxy];
+
+    NSString *proxyUri = [NSString stringWithFormat:@"coap://127.0.0.1:%u/large", server.port];
+    NSMutableArray *responses = [[NSMutableArray alloc] init];
+    XCTestExpectation *validExpectation = [self expectationWithDescription:@"Valid response of the proxy"];
+
+    //The client holds the representation of the first block and names its ETag for the next one
+    ICoAPTestServer *client = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *client, ICoAPMessage *response, NSData *responseAddress) {
+        [responses addObject:response];
+        if ([responses count] == 1) {
+            ICoAPMessage *cO = [self blockRequestWithNumber:1 proxyUri:proxyUri client:client];
+            [cO addOption:IC_ETAG withValue:kForwardProxyTestETag];
+            [client sendCoAPMessage:cO toAddress:responseAddress];
+        }
+        else {
+            [validExpectation fulfill];
+        }
+    }];
+    XCTAssertNotNil(client);
+
+    [client sendCoAPMessage:[self blockRequestWithNumber:0 proxyUri:proxyUri client:client] toAddress:address];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    XCTAssertEqual([responses count], (NSUInteger)2);
+    ICoAPMessage *response = [responses lastObject];
+    XCTAssertEqual(response.code, (uint)IC_VALID);
+    XCTAssertEqualObjects([[response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]] objectAtIndex:0], kForwardProxyTestETag);
+    XCTAssertEqualObjects([[response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]] objectAtIndex:0], @"0");
+    XCTAssertNil([response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]]);
+    XCTAssertEqual([response.payloadData length], (NSUInteger)0);
+    XCTAssertEqual(transferCount, (NSUInteger)1);
+    XCTAssertEqual(proxy.forwardedRequestCount, (NSUInteger)1);
+
+    [proxy stop];
+    [client close];
+    [server close];
+}
+
+- (void)testMatchingETagOfCachedResponseIsAnsweredWithValid {
+    __block NSUInteger requestCount = 0;
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        requestCount++;
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_CONTENT];
+        response.payloadData = [@"22.5 C" dataUsingEncoding:NSUTF8StringEncoding];
+        [response addOption:IC_ETAG withValue:kForwardProxyTestETag];
+        [response addOption:IC_MAX_AGE withValue:@"60"];
+        [server sendCoAPMessage:response toAddress:address];
+    }];
+    XCTAssertNotNil(server);
+
+    ICoAPForwardProxy *proxy = [[ICoAPForwardProxy alloc] init];
+    proxy.responseCache = [[ICoAPResponseCache alloc] init];
+    NSError *error;
+    XCTAssertTrue([proxy startOnPort:0 error:&error], @"%@", error);
+    NSData *address = [self addressOfProxy:proxy];
+
+    NSString *proxyUri = [NSString stringWithFormat:@"coap://127.0.0.1:%u/temp", server.port];
+    NSMutableArray *responses = [[NSMutableArray alloc] init];
+    XCTestExpectation *validExpectation = [self expectationWithDescription:@"Valid response of the proxy"];
+
+    ICoAPTestServer *client = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *client, ICoAPMessage *response, NSData *responseAddress) {
+        [responses addObject:response];
+        if ([responses count] == 1) {
+            ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+            cO.messageID = [client nextMessageID];
+            cO.token = 0x2A;
+            [cO addOption:IC_PROXY_URI withValue:proxyUri];
+            [cO addOption:IC_ETAG withValue:kForwardProxyTestETag];
+            [client sendCoAPMessage:cO toAddress:responseAddress];
+        }
+        else {
+            [validExpectation fulfill];
+        }
+    }];
+    XCTAssertNotNil(client);
+
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    cO.messageID = [client nextMessageID];
+    cO.token = 0x2A;
+    [cO addOption:IC_PROXY_URI withValue:proxyUri];
+    [client sendCoAPMessage:cO toAddress:address];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    XCTAssertEqual([responses count], (NSUInteger)2);
+    XCTAssertEqual(((ICoAPMessage *)[responses objectAtIndex:0]).code, (uint)IC_CONTENT);
+    ICoAPMessage *response = [responses lastObject];
+    XCTAssertEqual(response.code, (uint)IC_VALID);
+    XCTAssertEqualObjects([[response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]] objectAtIndex:0], kForwardProxyTestETag);
+    int maxAge = [[[response.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]] objectAtIndex:0] intValue];
+    XCTAssertGreaterThan(maxAge, 0);
+    XCTAssertLessThanOrEqual(maxAge, 60);
+    XCTAssertEqual([response.payloadData length], (NSUInteger)0);
+    XCTAssertEqual(requestCount, (NSUInteger)1);
+
+    [proxy stop];
+    [client close];
+    [server close];
+}
+
+@end
@@ -0,0 +1,74 @@
+//
+//  ICoAPNotificationFreshnessBenchmarks.m
+//  iCoAP
+//
+
+
+/*
+ *  Cost of the Observe reordering check per notification: the inline
+ *  check on the monotonic clock, compared with the former check, which
+ *  allocated an NSDate per notification and compared shifted dates.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPExchange.h"
+
+
+#define kFreshnessBenchmarkIterations       10000000
+
+
+
+
+@interface ICoAPNotificationFreshnessBenchmarks : XCTestCase
+@end
+
+@implementation ICoAPNotificationFreshnessBenchmarks
+
+- (void)testFreshnessCheck {
+    uint32_t previousValue = 0;
+    uint64_t previousTime = ICoAPMonotonicNanoseconds();
+    NSUInteger freshCount = 0;
+
+    uint64_t start = ICoAPMonotonicNanoseconds();
+    for (uint32_t i = 1; i <= kFreshnessBenchmarkIterations; i++) {
+        uint32_t value = (i * 7) % (2 * kMaxObserveOptionValue);
+        uint64_t now = ICoAPMonotonicNanoseconds();
+
+        if (ICoAPIsNotificationFresh(previousValue, previousTime, value, now)) {
+            previousValue = value;
+            previousTime = now;
+            freshCount++;
+        }
+    }
+    uint64_t monotonicTime = ICoAPMonotonicNanoseconds() - start;
+
+    NSDate *previousDate = [[NSDate alloc] init];
+    previousValue = 0;
+    NSUInteger dateFreshCount = 0;
+
+    start = ICoAPMonotonicNanoseconds();
+    for (uint32_t i = 1; i <= kFreshnessBenchmarkIterations; i++) {
+        @autoreleasepool {
+            uint32_t value = (i * 7) % (2 * kMaxObserveOptionValue);
+            NSDate *now = [[NSDate alloc] init];
+
+            if ((previousValue < value && value - previousValue < kMaxObserveOptionValue) ||
+                (previousValue > value && previousValue - value > kMaxObserveOptionValue) ||
+                [now compare:[previousDate dateByAddingTimeInterval:kMaxNotificationDelayTime]] == NSOrderedDescending) {
+                previousValue = value;
+                previousDate = now;
+                dateFreshCount++;
+            }
+        }
+    }
+    uint64_t dateTime = ICoAPMonotonicNanoseconds() - start;
+
+    XCTAssertEqual(freshCount, dateFreshCount);
+    NSLog(@"ICoAPIsNotificationFresh: %.1f ns per notification (with clock read), NSDate based check: %.1f ns",
+          (double)monotonicTime / kFreshnessBenchmarkIterations,
+          (double)dateTime / kFreshnessBenchmarkIterations);
+}
+
+@end
@@ -0,0 +1,81 @@
+//
+//  ICoAPNotificationFreshnessTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Reordering check of RFC 7641 Section 3.4 (ICoAPIsNotificationFresh)
+ *  on 24 bit sequence numbers and the monotonic clock.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPExchange.h"
+
+
+#define kSequenceNumberModulus              (2 * kMaxObserveOptionValue)    //2^24
+#define kNanosecondsPerSecond               1000000000ull
+
+
+
+
+@interface ICoAPNotificationFreshnessTests : XCTestCase
+@end
+
+@implementation ICoAPNotificationFreshnessTests
+
+- (void)testLargerValueIsFresh {
+    XCTAssertTrue(ICoAPIsNotificationFresh(1, 0, 2, 0));
+    XCTAssertTrue(ICoAPIsNotificationFresh(1000, 0, 1000 + kMaxObserveOptionValue - 1, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(2, 0, 1, 0));
+}
+
+- (void)testEqualValueIsNotFresh {
+    XCTAssertFalse(ICoAPIsNotificationFresh(0, 0, 0, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(4711, 0, 4711, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(kSequenceNumberModulus - 1, 0, kSequenceNumberModulus - 1, 0));
+}
+
+- (void)testValueWrappingForwardIsFresh {
+    XCTAssertTrue(ICoAPIsNotificationFresh(kSequenceNumberModulus - 1, 0, 0, 0));
+    XCTAssertTrue(ICoAPIsNotificationFresh(kSequenceNumberModulus - 10, 0, 5, 0));
+    XCTAssertTrue(ICoAPIsNotificationFresh(kSequenceNumberModulus - 1, 0, kMaxObserveOptionValue - 2, 0));
+}
+
+- (void)testValueWrappingBackwardIsNotFresh {
+    XCTAssertFalse(ICoAPIsNotificationFresh(0, 0, kSequenceNumberModulus - 1, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(5, 0, kSequenceNumberModulus - 10, 0));
+}
+
+- (void)testHalfRangeDistanceIsNotFresh {
+    //Exactly 2^23 apart, neither value is newer than the other
+    XCTAssertFalse(ICoAPIsNotificationFresh(0, 0, kMaxObserveOptionValue, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(kMaxObserveOptionValue, 0, 0, 0));
+    XCTAssertFalse(ICoAPIsNotificationFresh(kSequenceNumberModulus - 1, 0, kMaxObserveOptionValue - 1, 0));
+}
+
+- (void)testOlderValueIsFreshAfterDelayWindow {
+    uint64_t previousTime = 1000 * kNanosecondsPerSecond;
+    uint64_t window = (uint64_t)kMaxNotificationDelayTime * kNanosecondsPerSecond;
+
+    XCTAssertFalse(ICoAPIsNotificationFresh(10, previousTime, 5, previousTime + window - kNanosecondsPerSecond));
+    XCTAssertFalse(ICoAPIsNotificationFresh(10, previousTime, 5, previousTime + window));
+    XCTAssertTrue(ICoAPIsNotificationFresh(10, previousTime, 5, previousTime + window + 1));
+    XCTAssertTrue(ICoAPIsNotificationFresh(10, previousTime, 10, previousTime + window + 1));
+}
+
+- (void)testMonotonicClockAdvances {
+    uint64_t start = ICoAPMonotonicNanoseconds();
+    usleep(10000);
+    uint64_t end = ICoAPMonotonicNanoseconds();
+
+    XCTAssertGreaterThanOrEqual(end - start, 10000000ull);
+    XCTAssertLessThan(end - start, (uint64_t)kMaxNotificationDelayTime * kNanosecondsPerSecond);
+
+    //A notification received just now does not open the delay window
+    XCTAssertFalse(ICoAPIsNotificationFresh(10, start, 5, end));
+}
+
+@end
@@ -0,0 +1,172 @@
+//
+//  ICoAPObservableResourceTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Observe conformance of ICoAPObservableResource (RFC 7641), with an
+ *  ICoAPServer and an observing ICoAPExchange on the loopback interface.
+ *  Sequence numbers must stay fresh for the client across the 2^24 wrap,
+ *  and an observer with an unacknowledged confirmable notification must
+ *  receive the latest state, not the dropped ones, after its ACK.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPServer.h"
+
+
+#define kObserveTestWrapStart               16777214    //2^24 - 2
+#define kObserveTestWrapUpdateCount         4
+#define kObserveTestQuietPeriod             1.0         //Seconds in which no further notification may arrive
+
+
+
+
+@interface ICoAPObservableResourceTests : XCTestCase<ICoAPExchangeDelegate> {
+    ICoAPServer *server;
+    ICoAPObservableResource *resource;
+    ICoAPExchange *exchange;
+    NSMutableArray *observeValues;
+    NSMutableArray *payloads;
+    NSUInteger expectedMessageCount;
+    XCTestExpectation *notificationExpectation;
+    void (^messageHandler)(ICoAPMessage *coapMessage);
+}
+- (ICoAPMessage *)representationWithPayload:(NSString *)payload;
+- (void)observeResource;
+@end
+
+@implementation ICoAPObservableResourceTests
+
+- (void)setUp {
+    [super setUp];
+    server = [[ICoAPServer alloc] init];
+    resource = [server addObservableResourceWithPath:@"sensors/temp" attributes:nil representation:[self representationWithPayload:@"0"]];
+
+    NSError *error;
+    XCTAssertTrue([server startOnPort:0 error:&error], @"%@", error);
+
+    observeValues = [[NSMutableArray alloc] init];
+    payloads = [[NSMutableArray alloc] init];
+    messageHandler = nil;
+}
+
+- (void)tearDown {
+    exchange.delegate = nil;
+    [exchange closeExchange];
+    exchange = nil;
+    [server stop];
+    server = nil;
+    resource = nil;
+    [super tearDown];
+}
+
+- (ICoAPMessage *)representationWithPayload:(NSString *)payload {
+    ICoAPMessage *representation = [[ICoAPMessage alloc] init];
+    representation.code = IC_CONTENT;
+    representation.payload = payload;
+    return representation;
+}
+
+- (void)observeResource {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"sensors"];
+    [cO addOption:IC_URI_PATH withValue:@"temp"];
+    [cO addOption:IC_OBSERVE withValue:@"0"];
+
+    exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    [exchange sendRequestWithCoAPMessage:cO toHost:@"127.0.0.1" port:[server.udpSocket localPort]];
+}
+
+#pragma mark - Tests
+
+- (void)testSequenceNumbersStayFreshAcrossWrap {
+    [resource setValue:[NSNumber numberWithUnsignedInt:kObserveTestWrapStart] forKey:@"sequenceNumber"];
+
+    //The next update follows every received notification, so none overtakes another
+    __weak ICoAPObservableResourceTests *weakSelf = self;
+    messageHandler = ^(ICoAPMessage *coapMessage) {
+        ICoAPObservableResourceTests *strongSelf = weakSelf;
+        if ([strongSelf->observeValues count] <= kObserveTestWrapUpdateCount) {
+            [strongSelf->resource updateRepresentation:[strongSelf representationWithPayload:[NSString stringWithFormat:@"%lu", (unsigned long)[strongSelf->observeValues count]]]];
+        }
+    };
+
+    expectedMessageCount = 1 + kObserveTestWrapUpdateCount;
+    notificationExpectation = [self expectationWithDescription:@"Notifications across the wrap"];
+    [self observeResource];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    NSArray *expectedValues = [NSArray arrayWithObjects:@"16777214", @"16777215", @"0", @"1", @"2", nil];
+    XCTAssertEqualObjects(observeValues, expectedValues);
+
+    uint64_t now = ICoAPMonotonicNanoseconds();
+    for (NSUInteger i = 1; i < [observeValues count]; i++) {
+        uint32_t previousValue = (uint32_t)[[observeValues objectAtIndex:i - 1] intValue];
+        uint32_t value = (uint32_t)[[observeValues objectAtIndex:i] intValue];
+        XCTAssertTrue(ICoAPIsNotificationFresh(previousValue, now, value, now), @"%u after %u", value, previousValue);
+        XCTAssertFalse(ICoAPIsNotificationFresh(value, now, previousValue, now), @"%u after %u", previousValue, value);
+    }
+}
+
+- (void)testDroppedNotificationsCatchUpAfterAck {
+    resource.confirmableInterval = 1;
+
+    //Three updates at once: the first is confirmable, the second and third wait for its ACK
+    __weak ICoAPObservableResourceTests *weakSelf = self;
+    messageHandler = ^(ICoAPMessage *coapMessage) {
+        ICoAPObservableResourceTests *strongSelf = weakSelf;
+        if ([strongSelf->observeValues count] == 1) {
+            for (NSUInteger i = 1; i <= 3; i++) {
+                [strongSelf->resource updateRepresentation:[strongSelf representationWithPayload:[NSString stringWithFormat:@"%lu", (unsigned long)i]]];
+            }
+        }
+    };
+
+    expectedMessageCount = 3;
+    notificationExpectation = [self expectationWithDescription:@"Confirmable notification and catch-up"];
+    [self observeResource];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    //Nothing else may follow, in particular not the dropped second update
+    [[NSRunLoop mainRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:kObserveTestQuietPeriod]];
+
+    NSArray *expectedPayloads = [NSArray arrayWithObjects:@"0", @"1", @"3", nil];
+    XCTAssertEqualObjects(payloads, expectedPayloads);
+    XCTAssertEqual([observeValues count], (NSUInteger)3);
+
+    uint32_t firstValue = (uint32_t)[[observeValues objectAtIndex:1] intValue];
+    uint32_t catchUpValue = (uint32_t)[[observeValues objectAtIndex:2] intValue];
+    XCTAssertEqual(catchUpValue, (firstValue + 2) % (2 * kMaxObserveOptionValue));
+    XCTAssertEqual(resource.observerCount, (NSUInteger)1);
+}
+
+#pragma mark - ICoAPExchangeDelegate
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveCoAPMessage:(ICoAPMessage *)coapMessage {
+    NSArray *values = [coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]];
+    if (coapMessage.code != IC_CONTENT || !values) {
+        return;
+    }
+
+    [observeValues addObject:[values objectAtIndex:0]];
+    [payloads addObject:coapMessage.payload];
+    if (messageHandler) {
+        messageHandler(coapMessage);
+    }
+
+    if ([observeValues count] == expectedMessageCount) {
+        [notificationExpectation fulfill];
+        notificationExpectation = nil;
+    }
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didFailWithError:(NSError *)error {
+    XCTFail(@"Observation failed: %@", error);
+}
+
+@end
@@ -0,0 +1,141 @@
+//
+//  ICoAPObserveRegistryBenchmarks.m
+//  iCoAP
+//
+
+
+/*
+ *  Memory per subscription and routing latency of ICoAPObserveRegistry.
+
+ *  kObserveBenchmarkSubscriptionCount subscriptions are registered at a
+ *  stand-in server, which answers every registration with a notification.
+ *  The heap growth until all of them are answered is divided by their
+ *  number. Pre-encoded notifications are then passed to the socket
+ *  delegate method directly, once fresh (routed, decoded and delivered)
+ *  and once repeated (routed and dropped by the reordering check), so
+ *  the latencies do not include the socket.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import <malloc/malloc.h>
+#import <netinet/in.h>
+#import "ICoAPObserveRegistry.h"
+#import "ICoAPTestServer.h"
+
+
+#define kObserveBenchmarkSubscriptionCount  20000
+#define kObserveBenchmarkMaxAge             3600    //No re-registrations during the benchmark
+
+
+
+
+@interface ICoAPObserveRegistryBenchmarks : XCTestCase<ICoAPObserveRegistryDelegate> {
+    NSUInteger notificationCount;
+    XCTestExpectation *registrationExpectation;
+}
+@end
+
+@implementation ICoAPObserveRegistryBenchmarks
+
+- (void)testSubscriptionMemoryAndRoutingLatency {
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_CONTENT];
+        [response addOption:IC_OBSERVE withValue:@"1000"];
+        [response addOption:IC_MAX_AGE withValue:[NSString stringWithFormat:@"%i", kObserveBenchmarkMaxAge]];
+        response.payload = @"21.5";
+        [server sendCoAPMessage:response toAddress:address];
+    }];
+    XCTAssertNotNil(server);
+
+    malloc_statistics_t statistics;
+    malloc_zone_statistics(NULL, &statistics);
+    size_t heapSizeBefore = statistics.size_in_use;
+
+    ICoAPObserveRegistry *registry = [[ICoAPObserveRegistry alloc] initWithDelegate:self];
+    NSMutableArray *tokens = [[NSMutableArray alloc] initWithCapacity:kObserveBenchmarkSubscriptionCount];
+    notificationCount = 0;
+    registrationExpectation = [self expectationWithDescription:@"Registrations answered"];
+
+    for (NSUInteger i = 0; i < kObserveBenchmarkSubscriptionCount; i++) {
+        ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+        [cO addOption:IC_URI_PATH withValue:@"sensor"];
+        [tokens addObject:[NSNumber numberWithUnsignedInt:[registry observeWithCoAPMessage:cO toHost:@"127.0.0.1" port:server.port]]];
+    }
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    malloc_zone_statistics(NULL, &statistics);
+    size_t heapSizeAfter = statistics.size_in_use;
+    XCTAssertEqual(registry.observationCount, (NSUInteger)kObserveBenchmarkSubscriptionCount);
+
+    //Notifications of the stand-in server, encoded in advance
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_len = sizeof(serverAddress);
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons(server.port);
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    NSData *address = [NSData dataWithBytes:&serverAddress length:sizeof(serverAddress)];
+
+    ICoAPExchange *codec = [[ICoAPExchange alloc] init];
+    NSMutableArray *notifications = [[NSMutableArray alloc] initWithCapacity:kObserveBenchmarkSubscriptionCount];
+    for (NSUInteger i = 0; i < kObserveBenchmarkSubscriptionCount; i++) {
+        ICoAPMessage *notification = [[ICoAPMessage alloc] init];
+        notification.type = IC_NON_CONFIRMABLE;
+        notification.code = IC_CONTENT;
+        notification.messageID = i % 65536;
+        notification.token = [[tokens objectAtIndex:i] unsignedIntValue];
+        [notification addOption:IC_OBSERVE withValue:@"1001"];
+        [notification addOption:IC_MAX_AGE withValue:[NSString stringWithFormat:@"%i", kObserveBenchmarkMaxAge]];
+        notification.payload = @"21.6";
+        [notifications addObject:[codec encodeDataFromCoAPMessage:notification]];
+    }
+
+    //Fresh notifications: table lookup, reordering check, decoding and delivery
+    notificationCount = 0;
+    uint64_t start = ICoAPMonotonicNanoseconds();
+    for (NSData *data in notifications) {
+        [registry udpSocket:registry.udpSocket didReceiveData:data fromAddress:address withFilterContext:nil];
+    }
+    uint64_t deliveryTime = ICoAPMonotonicNanoseconds() - start;
+    XCTAssertEqual(notificationCount, (NSUInteger)kObserveBenchmarkSubscriptionCount);
+
+    //Repeated notifications: table lookup and reordering check only
+    notificationCount = 0;
+    start = ICoAPMonotonicNanoseconds();
+    for (NSData *data in notifications) {
+        [registry udpSocket:registry.udpSocket didReceiveData:data fromAddress:address withFilterContext:nil];
+    }
+    uint64_t routingTime = ICoAPMonotonicNanoseconds() - start;
+    XCTAssertEqual(notificationCount, (NSUInteger)0);
+
+    NSLog(@"ICoAPObserveRegistry: %i subscriptions, %lu bytes heap per subscription (record: %lu bytes)",
+          kObserveBenchmarkSubscriptionCount,
+          (unsigned long)((heapSizeAfter > heapSizeBefore ? heapSizeAfter - heapSizeBefore : 0) / kObserveBenchmarkSubscriptionCount),
+          (unsigned long)sizeof(ICoAPObservationRecord));
+    NSLog(@"ICoAPObserveRegistry: routing %.0f ns per notification, routing and delivery %.0f ns per notification",
+          (double)routingTime / kObserveBenchmarkSubscriptionCount,
+          (double)deliveryTime / kObserveBenchmarkSubscriptionCount);
+
+    [registry close];
+    [server close];
+}
+
+#pragma mark - ICoAPObserveRegistryDelegate
+
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didReceiveNotification:(ICoAPMessage *)coapMessage token:(uint)token {
+    if (++notificationCount == kObserveBenchmarkSubscriptionCount) {
+        [registrationExpectation fulfill];
+        registrationExpectation = nil;
+    }
+}
+
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didFailObservationWithToken:(uint)token host:(NSString *)host port:(uint)port error:(NSError *)error {
+    XCTFail(@"Registration failed: %@", error);
+}
+
+@end
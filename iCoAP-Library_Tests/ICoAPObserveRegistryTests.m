@@ -0,0 +1,256 @@
+//
+//  ICoAPObserveRegistryTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Notification delivery and re-registration of ICoAPObserveRegistry.
+ *  Subscriptions are registered at a stand-in server, which answers every
+ *  registration with a notification and records when it arrived. Further
+ *  notifications are passed to the socket delegate method directly, so
+ *  that the test decides when they arrive relative to the delivery timer.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import <netinet/in.h>
+#import "ICoAPObserveRegistry.h"
+#import "ICoAPTestServer.h"
+
+
+#define kObserveTestMaxAge                  3600    //No re-registrations unless a test asks for them
+#define kObserveTestShortMaxAge             4       //Max-Age of the first notification in the re-registration tests
+#define kObserveTestSlack                   0.5
+
+
+
+
+@interface ICoAPObserveRegistryTests : XCTestCase<ICoAPObserveRegistryDelegate> {
+    ICoAPTestServer *server;
+    ICoAPObserveRegistry *registry;
+    ICoAPExchange *codec;
+    NSData *serverAddress;
+    uint token;
+    uint firstMaxAge;
+    NSMutableDictionary *registrationTimes;
+    NSMutableDictionary *registrationPorts;
+    NSUInteger expectedReregistrationCount;
+    XCTestExpectation *reregistrationExpectation;
+    NSUInteger expectedNotificationCount;
+    NSMutableArray *deliveredObserveValues;
+    XCTestExpectation *notificationExpectation;
+}
+- (NSArray *)observeCount:(NSUInteger)observationCount;
+- (NSUInteger)reregisteredCount;
+- (void)waitForReregistrationsOfCount:(NSUInteger)observationCount timeout:(NSTimeInterval)timeout;
+- (NSData *)notificationDataWithObserveValue:(uint)observeValue;
+- (void)receiveNotificationWithObserveValue:(uint)observeValue;
+- (void)runTimersForInterval:(NSTimeInterval)interval;
+@end
+
+@implementation ICoAPObserveRegistryTests
+
+- (void)setUp {
+    [super setUp];
+    firstMaxAge = kObserveTestMaxAge;
+    registrationTimes = [[NSMutableDictionary alloc] init];
+    registrationPorts = [[NSMutableDictionary alloc] init];
+
+    //Every registration is answered, the first one of a subscription with 'firstMaxAge'
+    server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        NSNumber *key = [NSNumber numberWithUnsignedInt:request.token];
+        NSMutableArray *times = [self->registrationTimes objectForKey:key];
+        if (!times) {
+            times = [[NSMutableArray alloc] init];
+            [self->registrationTimes setObject:times forKey:key];
+            [self->registrationPorts setObject:[[NSMutableArray alloc] init] forKey:key];
+        }
+        [times addObject:[NSNumber numberWithDouble:CFAbsoluteTimeGetCurrent()]];
+        [[self->registrationPorts objectForKey:key] addObject:[NSNumber numberWithUnsignedInt:[GCDAsyncUdpSocket portFromAddress:address]]];
+
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_CONTENT];
+        [response addOption:IC_OBSERVE withValue:[NSString stringWithFormat:@"%lu", (unsigned long)[times count]]];
+        [response addOption:IC_MAX_AGE withValue:[NSString stringWithFormat:@"%u", [times count] == 1 ? self->firstMaxAge : kObserveTestMaxAge]];
+        [server sendCoAPMessage:response toAddress:address];
+
+        if (self->reregistrationExpectation && [self reregisteredCount] == self->expectedReregistrationCount) {
+            [self->reregistrationExpectation fulfill];
+            self->reregistrationExpectation = nil;
+        }
+    }];
+    XCTAssertNotNil(server);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_len = sizeof(address);
+    address.sin_family = AF_INET;
+    address.sin_port = htons(server.port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    serverAddress = [NSData dataWithBytes:&address length:sizeof(address)];
+
+    codec = [[ICoAPExchange alloc] init];
+    deliveredObserveValues = [[NSMutableArray alloc] init];
+    registry = [[ICoAPObserveRegistry alloc] initWithDelegate:self];
+}
+
+- (void)tearDown {
+    [registry close];
+    [server close];
+    [super tearDown];
+}
+
+//Registers the subscriptions and waits for the notifications answering them
+- (NSArray *)observeCount:(NSUInteger)observationCount {
+    NSMutableArray *tokens = [[NSMutableArray alloc] init];
+    expectedNotificationCount = [deliveredObserveValues count] + observationCount;
+    notificationExpectation = [self expectationWithDescription:@"Registrations answered"];
+
+    for (NSUInteger i = 0; i < observationCount; i++) {
+        ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+        [cO addOption:IC_URI_PATH withValue:@"sensor"];
+        [tokens addObject:[NSNumber numberWithUnsignedInt:[registry observeWithCoAPMessage:cO toHost:@"127.0.0.1" port:server.port]]];
+    }
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    token = [[tokens objectAtIndex:0] unsignedIntValue];
+    return tokens;
+}
+
+- (NSUInteger)reregisteredCount {
+    NSUInteger reregisteredCount = 0;
+    for (NSArray *times in [registrationTimes allValues]) {
+        if ([times count] > 1) {
+            reregisteredCount++;
+        }
+    }
+    return reregisteredCount;
+}
+
+- (void)waitForReregistrationsOfCount:(NSUInteger)observationCount timeout:(NSTimeInterval)timeout {
+    expectedReregistrationCount = observationCount;
+    reregistrationExpectation = [self expectationWithDescription:@"Re-registrations"];
+    [self waitForExpectationsWithTimeout:timeout handler:nil];
+}
+
+- (NSData *)notificationDataWithObserveValue:(uint)observeValue {
+    ICoAPMessage *notification = [[ICoAPMessage alloc] init];
+    notification.type = IC_NON_CONFIRMABLE;
+    notification.code = IC_CONTENT;
+    notification.messageID = [server nextMessageID];
+    notification.token = token;
+    [notification addOption:IC_OBSERVE withValue:[NSString stringWithFormat:@"%u", observeValue]];
+    [notification addOption:IC_MAX_AGE withValue:[NSString stringWithFormat:@"%i", kObserveTestMaxAge]];
+    return [codec encodeDataFromCoAPMessage:notification];
+}
+
+- (void)receiveNotificationWithObserveValue:(uint)observeValue {
+    [registry udpSocket:registry.udpSocket didReceiveData:[self notificationDataWithObserveValue:observeValue] fromAddress:serverAddress withFilterContext:nil];
+}
+
+- (void)runTimersForInterval:(NSTimeInterval)interval {
+    [[NSRunLoop currentRunLoop] runUntilDate:[NSDate dateWithTimeIntervalSinceNow:interval]];
+}
+
+#pragma mark - Tests
+
+- (void)testHeldNotificationIsDroppedWhenNewerOneIsDelivered {
+    [self observeCount:1];
+    [registry setDeliveryPolicy:IC_DELIVER_RATE_LIMITED interval:0.01 forObservationWithToken:token host:@"127.0.0.1" port:server.port];
+
+    [self receiveNotificationWithObserveValue:2];
+    [self receiveNotificationWithObserveValue:3];
+
+    //The interval ends before the delivery timer fires, the newer notification is delivered right away
+    usleep(20000);
+    [self receiveNotificationWithObserveValue:4];
+    [self runTimersForInterval:5 * kObserveRegistryTimerInterval];
+
+    NSArray *expected = [NSArray arrayWithObjects:[NSNumber numberWithUnsignedInt:1], [NSNumber numberWithUnsignedInt:2], [NSNumber numberWithUnsignedInt:4], nil];
+    XCTAssertEqualObjects(deliveredObserveValues, expected);
+}
+
+- (void)testSwitchingToDeliverAllReleasesHeldNotificationAtOnce {
+    [self observeCount:1];
+    [registry setDeliveryPolicy:IC_DELIVER_RATE_LIMITED interval:60 forObservationWithToken:token host:@"127.0.0.1" port:server.port];
+
+    [self receiveNotificationWithObserveValue:2];
+    [self receiveNotificationWithObserveValue:3];
+    XCTAssertEqual([deliveredObserveValues count], (NSUInteger)2);
+
+    [registry setDeliveryPolicy:IC_DELIVER_ALL interval:0 forObservationWithToken:token host:@"127.0.0.1" port:server.port];
+    XCTAssertEqual([deliveredObserveValues count], (NSUInteger)3);
+
+    [self receiveNotificationWithObserveValue:4];
+    [self runTimersForInterval:5 * kObserveRegistryTimerInterval];
+
+    NSArray *expected = [NSArray arrayWithObjects:[NSNumber numberWithUnsignedInt:1], [NSNumber numberWithUnsignedInt:2], [NSNumber numberWithUnsignedInt:3], [NSNumber numberWithUnsignedInt:4], nil];
+    XCTAssertEqualObjects(deliveredObserveValues, expected);
+}
+
+- (void)testReregistrationFallsIntoJitterWindowOfMaxAge {
+    firstMaxAge = kObserveTestShortMaxAge;
+    NSArray *tokens = [self observeCount:8];
+    [self waitForReregistrationsOfCount:[tokens count] timeout:kObserveTestShortMaxAge * kReregistrationLatest + kReregistrationTimerInterval + 2 * kObserveTestSlack];
+
+    //The notification arrives right after the registration, the re-registration is sent with the next timer tick once due
+    for (NSNumber *key in tokens) {
+        NSArray *times = [registrationTimes objectForKey:key];
+        NSTimeInterval delay = [[times objectAtIndex:1] doubleValue] - [[times objectAtIndex:0] doubleValue];
+        XCTAssertGreaterThanOrEqual(delay, kObserveTestShortMaxAge * kReregistrationEarliest - kObserveTestSlack);
+        XCTAssertLessThanOrEqual(delay, kObserveTestShortMaxAge * kReregistrationLatest + kReregistrationTimerInterval + kObserveTestSlack);
+    }
+}
+
+- (void)testReregistrationsAreSentInBatches {
+    registry.reregistrationBatchSize = 3;
+    firstMaxAge = 1;
+    NSArray *tokens = [self observeCount:12];
+    [self waitForReregistrationsOfCount:[tokens count] timeout:[tokens count] / registry.reregistrationBatchSize * kReregistrationTimerInterval + 3];
+
+    NSMutableArray *reregistrationTimes = [[NSMutableArray alloc] init];
+    for (NSNumber *key in tokens) {
+        [reregistrationTimes addObject:[[registrationTimes objectForKey:key] objectAtIndex:1]];
+    }
+    [reregistrationTimes sortUsingSelector:@selector(compare:)];
+
+    //A batch goes out with one timer tick, the next batch one tick later
+    for (NSUInteger i = registry.reregistrationBatchSize; i < [reregistrationTimes count]; i++) {
+        NSTimeInterval interval = [[reregistrationTimes objectAtIndex:i] doubleValue] - [[reregistrationTimes objectAtIndex:i - registry.reregistrationBatchSize] doubleValue];
+        XCTAssertGreaterThanOrEqual(interval, kReregistrationTimerInterval / 2);
+    }
+}
+
+- (void)testSubscriptionsAreRegisteredAgainAfterSocketFailure {
+    NSArray *tokens = [self observeCount:4];
+
+    [registry.udpSocket close];
+    [self waitForReregistrationsOfCount:[tokens count] timeout:kSocketRecoverySpread + kReregistrationTimerInterval + 2 * kObserveTestSlack];
+
+    XCTAssertEqual(registry.observationCount, [tokens count]);
+    for (NSNumber *key in tokens) {
+        NSArray *ports = [registrationPorts objectForKey:key];
+        XCTAssertNotEqualObjects([ports objectAtIndex:1], [ports objectAtIndex:0]);
+    }
+}
+
+#pragma mark - ICoAPObserveRegistryDelegate
+
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didReceiveNotification:(ICoAPMessage *)coapMessage token:(uint)token {
+    NSString *observeValue = [[coapMessage.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_OBSERVE]] objectAtIndex:0];
+    [deliveredObserveValues addObject:[NSNumber numberWithUnsignedInt:(uint)[observeValue intValue]]];
+    if ([deliveredObserveValues count] == expectedNotificationCount) {
+        [notificationExpectation fulfill];
+        notificationExpectation = nil;
+    }
+}
+
+- (void)observeRegistry:(ICoAPObserveRegistry *)registry didFailObservationWithToken:(uint)token host:(NSString *)host port:(uint)port error:(NSError *)error {
+    XCTFail(@"Registration failed: %@", error);
+}
+
+@end
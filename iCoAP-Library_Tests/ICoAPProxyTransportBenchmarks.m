@@ -0,0 +1,133 @@
+//
+//  ICoAPProxyTransportBenchmarks.m
+//  iCoAP
+//
+
+
+/*
+ *  Throughput of HTTP-Proxying against a stand-in HTTP proxy on the
+ *  loopback interface. kProxyBenchmarkExchangeCount exchanges send
+ *  their next request as soon as the previous one is answered, until
+ *  kProxyBenchmarkRequestCount requests are answered. This is done once
+ *  with one shared ICoAPProxyTransport, and once with a new transport
+ *  per request, which opens a connection per request like the former
+ *  NSURLConnection per message. Requests per second and the number of
+ *  connections the proxy accepted are logged for both.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPExchange.h"
+#import "ICoAPTestHTTPProxy.h"
+
+
+#define kProxyBenchmarkRequestCount         5000
+#define kProxyBenchmarkExchangeCount        16
+
+
+
+
+@interface ICoAPProxyTransportBenchmarks : XCTestCase<ICoAPExchangeDelegate> {
+    ICoAPTestHTTPProxy *proxy;
+    ICoAPProxyTransport *sharedTransport;
+    BOOL usesTransportPerRequest;
+    NSUInteger sentCount;
+    NSUInteger answeredCount;
+    XCTestExpectation *completionExpectation;
+}
+- (void)sendRequestWithExchange:(ICoAPExchange *)exchange;
+- (double)requestsPerSecondWithTransportPerRequest:(BOOL)transportPerRequest;
+@end
+
+@implementation ICoAPProxyTransportBenchmarks
+
+- (void)setUp {
+    [super setUp];
+    proxy = [[ICoAPTestHTTPProxy alloc] initWithResponseBody:[@"22.5 C" dataUsingEncoding:NSUTF8StringEncoding]];
+}
+
+- (void)tearDown {
+    [proxy close];
+    proxy = nil;
+    [super tearDown];
+}
+
+- (void)sendRequestWithExchange:(ICoAPExchange *)exchange {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"temp"];
+    cO.usesHttpProxying = YES;
+    cO.httpProxyHost = @"127.0.0.1";
+    cO.httpProxyPort = proxy.port;
+
+    exchange.proxyTransport = usesTransportPerRequest ? [[ICoAPProxyTransport alloc] init] : sharedTransport;
+    sentCount++;
+    [exchange sendRequestWithCoAPMessage:cO toHost:@"127.0.0.1" port:5683];
+}
+
+- (double)requestsPerSecondWithTransportPerRequest:(BOOL)transportPerRequest {
+    usesTransportPerRequest = transportPerRequest;
+    sharedTransport = [[ICoAPProxyTransport alloc] init];
+    sentCount = 0;
+    answeredCount = 0;
+    completionExpectation = [self expectationWithDescription:@"Requests answered"];
+
+    NSMutableArray *exchanges = [[NSMutableArray alloc] initWithCapacity:kProxyBenchmarkExchangeCount];
+    uint64_t start = ICoAPMonotonicNanoseconds();
+    for (NSUInteger i = 0; i < kProxyBenchmarkExchangeCount; i++) {
+        ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+        exchange.delegate = self;
+        [exchanges addObject:exchange];
+        [self sendRequestWithExchange:exchange];
+    }
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+    uint64_t time = ICoAPMonotonicNanoseconds() - start;
+
+    for (ICoAPExchange *exchange in exchanges) {
+        [exchange closeExchange];
+    }
+    [sharedTransport invalidate];
+    XCTAssertEqual(answeredCount, (NSUInteger)kProxyBenchmarkRequestCount);
+    return answeredCount * 1e9 / time;
+}
+
+#pragma mark - Benchmarks
+
+- (void)testProxyThroughput {
+    XCTAssertNotNil(proxy);
+
+    NSUInteger connectionCountBefore = [proxy connectionCount];
+    double sharedRate = [self requestsPerSecondWithTransportPerRequest:NO];
+    NSUInteger sharedConnectionCount = [proxy connectionCount] - connectionCountBefore;
+
+    connectionCountBefore = [proxy connectionCount];
+    double perRequestRate = [self requestsPerSecondWithTransportPerRequest:YES];
+    NSUInteger perRequestConnectionCount = [proxy connectionCount] - connectionCountBefore;
+
+    XCTAssertLessThanOrEqual(sharedConnectionCount, (NSUInteger)kProxyMaxConnectionsPerProxy);
+    NSLog(@"ICoAPProxyTransport: %i requests by %i exchanges, shared transport: %.0f requests/s over %lu connections, transport per request: %.0f requests/s over %lu connections",
+          kProxyBenchmarkRequestCount, kProxyBenchmarkExchangeCount,
+          sharedRate, (unsigned long)sharedConnectionCount,
+          perRequestRate, (unsigned long)perRequestConnectionCount);
+}
+
+#pragma mark - ICoAPExchangeDelegate
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveCoAPMessage:(ICoAPMessage *)coapMessage {
+    answeredCount++;
+    if (sentCount < kProxyBenchmarkRequestCount) {
+        [self sendRequestWithExchange:exchange];
+    }
+    else if (answeredCount == kProxyBenchmarkRequestCount) {
+        [completionExpectation fulfill];
+        completionExpectation = nil;
+    }
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didFailWithError:(NSError *)error {
+    XCTFail(@"Proxying failed: %@", error);
+    [completionExpectation fulfill];
+    completionExpectation = nil;
+}
+
+@end
@@ -0,0 +1,174 @@
+//
+//  ICoAPQBlockTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Q-Block2 transfers (RFC 9177) against a stand-in server, which sends
+ *  the body as a burst with a lost block, or rejects Q-Block2 with 4.02.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPTestServer.h"
+
+
+#define kQBlockTestBodyLength               5000    //Five blocks of 1024 Bytes
+#define kQBlockTestSzx                      6
+#define kQBlockTestLostBlockNumber          2
+
+
+
+
+@interface ICoAPQBlockTests : XCTestCase<ICoAPExchangeDelegate> {
+    NSData *body;
+    NSData *receivedPayload;
+    NSError *receivedError;
+    XCTestExpectation *transferExpectation;
+}
+- (ICoAPMessage *)blockMessageForRequest:(ICoAPMessage *)request blockNumber:(uint)blockNumber szx:(uint)szx option:(uint)option server:(ICoAPTestServer *)server;
+- (ICoAPMessage *)getRequest;
+@end
+
+@implementation ICoAPQBlockTests
+
+- (void)setUp {
+    [super setUp];
+    NSMutableData *data = [[NSMutableData alloc] initWithLength:kQBlockTestBodyLength];
+    uint8_t *bytes = [data mutableBytes];
+    for (NSUInteger i = 0; i < kQBlockTestBodyLength; i++) {
+        bytes[i] = i % 251;
+    }
+    body = data;
+    receivedPayload = nil;
+    receivedError = nil;
+}
+
+- (ICoAPMessage *)getRequest {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"large"];
+    return cO;
+}
+
+//Block 'blockNumber' of the body as response to 'request', with the Block2 or Q-Block2 'option'
+- (ICoAPMessage *)blockMessageForRequest:(ICoAPMessage *)request blockNumber:(uint)blockNumber szx:(uint)szx option:(uint)option server:(ICoAPTestServer *)server {
+    NSUInteger blockSize = 16 << szx;
+    NSUInteger offset = MIN(blockNumber * blockSize, [body length]);
+    NSUInteger length = MIN(blockSize, [body length] - offset);
+    BOOL more = offset + length < [body length];
+
+    ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_CONTENT];
+    response.payloadData = [body subdataWithRange:NSMakeRange(offset, length)];
+    [response addOption:option withValue:[NSString stringWithFormat:@"%u", blockNumber << 4 | (more ? 8 : 0) | szx]];
+    [response addOption:IC_SIZE2 withValue:[NSString stringWithFormat:@"%lu", (unsigned long)[body length]]];
+    return response;
+}
+
+#pragma mark - Tests
+
+- (void)testQBlock2BurstWithLostBlockIsCompleted {
+    NSMutableArray *requestedBlockNumbers = [[NSMutableArray alloc] init];
+
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        NSArray *blockValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]];
+        if (request.code != IC_GET || !blockValues) {
+            return;
+        }
+        uint lastNumber = (kQBlockTestBodyLength - 1) / (16 << kQBlockTestSzx);
+
+        //Initial request: the whole body as burst, one block is lost on the way
+        if (request.type == IC_CONFIRMABLE) {
+            [server sendCoAPMessage:[self blockMessageForRequest:request blockNumber:0 szx:kQBlockTestSzx option:IC_Q_BLOCK2 server:server] toAddress:address];
+
+            ICoAPMessage *nonRequest = [request copy];
+            nonRequest.type = IC_NON_CONFIRMABLE;
+            for (uint i = 1; i <= lastNumber; i++) {
+                if (i != kQBlockTestLostBlockNumber) {
+                    [server sendCoAPMessage:[self blockMessageForRequest:nonRequest blockNumber:i szx:kQBlockTestSzx option:IC_Q_BLOCK2 server:server] toAddress:address];
+                }
+            }
+            return;
+        }
+
+        //Request for missing blocks, with M set for "this one and all following"
+        for (NSString *value in blockValues) {
+            uint blockValue = [value intValue];
+            uint endNumber = blockValue & 8 ? lastNumber : blockValue >> 4;
+            for (uint i = blockValue >> 4; i <= endNumber; i++) {
+                [requestedBlockNumbers addObject:[NSNumber numberWithUnsignedInt:i]];
+                [server sendCoAPMessage:[self blockMessageForRequest:request blockNumber:i szx:kQBlockTestSzx option:IC_Q_BLOCK2 server:server] toAddress:address];
+            }
+        }
+    }];
+    XCTAssertNotNil(server);
+
+    ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    exchange.usesQBlock2 = YES;
+
+    transferExpectation = [self expectationWithDescription:@"Q-Block2 body"];
+    [exchange sendRequestWithCoAPMessage:[self getRequest] toHost:@"127.0.0.1" port:server.port];
+    [self waitForExpectationsWithTimeout:3 * kNON_RECEIVE_TIMEOUT handler:nil];
+    [exchange closeExchange];
+    [server close];
+
+    XCTAssertNil(receivedError);
+    XCTAssertEqualObjects(receivedPayload, body);
+    XCTAssertEqualObjects(requestedBlockNumbers, [NSArray arrayWithObject:[NSNumber numberWithUnsignedInt:kQBlockTestLostBlockNumber]]);
+}
+
+- (void)testQBlock2FallsBackToBlock2OnBadOption {
+    __block uint qBlock2RequestCount = 0;
+    __block uint block2RequestCount = 0;
+
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+
+        //A server without Q-Block support rejects the critical option
+        if ([request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_Q_BLOCK2]]) {
+            qBlock2RequestCount++;
+            [server sendCoAPMessage:[server responseToCoAPMessage:request code:IC_BAD_OPTION] toAddress:address];
+            return;
+        }
+
+        NSArray *blockValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_BLOCK2]];
+        uint blockValue = blockValues ? [[blockValues objectAtIndex:0] intValue] : kQBlockTestSzx;
+        block2RequestCount++;
+        [server sendCoAPMessage:[self blockMessageForRequest:request blockNumber:blockValue >> 4 szx:MIN(blockValue & 7, kQBlockTestSzx) option:IC_BLOCK2 server:server] toAddress:address];
+    }];
+    XCTAssertNotNil(server);
+
+    ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    exchange.usesQBlock2 = YES;
+    exchange.reassemblesBlock2Payload = YES;
+
+    transferExpectation = [self expectationWithDescription:@"Block2 body"];
+    [exchange sendRequestWithCoAPMessage:[self getRequest] toHost:@"127.0.0.1" port:server.port];
+    [self waitForExpectationsWithTimeout:2 * kMAX_TRANSMIT_WAIT handler:nil];
+    [exchange closeExchange];
+    [server close];
+
+    XCTAssertNil(receivedError);
+    XCTAssertEqualObjects(receivedPayload, body);
+    XCTAssertEqual(qBlock2RequestCount, 1u);
+    XCTAssertEqual(block2RequestCount, (uint)((kQBlockTestBodyLength - 1) / (16 << kQBlockTestSzx) + 1));
+}
+
+#pragma mark - ICoAPExchangeDelegate
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveBlock2Payload:(NSData *)payload coapMessage:(ICoAPMessage *)coapMessage {
+    receivedPayload = payload;
+    [transferExpectation fulfill];
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didFailWithError:(NSError *)error {
+    receivedError = error;
+    [transferExpectation fulfill];
+}
+
+@end
@@ -0,0 +1,103 @@
+//
+//  ICoAPRequestCoalescerTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Which requests the coalescer lets wait for a leading transmission.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPRequestCoalescer.h"
+
+
+
+
+@interface ICoAPCoalescerTestClient : NSObject<ICoAPRequestCoalescerClient>
+@property (strong, nonatomic) NSMutableArray *receivedMessages;
+@end
+
+@implementation ICoAPCoalescerTestClient
+
+- (id)init {
+    if (self = [super init]) {
+        self.receivedMessages = [[NSMutableArray alloc] init];
+    }
+    return self;
+}
+
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didReceiveCoAPMessage:(ICoAPMessage *)coapMessage isFinal:(BOOL)isFinal {
+    [self.receivedMessages addObject:coapMessage];
+}
+
+- (void)requestCoalescer:(ICoAPRequestCoalescer *)coalescer didFailWithError:(NSError *)error {
+}
+
+- (void)requestCoalescerDidAbandonRequest:(ICoAPRequestCoalescer *)coalescer {
+}
+
+@end
+
+
+
+
+@interface ICoAPRequestCoalescerTests : XCTestCase
+- (ICoAPMessage *)requestWithETags:(NSArray *)etags;
+@end
+
+@implementation ICoAPRequestCoalescerTests
+
+- (ICoAPMessage *)requestWithETags:(NSArray *)etags {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"temp"];
+    for (NSString *etag in etags) {
+        [cO addOption:IC_ETAG withValue:etag];
+    }
+    return cO;
+}
+
+- (void)testIdenticalRequestsAreCoalesced {
+    ICoAPRequestCoalescer *coalescer = [[ICoAPRequestCoalescer alloc] init];
+    ICoAPCoalescerTestClient *leader = [[ICoAPCoalescerTestClient alloc] init];
+    ICoAPCoalescerTestClient *waiter = [[ICoAPCoalescerTestClient alloc] init];
+
+    XCTAssertFalse([coalescer joinRequest:[self requestWithETags:nil] host:@"127.0.0.1" port:5683 client:leader]);
+    XCTAssertTrue([coalescer joinRequest:[self requestWithETags:nil] host:@"127.0.0.1" port:5683 client:waiter]);
+}
+
+- (void)testRequestsWithDifferentETagsAreNotCoalesced {
+    ICoAPRequestCoalescer *coalescer = [[ICoAPRequestCoalescer alloc] init];
+    ICoAPCoalescerTestClient *revalidatingLeader = [[ICoAPCoalescerTestClient alloc] init];
+    ICoAPCoalescerTestClient *plainClient = [[ICoAPCoalescerTestClient alloc] init];
+    ICoAPCoalescerTestClient *otherETagClient = [[ICoAPCoalescerTestClient alloc] init];
+    ICoAPCoalescerTestClient *sameETagClient = [[ICoAPCoalescerTestClient alloc] init];
+
+    XCTAssertFalse([coalescer joinRequest:[self requestWithETags:[NSArray arrayWithObject:@"a1b2"]] host:@"127.0.0.1" port:5683 client:revalidatingLeader]);
+    XCTAssertFalse([coalescer joinRequest:[self requestWithETags:nil] host:@"127.0.0.1" port:5683 client:plainClient]);
+    XCTAssertFalse([coalescer joinRequest:[self requestWithETags:[NSArray arrayWithObject:@"c3d4"]] host:@"127.0.0.1" port:5683 client:otherETagClient]);
+    XCTAssertTrue([coalescer joinRequest:[self requestWithETags:[NSArray arrayWithObject:@"a1b2"]] host:@"127.0.0.1" port:5683 client:sameETagClient]);
+
+    //The 2.03 of the revalidation reaches the client with the same ETag only
+    ICoAPMessage *valid = [[ICoAPMessage alloc] init];
+    valid.code = IC_VALID;
+    [valid addOption:IC_ETAG withValue:@"a1b2"];
+    [coalescer forwardCoAPMessage:valid fromClient:revalidatingLeader];
+
+    XCTAssertEqual([sameETagClient.receivedMessages count], (NSUInteger)1);
+    XCTAssertEqual([plainClient.receivedMessages count], (NSUInteger)0);
+    XCTAssertEqual([otherETagClient.receivedMessages count], (NSUInteger)0);
+}
+
+- (void)testETagOrderDoesNotMatter {
+    ICoAPRequestCoalescer *coalescer = [[ICoAPRequestCoalescer alloc] init];
+    ICoAPCoalescerTestClient *leader = [[ICoAPCoalescerTestClient alloc] init];
+    ICoAPCoalescerTestClient *waiter = [[ICoAPCoalescerTestClient alloc] init];
+
+    XCTAssertFalse([coalescer joinRequest:[self requestWithETags:[NSArray arrayWithObjects:@"a1b2", @"c3d4", nil]] host:@"127.0.0.1" port:5683 client:leader]);
+    XCTAssertTrue([coalescer joinRequest:[self requestWithETags:[NSArray arrayWithObjects:@"c3d4", @"a1b2", nil]] host:@"127.0.0.1" port:5683 client:waiter]);
+}
+
+@end
@@ -0,0 +1,224 @@
+//
+//  ICoAPResponseCacheTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Cache keys and the option order of encoded messages, which must not
+ *  depend on the order in which options were added, the Max-Age of
+ *  responses taken from the cache, and the recovery and compaction of
+ *  the persistent log in a temporary file.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import <sys/stat.h>
+#import "ICoAPResponseCache.h"
+
+
+#define kCacheTestOptionCount               8
+#define kCacheTestChurnPayloadLength        1024
+
+
+
+
+@interface ICoAPResponseCacheTests : XCTestCase {
+    NSString *storePath;
+}
+- (ICoAPMessage *)requestWithOptionsInOrder:(const uint *)order;
+- (ICoAPMessage *)requestForPath:(NSString *)path;
+- (NSData *)payloadDataForPath:(NSString *)path;
+- (void)storeResponseForPath:(NSString *)path inCache:(ICoAPResponseCache *)cache;
+- (NSData *)cachedPayloadDataForPath:(NSString *)path inCache:(ICoAPResponseCache *)cache;
+- (ICoAPResponseCache *)cacheWithPersistentStore;
+- (off_t)storeFileSize;
+@end
+
+@implementation ICoAPResponseCacheTests
+
+- (void)setUp {
+    [super setUp];
+    storePath = [NSTemporaryDirectory() stringByAppendingPathComponent:[[NSUUID UUID] UUIDString]];
+}
+
+- (void)tearDown {
+    [[NSFileManager defaultManager] removeItemAtPath:storePath error:nil];
+    [super tearDown];
+}
+
+static const uint kCacheTestOptions[kCacheTestOptionCount] = {IC_URI_HOST, IC_URI_PORT, IC_URI_PATH, IC_URI_PATH, IC_ACCEPT, IC_URI_QUERY, IC_PROXY_SCHEME, IC_SIZE2};
+static NSString * const kCacheTestValues[kCacheTestOptionCount] = {@"sensor.local", @"5684", @"sensors", @"temp", @"50", @"unit=c", @"coap", @"0"};
+
+//Adds the test options in the given order of indices, values of the same option keep their order
+- (ICoAPMessage *)requestWithOptionsInOrder:(const uint *)order {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    for (uint i = 0; i < kCacheTestOptionCount; i++) {
+        [cO addOption:kCacheTestOptions[order[i]] withValue:kCacheTestValues[order[i]]];
+    }
+    return cO;
+}
+
+- (void)testCacheKeyIgnoresOptionOrder {
+    const uint ascending[kCacheTestOptionCount] = {0, 1, 2, 3, 4, 5, 6, 7};
+    const uint descending[kCacheTestOptionCount] = {7, 6, 5, 4, 2, 3, 1, 0};
+    const uint mixed[kCacheTestOptionCount] = {4, 0, 7, 2, 5, 1, 3, 6};
+
+    NSData *key = [ICoAPResponseCache cacheKeyForRequest:[self requestWithOptionsInOrder:ascending] host:@"127.0.0.1" port:5683];
+    XCTAssertEqualObjects([ICoAPResponseCache cacheKeyForRequest:[self requestWithOptionsInOrder:descending] host:@"127.0.0.1" port:5683], key);
+    XCTAssertEqualObjects([ICoAPResponseCache cacheKeyForRequest:[self requestWithOptionsInOrder:mixed] host:@"127.0.0.1" port:5683], key);
+}
+
+- (void)testEncodedOptionsAreSortedByNumber {
+    const uint mixed[kCacheTestOptionCount] = {4, 0, 7, 2, 5, 1, 3, 6};
+    ICoAPExchange *codec = [[ICoAPExchange alloc] init];
+    ICoAPMessage *cO = [self requestWithOptionsInOrder:mixed];
+
+    //Option deltas are only valid in ascending order, so every option survives decoding
+    ICoAPMessage *decoded = [codec decodeCoAPMessageFromData:[codec encodeDataFromCoAPMessage:cO]];
+    XCTAssertNotNil(decoded);
+    for (uint i = 0; i < kCacheTestOptionCount; i++) {
+        NSArray *values = [decoded.optionDict valueForKey:[NSString stringWithFormat:@"%i", kCacheTestOptions[i]]];
+        XCTAssertTrue([values containsObject:kCacheTestValues[i]], @"Option %u", kCacheTestOptions[i]);
+    }
+    XCTAssertEqualObjects([decoded.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_URI_PATH]], ([NSArray arrayWithObjects:@"sensors", @"temp", nil]));
+}
+
+- (void)testCachedResponseCarriesRemainingMaxAge {
+    ICoAPResponseCache *cache = [[ICoAPResponseCache alloc] init];
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"temp"];
+
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = IC_CONTENT;
+    response.payload = @"22.5 C";
+    [response addOption:IC_MAX_AGE withValue:@"3"];
+    [cache storeResponse:response forRequest:cO host:@"127.0.0.1" port:5683];
+
+    [NSThread sleepForTimeInterval:1.5];
+    ICoAPMessage *cachedResponse = [cache freshResponseForRequest:cO host:@"127.0.0.1" port:5683];
+    XCTAssertEqualObjects([cachedResponse.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]], [NSArray arrayWithObject:@"2"]);
+
+    //Without Max-Age the default of 60 seconds is passed on explicitly
+    ICoAPMessage *defaultResponse = [[ICoAPMessage alloc] init];
+    defaultResponse.code = IC_CONTENT;
+    defaultResponse.payload = @"22.5 C";
+    [cache storeResponse:defaultResponse forRequest:cO host:@"127.0.0.1" port:5683];
+    cachedResponse = [cache freshResponseForRequest:cO host:@"127.0.0.1" port:5683];
+    XCTAssertEqualObjects([cachedResponse.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_MAX_AGE]], [NSArray arrayWithObject:[NSString stringWithFormat:@"%i", kDefaultResponseMaxAge]]);
+}
+
+#pragma mark - Persistent Store
+
+- (ICoAPMessage *)requestForPath:(NSString *)path {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:path];
+    return cO;
+}
+
+- (NSData *)payloadDataForPath:(NSString *)path {
+    return [[NSString stringWithFormat:@"payload of %@", path] dataUsingEncoding:NSUTF8StringEncoding];
+}
+
+- (void)storeResponseForPath:(NSString *)path inCache:(ICoAPResponseCache *)cache {
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = IC_CONTENT;
+    response.payloadData = [self payloadDataForPath:path];
+    [response addOption:IC_MAX_AGE withValue:@"3600"];
+    [cache storeResponse:response forRequest:[self requestForPath:path] host:@"127.0.0.1" port:5683];
+}
+
+- (NSData *)cachedPayloadDataForPath:(NSString *)path inCache:(ICoAPResponseCache *)cache {
+    return [[cache freshResponseForRequest:[self requestForPath:path] host:@"127.0.0.1" port:5683] payloadData];
+}
+
+- (ICoAPResponseCache *)cacheWithPersistentStore {
+    ICoAPResponseCache *cache = [[ICoAPResponseCache alloc] init];
+    NSError *error;
+    XCTAssertTrue([cache openPersistentStoreAtPath:storePath error:&error], @"%@", error);
+    return cache;
+}
+
+- (off_t)storeFileSize {
+    struct stat fileStatus;
+    return stat([storePath fileSystemRepresentation], &fileStatus) == 0 ? fileStatus.st_size : -1;
+}
+
+- (void)testTornRecordIsCutOffOnReopen {
+    ICoAPResponseCache *cache = [self cacheWithPersistentStore];
+    [self storeResponseForPath:@"a" inCache:cache];
+    [self storeResponseForPath:@"b" inCache:cache];
+    off_t validLength = [self storeFileSize];
+    [self storeResponseForPath:@"c" inCache:cache];
+    off_t fullLength = [self storeFileSize];
+    [cache closePersistentStore];
+
+    //A crash while appending leaves the last record incomplete
+    XCTAssertEqual(truncate([storePath fileSystemRepresentation], fullLength - 5), 0);
+
+    cache = [self cacheWithPersistentStore];
+    XCTAssertEqualObjects([self cachedPayloadDataForPath:@"a" inCache:cache], [self payloadDataForPath:@"a"]);
+    XCTAssertEqualObjects([self cachedPayloadDataForPath:@"b" inCache:cache], [self payloadDataForPath:@"b"]);
+    XCTAssertNil([self cachedPayloadDataForPath:@"c" inCache:cache]);
+    XCTAssertEqual([self storeFileSize], validLength);
+    [cache closePersistentStore];
+}
+
+- (void)testRecordWithDamagedBodyIsDropped {
+    ICoAPResponseCache *cache = [self cacheWithPersistentStore];
+    [self storeResponseForPath:@"a" inCache:cache];
+    [self storeResponseForPath:@"b" inCache:cache];
+    off_t length = [self storeFileSize];
+    [cache closePersistentStore];
+
+    //The last byte of the log belongs to the payload of "b"
+    NSMutableData *log = [NSMutableData dataWithContentsOfFile:storePath];
+    ((uint8_t *)[log mutableBytes])[length - 1] ^= 0xFF;
+    XCTAssertTrue([log writeToFile:storePath atomically:NO]);
+
+    cache = [self cacheWithPersistentStore];
+    XCTAssertEqualObjects([self cachedPayloadDataForPath:@"a" inCache:cache], [self payloadDataForPath:@"a"]);
+    XCTAssertNil([self cachedPayloadDataForPath:@"b" inCache:cache]);
+    [cache closePersistentStore];
+
+    //The damaged record was removed from the log as well
+    cache = [self cacheWithPersistentStore];
+    XCTAssertEqualObjects([self cachedPayloadDataForPath:@"a" inCache:cache], [self payloadDataForPath:@"a"]);
+    XCTAssertNil([self cachedPayloadDataForPath:@"b" inCache:cache]);
+    [cache closePersistentStore];
+}
+
+- (void)testCompactionKeepsLiveResponses {
+    ICoAPResponseCache *cache = [self cacheWithPersistentStore];
+    NSArray *livePaths = [NSArray arrayWithObjects:@"a", @"b", @"c", @"d", nil];
+    for (NSString *path in livePaths) {
+        [self storeResponseForPath:path inCache:cache];
+    }
+
+    //Every store of "churn" supersedes the previous record, until less than half of the log is live
+    NSMutableData *churnPayloadData = [[NSMutableData alloc] initWithLength:kCacheTestChurnPayloadLength];
+    NSUInteger churnCount = 2 * kPersistentCacheMinCompactionSize / kCacheTestChurnPayloadLength;
+    off_t writtenLength = 0;
+    for (NSUInteger i = 0; i < churnCount; i++) {
+        ((uint8_t *)[churnPayloadData mutableBytes])[0] = i % 256;
+        ICoAPMessage *response = [[ICoAPMessage alloc] init];
+        response.code = IC_CONTENT;
+        response.payloadData = churnPayloadData;
+        [response addOption:IC_MAX_AGE withValue:@"3600"];
+        [cache storeResponse:response forRequest:[self requestForPath:@"churn"] host:@"127.0.0.1" port:5683];
+        writtenLength += kCacheTestChurnPayloadLength;
+    }
+    XCTAssertGreaterThan(writtenLength, (off_t)kPersistentCacheMinCompactionSize);
+    XCTAssertLessThan([self storeFileSize], (off_t)kPersistentCacheMinCompactionSize);
+    [cache closePersistentStore];
+
+    cache = [self cacheWithPersistentStore];
+    for (NSString *path in livePaths) {
+        XCTAssertEqualObjects([self cachedPayloadDataForPath:path inCache:cache], [self payloadDataForPath:path]);
+    }
+    XCTAssertEqualObjects([self cachedPayloadDataForPath:@"churn" inCache:cache], churnPayloadData);
+    [cache closePersistentStore];
+}
+
+@end
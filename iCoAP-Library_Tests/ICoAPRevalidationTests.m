@@ -0,0 +1,158 @@
+//
+//  ICoAPRevalidationTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Revalidation of stale cached responses by ICoAPExchange against a
+ *  stand-in server, which answers the stored ETag with 2.03 Valid, or
+ *  names a different ETag so that the stored response can not be
+ *  refreshed.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPResponseCache.h"
+#import "ICoAPTestServer.h"
+
+
+#define kRevalidationTestETag               @"a1b2"
+#define kRevalidationTestNewETag            @"c3d4"
+
+
+
+
+@interface ICoAPRevalidationTests : XCTestCase<ICoAPExchangeDelegate> {
+    ICoAPResponseCache *cache;
+    NSMutableArray *receivedMessages;
+    XCTestExpectation *responseExpectation;
+}
+- (ICoAPMessage *)getRequest;
+- (void)storeStaleResponseForPort:(uint)port;
+@end
+
+@implementation ICoAPRevalidationTests
+
+- (void)setUp {
+    [super setUp];
+    cache = [[ICoAPResponseCache alloc] init];
+    receivedMessages = [[NSMutableArray alloc] init];
+}
+
+- (ICoAPMessage *)getRequest {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    [cO addOption:IC_URI_PATH withValue:@"temp"];
+    return cO;
+}
+
+//Max-Age 0: the response is stale at once, but its ETag is kept for revalidation
+- (void)storeStaleResponseForPort:(uint)port {
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = IC_CONTENT;
+    response.payload = @"22.5 C";
+    [response addOption:IC_ETAG withValue:kRevalidationTestETag];
+    [response addOption:IC_MAX_AGE withValue:@"0"];
+    [cache storeResponse:response forRequest:[self getRequest] host:@"127.0.0.1" port:port];
+}
+
+#pragma mark - Tests
+
+- (void)testValidResponseRefreshesStoredResponse {
+    NSMutableArray *requestETags = [[NSMutableArray alloc] init];
+
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        NSArray *etagValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+        [requestETags addObject:etagValues ? [etagValues objectAtIndex:0] : @""];
+
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:IC_VALID];
+        [response addOption:IC_ETAG withValue:kRevalidationTestETag];
+        [response addOption:IC_MAX_AGE withValue:@"30"];
+        [server sendCoAPMessage:response toAddress:address];
+    }];
+    XCTAssertNotNil(server);
+    [self storeStaleResponseForPort:server.port];
+
+    ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    exchange.responseCache = cache;
+
+    ICoAPMessage *cO = [self getRequest];
+    responseExpectation = [self expectationWithDescription:@"Refreshed response"];
+    [exchange sendRequestWithCoAPMessage:cO toHost:@"127.0.0.1" port:server.port];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+    [exchange closeExchange];
+    [server close];
+
+    //The ETag went out on a copy, the request of the caller is unchanged
+    XCTAssertNil([cO.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]]);
+    XCTAssertEqualObjects(requestETags, [NSArray arrayWithObject:kRevalidationTestETag]);
+
+    XCTAssertEqual([receivedMessages count], (NSUInteger)1);
+    ICoAPMessage *response = [receivedMessages objectAtIndex:0];
+    XCTAssertEqual(response.code, (uint)IC_CONTENT);
+    XCTAssertEqualObjects(response.payload, @"22.5 C");
+    XCTAssertNotNil([cache freshResponseForRequest:[self getRequest] host:@"127.0.0.1" port:server.port]);
+}
+
+- (void)testFailedRefreshSendsRequestAgainWithoutETag {
+    NSMutableArray *requestETags = [[NSMutableArray alloc] init];
+
+    //The resource changed meanwhile: 2.03 names another ETag than the stored one, which is a server error,
+    //but must not leave the delegate with an empty response
+    ICoAPTestServer *server = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *server, ICoAPMessage *request, NSData *address) {
+        if (request.code != IC_GET) {
+            return;
+        }
+        NSArray *etagValues = [request.optionDict valueForKey:[NSString stringWithFormat:@"%i", IC_ETAG]];
+        [requestETags addObject:etagValues ? [etagValues objectAtIndex:0] : @""];
+
+        ICoAPMessage *response = [server responseToCoAPMessage:request code:etagValues ? IC_VALID : IC_CONTENT];
+        [response addOption:IC_ETAG withValue:kRevalidationTestNewETag];
+        [response addOption:IC_MAX_AGE withValue:@"30"];
+        if (!etagValues) {
+            response.payload = @"23.0 C";
+        }
+        [server sendCoAPMessage:response toAddress:address];
+    }];
+    XCTAssertNotNil(server);
+    [self storeStaleResponseForPort:server.port];
+
+    ICoAPExchange *exchange = [[ICoAPExchange alloc] init];
+    exchange.delegate = self;
+    exchange.responseCache = cache;
+
+    responseExpectation = [self expectationWithDescription:@"Full response"];
+    [exchange sendRequestWithCoAPMessage:[self getRequest] toHost:@"127.0.0.1" port:server.port];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+    [exchange closeExchange];
+    [server close];
+
+    XCTAssertEqualObjects(requestETags, ([NSArray arrayWithObjects:kRevalidationTestETag, @"", nil]));
+
+    XCTAssertEqual([receivedMessages count], (NSUInteger)1);
+    ICoAPMessage *response = [receivedMessages objectAtIndex:0];
+    XCTAssertEqual(response.code, (uint)IC_CONTENT);
+    XCTAssertEqualObjects(response.payload, @"23.0 C");
+    XCTAssertEqualObjects([cache storedETagForRequest:[self getRequest] host:@"127.0.0.1" port:server.port], kRevalidationTestNewETag);
+}
+
+#pragma mark - ICoAPExchangeDelegate
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didReceiveCoAPMessage:(ICoAPMessage *)coapMessage {
+    [receivedMessages addObject:coapMessage];
+    [responseExpectation fulfill];
+    responseExpectation = nil;
+}
+
+- (void)iCoAPExchange:(ICoAPExchange *)exchange didFailWithError:(NSError *)error {
+    XCTFail(@"Exchange failed: %@", error);
+    [responseExpectation fulfill];
+    responseExpectation = nil;
+}
+
+@end
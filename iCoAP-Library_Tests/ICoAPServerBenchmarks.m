@@ -0,0 +1,65 @@
+//
+//  ICoAPServerBenchmarks.m
+//  iCoAP
+//
+
+
+/*
+ *  Request throughput of ICoAPServer on the loopback interface. The
+ *  server runs on a queue of its own and answers a resource with a
+ *  piggybacked 2.05, the load client keeps kServerBenchmarkWindowSize
+ *  confirmable requests outstanding on each of its sockets. Requests
+ *  per second and the requests the server handled are logged. Client
+ *  and server share the machine, so the rate is a lower bound of what
+ *  the server alone sustains.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPServer.h"
+#import "ICoAPTestLoadClient.h"
+
+
+#define kServerBenchmarkRequestCount        60000
+#define kServerBenchmarkSocketCount         4
+#define kServerBenchmarkWindowSize          32
+
+
+
+
+@interface ICoAPServerBenchmarks : XCTestCase
+@end
+
+@implementation ICoAPServerBenchmarks
+
+- (void)testRequestThroughput {
+    dispatch_queue_t serverQueue = dispatch_queue_create("ICoAPServerBenchmarks", DISPATCH_QUEUE_SERIAL);
+    ICoAPServer *server = [[ICoAPServer alloc] initWithQueue:serverQueue resourceDirectory:[[ICoAPResourceDirectory alloc] init]];
+    [server addResourceWithPath:@"/sensors/temp" attributes:nil handler:^(ICoAPServerTransaction *transaction) {
+        ICoAPMessage *response = [[ICoAPMessage alloc] init];
+        response.code = IC_CONTENT;
+        response.payload = @"22.5 C";
+        [transaction respondWithCoAPMessage:response];
+    }];
+
+    NSError *error;
+    XCTAssertTrue([server startOnPort:0 error:&error], @"%@", error);
+
+    ICoAPTestLoadClient *client = [[ICoAPTestLoadClient alloc] initWithPath:@"/sensors/temp" socketCount:kServerBenchmarkSocketCount windowSize:kServerBenchmarkWindowSize];
+    NSTimeInterval duration;
+    NSUInteger responseCount = [client runRequests:kServerBenchmarkRequestCount toPort:[server.udpSocket localPort] timeout:kMAX_TRANSMIT_WAIT duration:&duration];
+
+    __block NSUInteger handledRequestCount;
+    dispatch_sync(serverQueue, ^{
+        handledRequestCount = server.handledRequestCount;
+        [server stop];
+    });
+
+    XCTAssertEqual(responseCount, (NSUInteger)kServerBenchmarkRequestCount);
+    NSLog(@"ICoAPServer: %.0f requests/s (%lu responses in %.2f s, %lu requests handled, %i sockets with %i outstanding requests each)",
+          responseCount / duration, (unsigned long)responseCount, duration, (unsigned long)handledRequestCount,
+          kServerBenchmarkSocketCount, kServerBenchmarkWindowSize);
+}
+
+@end
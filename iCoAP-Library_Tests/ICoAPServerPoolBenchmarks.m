@@ -0,0 +1,72 @@
+//
+//  ICoAPServerPoolBenchmarks.m
+//  iCoAP
+//
+
+
+/*
+ *  Load test of ICoAPServerPool on the loopback interface with an
+ *  increasing number of workers. The load client sends from
+ *  kPoolBenchmarkSocketCount sockets, so the kernel has distinct client
+ *  addresses to distribute. Requests per second and the number of
+ *  requests each worker handled are logged per pool size: on Linux the
+ *  requests spread over the workers, on Darwin one worker handles all.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import "ICoAPServerPool.h"
+#import "ICoAPTestLoadClient.h"
+
+
+#define kPoolBenchmarkRequestCount          64000
+#define kPoolBenchmarkSocketCount           16
+#define kPoolBenchmarkWindowSize            8
+#define kPoolBenchmarkMaxWorkerCount        8
+
+
+
+
+@interface ICoAPServerPoolBenchmarks : XCTestCase
+@end
+
+@implementation ICoAPServerPoolBenchmarks
+
+- (void)testRequestThroughputPerWorkerCount {
+    NSUInteger maxWorkerCount = MIN([[NSProcessInfo processInfo] activeProcessorCount], kPoolBenchmarkMaxWorkerCount);
+
+    for (NSUInteger workerCount = 1; workerCount <= maxWorkerCount; workerCount *= 2) {
+        ICoAPServerPool *pool = [[ICoAPServerPool alloc] initWithWorkerCount:workerCount];
+        [pool addResourceWithPath:@"/sensors/temp" attributes:nil handler:^(ICoAPServerTransaction *transaction) {
+            ICoAPMessage *response = [[ICoAPMessage alloc] init];
+            response.code = IC_CONTENT;
+            response.payload = @"22.5 C";
+            [transaction respondWithCoAPMessage:response];
+        }];
+
+        NSError *error;
+        XCTAssertTrue([pool startOnPort:0 error:&error], @"%@", error);
+
+        ICoAPTestLoadClient *client = [[ICoAPTestLoadClient alloc] initWithPath:@"/sensors/temp" socketCount:kPoolBenchmarkSocketCount windowSize:kPoolBenchmarkWindowSize];
+        NSTimeInterval duration;
+        NSUInteger responseCount = [client runRequests:kPoolBenchmarkRequestCount toPort:pool.port timeout:kMAX_TRANSMIT_WAIT duration:&duration];
+        [pool stop];
+
+        //Read on the worker queues, which are idle once the pool is stopped
+        NSMutableArray *handledCounts = [[NSMutableArray alloc] initWithCapacity:workerCount];
+        for (ICoAPServer *worker in pool.workers) {
+            __block NSUInteger handledRequestCount;
+            dispatch_sync(worker.serverQueue, ^{
+                handledRequestCount = worker.handledRequestCount;
+            });
+            [handledCounts addObject:[NSString stringWithFormat:@"%lu", (unsigned long)handledRequestCount]];
+        }
+
+        XCTAssertEqual(responseCount, (NSUInteger)kPoolBenchmarkRequestCount);
+        NSLog(@"ICoAPServerPool: %lu workers, %.0f requests/s, requests per worker: %@",
+              (unsigned long)workerCount, responseCount / duration, [handledCounts componentsJoinedByString:@", "]);
+    }
+}
+
+@end
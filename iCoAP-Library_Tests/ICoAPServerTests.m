@@ -0,0 +1,97 @@
+//
+//  ICoAPServerTests.m
+//  iCoAP
+//
+
+
+/*
+ *  Deduplication of confirmable requests by ICoAPServer. A stand-in
+ *  client sends more requests than a fixed size store would hold, one
+ *  after the other, and then repeats the first one. The duplicate must
+ *  be answered with the first response without calling the handler.
+ */
+
+
+
+#import <XCTest/XCTest.h>
+#import <netinet/in.h>
+#import "ICoAPServer.h"
+#import "ICoAPTestServer.h"
+
+
+#define kServerTestRequestCount             300
+
+
+
+
+@interface ICoAPServerTests : XCTestCase
+- (ICoAPMessage *)requestWithMessageID:(uint)messageID;
+@end
+
+@implementation ICoAPServerTests
+
+- (ICoAPMessage *)requestWithMessageID:(uint)messageID {
+    ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+    cO.messageID = messageID;
+    cO.token = messageID;
+    [cO addOption:IC_URI_PATH withValue:@"count"];
+    return cO;
+}
+
+- (void)testDuplicateIsAnsweredAfterManyOtherRequests {
+    __block NSUInteger handlerCount = 0;
+    ICoAPServer *server = [[ICoAPServer alloc] init];
+    [server addResourceWithPath:@"/count" attributes:nil handler:^(ICoAPServerTransaction *transaction) {
+        handlerCount++;
+        ICoAPMessage *response = [[ICoAPMessage alloc] init];
+        response.code = IC_CONTENT;
+        response.payloadData = [[NSString stringWithFormat:@"%lu", (unsigned long)handlerCount] dataUsingEncoding:NSUTF8StringEncoding];
+        [transaction respondWithCoAPMessage:response];
+    }];
+
+    NSError *error;
+    XCTAssertTrue([server startOnPort:0 error:&error], @"%@", error);
+
+    struct sockaddr_in serverAddress;
+    memset(&serverAddress, 0, sizeof(serverAddress));
+    serverAddress.sin_len = sizeof(serverAddress);
+    serverAddress.sin_family = AF_INET;
+    serverAddress.sin_port = htons([server.udpSocket localPort]);
+    serverAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    NSData *address = [NSData dataWithBytes:&serverAddress length:sizeof(serverAddress)];
+
+    NSMutableArray *responses = [[NSMutableArray alloc] init];
+    XCTestExpectation *duplicateExpectation = [self expectationWithDescription:@"Response to the duplicate"];
+
+    //Each request is sent once the previous one is answered, the first one is repeated last
+    ICoAPTestServer *client = [[ICoAPTestServer alloc] initWithMessageHandler:^(ICoAPTestServer *client, ICoAPMessage *response, NSData *responseAddress) {
+        [responses addObject:response];
+        if ([responses count] < kServerTestRequestCount) {
+            [client sendCoAPMessage:[self requestWithMessageID:1 + [responses count]] toAddress:responseAddress];
+        }
+        else if ([responses count] == kServerTestRequestCount) {
+            [client sendCoAPMessage:[self requestWithMessageID:1] toAddress:responseAddress];
+        }
+        else {
+            [duplicateExpectation fulfill];
+        }
+    }];
+    XCTAssertNotNil(client);
+
+    [client sendCoAPMessage:[self requestWithMessageID:1] toAddress:address];
+    [self waitForExpectationsWithTimeout:kMAX_TRANSMIT_WAIT handler:nil];
+
+    XCTAssertEqual([responses count], (NSUInteger)kServerTestRequestCount + 1);
+    XCTAssertEqual(handlerCount, (NSUInteger)kServerTestRequestCount);
+    XCTAssertEqual(server.handledRequestCount, (NSUInteger)kServerTestRequestCount);
+
+    ICoAPMessage *response = [responses lastObject];
+    XCTAssertEqual(response.type, (uint)IC_ACKNOWLEDGMENT);
+    XCTAssertEqual(response.messageID, (uint)1);
+    XCTAssertEqualObjects(response.payloadData, [@"1" dataUsingEncoding:NSUTF8StringEncoding]);
+
+    [server stop];
+    [client close];
+}
+
+@end
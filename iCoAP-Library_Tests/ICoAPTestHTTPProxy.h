@@ -0,0 +1,64 @@
+//
+//  ICoAPTestHTTPProxy.h
+//  iCoAP
+//
+
+
+/*
+ *  Stand-in HTTP proxy for the tests, listening on an ephemeral port of
+ *  the loopback interface. Every request is answered at once with the
+ *  same 200 response carrying 'responseBody' and the COAP_TYPE header
+ *  ICoAPExchange reads, and connections are kept alive, so pipelined
+ *  requests are answered in order.
+
+ *  Connections are served on a queue of their own, not the main queue
+ *  the exchanges operate on. 'connectionCount' tells how many
+ *  connections the clients have opened.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+
+
+@interface ICoAPTestHTTPProxy : NSObject {
+    int listenSocket;
+    dispatch_queue_t queue;
+    dispatch_source_t acceptSource;
+    NSMutableSet *connectionSources;
+    NSData *responseData;
+    NSUInteger connectionCount;
+    NSUInteger requestCount;
+}
+
+/*
+ *  'port':
+ *  The port the proxy listens on.
+ */
+@property (readonly, nonatomic) uint port;
+
+/*
+ *  'initWithResponseBody:':
+ *  Starts listening. Returns nil if the socket could not be set up.
+ */
+- (id)initWithResponseBody:(NSData *)responseBody;
+
+/*
+ *  'connectionCount':
+ *  Number of connections accepted so far.
+ */
+- (NSUInteger)connectionCount;
+
+/*
+ *  'requestCount':
+ *  Number of requests answered so far.
+ */
+- (NSUInteger)requestCount;
+
+/*
+ *  'close':
+ *  Closes the listening socket and all connections.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,179 @@
+//
+//  ICoAPTestHTTPProxy.m
+//  iCoAP
+//
+
+
+#import "ICoAPTestHTTPProxy.h"
+#import <sys/socket.h>
+#import <netinet/in.h>
+#import <arpa/inet.h>
+#import <unistd.h>
+
+
+#define kTestHTTPProxyReadLength            4096
+
+
+
+
+@interface ICoAPTestHTTPProxy ()
+- (void)acceptConnection;
+- (NSUInteger)answerRequestsInBuffer:(NSMutableData *)buffer onSocket:(int)connectionSocket;
+@end
+
+@implementation ICoAPTestHTTPProxy
+
+- (id)initWithResponseBody:(NSData *)responseBody {
+    if (self = [super init]) {
+        NSString *header = [NSString stringWithFormat:@"HTTP/1.1 200 OK\r\nContent-Length: %lu\r\nCOAP_TYPE: ACK\r\nConnection: keep-alive\r\n\r\n", (unsigned long)[responseBody length]];
+        NSMutableData *response = [[header dataUsingEncoding:NSASCIIStringEncoding] mutableCopy];
+        [response appendData:responseBody];
+        responseData = response;
+
+        connectionSources = [[NSMutableSet alloc] init];
+        queue = dispatch_queue_create("ICoAPTestHTTPProxy", DISPATCH_QUEUE_SERIAL);
+
+        listenSocket = socket(AF_INET, SOCK_STREAM, 0);
+        if (listenSocket < 0) {
+            return nil;
+        }
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_len = sizeof(address);
+        address.sin_family = AF_INET;
+        address.sin_port = 0;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t addressLength = sizeof(address);
+
+        if (bind(listenSocket, (struct sockaddr *)&address, sizeof(address)) != 0 ||
+            listen(listenSocket, SOMAXCONN) != 0 ||
+            getsockname(listenSocket, (struct sockaddr *)&address, &addressLength) != 0) {
+            close(listenSocket);
+            return nil;
+        }
+        _port = ntohs(address.sin_port);
+
+        __weak ICoAPTestHTTPProxy *weakSelf = self;
+        int acceptedSocket = listenSocket;
+        acceptSource = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, listenSocket, 0, queue);
+        dispatch_source_set_event_handler(acceptSource, ^{
+            [weakSelf acceptConnection];
+        });
+        dispatch_source_set_cancel_handler(acceptSource, ^{
+            close(acceptedSocket);
+        });
+        dispatch_resume(acceptSource);
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+}
+
+- (NSUInteger)connectionCount {
+    __block NSUInteger count;
+    dispatch_sync(queue, ^{
+        count = connectionCount;
+    });
+    return count;
+}
+
+- (NSUInteger)requestCount {
+    __block NSUInteger count;
+    dispatch_sync(queue, ^{
+        count = requestCount;
+    });
+    return count;
+}
+
+- (void)close {
+    dispatch_sync(queue, ^{
+        if (acceptSource) {
+            dispatch_source_cancel(acceptSource);
+            acceptSource = nil;
+        }
+        for (dispatch_source_t source in connectionSources) {
+            dispatch_source_cancel(source);
+        }
+        [connectionSources removeAllObjects];
+    });
+}
+
+#pragma mark - Connections
+
+- (void)acceptConnection {
+    int connectionSocket = accept(listenSocket, NULL, NULL);
+    if (connectionSocket < 0) {
+        return;
+    }
+
+    int noSigPipe = 1;
+    setsockopt(connectionSocket, SOL_SOCKET, SO_NOSIGPIPE, &noSigPipe, sizeof(noSigPipe));
+    connectionCount++;
+
+    NSMutableData *buffer = [[NSMutableData alloc] init];
+    dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_READ, connectionSocket, 0, queue);
+    __weak ICoAPTestHTTPProxy *weakSelf = self;
+    __weak dispatch_source_t weakSource = source;
+
+    dispatch_source_set_event_handler(source, ^{
+        uint8_t bytes[kTestHTTPProxyReadLength];
+        ssize_t length = read(connectionSocket, bytes, sizeof(bytes));
+        ICoAPTestHTTPProxy *strongSelf = weakSelf;
+
+        if (!strongSelf) {
+            return;
+        }
+        if (length <= 0) {
+            [strongSelf->connectionSources removeObject:weakSource];
+            dispatch_source_cancel(weakSource);
+            return;
+        }
+        [buffer appendBytes:bytes length:length];
+        strongSelf->requestCount += [strongSelf answerRequestsInBuffer:buffer onSocket:connectionSocket];
+    });
+    dispatch_source_set_cancel_handler(source, ^{
+        close(connectionSocket);
+    });
+
+    [connectionSources addObject:source];
+    dispatch_resume(source);
+}
+
+//Answers and removes the complete requests at the start of 'buffer', returns their number
+- (NSUInteger)answerRequestsInBuffer:(NSMutableData *)buffer onSocket:(int)connectionSocket {
+    NSData *headerEnd = [@"\r\n\r\n" dataUsingEncoding:NSASCIIStringEncoding];
+    NSUInteger answeredCount = 0;
+
+    while (YES) {
+        NSRange range = [buffer rangeOfData:headerEnd options:0 range:NSMakeRange(0, [buffer length])];
+        if (range.location == NSNotFound) {
+            break;
+        }
+
+        NSUInteger headerLength = range.location + range.length;
+        NSString *header = [[NSString alloc] initWithData:[buffer subdataWithRange:NSMakeRange(0, headerLength)] encoding:NSASCIIStringEncoding];
+        NSUInteger contentLength = 0;
+
+        for (NSString *line in [header componentsSeparatedByString:@"\r\n"]) {
+            if ([line length] > 15 && [line compare:@"Content-Length:" options:NSCaseInsensitiveSearch range:NSMakeRange(0, 15)] == NSOrderedSame) {
+                contentLength = [[line substringFromIndex:15] integerValue];
+            }
+        }
+
+        if ([buffer length] < headerLength + contentLength) {
+            break;
+        }
+        [buffer replaceBytesInRange:NSMakeRange(0, headerLength + contentLength) withBytes:NULL length:0];
+
+        if (write(connectionSocket, [responseData bytes], [responseData length]) != (ssize_t)[responseData length]) {
+            break;
+        }
+        answeredCount++;
+    }
+    return answeredCount;
+}
+
+@end
@@ -0,0 +1,52 @@
+//
+//  ICoAPTestLoadClient.h
+//  iCoAP
+//
+
+
+/*
+ *  Load generator for the server benchmarks. Confirmable GET requests
+ *  to 'path' are sent from 'socketCount' sockets on the loopback
+ *  interface, each keeping 'windowSize' requests outstanding and
+ *  sending the next one for every datagram it receives. The requests
+ *  are encoded once, only the Message ID is patched per request.
+
+ *  The sockets operate on a queue of their own, so the server under
+ *  test must not use the queue 'runRequests:toPort:timeout:' is called on.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+
+
+@interface ICoAPTestLoadClient : NSObject<GCDAsyncUdpSocketDelegate> {
+    NSString *path;
+    NSUInteger socketCount;
+    NSUInteger windowSize;
+    dispatch_queue_t clientQueue;
+    NSMutableArray *sockets;
+    NSMutableData *requestData;
+    NSUInteger *sentCounts;
+    NSUInteger requestCountPerSocket;
+    NSUInteger responseCount;
+    dispatch_semaphore_t completionSemaphore;
+}
+
+/*
+ *  'initWithPath:socketCount:windowSize:':
+ *  Initialization
+ */
+- (id)initWithPath:(NSString *)aPath socketCount:(NSUInteger)aSocketCount windowSize:(NSUInteger)aWindowSize;
+
+/*
+ *  'runRequests:toPort:timeout:':
+ *  Sends 'requestCount' requests (at most 65536 per socket, so Message IDs
+ *  are not reused) to 127.0.0.1:'port' and blocks until all are answered,
+ *  or until 'timeout'. Returns the number of received responses and sets
+ *  'duration' to the seconds taken.
+ */
+- (NSUInteger)runRequests:(NSUInteger)requestCount toPort:(uint)port timeout:(NSTimeInterval)timeout duration:(NSTimeInterval *)duration;
+
+@end
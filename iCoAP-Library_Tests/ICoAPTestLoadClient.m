@@ -0,0 +1,115 @@
+//
+//  ICoAPTestLoadClient.m
+//  iCoAP
+//
+
+
+#import "ICoAPTestLoadClient.h"
+#import "ICoAPExchange.h"
+
+
+
+
+@interface ICoAPTestLoadClient ()
+- (void)sendRequestWithSocketAtIndex:(NSUInteger)index;
+- (void)closeSockets;
+@end
+
+@implementation ICoAPTestLoadClient
+
+- (id)initWithPath:(NSString *)aPath socketCount:(NSUInteger)aSocketCount windowSize:(NSUInteger)aWindowSize {
+    if (self = [super init]) {
+        path = aPath;
+        socketCount = aSocketCount;
+        windowSize = aWindowSize;
+        clientQueue = dispatch_queue_create("ICoAPTestLoadClient", DISPATCH_QUEUE_SERIAL);
+        sentCounts = calloc(socketCount, sizeof(NSUInteger));
+
+        ICoAPMessage *cO = [[ICoAPMessage alloc] initAsRequestConfirmable:YES requestMethod:IC_GET sendToken:YES payload:@""];
+        cO.token = 0x2A;
+        for (NSString *segment in [path componentsSeparatedByString:@"/"]) {
+            if ([segment length] > 0) {
+                [cO addOption:IC_URI_PATH withValue:segment];
+            }
+        }
+        requestData = [[[[ICoAPExchange alloc] init] encodeDataFromCoAPMessage:cO] mutableCopy];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self closeSockets];
+    free(sentCounts);
+}
+
+- (NSUInteger)runRequests:(NSUInteger)requestCount toPort:(uint)port timeout:(NSTimeInterval)timeout duration:(NSTimeInterval *)duration {
+    sockets = [[NSMutableArray alloc] initWithCapacity:socketCount];
+    for (NSUInteger i = 0; i < socketCount; i++) {
+        GCDAsyncUdpSocket *socket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:clientQueue];
+        NSError *error;
+        if (![socket connectToHost:@"127.0.0.1" onPort:port error:&error] || ![socket beginReceiving:&error]) {
+            [socket close];
+            [self closeSockets];
+            return 0;
+        }
+        [sockets addObject:socket];
+    }
+
+    requestCountPerSocket = MIN(requestCount / socketCount, 65536);
+    responseCount = 0;
+    completionSemaphore = dispatch_semaphore_create(0);
+
+    uint64_t start = ICoAPMonotonicNanoseconds();
+    dispatch_async(clientQueue, ^{
+        memset(sentCounts, 0, socketCount * sizeof(NSUInteger));
+        for (NSUInteger i = 0; i < socketCount; i++) {
+            for (NSUInteger j = 0; j < windowSize; j++) {
+                [self sendRequestWithSocketAtIndex:i];
+            }
+        }
+    });
+
+    dispatch_semaphore_wait(completionSemaphore, dispatch_time(DISPATCH_TIME_NOW, (int64_t)(timeout * NSEC_PER_SEC)));
+    *duration = (ICoAPMonotonicNanoseconds() - start) / 1e9;
+
+    //Closed on the client queue, where late responses are still handled
+    __block NSUInteger count;
+    dispatch_sync(clientQueue, ^{
+        count = responseCount;
+        [self closeSockets];
+    });
+    return count;
+}
+
+- (void)sendRequestWithSocketAtIndex:(NSUInteger)index {
+    if (sentCounts[index] >= requestCountPerSocket) {
+        return;
+    }
+
+    uint messageID = sentCounts[index]++ % 65536;
+    uint8_t *bytes = [requestData mutableBytes];
+    bytes[2] = (messageID >> 8) & 0xFF;
+    bytes[3] = messageID & 0xFF;
+
+    //The data is copied, the template is patched again before the socket sends it
+    [[sockets objectAtIndex:index] sendData:[requestData copy] withTimeout:-1 tag:0];
+}
+
+- (void)closeSockets {
+    for (GCDAsyncUdpSocket *socket in sockets) {
+        socket.delegate = nil;
+        [socket close];
+    }
+    sockets = nil;
+}
+
+#pragma mark - GCDAsyncUdpSocketDelegate
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+    if (++responseCount == requestCountPerSocket * socketCount) {
+        dispatch_semaphore_signal(completionSemaphore);
+    }
+    [self sendRequestWithSocketAtIndex:[sockets indexOfObjectIdenticalTo:sock]];
+}
+
+@end
@@ -0,0 +1,79 @@
+//
+//  ICoAPTestServer.h
+//  iCoAP
+//
+
+
+/*
+ *  Stand-in CoAP endpoint for the tests, on an ephemeral port of the
+ *  loopback interface. Received messages are decoded with the codec of
+ *  ICoAPExchange and passed to the 'messageHandler' on the main queue,
+ *  which answers them with 'sendCoAPMessage:toAddress:'. Nothing else
+ *  is done automatically, so a test controls every message the client
+ *  receives.
+ */
+
+
+
+#import <Foundation/Foundation.h>
+#import "GCDAsyncUdpSocket.h"
+#import "ICoAPExchange.h"
+
+
+@class ICoAPTestServer;
+
+
+typedef void (^ICoAPTestServerMessageHandler)(ICoAPTestServer *server, ICoAPMessage *message, NSData *address);
+
+
+@interface ICoAPTestServer : NSObject<GCDAsyncUdpSocketDelegate> {
+    GCDAsyncUdpSocket *udpSocket;
+    ICoAPExchange *codec;
+    uint randomMessageId;
+}
+
+/*
+ *  'port':
+ *  The port the server is bound to.
+ */
+@property (readonly, nonatomic) uint port;
+
+/*
+ *  'messageHandler':
+ *  Called for every received message.
+ */
+@property (copy, nonatomic) ICoAPTestServerMessageHandler messageHandler;
+
+/*
+ *  'initWithMessageHandler:':
+ *  Binds the server and starts receiving. Returns nil if the socket could
+ *  not be set up.
+ */
+- (id)initWithMessageHandler:(ICoAPTestServerMessageHandler)handler;
+
+/*
+ *  'responseToCoAPMessage:code:':
+ *  Returns a response to 'request', piggybacked on the ACK of a confirmable
+ *  request and non-confirmable otherwise, with the token of the request.
+ */
+- (ICoAPMessage *)responseToCoAPMessage:(ICoAPMessage *)request code:(uint)code;
+
+/*
+ *  'nextMessageID':
+ *  Returns a Message ID for a message which is not a piggybacked response.
+ */
+- (uint)nextMessageID;
+
+/*
+ *  'sendCoAPMessage:toAddress:':
+ *  Encodes 'cO' and sends it to 'address'.
+ */
+- (void)sendCoAPMessage:(ICoAPMessage *)cO toAddress:(NSData *)address;
+
+/*
+ *  'close':
+ *  Closes the socket.
+ */
+- (void)close;
+
+@end
@@ -0,0 +1,68 @@
+//
+//  ICoAPTestServer.m
+//  iCoAP
+//
+
+
+#import "ICoAPTestServer.h"
+
+@implementation ICoAPTestServer
+
+- (id)initWithMessageHandler:(ICoAPTestServerMessageHandler)handler {
+    if (self = [super init]) {
+        self.messageHandler = handler;
+        codec = [[ICoAPExchange alloc] init];
+        randomMessageId = 1 + arc4random() % 65536;
+        udpSocket = [[GCDAsyncUdpSocket alloc] initWithDelegate:self delegateQueue:dispatch_get_main_queue()];
+
+        NSError *error;
+        if (![udpSocket bindToPort:0 interface:@"127.0.0.1" error:&error] || ![udpSocket beginReceiving:&error]) {
+            [udpSocket close];
+            return nil;
+        }
+        _port = [udpSocket localPort];
+    }
+    return self;
+}
+
+- (void)dealloc {
+    [self close];
+}
+
+- (ICoAPMessage *)responseToCoAPMessage:(ICoAPMessage *)request code:(uint)code {
+    ICoAPMessage *response = [[ICoAPMessage alloc] init];
+    response.code = code;
+    response.token = request.token;
+
+    if (request.type == IC_CONFIRMABLE) {
+        response.type = IC_ACKNOWLEDGMENT;
+        response.messageID = request.messageID;
+    }
+    else {
+        response.type = IC_NON_CONFIRMABLE;
+        response.messageID = [self nextMessageID];
+    }
+    return response;
+}
+
+- (uint)nextMessageID {
+    return ++randomMessageId % 65536;
+}
+
+- (void)sendCoAPMessage:(ICoAPMessage *)cO toAddress:(NSData *)address {
+    [udpSocket sendData:[codec encodeDataFromCoAPMessage:cO] toAddress:address withTimeout:-1 tag:0];
+}
+
+- (void)close {
+    udpSocket.delegate = nil;
+    [udpSocket close];
+}
+
+- (void)udpSocket:(GCDAsyncUdpSocket *)sock didReceiveData:(NSData *)data fromAddress:(NSData *)address withFilterContext:(id)filterContext {
+    ICoAPMessage *cO = [codec decodeCoAPMessageFromData:data];
+    if (cO && self.messageHandler) {
+        self.messageHandler(self, cO, address);
+    }
+}
+
+@end